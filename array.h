@@ -0,0 +1,184 @@
+#ifndef PLD_LISP_ARRAY_H
+#define PLD_LISP_ARRAY_H
+
+#include <stdlib.h>
+#include "sexp.h"
+#include "exception.h"
+#include "builtin.h"
+#include "vector.h"
+
+/*
+ * Builtins on arrays, the vectors of Scheme, see struct _sexp_array_t. Their
+ * elements are any S-expressions, and reading or replacing one takes constant
+ * time, where a list takes time linear in the index:
+ *   (makevector n [x])   an array of n elements, all x, or () without it
+ *   (vector e1 e2 ...)   the array of the arguments
+ *   (listvector l)       the array of the elements of the list l
+ *   (vectorlist a)       the list of the elements of a
+ *   (vectorlength a)     the number of elements of a
+ *   (vectorref a i)      the element of a at index i
+ *   (vectorset a i x)    replaces the element of a at index i by x
+ * vectorset returns the array itself, so an algorithm that fills an array
+ * passes it on from one call to the next, e.g. a sieve of Eratosthenes:
+ *   (define cross (lambda (a i p n)
+ *     (if (< i n) (cross (vectorset a i false) (+ i p) p n) a)))
+ * Every copy of an array sees what vectorset stores in it, see sexpCopy, so
+ * an array may hold itself: it is printed as #(...) where it recurs, and
+ * equals compares such arrays without running around the cycle.
+ */
+
+
+
+/* builtins */
+int arrayIsIndex(Sexp index, SexpArray array)
+{
+  return SEXP_TYPE_OF(index) == SEXP_TYPE_INTEGER && index->value.integer >= 0 &&
+    (size_t)index->value.integer < array->length;
+}
+
+// sexpArrayCreate, which reports an array too large to allocate
+SexpArray arrayCreate(const char* name, size_t length)
+{
+  SexpArray array = sexpArrayCreate(length);
+  if(!array) {
+    printf("! %s: out of memory for an array of %zu elements\n", name, length);
+    throwException();
+    printf("Control should not reach this point!\n");
+  }
+  return array;
+}
+
+// the array of the elements of a list, which are copied
+Sexp arrayFromList(const char* name, Sexp list)
+{
+  size_t length = 0;
+  Sexp element = list;
+  for(; SEXP_TYPE_OF(element) == SEXP_TYPE_CONS; element = SEXP_CDR(element)) {
+    length++;
+  }
+  SexpArray array = arrayCreate(name, length);
+  element = list;
+  for(size_t i = 0; i < length; i++, element = SEXP_CDR(element)) {
+    array->elements[i] = sexpCopy(SEXP_CAR(element));
+  }
+  return sexpCreateArrayOf(array);
+}
+
+Sexp arrayMakeBuiltin(Sexp arguments)
+{
+  if(SEXP_TYPE_OF(arguments) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_INTEGER ||
+     SEXP_CAR(arguments)->value.integer < 0 ||
+     (SEXP_TYPE_OF(SEXP_CDR(arguments)) != SEXP_TYPE_NIL &&
+      !vectorTwoArguments(arguments))) {
+    vectorBadArguments("makevector", "a non-negative length and an optional element");
+    return NULL;
+  }
+  size_t length = SEXP_CAR(arguments)->value.integer;
+  Sexp fill = (SEXP_TYPE_OF(SEXP_CDR(arguments)) == SEXP_TYPE_CONS) ?
+    SEXP_CAR(SEXP_CDR(arguments)) : NULL;
+  SexpArray array = arrayCreate("makevector", length);
+  for(size_t i = 0; i < length; i++) {
+    array->elements[i] = (fill) ? sexpCopy(fill) : sexpCreateNil();
+  }
+  return sexpCreateArrayOf(array);
+}
+
+Sexp arrayVectorBuiltin(Sexp arguments)
+{
+  return arrayFromList("vector", arguments);
+}
+
+Sexp arrayFromListBuiltin(Sexp arguments)
+{
+  Sexp list = (SEXP_TYPE_OF(arguments) == SEXP_TYPE_CONS &&
+               SEXP_TYPE_OF(SEXP_CDR(arguments)) == SEXP_TYPE_NIL) ?
+    SEXP_CAR(arguments) : NULL;
+  Sexp element = list;
+  while(element && SEXP_TYPE_OF(element) == SEXP_TYPE_CONS) {
+    element = SEXP_CDR(element);
+  }
+  if(!element || SEXP_TYPE_OF(element) != SEXP_TYPE_NIL) {
+    vectorBadArguments("listvector", "a list");
+    return NULL;
+  }
+  return arrayFromList("listvector", list);
+}
+
+Sexp arrayToListBuiltin(Sexp arguments)
+{
+  if(SEXP_TYPE_OF(arguments) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_ARRAY ||
+     SEXP_TYPE_OF(SEXP_CDR(arguments)) != SEXP_TYPE_NIL) {
+    vectorBadArguments("vectorlist", "an array");
+    return NULL;
+  }
+  SexpArray array = SEXP_CAR(arguments)->value.array;
+  Sexp* elements = malloc(sizeof(Sexp) * (array->length + 1));
+  if(!elements) {
+    printf("! vectorlist: out of memory for a list of %zu elements\n", array->length);
+    throwException();
+    printf("Control should not reach this point!\n");
+  }
+  for(size_t i = 0; i < array->length; i++) {
+    elements[i] = sexpCopy(array->elements[i]);
+  }
+  Sexp list = sexpCreateListOf(elements, array->length, sexpCreateNil());
+  free(elements);
+  return list;
+}
+
+Sexp arrayLengthBuiltin(Sexp arguments)
+{
+  if(SEXP_TYPE_OF(arguments) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_ARRAY ||
+     SEXP_TYPE_OF(SEXP_CDR(arguments)) != SEXP_TYPE_NIL) {
+    vectorBadArguments("vectorlength", "an array");
+    return NULL;
+  }
+  return sexpCreateInteger((long)SEXP_CAR(arguments)->value.array->length);
+}
+
+Sexp arrayRefBuiltin(Sexp arguments)
+{
+  if(!vectorTwoArguments(arguments) ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_ARRAY ||
+     !arrayIsIndex(SEXP_CAR(SEXP_CDR(arguments)), SEXP_CAR(arguments)->value.array)) {
+    vectorBadArguments("vectorref", "an array and an index within it");
+    return NULL;
+  }
+  SexpArray array = SEXP_CAR(arguments)->value.array;
+  return sexpCopy(array->elements[SEXP_CAR(SEXP_CDR(arguments))->value.integer]);
+}
+
+Sexp arraySetBuiltin(Sexp arguments)
+{
+  if(SEXP_TYPE_OF(arguments) != SEXP_TYPE_CONS ||
+     !vectorTwoArguments(SEXP_CDR(arguments)) ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_ARRAY ||
+     !arrayIsIndex(SEXP_CAR(SEXP_CDR(arguments)), SEXP_CAR(arguments)->value.array)) {
+    vectorBadArguments("vectorset", "an array, an index within it and an element");
+    return NULL;
+  }
+  SexpArray array = SEXP_CAR(arguments)->value.array;
+  long i = SEXP_CAR(SEXP_CDR(arguments))->value.integer;
+  Sexp element = sexpCopy(SEXP_CAR(SEXP_CDR(SEXP_CDR(arguments))));
+  sexpFree(array->elements[i]);
+  array->elements[i] = element;
+  return sexpCopy(SEXP_CAR(arguments));
+}
+
+void arrayRegisterBuiltins()
+{
+  builtinRegister("makevector", arrayMakeBuiltin);
+  builtinRegister("vector", arrayVectorBuiltin);
+  builtinRegister("listvector", arrayFromListBuiltin);
+  builtinRegister("vectorlist", arrayToListBuiltin);
+  builtinRegister("vectorlength", arrayLengthBuiltin);
+  builtinRegister("vectorref", arrayRefBuiltin);
+  builtinRegister("vectorset", arraySetBuiltin);
+}
+
+
+
+#endif // PLD_LISP_ARRAY_H
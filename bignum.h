@@ -0,0 +1,574 @@
+#ifndef PLD_LISP_BIGNUM_H
+#define PLD_LISP_BIGNUM_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include "sexp.h"
+#include "operator.h"
+#include "exception.h"
+
+/*
+ * Arithmetic on integers of any size, see struct _sexp_bignum_t. Integers are
+ * longs until a result overflows, which the operators detect, and the result
+ * is then a bignum; a result that fits a long again is returned as one.
+ *
+ * Magnitudes are arrays of digits in base 10^9, least significant first. They
+ * are multiplied digit by digit below BIGNUM_KARATSUBA digits, and above by
+ * Karatsuba's method: with a = a1 B^h + a0 and b = b1 B^h + b0,
+ *   a b = a1 b1 B^2h + ((a0 + a1) (b0 + b1) - a0 b0 - a1 b1) B^h + a0 b0
+ * takes three products of half the size instead of four. A product of very
+ * different sizes is taken in pieces of the size of the smaller operand.
+ * Division is Knuth's algorithm D, and powers are taken by squaring.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__SANITIZE_ADDRESS__)
+#define BIGNUM_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define BIGNUM_KERNEL
+#endif
+
+#define BIGNUM_KARATSUBA 96
+#define BIGNUM_ROWS 16 // products summed in 64 bits before carrying
+#define BIGNUM_LONG_DIGITS 3 // a long has at most 3 digits
+#define BIGNUM_DIGITS_LIMIT (1 << 19) // 4.7 million decimal digits, a few seconds
+
+typedef uint32_t BignumDigit;
+
+// an integer operand, a long taken as a bignum or a bignum
+struct _bignum_view_t {
+  int negative;
+  size_t length;
+  const BignumDigit* digits;
+  BignumDigit small[BIGNUM_LONG_DIGITS];
+};
+
+typedef struct _bignum_view_t BignumView;
+
+
+
+/* magnitudes */
+
+size_t bignumTrim(const BignumDigit* a, size_t n)
+{
+  while(n > 0 && !a[n - 1]) {
+    n--;
+  }
+  return n;
+}
+
+int bignumCompareDigits(const BignumDigit* a, size_t n, const BignumDigit* b, size_t m)
+{
+  if(n != m) {
+    return (n < m) ? -1 : 1;
+  }
+  while(n-- > 0) {
+    if(a[n] != b[n]) {
+      return (a[n] < b[n]) ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+// r += a, where r has n digits, and the sum fits them
+void bignumAddInto(BignumDigit* r, size_t n, const BignumDigit* a, size_t m)
+{
+  BignumDigit carry = 0;
+  size_t i = 0;
+  for(; i < m; i++) {
+    BignumDigit sum = r[i] + a[i] + carry;
+    carry = sum >= SEXP_BIGNUM_BASE;
+    r[i] = carry ? sum - SEXP_BIGNUM_BASE : sum;
+  }
+  for(; carry && i < n; i++) {
+    carry = ++r[i] == SEXP_BIGNUM_BASE;
+    if(carry) {
+      r[i] = 0;
+    }
+  }
+}
+
+// r -= a, where r has n digits, and is at least a
+void bignumSubtractFrom(BignumDigit* r, size_t n, const BignumDigit* a, size_t m)
+{
+  BignumDigit borrow = 0;
+  size_t i = 0;
+  for(; i < m; i++) {
+    BignumDigit subtracted = a[i] + borrow;
+    borrow = r[i] < subtracted;
+    r[i] = borrow ? r[i] + SEXP_BIGNUM_BASE - subtracted : r[i] - subtracted;
+  }
+  for(; borrow && i < n; i++) {
+    borrow = r[i] == 0;
+    r[i] = borrow ? SEXP_BIGNUM_BASE - 1 : r[i] - 1;
+  }
+}
+
+// r = a + b in n + 1 digits, n >= m
+void bignumAddDigits(const BignumDigit* a, size_t n, const BignumDigit* b, size_t m,
+                     BignumDigit* r)
+{
+  memcpy(r, a, sizeof(BignumDigit) * n);
+  r[n] = 0;
+  bignumAddInto(r, n + 1, b, m);
+}
+
+// r = a d in n + 1 digits, for a small d
+void bignumMultiplySmall(const BignumDigit* a, size_t n, BignumDigit d, BignumDigit* r)
+{
+  uint64_t carry = 0;
+  for(size_t i = 0; i < n; i++) {
+    uint64_t t = (uint64_t)a[i] * d + carry;
+    carry = t / SEXP_BIGNUM_BASE;
+    r[i] = t - carry * SEXP_BIGNUM_BASE;
+  }
+  r[n] = carry;
+}
+
+// t[from..to) is reduced to digits, and the carry out of it is added to t[to]
+void bignumCarry(uint64_t* t, size_t from, size_t to)
+{
+  uint64_t carry = 0;
+  for(size_t k = from; k < to; k++) {
+    uint64_t sum = t[k] + carry;
+    carry = sum / SEXP_BIGNUM_BASE;
+    t[k] = sum - carry * SEXP_BIGNUM_BASE;
+  }
+  t[to] += carry;
+}
+
+// t[0..n) += a d, a plain loop which is vectorized
+BIGNUM_KERNEL
+void bignumMultiplyRow(uint64_t* t, const BignumDigit* a, size_t n, uint64_t d)
+{
+  for(size_t i = 0; i < n; i++) {
+    t[i] += a[i] * d;
+  }
+}
+
+/*
+ * r = a b in n + m digits, digit by digit. The products are summed into
+ * columns of 64 bits, BIGNUM_ROWS rows of them at a time before the carries
+ * are propagated, instead of dividing by the base at every product.
+ */
+void bignumMultiplySchoolbook(const BignumDigit* a, size_t n,
+                              const BignumDigit* b, size_t m, BignumDigit* r)
+{
+  uint64_t* t = calloc(n + m + 1, sizeof(uint64_t));
+  for(size_t j = 0; j < m; j += BIGNUM_ROWS) {
+    size_t rows = (m - j < BIGNUM_ROWS) ? m - j : BIGNUM_ROWS;
+    for(size_t k = j; k < j + rows; k++) {
+      bignumMultiplyRow(t + k, a, n, b[k]);
+    }
+    bignumCarry(t, j, j + rows + n - 1);
+  }
+  bignumCarry(t, 0, n + m);
+  for(size_t k = 0; k < n + m; k++) {
+    r[k] = t[k];
+  }
+  free(t);
+}
+
+// r = a b in n + m digits
+void bignumMultiplyDigits(const BignumDigit* a, size_t n,
+                          const BignumDigit* b, size_t m, BignumDigit* r)
+{
+  if(n < m) {
+    const BignumDigit* c = a; a = b; b = c;
+    size_t k = n; n = m; m = k;
+  }
+  if(m == 1) {
+    bignumMultiplySmall(a, n, b[0], r);
+    return;
+  }
+  if(m < BIGNUM_KARATSUBA) {
+    bignumMultiplySchoolbook(a, n, b, m, r);
+    return;
+  }
+
+  if(n >= 2 * m) {
+    memset(r, 0, sizeof(BignumDigit) * (n + m));
+    BignumDigit* piece = malloc(sizeof(BignumDigit) * 2 * m);
+    for(size_t i = 0; i < n; i += m) {
+      size_t k = (n - i < m) ? n - i : m;
+      bignumMultiplyDigits(a + i, k, b, m, piece);
+      bignumAddInto(r + i, n + m - i, piece, k + m);
+    }
+    free(piece);
+    return;
+  }
+
+  // m > h, so every part has digits
+  size_t h = n / 2;
+  size_t sumA = n - h + 1, sumB = ((m - h > h) ? m - h : h) + 1;
+  BignumDigit* sa = malloc(sizeof(BignumDigit) * 2 * (sumA + sumB));
+  BignumDigit* sb = sa + sumA;
+  BignumDigit* middle = sb + sumB;
+  bignumAddDigits(a + h, n - h, a, h, sa);
+  if(m - h >= h) {
+    bignumAddDigits(b + h, m - h, b, h, sb);
+  }
+  else {
+    bignumAddDigits(b, h, b + h, m - h, sb);
+  }
+  bignumMultiplyDigits(sa, sumA, sb, sumB, middle);
+
+  bignumMultiplyDigits(a, h, b, h, r);
+  bignumMultiplyDigits(a + h, n - h, b + h, m - h, r + 2 * h);
+  size_t length = sumA + sumB;
+  bignumSubtractFrom(middle, length, r, 2 * h);
+  bignumSubtractFrom(middle, length, r + 2 * h, n + m - 2 * h);
+  bignumAddInto(r + h, n + m - h, middle, bignumTrim(middle, length));
+  free(sa);
+}
+
+// q = a / divisor, returns the remainder
+BignumDigit bignumDivideSmall(const BignumDigit* a, size_t n, BignumDigit divisor,
+                              BignumDigit* q)
+{
+  uint64_t remainder = 0;
+  while(n-- > 0) {
+    uint64_t t = remainder * SEXP_BIGNUM_BASE + a[n];
+    q[n] = t / divisor;
+    remainder = t % divisor;
+  }
+  return remainder;
+}
+
+/*
+ * q = a / b and r = a % b, for n >= m >= 2 and b with no leading zero digit:
+ * q has n - m + 1 digits and r has m. This is algorithm D of Knuth, TAOCP
+ * 4.3.1: both are scaled so that the leading digit of b is at least B / 2,
+ * then each digit of the quotient is estimated from the leading digits, and
+ * is at most one too large.
+ */
+void bignumDivideDigits(const BignumDigit* a, size_t n, const BignumDigit* b, size_t m,
+                        BignumDigit* q, BignumDigit* r)
+{
+  BignumDigit* u = malloc(sizeof(BignumDigit) * (n + 1 + m + 1));
+  BignumDigit* v = u + n + 1;
+  BignumDigit d = SEXP_BIGNUM_BASE / ((uint64_t)b[m - 1] + 1);
+  bignumMultiplySmall(a, n, d, u);
+  bignumMultiplySmall(b, m, d, v); // v[m] is 0
+  const uint64_t base = SEXP_BIGNUM_BASE;
+
+  for(size_t j = n - m + 1; j-- > 0;) {
+    uint64_t numerator = u[j + m] * base + u[j + m - 1];
+    uint64_t qhat = numerator / v[m - 1];
+    uint64_t rhat = numerator % v[m - 1];
+    while(qhat >= base || qhat * v[m - 2] > rhat * base + u[j + m - 2]) {
+      qhat--;
+      rhat += v[m - 1];
+      if(rhat >= base) {
+        break;
+      }
+    }
+
+    // u[j..j + m] -= qhat v
+    uint64_t carry = 0;
+    int64_t borrow = 0;
+    for(size_t i = 0; i < m; i++) {
+      uint64_t p = qhat * v[i] + carry;
+      carry = p / base;
+      int64_t t = (int64_t)u[i + j] - borrow - (int64_t)(p - carry * base);
+      borrow = t < 0;
+      u[i + j] = (BignumDigit)(borrow ? t + (int64_t)base : t);
+    }
+    int64_t t = (int64_t)u[j + m] - borrow - (int64_t)carry;
+    if(t < 0) {
+      // qhat was one too large, so v is added back, and the carry cancels
+      qhat--;
+      BignumDigit c = 0;
+      for(size_t i = 0; i < m; i++) {
+        BignumDigit sum = u[i + j] + v[i] + c;
+        c = sum >= SEXP_BIGNUM_BASE;
+        u[i + j] = c ? sum - SEXP_BIGNUM_BASE : sum;
+      }
+      t = 0;
+    }
+    u[j + m] = t;
+    q[j] = qhat;
+  }
+  bignumDivideSmall(u, m, d, r);
+  free(u);
+}
+
+
+
+/* conversions */
+
+void bignumViewOf(Sexp sexp, BignumView* view)
+{
+  if(SEXP_TYPE_OF(sexp) == SEXP_TYPE_BIGNUM) {
+    view->negative = sexp->value.bignum->negative;
+    view->length = sexp->value.bignum->length;
+    view->digits = sexp->value.bignum->digits;
+    return;
+  }
+  long integer = sexp->value.integer;
+  unsigned long magnitude = (integer < 0) ? -(unsigned long)integer : (unsigned long)integer;
+  view->negative = integer < 0;
+  view->length = 0;
+  for(; magnitude; magnitude /= SEXP_BIGNUM_BASE) {
+    view->small[view->length++] = magnitude % SEXP_BIGNUM_BASE;
+  }
+  view->digits = view->small;
+}
+
+// the integer of a bignum, which is released, a long if it fits one
+Sexp bignumNormalize(SexpBignum bignum)
+{
+  bignum->length = bignumTrim(bignum->digits, bignum->length);
+  if(bignum->length <= BIGNUM_LONG_DIGITS &&
+     (bignum->length < BIGNUM_LONG_DIGITS || bignum->digits[2] < 10)) {
+    unsigned long magnitude = 0;
+    for(size_t i = bignum->length; i-- > 0;) {
+      magnitude = magnitude * SEXP_BIGNUM_BASE + bignum->digits[i];
+    }
+    int negative = bignum->negative;
+    if(magnitude <= (unsigned long)LONG_MAX ||
+       (negative && magnitude == (unsigned long)LONG_MAX + 1)) {
+      sexpBignumRelease(bignum);
+      return sexpCreateInteger(negative ? (long)-magnitude : (long)magnitude);
+    }
+  }
+  return sexpCreateBignumOf(bignum);
+}
+
+// the integer written in decimal digits, with a leading - if negative
+Sexp bignumFromString(const char* text)
+{
+  int negative = *text == '-';
+  text += negative;
+  while(*text == '0') {
+    text++;
+  }
+  size_t count = strlen(text);
+  SexpBignum bignum = sexpBignumCreate(count / SEXP_BIGNUM_BASE_DIGITS + 1);
+  bignum->negative = negative;
+  size_t i = 0;
+  for(const char* end = text + count; end > text; i++) {
+    const char* start = (end - text > SEXP_BIGNUM_BASE_DIGITS) ?
+      end - SEXP_BIGNUM_BASE_DIGITS : text;
+    BignumDigit digit = 0;
+    for(const char* c = start; c < end; c++) {
+      digit = digit * 10 + (*c - '0');
+    }
+    bignum->digits[i] = digit;
+    end = start;
+  }
+  bignum->length = i;
+  return bignumNormalize(bignum);
+}
+
+double bignumToDouble(SexpBignum bignum)
+{
+  double value = 0;
+  for(size_t i = bignum->length; i-- > 0;) {
+    value = value * SEXP_BIGNUM_BASE + bignum->digits[i];
+  }
+  return bignum->negative ? -value : value;
+}
+
+// an integer or a bignum, as a double
+double bignumIntegerToDouble(Sexp sexp)
+{
+  return (SEXP_TYPE_OF(sexp) == SEXP_TYPE_BIGNUM) ?
+    bignumToDouble(sexp->value.bignum) : (double)sexp->value.integer;
+}
+
+int bignumIsInteger(Sexp sexp)
+{
+  return SEXP_TYPE_OF(sexp) == SEXP_TYPE_INTEGER || SEXP_TYPE_OF(sexp) == SEXP_TYPE_BIGNUM;
+}
+
+
+
+/* arithmetic */
+
+// x + y, or x - y if y is negated
+Sexp bignumAdd(const BignumView* x, const BignumView* y, int negateY)
+{
+  int negativeY = y->negative ^ negateY;
+  if(x->negative == negativeY) {
+    const BignumView* larger = (x->length >= y->length) ? x : y;
+    const BignumView* smaller = (larger == x) ? y : x;
+    SexpBignum sum = sexpBignumCreate(larger->length + 1);
+    bignumAddDigits(larger->digits, larger->length, smaller->digits, smaller->length,
+                    sum->digits);
+    sum->negative = x->negative;
+    return bignumNormalize(sum);
+  }
+  int order = bignumCompareDigits(x->digits, x->length, y->digits, y->length);
+  const BignumView* larger = (order >= 0) ? x : y;
+  const BignumView* smaller = (larger == x) ? y : x;
+  SexpBignum difference = sexpBignumCreate(larger->length);
+  memcpy(difference->digits, larger->digits, sizeof(BignumDigit) * larger->length);
+  bignumSubtractFrom(difference->digits, larger->length, smaller->digits, smaller->length);
+  difference->negative = (larger == x) ? x->negative : negativeY;
+  return bignumNormalize(difference);
+}
+
+Sexp bignumMultiply(const BignumView* x, const BignumView* y)
+{
+  if(!x->length || !y->length) {
+    return sexpCreateInteger(0);
+  }
+  SexpBignum product = sexpBignumCreate(x->length + y->length);
+  bignumMultiplyDigits(x->digits, x->length, y->digits, y->length, product->digits);
+  product->negative = x->negative != y->negative;
+  return bignumNormalize(product);
+}
+
+// the quotient truncated towards zero, or the remainder, as in C
+Sexp bignumDivide(const BignumView* x, const BignumView* y, int remainder)
+{
+  if(!y->length) {
+    printf("! divion by zero\n");
+    throwException();
+    return NULL;
+  }
+  if(bignumCompareDigits(x->digits, x->length, y->digits, y->length) < 0) {
+    if(remainder) {
+      SexpBignum copy = sexpBignumCreate(x->length);
+      memcpy(copy->digits, x->digits, sizeof(BignumDigit) * x->length);
+      copy->negative = x->negative;
+      return bignumNormalize(copy);
+    }
+    return sexpCreateInteger(0);
+  }
+  SexpBignum q = sexpBignumCreate(x->length - y->length + 1);
+  SexpBignum r = sexpBignumCreate(y->length);
+  if(y->length == 1) {
+    r->digits[0] = bignumDivideSmall(x->digits, x->length, y->digits[0], q->digits);
+  }
+  else {
+    bignumDivideDigits(x->digits, x->length, y->digits, y->length, q->digits, r->digits);
+  }
+  q->negative = x->negative != y->negative;
+  r->negative = x->negative;
+  if(remainder) {
+    sexpBignumRelease(q);
+    return bignumNormalize(r);
+  }
+  sexpBignumRelease(r);
+  return bignumNormalize(q);
+}
+
+/*
+ * base ** exponent, exactly, by squaring. A negative exponent gives the
+ * reciprocal truncated towards zero, as integer division does. Powers which
+ * would have more than BIGNUM_DIGITS_LIMIT digits are an error.
+ */
+Sexp bignumPower(Sexp base, long exponent)
+{
+  BignumView x;
+  bignumViewOf(base, &x);
+  if(x.length == 0 && exponent <= 0) {
+    printf((exponent == 0) ? "! 0 raised to the power of 0 is undefined\n" :
+           "! the power of 0 is undefined for a negative exponent\n");
+    throwException();
+    return NULL;
+  }
+  int isOne = x.length == 1 && x.digits[0] == 1;
+  if(exponent < 0 || x.length == 0 || isOne) {
+    if(!isOne) {
+      return sexpCreateInteger(0);
+    }
+    return sexpCreateInteger((x.negative && (exponent & 1)) ? -1 : 1);
+  }
+
+  // a long result is found without a bignum
+  if(SEXP_TYPE_OF(base) == SEXP_TYPE_INTEGER) {
+    long result = 1, square = base->value.integer;
+    long e = exponent;
+    for(;;) {
+      if((e & 1) && __builtin_mul_overflow(result, square, &result)) {
+        break;
+      }
+      e >>= 1;
+      if(!e) {
+        return sexpCreateInteger(result);
+      }
+      if(__builtin_mul_overflow(square, square, &square)) {
+        break;
+      }
+    }
+  }
+
+  double digits = (x.length - 1 + log10(x.digits[x.length - 1] + 1.0) /
+                   SEXP_BIGNUM_BASE_DIGITS) * exponent;
+  if(digits > BIGNUM_DIGITS_LIMIT) {
+    printf("! integer power is too large\n");
+    throwException();
+    return NULL;
+  }
+  size_t capacity = (size_t)digits + 2;
+  BignumDigit* result = malloc(sizeof(BignumDigit) * capacity);
+  BignumDigit* square = malloc(sizeof(BignumDigit) * capacity);
+  BignumDigit* product = malloc(sizeof(BignumDigit) * 2 * capacity);
+  size_t resultLength = 1, squareLength = x.length;
+  result[0] = 1;
+  memcpy(square, x.digits, sizeof(BignumDigit) * x.length);
+  for(long e = exponent;;) {
+    if(e & 1) {
+      bignumMultiplyDigits(result, resultLength, square, squareLength, product);
+      resultLength = bignumTrim(product, resultLength + squareLength);
+      memcpy(result, product, sizeof(BignumDigit) * resultLength);
+    }
+    e >>= 1;
+    if(!e) {
+      break;
+    }
+    bignumMultiplyDigits(square, squareLength, square, squareLength, product);
+    squareLength = bignumTrim(product, 2 * squareLength);
+    memcpy(square, product, sizeof(BignumDigit) * squareLength);
+  }
+  free(square);
+  free(product);
+  SexpBignum power = sexpBignumCreate(resultLength);
+  memcpy(power->digits, result, sizeof(BignumDigit) * resultLength);
+  power->negative = x.negative && (exponent & 1);
+  free(result);
+  return bignumNormalize(power);
+}
+
+// the operator applied to two integers, longs or bignums
+Sexp bignumApplyOperator(Sexp num1, Sexp num2, Operator operator)
+{
+  BignumView x, y;
+  bignumViewOf(num1, &x);
+  bignumViewOf(num2, &y);
+  int order = (x.negative != y.negative) ? (x.negative ? -1 : 1) :
+    bignumCompareDigits(x.digits, x.length, y.digits, y.length) * (x.negative ? -1 : 1);
+
+  switch(operator)
+  {
+  case OPERATOR_EQUAL:         return sexpCreateBoolean(order == 0);
+  case OPERATOR_LESS:          return sexpCreateBoolean(order < 0);
+  case OPERATOR_LESS_EQUAL:    return sexpCreateBoolean(order <= 0);
+  case OPERATOR_GREATER:       return sexpCreateBoolean(order > 0);
+  case OPERATOR_GREATER_EQUAL: return sexpCreateBoolean(order >= 0);
+  case OPERATOR_PLUS:          return bignumAdd(&x, &y, 0);
+  case OPERATOR_MINUS:         return bignumAdd(&x, &y, 1);
+  case OPERATOR_MULTIPLY:      return bignumMultiply(&x, &y);
+  case OPERATOR_DIVIDE:        return bignumDivide(&x, &y, 0);
+  case OPERATOR_MODULUS:       return bignumDivide(&x, &y, 1);
+  case OPERATOR_POWER:
+    if(SEXP_TYPE_OF(num2) == SEXP_TYPE_INTEGER) {
+      return bignumPower(num1, num2->value.integer);
+    }
+    // only powers of 0 and 1 and -1, and reciprocals, are small enough
+    return bignumPower(num1, (y.negative ? -1 : 1) * (LONG_MAX - 1 + (y.digits[0] & 1)));
+  default:
+    printf("apply arithmetic operator: invalid operator type\n");
+    throwException();
+    return NULL;
+  }
+}
+
+
+
+#endif // PLD_LISP_BIGNUM_H
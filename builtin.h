@@ -0,0 +1,41 @@
+#ifndef PLD_LISP_BUILTIN_H
+#define PLD_LISP_BUILTIN_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "sexp.h"
+#include "symtable.h"
+
+/* global symbol table */
+extern Symtable globalEnvironment;
+
+
+
+/* typedefs for easy usage */
+typedef Sexp (*BuiltinFunction)(Sexp arguments);
+
+
+
+/* builtin functions */
+
+/*
+ * Bind a native C function to a symbol in the global environment.
+ * The descriptor is never freed, since every copy of the binding
+ * refers to it.
+ */
+void builtinRegister(const char* name, BuiltinFunction function)
+{
+  SexpBuiltin builtin = malloc(sizeof(struct _sexp_builtin_t));
+  char* builtinName = malloc((strlen(name) + 1) * sizeof(char));
+  strcpy(builtinName, name);
+  builtin->name = builtinName;
+  builtin->function = function;
+
+  Sexp sexp = sexpCreateBuiltin(builtin);
+  symtableUpdate(globalEnvironment, name, sexp);
+  sexpFree(sexp);
+}
+
+
+
+#endif // PLD_LISP_BUILTIN_H
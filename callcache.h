@@ -0,0 +1,110 @@
+#ifndef PLD_LISP_CALLCACHE_H
+#define PLD_LISP_CALLCACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "sexp.h"
+
+#define CALL_CACHE_SIZE 4096 // must be a power of two
+
+/*
+ * Monomorphic inline caches for calls to global functions.
+ *
+ * Each call site (the cons of a function application) remembers the global
+ * value its callee symbol resolved to, so later calls neither search the
+ * global environment nor copy the function definition.
+ * An entry is only valid for the version it was stored in. The version is
+ * bumped whenever a global is defined, and whenever the REPL frees a program,
+ * since the address of a freed call site may be reused by another one.
+ *
+ * An entry may also hold the inlined expansion of its call site.
+ * Replaced expansions can still be under evaluation, so they are only
+ * released by callCacheCollect when the REPL is done with a program.
+ */
+struct _call_cache_entry_t {
+  Sexp site;
+  unsigned long version;
+  Sexp function;
+  int expanded; // has inlining been attempted for this entry?
+  Sexp expansion;
+};
+
+typedef struct _call_cache_entry_t* CallCacheEntry;
+
+
+
+/* global data structures for easy usage */
+struct _call_cache_entry_t callCache[CALL_CACHE_SIZE];
+unsigned long callCacheVersion = 1;
+Sexp* callCacheGarbage = NULL;
+unsigned int callCacheGarbageSize = 0;
+unsigned int callCacheGarbageCapacity = 0;
+
+
+
+/* inline cache functions */
+CallCacheEntry callCacheEntry(Sexp site)
+{
+  // S-expressions are at least 16-byte aligned
+  return &callCache[((uintptr_t)site >> 4) & (CALL_CACHE_SIZE - 1)];
+}
+
+// returns the entry of the call site, or NULL if it is not cached
+CallCacheEntry callCacheLookup(Sexp site)
+{
+  CallCacheEntry entry = callCacheEntry(site);
+  if(entry->site == site && entry->version == callCacheVersion) {
+    return entry;
+  }
+  return NULL;
+}
+
+void callCacheRetire(Sexp expansion)
+{
+  if(callCacheGarbageSize == callCacheGarbageCapacity) {
+    callCacheGarbageCapacity = (callCacheGarbageCapacity) ?
+      callCacheGarbageCapacity * 2 : 64;
+    callCacheGarbage = realloc(callCacheGarbage,
+                               sizeof(Sexp) * callCacheGarbageCapacity);
+  }
+  callCacheGarbage[callCacheGarbageSize++] = expansion;
+}
+
+CallCacheEntry callCacheStore(Sexp site, Sexp function)
+{
+  CallCacheEntry entry = callCacheEntry(site);
+  if(entry->expansion) {
+    callCacheRetire(entry->expansion);
+  }
+  entry->site = site;
+  entry->version = callCacheVersion;
+  entry->function = function;
+  entry->expanded = 0;
+  entry->expansion = NULL;
+  return entry;
+}
+
+void callCacheStoreExpansion(CallCacheEntry entry, Sexp expansion)
+{
+  entry->expanded = 1;
+  entry->expansion = expansion;
+}
+
+void callCacheInvalidate()
+{
+  callCacheVersion++;
+}
+
+// free replaced expansions, only safe when no program is being evaluated
+void callCacheCollect()
+{
+  for(unsigned int i = 0; i < callCacheGarbageSize; i++) {
+    sexpFree(callCacheGarbage[i]);
+  }
+  callCacheGarbageSize = 0;
+}
+
+
+
+#undef CALL_CACHE_SIZE
+#endif // PLD_LISP_CALLCACHE_H
@@ -7,6 +7,12 @@
 #include "eval.h"
 #include "symtable.h"
 #include "exception.h"
+#include "compile.h"
+#include "simplify.h"
+
+#ifdef CLISP_COMPILED_LIBRARY
+#include CLISP_COMPILED_LIBRARY
+#endif
 
 /* C-Lisp REPL help */
 void printHelp()
@@ -34,6 +40,15 @@ void printHelp()
 
   printf("  %-20s", "--debug-all");
   printf("Enable all interpreter options (verbose output!)\n");
+
+  printf("  %-20s", "--no-adaptive");
+  printf("Always try the clauses of a function in source order\n");
+
+  printf("  %-20s", "--hash-cons");
+  printf("Share equal S-expressions, so equality is mostly a pointer compare\n");
+
+  printf("  %-20s", "--emit-c <file>");
+  printf("Translate library file to C source (printed to stdout)\n");
 }
 
 
@@ -63,6 +78,8 @@ void repl()
 {
   /* create return point from caught exceptions */
   setjmp(jumpbuffer);
+  evalClosure = NULL;
+  immortalLoading = 0;
 
   // TODO: deallocate used memory for sexp and symtable types!
 
@@ -86,6 +103,37 @@ void repl()
     if(!strcmp(input, "#help")) {
       printf("#exit     -> exit LISP repl\n");
       printf("#bindings -> show global bindings\n");
+      printf("#simplify -> show simplification and inlining statistics\n");
+      printf("#profile-clauses -> show how often each clause has matched\n");
+      printf("#hashcons -> show hash-consing statistics\n");
+      printf("#immortal -> show the size of the loaded library code\n");
+      printf("#strings  -> show string arena statistics\n");
+      inputBufferFree(input);
+      continue;
+    }
+    if(!strcmp(input, "#profile-clauses")) {
+      functionPrintProfiles(globalEnvironment);
+      inputBufferFree(input);
+      continue;
+    }
+    if(!strcmp(input, "#hashcons")) {
+      hashconsPrintStatistics();
+      inputBufferFree(input);
+      continue;
+    }
+    if(!strcmp(input, "#immortal")) {
+      immortalPrintStatistics();
+      inputBufferFree(input);
+      continue;
+    }
+    if(!strcmp(input, "#strings")) {
+      memoryManagerPrintStatistics();
+      inputBufferFree(input);
+      continue;
+    }
+    if(!strcmp(input, "#simplify")) {
+      simplifyPrintStatistics();
+      inlinePrintStatistics();
       inputBufferFree(input);
       continue;
     }
@@ -138,6 +186,11 @@ void repl()
       printf("\n");
     }
 
+    /* fold constant expressions */
+    Sexp simplified = simplifySexp(sexp);
+    sexpFree(sexp);
+    sexp = simplified;
+
     /* evaluate input */
     Symtable symtable = symtableCreate();
     Sexp result = evalSexp(sexp, symtable);
@@ -167,6 +220,8 @@ void repl()
     sexpFree(sexp);
     sexpFree(result);
     symtableFree(symtable);
+    callCacheInvalidate();
+    callCacheCollect();
   }
 }
 
@@ -175,6 +230,14 @@ void repl()
 int main(int argc, char** argv)
 {
   globalEnvironment = symtableCreate();
+  memoRegisterBuiltins();
+  stringRegisterBuiltins();
+  vectorRegisterBuiltins();
+  matrixRegisterBuiltins();
+  arrayRegisterBuiltins();
+#ifdef CLISP_COMPILED_LIBRARY
+  compiledLibraryRegister();
+#endif
 
   for(int i = 1; i < argc; i++) {
     if(!strcmp(argv[i], "--help")) { printHelp(); goto END_REPL; } // ok, exit.
@@ -186,6 +249,19 @@ int main(int argc, char** argv)
     else if(!strcmp(argv[i], "--debug-all"     )) {
       debugLexing = debugSyntree = debugSymtable = debugInput = debugTime = 1;
     }
+    else if(!strcmp(argv[i], "--no-adaptive"   )) { evalAdaptiveClauses = 0; }
+    else if(!strcmp(argv[i], "--hash-cons"     )) {
+#ifdef SEXP_COMPACT
+      printf("Hash-consing is not available with compact cells\n");
+#else
+      hashconsEnabled = 1;
+#endif
+    }
+    else if(!strcmp(argv[i], "--emit-c") && i + 1 < argc) {
+      int compiled = compileLibrary(argv[i + 1]);
+      symtableFree(globalEnvironment);
+      return (compiled) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
     else { printf("Invalid argument '%s'", argv[i]); }
   }
   printf("PLD C-LISP v. 0.1\n");
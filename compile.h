@@ -0,0 +1,946 @@
+#ifndef PLD_LISP_COMPILE_H
+#define PLD_LISP_COMPILE_H
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <limits.h>
+#include "sexp.h"
+#include "symtable.h"
+#include "keyword.h"
+#include "operator.h"
+#include "exception.h"
+#include "io.h"
+#include "lex.h"
+#include "syntree.h"
+#include "builtin.h"
+#include "simplify.h"
+#include "eval.h"
+
+/*
+ * Ahead-of-time translation of library files into C.
+ *
+ * `clisp --emit-c lib.le` prints a C translation unit on stdout, in which
+ * every top-level (define f (lambda rules...)) becomes a native builtin:
+ * - patterns are unfolded into type tests on the argument list,
+ * - operators, if, not, cons, equals and quote call the runtime directly,
+ * - calls to global functions go through a cache at each call site,
+ * - let-bindings become helper functions taking the bound variable.
+ * Anything else (message, nested lambdas, ...) is handed to the interpreter
+ * with the pattern variables bound in a fresh environment.
+ * Pattern variables borrow from the argument list, so they are copied where
+ * they outlive it: when they are returned or stored in an argument list.
+ *
+ * Compiled functions resolve free variables in the global environment only,
+ * so unlike interpreted ones they do not see the local variables of their
+ * caller. The callee of a call is looked up when the call is made, like in
+ * the interpreter, so redefining a library function changes its callers.
+ *
+ * Use `make build-library LIBRARY=lib` to compile the result into clisp.
+ */
+
+
+
+/* jump buffer for exception handling */
+extern jmp_buf jumpbuffer;
+
+/* global symbol table */
+extern Symtable globalEnvironment;
+
+
+
+/* runtime support for generated code */
+Symtable compiledEnvironmentEmpty = NULL;
+
+Symtable compiledEmptyEnvironment()
+{
+  if(!compiledEnvironmentEmpty) {
+    compiledEnvironmentEmpty = symtableCreate();
+  }
+  return compiledEnvironmentEmpty;
+}
+
+int compiledIsNil(Sexp sexp)
+{
+  return SEXP_TYPE_OF(sexp) == SEXP_TYPE_NIL;
+}
+
+int compiledIsCons(Sexp sexp)
+{
+  return SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS;
+}
+
+Sexp compiledCar(Sexp sexp)
+{
+  return SEXP_CAR(sexp);
+}
+
+Sexp compiledCdr(Sexp sexp)
+{
+  return SEXP_CDR(sexp);
+}
+
+// cons without copying, used for constants and argument lists
+Sexp compiledCons(Sexp sexp1, Sexp sexp2)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_CONS);
+  SEXP_SET_CAR(sexp, sexp1);
+  SEXP_SET_CDR(sexp, sexp2);
+  return sexp;
+}
+
+Sexp compiledList(int count, ...)
+{
+  Sexp arguments[count > 0 ? count : 1];
+  va_list list;
+  va_start(list, count);
+  for(int i = 0; i < count; i++) {
+    arguments[i] = va_arg(list, Sexp);
+  }
+  va_end(list);
+
+  Sexp ret = sexpCreateNil();
+  for(int i = count - 1; i >= 0; i--) {
+    ret = compiledCons(arguments[i], ret);
+  }
+  return ret;
+}
+
+Symtable compiledEnvironment(int count, ...)
+{
+  Symtable environment = symtableCreate();
+  va_list list;
+  va_start(list, count);
+  for(int i = 0; i < count; i++) {
+    const char* symbol = va_arg(list, const char*);
+    Sexp value = va_arg(list, Sexp);
+    symtableUpdate(environment, symbol, value);
+  }
+  va_end(list);
+  return environment;
+}
+
+int compiledCondition(Sexp cond)
+{
+  if(SEXP_TYPE_OF(cond) != SEXP_TYPE_BOOLEAN) {
+    printf("! condition expression must be a boolean\n");
+    throwException();
+    printf("Control should not reach this point!\n");
+    return 0;
+  }
+  return cond->value.boolean;
+}
+
+Sexp compiledNot(Sexp e)
+{
+  return sexpCreateBoolean(!compiledCondition(e));
+}
+
+Sexp compiledEquals(Sexp e1, Sexp e2)
+{
+  return sexpCreateBoolean(evalEquals(e1, e2));
+}
+
+Sexp compiledNoMatch(Sexp arguments)
+{
+  printf("! no patterns matched arguments ");
+  sexpPrint(arguments);
+  printf("\n");
+  throwException();
+  printf("Control should not reach this point!\n");
+  return NULL;
+}
+
+Sexp compiledLookupGlobal(const char* symbol)
+{
+  Sexp value = symtableLookupSymbol(globalEnvironment, symbol);
+  if(!value) {
+    printf("! undefined variable %s\n", symbol);
+    throwException();
+    printf("Control should not reach this point!\n");
+    return NULL;
+  }
+  return value;
+}
+
+Sexp compiledApply(Sexp function, Sexp arguments)
+{
+  return evalApply(function, arguments, compiledEmptyEnvironment());
+}
+
+/*
+ * Each call site of a global function remembers the value its symbol
+ * resolved to, which is valid for one version of the call cache, see
+ * callcache.h. The version is bumped whenever a global is defined.
+ */
+struct _compiled_site_t {
+  unsigned long version;
+  Sexp function;
+};
+
+typedef struct _compiled_site_t* CompiledSite;
+
+Sexp compiledCallGlobal(CompiledSite site, const char* symbol, Sexp arguments)
+{
+  if(site->version != callCacheVersion) {
+    SymtableBinding binding = symtableLookupBinding(globalEnvironment, symbol);
+    if(!binding) {
+      printf("! undefined variable %s\n", symbol);
+      throwException();
+      printf("Control should not reach this point!\n");
+      return NULL;
+    }
+    site->function = binding->value;
+    site->version = callCacheVersion;
+  }
+  return compiledApply(site->function, arguments);
+}
+
+// registers a compiled function, so that call sites look it up again
+void compiledRegister(const char* name, BuiltinFunction function)
+{
+  builtinRegister(name, function);
+  callCacheInvalidate();
+}
+
+// the interpreter may return parts of the program (quote, lambda),
+// so it always works on a private copy of the constant expression
+Sexp compiledInterpret(Sexp expression, Symtable environment)
+{
+  return evalSexp(sexpCopy(expression), environment);
+}
+
+
+
+/* output buffer for generated code */
+struct _compile_buffer_t {
+  char* data;
+  size_t size;
+  size_t capacity;
+};
+
+typedef struct _compile_buffer_t* CompileBuffer;
+
+CompileBuffer compileBufferCreate()
+{
+  CompileBuffer buffer = malloc(sizeof(struct _compile_buffer_t));
+  buffer->capacity = 256;
+  buffer->size = 0;
+  buffer->data = malloc(buffer->capacity * sizeof(char));
+  buffer->data[0] = '\0';
+  return buffer;
+}
+
+void compileBufferFree(CompileBuffer buffer)
+{
+  free(buffer->data);
+  free(buffer);
+}
+
+void compileBufferAppend(CompileBuffer buffer, const char* format, ...)
+{
+  va_list list;
+  va_start(list, format);
+  int len = vsnprintf(NULL, 0, format, list);
+  va_end(list);
+
+  while(buffer->size + len + 1 > buffer->capacity) {
+    buffer->capacity *= 2;
+    char* data = malloc(buffer->capacity * sizeof(char));
+    memcpy(data, buffer->data, buffer->size + 1);
+    free(buffer->data);
+    buffer->data = data;
+  }
+
+  va_start(list, format);
+  vsnprintf(&buffer->data[buffer->size], len + 1, format, list);
+  va_end(list);
+  buffer->size += len;
+}
+
+// identifiers are mangled, since LISP symbols may contain e.g. '-'
+void compileBufferAppendName(CompileBuffer buffer, const char* symbol)
+{
+  for(const char* c = symbol; *c; c++) {
+    if(('a' <= *c && *c <= 'z') || ('A' <= *c && *c <= 'Z') ||
+       ('0' <= *c && *c <= '9')) {
+      compileBufferAppend(buffer, "%c", *c);
+    } else {
+      compileBufferAppend(buffer, "_%02x", (unsigned char)*c);
+    }
+  }
+}
+
+void compileBufferAppendCharacters(CompileBuffer buffer, const char* chars,
+                                   size_t length)
+{
+  compileBufferAppend(buffer, "\"");
+  for(const char* c = chars; c < chars + length; c++) {
+    if(*c == '"' || *c == '\\') {
+      compileBufferAppend(buffer, "\\%c", *c);
+    } else if(*c < ' ' || *c > '~') {
+      compileBufferAppend(buffer, "\\%03o", (unsigned char)*c);
+    } else {
+      compileBufferAppend(buffer, "%c", *c);
+    }
+  }
+  compileBufferAppend(buffer, "\"");
+}
+
+void compileBufferAppendStringLiteral(CompileBuffer buffer, const char* string)
+{
+  compileBufferAppendCharacters(buffer, string, strlen(string));
+}
+
+
+
+/* compiler state */
+struct _compile_state_t {
+  CompileBuffer declarations;
+  CompileBuffer functions;
+  CompileBuffer constants;
+  CompileBuffer registrations;
+  char** functionNames;
+  int functionCount;
+  int constantCount;
+  int siteCount;
+  int letCount;
+  int errors;
+};
+
+// pattern variables visible in the expression being compiled
+struct _compile_scope_t {
+  const char** symbols;
+  int count;
+};
+
+typedef struct _compile_state_t* CompileState;
+typedef struct _compile_scope_t* CompileScope;
+
+CompileState compileStateCreate()
+{
+  CompileState state = malloc(sizeof(struct _compile_state_t));
+  state->declarations = compileBufferCreate();
+  state->functions = compileBufferCreate();
+  state->constants = compileBufferCreate();
+  state->registrations = compileBufferCreate();
+  state->functionNames = NULL;
+  state->functionCount = 0;
+  state->constantCount = 0;
+  state->siteCount = 0;
+  state->letCount = 0;
+  state->errors = 0;
+  return state;
+}
+
+void compileStateFree(CompileState state)
+{
+  compileBufferFree(state->declarations);
+  compileBufferFree(state->functions);
+  compileBufferFree(state->constants);
+  compileBufferFree(state->registrations);
+  free(state->functionNames);
+  free(state);
+}
+
+CompileScope compileScopeCreate()
+{
+  CompileScope scope = malloc(sizeof(struct _compile_scope_t));
+  scope->symbols = NULL;
+  scope->count = 0;
+  return scope;
+}
+
+void compileScopeFree(CompileScope scope)
+{
+  free(scope->symbols);
+  free(scope);
+}
+
+int compileScopeContains(CompileScope scope, const char* symbol)
+{
+  for(int i = 0; i < scope->count; i++) {
+    if(!strcmp(scope->symbols[i], symbol)) return 1;
+  }
+  return 0;
+}
+
+void compileScopeAdd(CompileScope scope, const char* symbol)
+{
+  scope->symbols = realloc(scope->symbols,
+                           (scope->count + 1) * sizeof(const char*));
+  scope->symbols[scope->count] = symbol;
+  scope->count++;
+}
+
+int compileIsFunction(CompileState state, const char* symbol)
+{
+  for(int i = 0; i < state->functionCount; i++) {
+    if(!strcmp(state->functionNames[i], symbol)) return 1;
+  }
+  return 0;
+}
+
+void compileError(CompileState state, const char* message, Sexp sexp)
+{
+  fprintf(stderr, "! %s: ", message);
+  fflush(stdout);
+  sexpPrint(sexp);
+  fflush(stdout);
+  fprintf(stderr, "\n");
+  state->errors++;
+}
+
+// returns the number of elements in a proper list, otherwise -1
+int compileListLength(Sexp list)
+{
+  int len = 0;
+  while(SEXP_TYPE_OF(list) == SEXP_TYPE_CONS) {
+    list = SEXP_CDR(list);
+    len++;
+  }
+  return (SEXP_TYPE_OF(list) == SEXP_TYPE_NIL) ? len : -1;
+}
+
+Sexp compileListItem(Sexp list, int index)
+{
+  for(int i = 0; i < index; i++) {
+    list = SEXP_CDR(list);
+  }
+  return SEXP_CAR(list);
+}
+
+
+
+/* emit C code that constructs a constant S-expression */
+void compileConstructor(CompileBuffer out, Sexp sexp)
+{
+  switch(SEXP_TYPE_OF(sexp))
+  {
+  case SEXP_TYPE_SYMBOL:
+    compileBufferAppend(out, "sexpCreateSymbol(");
+    compileBufferAppendStringLiteral(out, sexp->value.symbol);
+    compileBufferAppend(out, ")");
+    break;
+  case SEXP_TYPE_BOOLEAN:
+    compileBufferAppend(out, "sexpCreateBoolean(%i)", sexp->value.boolean);
+    break;
+  case SEXP_TYPE_NIL:
+    compileBufferAppend(out, "sexpCreateNil()");
+    break;
+  case SEXP_TYPE_CONS:
+    compileBufferAppend(out, "compiledCons(");
+    compileConstructor(out, SEXP_CAR(sexp));
+    compileBufferAppend(out, ", ");
+    compileConstructor(out, SEXP_CDR(sexp));
+    compileBufferAppend(out, ")");
+    break;
+  case SEXP_TYPE_INTEGER:
+    if(sexp->value.integer == LONG_MIN) {
+      compileBufferAppend(out, "sexpCreateInteger(LONG_MIN)");
+    }
+    else {
+      compileBufferAppend(out, "sexpCreateInteger(%ldL)", sexp->value.integer);
+    }
+    break;
+  case SEXP_TYPE_BIGNUM: {
+    char* digits = sexpBignumText(sexp->value.bignum);
+    compileBufferAppend(out, "bignumFromString(\"%s\")", digits);
+    free(digits);
+    break;
+  }
+  case SEXP_TYPE_DOUBLE:
+    compileBufferAppend(out, "sexpCreateDouble(%.17g)", sexp->value.doubleFP);
+    break;
+  case SEXP_TYPE_OPERATOR:
+    compileBufferAppend(out, "sexpCreateOperator((Operator)%i)",
+                        (int)sexp->value.operator);
+    break;
+  case SEXP_TYPE_STRING:
+    compileBufferAppend(out, "sexpCreateString(");
+    compileBufferAppendCharacters(out, sexp->value.string->chars,
+                                  sexp->value.string->length);
+    compileBufferAppend(out, ")");
+    break;
+  default:
+    compileBufferAppend(out, "sexpCreateNil()");
+    printf("compile constructor: Invalid S-expression type\n");
+  }
+}
+
+// returns the index into compiledConstants[]
+int compileConstant(CompileState state, Sexp sexp)
+{
+  int index = state->constantCount++;
+  compileBufferAppend(state->constants, "  compiledConstants[%i] = ", index);
+  compileConstructor(state->constants, sexp);
+  compileBufferAppend(state->constants, ";\n");
+  return index;
+}
+
+
+
+/* function definitions for mutual recursion */
+void compileExpression(CompileState state, CompileScope scope, Sexp e,
+                       CompileBuffer out);
+void compileOwnedExpression(CompileState state, CompileScope scope, Sexp e,
+                            CompileBuffer out);
+
+
+
+/* expressions without a direct translation are left to the interpreter */
+void compileFallback(CompileState state, CompileScope scope, Sexp e,
+                     CompileBuffer out)
+{
+  int index = compileConstant(state, e);
+  compileBufferAppend(out, "compiledInterpret(compiledConstants[%i], "
+                      "compiledEnvironment(%i", index, scope->count);
+  for(int i = 0; i < scope->count; i++) {
+    compileBufferAppend(out, ", ");
+    compileBufferAppendStringLiteral(out, scope->symbols[i]);
+    compileBufferAppend(out, ", v_");
+    compileBufferAppendName(out, scope->symbols[i]);
+  }
+  compileBufferAppend(out, "))");
+}
+
+void compileArguments(CompileState state, CompileScope scope, Sexp args,
+                      CompileBuffer out)
+{
+  int count = compileListLength(args);
+  if(count == 0) {
+    compileBufferAppend(out, "sexpCreateNil()");
+    return;
+  }
+  compileBufferAppend(out, "compiledList(%i", count);
+  for(Sexp arg = args; SEXP_TYPE_OF(arg) == SEXP_TYPE_CONS; arg = SEXP_CDR(arg)) {
+    compileBufferAppend(out, ", ");
+    compileOwnedExpression(state, scope, SEXP_CAR(arg), out);
+  }
+  compileBufferAppend(out, ")");
+}
+
+// (let k e1 in e2) -> compiledLetN(<scope without k>, e1)
+void compileLet(CompileState state, CompileScope scope, const char* k,
+                Sexp e1, Sexp e2, CompileBuffer out)
+{
+  int index = state->letCount++;
+  CompileScope letScope = compileScopeCreate();
+  for(int i = 0; i < scope->count; i++) {
+    if(strcmp(scope->symbols[i], k)) {
+      compileScopeAdd(letScope, scope->symbols[i]);
+    }
+  }
+  compileScopeAdd(letScope, k);
+
+  CompileBuffer signature = compileBufferCreate();
+  compileBufferAppend(signature, "Sexp compiledLet%i(", index);
+  for(int i = 0; i < letScope->count; i++) {
+    compileBufferAppend(signature, "%sSexp v_", (i > 0) ? ", " : "");
+    compileBufferAppendName(signature, letScope->symbols[i]);
+  }
+  compileBufferAppend(signature, ")");
+  compileBufferAppend(state->declarations, "%s;\n", signature->data);
+
+  CompileBuffer body = compileBufferCreate();
+  compileOwnedExpression(state, letScope, e2, body);
+  compileBufferAppend(state->functions, "%s\n{\n  return %s;\n}\n\n",
+                      signature->data, body->data);
+  compileBufferFree(signature);
+  compileBufferFree(body);
+
+  compileBufferAppend(out, "compiledLet%i(", index);
+  for(int i = 0; i < letScope->count - 1; i++) {
+    compileBufferAppend(out, "v_");
+    compileBufferAppendName(out, letScope->symbols[i]);
+    compileBufferAppend(out, ", ");
+  }
+  compileExpression(state, scope, e1, out);
+  compileBufferAppend(out, ")");
+  compileScopeFree(letScope);
+}
+
+void compileForm(CompileState state, CompileScope scope, Sexp e,
+                 CompileBuffer out)
+{
+  Sexp s1 = SEXP_CAR(e);
+  Sexp s2 = SEXP_CDR(e);
+  int count = compileListLength(s2);
+
+  if(SEXP_TYPE_OF(s1) == SEXP_TYPE_OPERATOR && count == 2) {
+    compileBufferAppend(out, "applyOperator(");
+    compileExpression(state, scope, compileListItem(s2, 0), out);
+    compileBufferAppend(out, ", ");
+    compileExpression(state, scope, compileListItem(s2, 1), out);
+    compileBufferAppend(out, ", (Operator)%i)", (int)s1->value.operator);
+    return;
+  }
+  if(SEXP_TYPE_OF(s1) != SEXP_TYPE_SYMBOL || count < 0) {
+    compileFallback(state, scope, e, out);
+    return;
+  }
+
+  switch(keywordMatch(s1->value.symbol))
+  {
+  case KEYWORD_QUOTE:
+    if(count == 1) {
+      int index = compileConstant(state, compileListItem(s2, 0));
+      compileBufferAppend(out, "sexpCopy(compiledConstants[%i])", index);
+      return;
+    }
+    break;
+
+  case KEYWORD_IF:
+    if(count == 3) {
+      compileBufferAppend(out, "(compiledCondition(");
+      compileExpression(state, scope, compileListItem(s2, 0), out);
+      compileBufferAppend(out, ") ? ");
+      compileOwnedExpression(state, scope, compileListItem(s2, 1), out);
+      compileBufferAppend(out, " : ");
+      compileOwnedExpression(state, scope, compileListItem(s2, 2), out);
+      compileBufferAppend(out, ")");
+      return;
+    }
+    break;
+
+  case KEYWORD_CONS:
+    if(count == 2) {
+      compileBufferAppend(out, "sexpCreateCons(");
+      compileExpression(state, scope, compileListItem(s2, 0), out);
+      compileBufferAppend(out, ", ");
+      compileExpression(state, scope, compileListItem(s2, 1), out);
+      compileBufferAppend(out, ")");
+      return;
+    }
+    break;
+
+  case KEYWORD_EQUALS:
+    if(count == 2) {
+      compileBufferAppend(out, "compiledEquals(");
+      compileExpression(state, scope, compileListItem(s2, 0), out);
+      compileBufferAppend(out, ", ");
+      compileExpression(state, scope, compileListItem(s2, 1), out);
+      compileBufferAppend(out, ")");
+      return;
+    }
+    break;
+
+  case KEYWORD_NOT:
+    if(count == 1) {
+      compileBufferAppend(out, "compiledNot(");
+      compileExpression(state, scope, compileListItem(s2, 0), out);
+      compileBufferAppend(out, ")");
+      return;
+    }
+    break;
+
+  case KEYWORD_LET:
+    if(count == 4 &&
+       SEXP_TYPE_OF(compileListItem(s2, 0)) == SEXP_TYPE_SYMBOL &&
+       (int)keywordMatch(compileListItem(s2, 0)->value.symbol) == -1 &&
+       SEXP_TYPE_OF(compileListItem(s2, 2)) == SEXP_TYPE_SYMBOL &&
+       keywordMatch(compileListItem(s2, 2)->value.symbol) == KEYWORD_IN)
+    {
+      compileLet(state, scope, compileListItem(s2, 0)->value.symbol,
+                 compileListItem(s2, 1), compileListItem(s2, 3), out);
+      return;
+    }
+    break;
+
+  default:
+    if((int)keywordMatch(s1->value.symbol) != -1) {
+      break;
+    }
+    // function application
+    if(compileScopeContains(scope, s1->value.symbol)) {
+      compileBufferAppend(out, "compiledApply(v_");
+      compileBufferAppendName(out, s1->value.symbol);
+      compileBufferAppend(out, ", ");
+    }
+    else {
+      compileBufferAppend(out, "compiledCallGlobal(&compiledSites[%i], ",
+                          state->siteCount++);
+      compileBufferAppendStringLiteral(out, s1->value.symbol);
+      compileBufferAppend(out, ", ");
+    }
+    compileArguments(state, scope, s2, out);
+    compileBufferAppend(out, ")");
+    return;
+  }
+
+  compileFallback(state, scope, e, out);
+}
+
+void compileExpression(CompileState state, CompileScope scope, Sexp e,
+                       CompileBuffer out)
+{
+  switch(SEXP_TYPE_OF(e))
+  {
+  case SEXP_TYPE_NIL:
+    compileBufferAppend(out, "sexpCreateNil()");
+    return;
+
+  case SEXP_TYPE_BOOLEAN:
+  case SEXP_TYPE_INTEGER:
+  case SEXP_TYPE_DOUBLE:
+    compileConstructor(out, e);
+    return;
+
+  case SEXP_TYPE_STRING:
+    compileBufferAppend(out, "sexpCopy(compiledConstants[%i])",
+                        compileConstant(state, e));
+    return;
+
+  case SEXP_TYPE_SYMBOL:
+    if((int)keywordMatch(e->value.symbol) != -1) {
+      compileFallback(state, scope, e, out);
+    }
+    else if(compileScopeContains(scope, e->value.symbol)) {
+      compileBufferAppend(out, "v_");
+      compileBufferAppendName(out, e->value.symbol);
+    }
+    else {
+      compileBufferAppend(out, "compiledLookupGlobal(");
+      compileBufferAppendStringLiteral(out, e->value.symbol);
+      compileBufferAppend(out, ")");
+    }
+    return;
+
+  case SEXP_TYPE_CONS:
+    compileForm(state, scope, e, out);
+    return;
+
+  default:
+    compileFallback(state, scope, e, out);
+    return;
+  }
+}
+
+
+
+// the value of a variable is borrowed, every other expression yields a new one
+void compileOwnedExpression(CompileState state, CompileScope scope, Sexp e,
+                            CompileBuffer out)
+{
+  if(SEXP_TYPE_OF(e) == SEXP_TYPE_SYMBOL &&
+     (int)keywordMatch(e->value.symbol) == -1) {
+    compileBufferAppend(out, "sexpCopy(");
+    compileExpression(state, scope, e, out);
+    compileBufferAppend(out, ")");
+    return;
+  }
+  compileExpression(state, scope, e, out);
+}
+
+
+
+/* translate a pattern into a condition on the argument list */
+void compilePattern(CompileState state, CompileScope scope, Sexp pattern,
+                    const char* path, CompileBuffer condition,
+                    CompileBuffer bindings)
+{
+  switch(SEXP_TYPE_OF(pattern))
+  {
+  case SEXP_TYPE_NIL:
+    compileBufferAppend(condition, " && compiledIsNil(%s)", path);
+    return;
+
+  case SEXP_TYPE_SYMBOL:
+    if((int)keywordMatch(pattern->value.symbol) != -1) {
+      compileError(state, "keyword can not be used in pattern", pattern);
+      return;
+    }
+    if(compileScopeContains(scope, pattern->value.symbol)) {
+      compileError(state, "repeated variable in pattern", pattern);
+      return;
+    }
+    compileScopeAdd(scope, pattern->value.symbol);
+    compileBufferAppend(bindings, "    Sexp v_");
+    compileBufferAppendName(bindings, pattern->value.symbol);
+    compileBufferAppend(bindings, " = %s;\n", path);
+    return;
+
+  case SEXP_TYPE_CONS: {
+    size_t len = strlen(path) + 16;
+    char car[len];
+    char cdr[len];
+    snprintf(car, len, "compiledCar(%s)", path);
+    snprintf(cdr, len, "compiledCdr(%s)", path);
+    compileBufferAppend(condition, " && compiledIsCons(%s)", path);
+    compilePattern(state, scope, SEXP_CAR(pattern), car,
+                   condition, bindings);
+    compilePattern(state, scope, SEXP_CDR(pattern), cdr,
+                   condition, bindings);
+    return;
+  }
+
+  default:
+    // only nil, symbols and lists can ever match
+    compileBufferAppend(condition, " && 0");
+    return;
+  }
+}
+
+void compileFunction(CompileState state, const char* name, Sexp rules)
+{
+  CompileBuffer function = compileBufferCreate();
+  compileBufferAppend(function, "Sexp compiled_");
+  compileBufferAppendName(function, name);
+  compileBufferAppend(function, "(Sexp arguments)\n{\n");
+
+  int rule = 0;
+  while(SEXP_TYPE_OF(rules) == SEXP_TYPE_CONS)
+  {
+    if(SEXP_TYPE_OF(SEXP_CDR(rules)) != SEXP_TYPE_CONS) {
+      compileError(state, "malformed rules", rules);
+      break;
+    }
+    Sexp pattern = SEXP_CAR(rules);
+    Sexp body = SEXP_CAR(SEXP_CDR(rules));
+
+    CompileScope scope = compileScopeCreate();
+    CompileBuffer condition = compileBufferCreate();
+    CompileBuffer bindings = compileBufferCreate();
+    CompileBuffer expression = compileBufferCreate();
+    compilePattern(state, scope, pattern, "arguments", condition, bindings);
+    compileOwnedExpression(state, scope, body, expression);
+
+    compileBufferAppend(function, "  /* rule %i */\n", rule++);
+    // skip the leading " && " of the first test
+    compileBufferAppend(function, "  if(%s) {\n%s    return %s;\n  }\n",
+                        (condition->size) ? &condition->data[4] : "1",
+                        bindings->data, expression->data);
+
+    compileBufferFree(condition);
+    compileBufferFree(bindings);
+    compileBufferFree(expression);
+    compileScopeFree(scope);
+    rules = SEXP_CDR(SEXP_CDR(rules));
+  }
+
+  compileBufferAppend(function, "  return compiledNoMatch(arguments);\n}\n\n");
+  compileBufferAppend(state->functions, "%s", function->data);
+  compileBufferFree(function);
+}
+
+
+
+/* compile a top-level form of a library file */
+int compileIsLambdaDefinition(Sexp sexp)
+{
+  // Cons (Symbol "define", Cons (Symbol f, Cons (Cons (Symbol "lambda", rules), Nil)))
+  if(compileListLength(sexp) != 3) return 0;
+  Sexp s1 = compileListItem(sexp, 0);
+  Sexp s2 = compileListItem(sexp, 1);
+  Sexp s3 = compileListItem(sexp, 2);
+  return SEXP_TYPE_OF(s1) == SEXP_TYPE_SYMBOL &&
+         keywordMatch(s1->value.symbol) == KEYWORD_DEFINE &&
+         SEXP_TYPE_OF(s2) == SEXP_TYPE_SYMBOL &&
+         (int)keywordMatch(s2->value.symbol) == -1 &&
+         SEXP_TYPE_OF(s3) == SEXP_TYPE_CONS &&
+         SEXP_TYPE_OF(SEXP_CAR(s3)) == SEXP_TYPE_SYMBOL &&
+         keywordMatch(SEXP_CAR(s3)->value.symbol) == KEYWORD_LAMBDA;
+}
+
+void compileDeclareFunction(CompileState state, Sexp sexp)
+{
+  const char* name = compileListItem(sexp, 1)->value.symbol;
+  if(compileIsFunction(state, name)) {
+    return;
+  }
+  state->functionNames = realloc(state->functionNames,
+                                 (state->functionCount + 1) * sizeof(char*));
+  state->functionNames[state->functionCount++] = (char*)name;
+
+  compileBufferAppend(state->declarations, "Sexp compiled_");
+  compileBufferAppendName(state->declarations, name);
+  compileBufferAppend(state->declarations, "(Sexp arguments);\n");
+}
+
+void compileToplevel(CompileState state, Sexp sexp)
+{
+  if(compileIsLambdaDefinition(sexp)) {
+    const char* name = compileListItem(sexp, 1)->value.symbol;
+    Sexp lambda = simplifySexp(compileListItem(sexp, 2));
+    compileFunction(state, name, SEXP_CDR(lambda));
+    sexpFree(lambda);
+    compileBufferAppend(state->registrations, "  compiledRegister(");
+    compileBufferAppendStringLiteral(state->registrations, name);
+    compileBufferAppend(state->registrations, ", compiled_");
+    compileBufferAppendName(state->registrations, name);
+    compileBufferAppend(state->registrations, ");\n");
+  }
+  else {
+    int index = compileConstant(state, sexp);
+    compileBufferAppend(state->registrations,
+                        "  compiledInterpret(compiledConstants[%i], "
+                        "compiledEnvironment(0));\n", index);
+  }
+}
+
+/* translate a library file and print the C translation unit on stdout */
+int compileLibrary(const char* filename)
+{
+  if(setjmp(jumpbuffer)) {
+    fprintf(stderr, "! could not compile %s\n", filename);
+    return 0;
+  }
+
+  // library lines are stored in reverse order
+  FileContents lib = librarySmartLoad(filename);
+  int count = 0;
+  for(FileContentsLine line = lib->head; line; line = line->next) {
+    count++;
+  }
+  Sexp toplevel[count > 0 ? count : 1];
+  int index = count;
+  for(FileContentsLine line = lib->head; line; line = line->next) {
+    LexTokenList tokenlist = transformBufferToTokenList(line->line);
+    Sexp sexp = (tokenlist) ? transformTokenListToSexp(tokenlist) : NULL;
+    if(!sexp) {
+      fprintf(stderr, "! error while reading %s\n", filename);
+      return 0;
+    }
+    lexTokenListFree(tokenlist);
+    toplevel[--index] = sexp;
+  }
+
+  // declare all functions first
+  CompileState state = compileStateCreate();
+  for(int i = 0; i < count; i++) {
+    if(compileIsLambdaDefinition(toplevel[i])) {
+      compileDeclareFunction(state, toplevel[i]);
+    }
+  }
+  for(int i = 0; i < count; i++) {
+    compileToplevel(state, toplevel[i]);
+  }
+  if(state->errors) {
+    fprintf(stderr, "! could not compile %s\n", filename);
+    compileStateFree(state);
+    return 0;
+  }
+
+  printf("/* Generated by `clisp --emit-c %s`. Do not edit. */\n", filename);
+  printf("#include \"compile.h\"\n\n");
+  printf("Sexp compiledConstants[%i];\n", (state->constantCount > 0) ?
+         state->constantCount : 1);
+  printf("struct _compiled_site_t compiledSites[%i];\n\n", (state->siteCount > 0) ?
+         state->siteCount : 1);
+  printf("%s\n", state->declarations->data);
+  printf("%s", state->functions->data);
+  printf("void compiledLibraryRegister()\n{\n%s%s}\n",
+         state->constants->data, state->registrations->data);
+
+  compileStateFree(state);
+  for(int i = 0; i < count; i++) {
+    sexpFree(toplevel[i]);
+  }
+  return 1;
+}
+
+
+
+#endif // PLD_LISP_COMPILE_H
@@ -10,22 +10,45 @@
 #include "io.h"
 #include "syntree.h"
 #include "string.h"
+#include "vector.h"
+#include "matrix.h"
+#include "array.h"
 #include "operator_application.h"
+#include "builtin.h"
+#include "function.h"
+#include "memo.h"
+#include "simplify.h"
+#include "callcache.h"
+#include "inline.h"
+#include "hashcons.h"
+#include "immortal.h"
 
 /* global symbol table */
 extern Symtable globalEnvironment;
 
+/* the function whose body is being evaluated, slots refer to its captures */
+SexpFunction evalClosure = NULL;
+
+/* calls with up to this many arguments keep their frame on the C stack */
+#define EVAL_FRAME_SIZE 8
+
+/* try the clauses of functions with exclusive patterns by their hit counts */
+int evalAdaptiveClauses = 1;
+#define EVAL_REORDER_INTERVAL 64
+
 
 
 /* function definitions for mutual recursion */
 Sexp evalTryRules(Sexp rules, Sexp arguments, Symtable environment);
+Sexp evalTryClauses(SexpFunction function, Sexp arguments, Symtable environment);
+Sexp evalCallFunction(Sexp function, Sexp arguments, Symtable environment);
 Sexp evalList(Sexp program, Symtable environment);
 Sexp evalSexpConsNoMatch(Sexp program, Symtable environment);
+Sexp evalApply(Sexp function, Sexp arguments, Symtable environment);
 Sexp evalSexp(Sexp program, Symtable environment);
 Symtable evalMatchPattern(Sexp pattern, Sexp arguments);
 void evalQuoteSexp(Sexp sexp);
-Sexp evalSexpEquals(Sexp e1, Symtable env1, Sexp e2, Symtable env2);
-Sexp evalListEquals(Sexp e1, Symtable env1, Sexp e2, Symtable env2);
+int evalEquals(Sexp e1, Sexp e2);
 
 
 
@@ -42,7 +65,7 @@ Sexp evalList(Sexp program, Symtable environment)
   }
 
   Sexp ret = NULL;
-  switch(program->type)
+  switch(SEXP_TYPE_OF(program))
   {
   case SEXP_TYPE_NIL:
     return sexpCreateNil();
@@ -75,11 +98,24 @@ Sexp evalList(Sexp program, Symtable environment)
     printf("Control should not reach this point!\n");
     return NULL;
 
-  case SEXP_TYPE_CONS:
-    ret = NULL;
-    Sexp s1 = program->value.cons[0];
-    Sexp s2 = program->value.cons[1];
-    return sexpCreateCons(evalSexp(s1, environment), evalList(s2, environment));
+  case SEXP_TYPE_CONS: {
+    // the values are collected in a frame, so the list is built at once
+    Sexp local[EVAL_FRAME_SIZE];
+    int count = 0;
+    Sexp element = program;
+    for(; SEXP_TYPE_OF(element) == SEXP_TYPE_CONS; element = SEXP_CDR(element)) {
+      count++;
+    }
+    Sexp* frame = (count <= EVAL_FRAME_SIZE) ? local : malloc(sizeof(Sexp) * count);
+    element = program;
+    for(int i = 0; i < count; i++) {
+      frame[i] = evalSexp(SEXP_CAR(element), environment);
+      element = SEXP_CDR(element);
+    }
+    ret = sexpCreateListOf(frame, count, evalList(element, environment));
+    if(frame != local) free(frame);
+    return ret;
+  }
 
   default:
     printf("eval list: Invalid S-expression type\n");
@@ -103,7 +139,7 @@ Sexp evalTryRules(Sexp rules, Sexp arguments, Symtable environment)
   }
 
   Sexp ret = NULL;
-  switch(rules->type)
+  switch(SEXP_TYPE_OF(rules))
   {
   case SEXP_TYPE_NIL:
     printf("! no patterns matched arguments ");
@@ -115,11 +151,11 @@ Sexp evalTryRules(Sexp rules, Sexp arguments, Symtable environment)
 
   case SEXP_TYPE_CONS:
     ret = NULL;
-    Sexp s1 = rules->value.cons[0]; // p
-    Sexp s2 = rules->value.cons[1]; // Cons(e, rs1)
-    if(s2->type == SEXP_TYPE_CONS) {
-      Sexp s3 = s2->value.cons[0];  // e
-      Sexp s4 = s2->value.cons[1];  // rs1
+    Sexp s1 = SEXP_CAR(rules); // p
+    Sexp s2 = SEXP_CDR(rules); // Cons(e, rs1)
+    if(SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS) {
+      Sexp s3 = SEXP_CAR(s2);  // e
+      Sexp s4 = SEXP_CDR(s2);  // rs1
       Symtable newEnvironment = evalMatchPattern(s1, arguments);
       if(newEnvironment) {
         return evalSexp(s3, symtableCombine(newEnvironment, environment));
@@ -135,6 +171,8 @@ Sexp evalTryRules(Sexp rules, Sexp arguments, Symtable environment)
   case SEXP_TYPE_DOUBLE:
   case SEXP_TYPE_OPERATOR:
   case SEXP_TYPE_STRING:
+  case SEXP_TYPE_BUILTIN:
+  case SEXP_TYPE_FUNCTION:
   default:
     printf("! malformed rules ");
     sexpPrint(rules);
@@ -146,6 +184,205 @@ Sexp evalTryRules(Sexp rules, Sexp arguments, Symtable environment)
   return ret;
 }
 
+// can the pattern match the value? checked before allocating any bindings
+int evalPatternShapeMatches(Sexp pattern, Sexp value)
+{
+  while(SEXP_TYPE_OF(pattern) == SEXP_TYPE_CONS) {
+    if(SEXP_TYPE_OF(value) != SEXP_TYPE_CONS ||
+       !evalPatternShapeMatches(SEXP_CAR(pattern), SEXP_CAR(value))) {
+      return 0;
+    }
+    pattern = SEXP_CDR(pattern);
+    value = SEXP_CDR(value);
+  }
+  return SEXP_TYPE_OF(pattern) == SEXP_TYPE_SYMBOL ||
+         (SEXP_TYPE_OF(pattern) == SEXP_TYPE_NIL && SEXP_TYPE_OF(value) == SEXP_TYPE_NIL);
+}
+
+/*
+ * Match a clause against the arguments of a frame in place.
+ * Only a pattern with a rest variable, e.g. (x . xs), needs the remaining
+ * arguments as a list, which is then built from the frame.
+ */
+Symtable evalMatchFrame(SexpClause clause, Sexp* frame, int count)
+{
+  Symtable symtable = symtableCreate();
+  Sexp pattern = clause->pattern;
+  for(int i = 0; i <= clause->arity; i++) {
+    Symtable element = NULL;
+    if(i < clause->arity) {
+      if(!evalPatternShapeMatches(SEXP_CAR(pattern), frame[i])) {
+        symtableFree(symtable);
+        return NULL;
+      }
+      element = evalMatchPattern(SEXP_CAR(pattern), frame[i]);
+      pattern = SEXP_CDR(pattern);
+    }
+    else if(clause->rest) {
+      Sexp local[EVAL_FRAME_SIZE];
+      int length = count - clause->arity;
+      Sexp* copies = (length <= EVAL_FRAME_SIZE) ? local : malloc(sizeof(Sexp) * length);
+      for(int j = 0; j < length; j++) {
+        copies[j] = sexpCopy(frame[clause->arity + j]);
+      }
+      Sexp rest = sexpCreateListOf(copies, length, sexpCreateNil());
+      if(copies != local) free(copies);
+      element = evalMatchPattern(pattern, rest);
+      sexpFree(rest);
+    }
+    else if(SEXP_TYPE_OF(pattern) == SEXP_TYPE_NIL) {
+      break;
+    }
+
+    if(!element || !symtableDisjoint(symtable, element)) {
+      if(element) symtableFree(element);
+      symtableFree(symtable);
+      return NULL;
+    }
+    Symtable combined = symtableCombine(symtable, element);
+    symtableFree(symtable);
+    symtableFree(element);
+    symtable = combined;
+  }
+  return symtable;
+}
+
+/*
+ * Try the clauses of a function object on a frame of evaluated arguments.
+ * Clauses whose arity does not fit the number of arguments are skipped, and
+ * flat patterns are bound without walking the pattern. Clauses are tried in
+ * source order, unless the patterns are exclusive and the adaptive mode
+ * orders them by their hit counts.
+ */
+Sexp evalTryFrameClauses(SexpFunction function, Sexp* frame, int count,
+                         Symtable environment)
+{
+  // every call is counted for #profile-clauses, only reordering is adaptive
+  function->calls++;
+  if(function->adaptive && evalAdaptiveClauses &&
+     function->calls % EVAL_REORDER_INTERVAL == 0) {
+    functionReorderClauses(function);
+  }
+
+  for(int i = 0; i < function->clauseCount; i++) {
+    SexpClause clause = (evalAdaptiveClauses) ?
+      &function->clauses[function->order[i]] : &function->clauses[i];
+    if(count < clause->arity || (count > clause->arity && !clause->rest)) {
+      continue;
+    }
+
+    Symtable newEnvironment = NULL;
+    if(clause->flat) {
+      newEnvironment = symtableCreate();
+      Sexp variable = clause->pattern;
+      for(int j = 0; j < clause->arity; j++) {
+        symtableUpdate(newEnvironment, SEXP_CAR(variable)->value.symbol,
+                       frame[j]);
+        variable = SEXP_CDR(variable);
+      }
+    }
+    else {
+      newEnvironment = evalMatchFrame(clause, frame, count);
+    }
+
+    if(newEnvironment) {
+      clause->hits++;
+      Symtable combined = symtableCombine(newEnvironment, environment);
+      symtableFree(newEnvironment);
+      SexpFunction previous = evalClosure;
+      evalClosure = function;
+      Sexp ret = evalSexp(clause->body, combined);
+      evalClosure = previous;
+      return ret;
+    }
+  }
+
+  printf("! no patterns matched arguments (");
+  for(int i = 0; i < count; i++) {
+    if(i) printf(" ");
+    sexpPrint(frame[i]);
+  }
+  printf(")\n");
+  throwException();
+  printf("Control should not reach this point!\n");
+  return NULL;
+}
+
+// memoized functions only evaluate their clauses for unseen arguments
+Sexp evalTryFrame(SexpFunction function, Sexp* frame, int count,
+                  Symtable environment)
+{
+  if(!function->memo) {
+    return evalTryFrameClauses(function, frame, count, environment);
+  }
+  unsigned long hash = memoHash(frame, count);
+  Sexp result = memoLookup(function->memo, hash, frame, count);
+  if(result) {
+    return sexpCopy(result);
+  }
+  result = evalTryFrameClauses(function, frame, count, environment);
+  memoStore(function->memo, hash, frame, count, result);
+  return result;
+}
+
+// apply a function object to an already evaluated list of arguments
+Sexp evalTryClauses(SexpFunction function, Sexp arguments, Symtable environment)
+{
+  Sexp local[EVAL_FRAME_SIZE];
+  int count = 0;
+  Sexp argument = arguments;
+  for(; SEXP_TYPE_OF(argument) == SEXP_TYPE_CONS; argument = SEXP_CDR(argument)) {
+    count++;
+  }
+  Sexp* frame = (count <= EVAL_FRAME_SIZE) ? local : malloc(sizeof(Sexp) * count);
+  argument = arguments;
+  for(int i = 0; i < count; i++) {
+    frame[i] = SEXP_CAR(argument);
+    argument = SEXP_CDR(argument);
+  }
+
+  Sexp ret = evalTryFrame(function, frame, count, environment);
+  if(frame != local) free(frame);
+  return ret;
+}
+
+/*
+ * Call a function object with the unevaluated arguments of a call site.
+ * The arguments are evaluated straight into a frame, which is released when
+ * the call returns, instead of being consed into an argument list.
+ */
+Sexp evalCallFunction(Sexp function, Sexp arguments, Symtable environment)
+{
+  Sexp local[EVAL_FRAME_SIZE];
+  int count = 0;
+  Sexp argument = arguments;
+  for(; SEXP_TYPE_OF(argument) == SEXP_TYPE_CONS; argument = SEXP_CDR(argument)) {
+    count++;
+  }
+  if(SEXP_TYPE_OF(argument) != SEXP_TYPE_NIL) {
+    return evalTryClauses(function->value.function,
+                          evalList(arguments, environment), environment);
+  }
+
+  Sexp* frame = (count <= EVAL_FRAME_SIZE) ? local : malloc(sizeof(Sexp) * count);
+  argument = arguments;
+  for(int i = 0; i < count; i++) {
+    frame[i] = evalSexp(SEXP_CAR(argument), environment);
+    argument = SEXP_CDR(argument);
+  }
+
+  // the function stays alive, even if the body redefines its binding
+  Sexp self = sexpCopy(function);
+  Sexp ret = evalTryFrame(self->value.function, frame, count, environment);
+  sexpFree(self);
+
+  for(int i = 0; i < count; i++) {
+    sexpFree(frame[i]);
+  }
+  if(frame != local) free(frame);
+  return ret;
+}
+
 Symtable evalMatchPattern(Sexp pattern, Sexp arguments)
 {
   if(!pattern) {
@@ -157,10 +394,10 @@ Symtable evalMatchPattern(Sexp pattern, Sexp arguments)
     return NULL;
   }
 
-  if(pattern->type == SEXP_TYPE_NIL && arguments->type == SEXP_TYPE_NIL) {
+  if(SEXP_TYPE_OF(pattern) == SEXP_TYPE_NIL && SEXP_TYPE_OF(arguments) == SEXP_TYPE_NIL) {
     return symtableCreate(); // return empty list
   }
-  else if(pattern->type == SEXP_TYPE_SYMBOL) {
+  else if(SEXP_TYPE_OF(pattern) == SEXP_TYPE_SYMBOL) {
     if((int)keywordMatch(pattern->value.symbol) != -1) {
       printf("! keyword %s can not be used in pattern\n", pattern->value.symbol);
       throwException();
@@ -173,12 +410,12 @@ Symtable evalMatchPattern(Sexp pattern, Sexp arguments)
       return newSymtable;
     }
   }
-  else if(pattern->type == SEXP_TYPE_CONS && arguments->type == SEXP_TYPE_CONS) {
+  else if(SEXP_TYPE_OF(pattern) == SEXP_TYPE_CONS && SEXP_TYPE_OF(arguments) == SEXP_TYPE_CONS) {
     // using same naming convention as the F# LISP interpreter
-    Sexp p1 = pattern->value.cons[0];
-    Sexp p2 = pattern->value.cons[1];
-    Sexp v1 = arguments->value.cons[0];
-    Sexp v2 = arguments->value.cons[1];
+    Sexp p1 = SEXP_CAR(pattern);
+    Sexp p2 = SEXP_CDR(pattern);
+    Sexp v1 = SEXP_CAR(arguments);
+    Sexp v2 = SEXP_CDR(arguments);
     Symtable symtable1 = evalMatchPattern(p1, v1);
     Symtable symtable2 = evalMatchPattern(p2, v2);
     if(symtable1 && symtable2 && symtableDisjoint(symtable1, symtable2)) {
@@ -201,7 +438,7 @@ void evalQuoteSexp(Sexp sexp)
     return;
   }
 
-  switch(sexp->type)
+  switch(SEXP_TYPE_OF(sexp))
   {
   case SEXP_TYPE_NIL:
     printf("()");
@@ -212,9 +449,9 @@ void evalQuoteSexp(Sexp sexp)
     return;
 
   case SEXP_TYPE_CONS:
-    if(sexp->value.cons[0]->type == SEXP_TYPE_SYMBOL) {
-      if(!strcmp(sexp->value.cons[0]->value.symbol, "quote") ||
-         !strcmp(sexp->value.cons[0]->value.symbol, "lambda"))
+    if(SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_SYMBOL) {
+      if(!strcmp(SEXP_CAR(sexp)->value.symbol, "quote") ||
+         !strcmp(SEXP_CAR(sexp)->value.symbol, "lambda"))
       {
         sexpPrint(sexp);
         return;
@@ -244,12 +481,65 @@ void evalQuoteSexp(Sexp sexp)
     sexpPrint(sexp);
     return;
 
+  case SEXP_TYPE_BUILTIN:
+  case SEXP_TYPE_FUNCTION:
+  case SEXP_TYPE_VECTOR:
+  case SEXP_TYPE_MATRIX:
+  case SEXP_TYPE_BIGNUM:
+  case SEXP_TYPE_ARRAY:
+    sexpPrint(sexp);
+    return;
+
   default:
     printf("eval quote sexp: Invalid S-expression type\n");
     return;
   }
 }
 
+/*
+ * A function is either the value of a lambda expression or a native builtin.
+ * Quoted (lambda ...) lists can be applied as well, by walking their rules.
+ */
+int evalIsFunction(Sexp sexp)
+{
+  if(SEXP_TYPE_OF(sexp) == SEXP_TYPE_BUILTIN || SEXP_TYPE_OF(sexp) == SEXP_TYPE_FUNCTION) {
+    return 1;
+  }
+  return SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS &&
+         SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_SYMBOL &&
+         keywordMatch(SEXP_CAR(sexp)->value.symbol) == KEYWORD_LAMBDA;
+}
+
+/* apply a function to a list of already evaluated arguments */
+Sexp evalApply(Sexp function, Sexp arguments, Symtable environment)
+{
+  if(!function) {
+    printf("eval apply: function is null\n");
+    return NULL;
+  }
+  if(!arguments) {
+    printf("eval apply: arguments is null\n");
+    return NULL;
+  }
+
+  if(SEXP_TYPE_OF(function) == SEXP_TYPE_BUILTIN) {
+    return function->value.builtin->function(arguments);
+  }
+  if(SEXP_TYPE_OF(function) == SEXP_TYPE_FUNCTION) {
+    return evalTryClauses(function->value.function, arguments, environment);
+  }
+  if(evalIsFunction(function)) {
+    return evalTryRules(SEXP_CDR(function), arguments, environment);
+  }
+
+  printf("! ");
+  sexpPrint(function);
+  printf(" can not be applied as a function\n");
+  throwException();
+  printf("Control should not reach this point!\n");
+  return NULL;
+}
+
 /*
  * Since C does not support structured match cases with conditionals as in F#:
  * | Cons (Symbol "quote", Cons (v, Nil)) -> ,
@@ -266,13 +556,21 @@ Sexp evalSexpConsNoMatch(Sexp cons, Symtable environment)
     printf("eval sexp cons no match: environment is null\n");
     return NULL;
   }
-  if(cons->type != SEXP_TYPE_CONS) {
+  if(SEXP_TYPE_OF(cons) != SEXP_TYPE_CONS) {
     printf("eval sexp cons no match: cons is not of type cons\n");
     return NULL;
   }
 
-  Sexp s1 = cons->value.cons[0];
-  Sexp s2 = cons->value.cons[1];
+  Sexp s1 = SEXP_CAR(cons);
+  Sexp s2 = SEXP_CDR(cons);
+  // captured functions are loaded from their slot
+  if(SEXP_TYPE_OF(s1) == SEXP_TYPE_SLOT) {
+    Sexp newSexp = evalSexp(s1, environment);
+    if(SEXP_TYPE_OF(newSexp) == SEXP_TYPE_FUNCTION) {
+      return evalCallFunction(newSexp, s2, environment);
+    }
+    return evalApply(newSexp, evalList(s2, environment), environment);
+  }
   // check if keyword is being used as a symbol
   if((int)keywordMatch(s1->value.symbol) != -1) {
     printf("! malformed %s in expression\n", s1->value.symbol);
@@ -282,17 +580,41 @@ Sexp evalSexpConsNoMatch(Sexp cons, Symtable environment)
   }
   // try to match for function application
   else {
-    Sexp newSexp = evalSexp(s1, environment);
+    // global functions are resolved through the inline cache of the call site
+    Sexp newSexp = NULL;
+    if(!symtableContainsBinding(environment, s1->value.symbol)) {
+      CallCacheEntry entry = callCacheLookup(cons);
+      if(!entry) {
+        SymtableBinding binding = symtableLookupBinding(globalEnvironment,
+                                                        s1->value.symbol);
+        if(binding) {
+          entry = callCacheStore(cons, binding->value);
+        }
+      }
+      if(entry) {
+        // small functions are evaluated as their body at the call site
+        if(!entry->expanded) {
+          callCacheStoreExpansion(entry,
+            inlineCall(s1->value.symbol, entry->function, cons));
+        }
+        if(entry->expansion) {
+          return evalSexp(entry->expansion, environment);
+        }
+        newSexp = entry->function;
+      }
+    }
+    if(!newSexp) {
+      newSexp = evalSexp(s1, environment);
+    }
     if(!newSexp) {
       printf("newSexp was null\n");
       return NULL;
     }
-    if(newSexp->type == SEXP_TYPE_CONS &&
-       newSexp->value.cons[0]->type == SEXP_TYPE_SYMBOL &&
-       keywordMatch(newSexp->value.cons[0]->value.symbol) == KEYWORD_LAMBDA)
-    {
-      return evalTryRules(newSexp->value.cons[1], evalList(s2, environment),
-                          environment);
+    if(SEXP_TYPE_OF(newSexp) == SEXP_TYPE_FUNCTION) {
+      return evalCallFunction(newSexp, s2, environment);
+    }
+    if(evalIsFunction(newSexp)) {
+      return evalApply(newSexp, evalList(s2, environment), environment);
     }
     else {
       printf("! ");
@@ -305,85 +627,146 @@ Sexp evalSexpConsNoMatch(Sexp cons, Symtable environment)
   }
 }
 
-// TODO: Does this function require symtables for each S-expression?
-Sexp evalListEquals(Sexp e1, Symtable env1, Sexp e2, Symtable env2)
+/*
+ * Structural equality of two evaluated S-expressions, as tested by equals.
+ * Lists are walked iteratively along their tails, and nothing is allocated.
+ * Integers and doubles are equal by value, also as elements of vectors,
+ * functions by their source, and arrays element by element. Two arrays met
+ * again while they are being compared, which hold themselves, are taken to be
+ * equal.
+ */
+int evalEqualsVectors(SexpVector vector1, SexpVector vector2)
 {
-  // head of lists are not of same type -> will always be false
-  if(e1->type != e2->type) {
-    return sexpCreateBoolean(0);
-  }
-  // otherwise e2 must be of same type as e1, and we can omit this check
-  else if(e1->type == SEXP_TYPE_CONS) {
-    Sexp bool = evalSexpEquals(e1->value.cons[0], env1, e2->value.cons[0], env2);
-    if(bool->type != SEXP_TYPE_BOOLEAN) {
-      printf("Parse error: could not evaluate as boolean type!\n");
-      throwException();
-      printf("Control should not reach this point!\n");
-      return NULL;
-    }
-    if(!bool->value.boolean) {
-      return sexpCreateBoolean(0);
-    }
-    return evalListEquals(e1->value.cons[1], env1, e2->value.cons[1], env2);
+  if(vector1->type == vector2->type) {
+    return sexpVectorEquals(vector1, vector2);
   }
-  else {
-    return evalSexpEquals(e1, env1, e2, env2);
+  if(vector1->length != vector2->length) {
+    return 0;
   }
-
-  return sexpCreateBoolean(0);
+  const long* integers = (vector1->type == SEXP_VECTOR_INTEGER) ?
+    vector1->elements.integers : vector2->elements.integers;
+  const double* doubles = (vector1->type == SEXP_VECTOR_DOUBLE) ?
+    vector1->elements.doubles : vector2->elements.doubles;
+  for(size_t i = 0; i < vector1->length; i++) {
+    if(!(1e-8 > fabs((double)integers[i] - doubles[i]))) {
+      return 0;
+    }
+  }
+  return 1;
 }
 
-Sexp evalSexpEquals(Sexp e1, Symtable env1, Sexp e2, Symtable env2)
-{
-  if(!e1) {
-    printf("eval sexp equals: e1 is null\n");
-    return NULL;
-  }
-  if(!e2) {
-    printf("eval sexp equals: e2 is null\n");
-    return NULL;
-  }
+struct _eval_array_pair_t {
+  SexpArray array1;
+  SexpArray array2;
+  struct _eval_array_pair_t* outer;
+};
 
-  if(e1->type == SEXP_TYPE_NIL && e2->type == SEXP_TYPE_NIL) {
-    return sexpCreateBoolean(1);
-  }
-  if(e1->type == SEXP_TYPE_NIL || e2->type == SEXP_TYPE_NIL) {
-    return sexpCreateBoolean(0);
-  }
-  if(e1->type == SEXP_TYPE_BOOLEAN && e2->type == SEXP_TYPE_BOOLEAN) {
-    return sexpCreateBoolean(e1->value.boolean == e2->value.boolean);
-  }
-  if(e1->type == SEXP_TYPE_SYMBOL && e2->type == SEXP_TYPE_SYMBOL) {
-    return sexpCreateBoolean(!strcmp(e1->value.symbol, e2->value.symbol));
-  }
-  if(e1->type == SEXP_TYPE_STRING && e2->type == SEXP_TYPE_STRING) {
-    return sexpCreateBoolean(!strcmp(e1->value.string, e2->value.string));
-  }
-  if(e1->type == SEXP_TYPE_INTEGER && e2->type == SEXP_TYPE_INTEGER) {
-    return sexpCreateBoolean(e1->value.integer == e2->value.integer);
-  }
-  if(e1->type == SEXP_TYPE_DOUBLE && e2->type == SEXP_TYPE_DOUBLE) {
-    // TODO: Should we match against a minimal arithmetic distance?
-    return sexpCreateBoolean(e1->value.doubleFP == e2->value.doubleFP);
-  }
+struct _eval_array_pair_t* evalArraysCompared = NULL;
 
-  if(e1->type == SEXP_TYPE_INTEGER && e2->type == SEXP_TYPE_DOUBLE) {
-    // TODO: Should we match against a minimal arithmetic distance?
-    return sexpCreateBoolean(1e-8 > fabs((double)e1->value.integer - e2->value.doubleFP));
+int evalEqualsArrays(SexpArray array1, SexpArray array2)
+{
+  if(array1 == array2) {
+    return 1;
   }
-  if(e1->type == SEXP_TYPE_DOUBLE && e2->type == SEXP_TYPE_INTEGER) {
-    // TODO: Should we match against a minimal arithmetic distance?
-    return sexpCreateBoolean(1e-8 > fabs(e1->value.doubleFP - (double)e2->value.integer));
+  if(array1->length != array2->length) {
+    return 0;
   }
-
-  if(e1->type == SEXP_TYPE_CONS && e2->type == SEXP_TYPE_CONS) {
-    return evalListEquals(e1, env1, e2, env2);
+  for(struct _eval_array_pair_t* pair = evalArraysCompared; pair; pair = pair->outer) {
+    if(pair->array1 == array1 && pair->array2 == array2) {
+      return 1;
+    }
   }
-  if(e1->type == SEXP_TYPE_CONS || e2->type == SEXP_TYPE_CONS) {
-    return sexpCreateBoolean(0);
+  struct _eval_array_pair_t pair = { array1, array2, evalArraysCompared };
+  evalArraysCompared = &pair;
+  int equal = 1;
+  for(size_t i = 0; equal && i < array1->length; i++) {
+    equal = evalEquals(array1->elements[i], array2->elements[i]);
   }
+  evalArraysCompared = pair.outer;
+  return equal;
+}
 
-  return sexpCreateBoolean(0);
+int evalEquals(Sexp e1, Sexp e2)
+{
+  while(1) {
+    // equal S-expressions are identical when hash-consing (except for NaN)
+    if(e1 == e2 && SEXP_TYPE_OF(e1) != SEXP_TYPE_DOUBLE) {
+      return 1;
+    }
+#ifdef SEXP_CACHE_HASH
+    if(e1->hash && e2->hash && e1->hash != e2->hash) {
+      return 0;
+    }
+#endif
+    switch(SEXP_TYPE_OF(e1))
+    {
+    case SEXP_TYPE_CONS:
+      if(SEXP_TYPE_OF(e2) != SEXP_TYPE_CONS ||
+         !evalEquals(SEXP_CAR(e1), SEXP_CAR(e2))) {
+        return 0;
+      }
+      e1 = SEXP_CDR(e1);
+      e2 = SEXP_CDR(e2);
+      continue;
+    case SEXP_TYPE_NIL:
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_NIL;
+    case SEXP_TYPE_BOOLEAN:
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_BOOLEAN &&
+        e1->value.boolean == e2->value.boolean;
+    case SEXP_TYPE_SYMBOL:
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_SYMBOL &&
+        !strcmp(e1->value.symbol, e2->value.symbol);
+    case SEXP_TYPE_STRING:
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_STRING &&
+        sexpStringEquals(e1->value.string, e2->value.string);
+    case SEXP_TYPE_INTEGER:
+      if(SEXP_TYPE_OF(e2) == SEXP_TYPE_INTEGER) {
+        return e1->value.integer == e2->value.integer;
+      }
+      // TODO: Should we match against a minimal arithmetic distance?
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_DOUBLE &&
+        1e-8 > fabs((double)e1->value.integer - e2->value.doubleFP);
+    case SEXP_TYPE_DOUBLE:
+      if(SEXP_TYPE_OF(e2) == SEXP_TYPE_DOUBLE) {
+        return e1->value.doubleFP == e2->value.doubleFP;
+      }
+      if(SEXP_TYPE_OF(e2) == SEXP_TYPE_BIGNUM) {
+        return 1e-8 > fabs(e1->value.doubleFP - bignumToDouble(e2->value.bignum));
+      }
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_INTEGER &&
+        1e-8 > fabs(e1->value.doubleFP - (double)e2->value.integer);
+    case SEXP_TYPE_BIGNUM:
+      if(SEXP_TYPE_OF(e2) == SEXP_TYPE_BIGNUM) {
+        return sexpBignumEquals(e1->value.bignum, e2->value.bignum);
+      }
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_DOUBLE &&
+        1e-8 > fabs(bignumToDouble(e1->value.bignum) - e2->value.doubleFP);
+    case SEXP_TYPE_BUILTIN:
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_BUILTIN &&
+        e1->value.builtin == e2->value.builtin;
+    case SEXP_TYPE_VECTOR:
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_VECTOR &&
+        evalEqualsVectors(e1->value.vector, e2->value.vector);
+    case SEXP_TYPE_MATRIX:
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_MATRIX &&
+        sexpMatrixEquals(e1->value.matrix, e2->value.matrix);
+    case SEXP_TYPE_ARRAY:
+      return SEXP_TYPE_OF(e2) == SEXP_TYPE_ARRAY &&
+        evalEqualsArrays(e1->value.array, e2->value.array);
+    case SEXP_TYPE_FUNCTION:
+      if(SEXP_TYPE_OF(e2) != SEXP_TYPE_FUNCTION) {
+        return 0;
+      }
+      if(e1->value.function == e2->value.function) {
+        return 1;
+      }
+      e1 = e1->value.function->source;
+      e2 = e2->value.function->source;
+      continue;
+    default:
+      return 0;
+    }
+  }
 }
 
 
@@ -400,7 +783,7 @@ Sexp evalSexp(Sexp program, Symtable environment)
     return NULL;
   }
 
-  switch(program->type)
+  switch(SEXP_TYPE_OF(program))
   {
   case SEXP_TYPE_NIL:
     return sexpCreateNil();
@@ -444,48 +827,79 @@ Sexp evalSexp(Sexp program, Symtable environment)
     return NULL;
 
   case SEXP_TYPE_STRING:
-    return sexpCreateString(program->value.string);
+    return sexpCreateStringOf(sexpStringRetain(program->value.string));
+
+  case SEXP_TYPE_BUILTIN:
+    return sexpCreateBuiltin(program->value.builtin);
+
+  case SEXP_TYPE_FUNCTION:
+    return sexpCreateFunction(program->value.function);
+
+  case SEXP_TYPE_SLOT:
+    return sexpCopy(evalClosure->captures[program->value.slot]);
+
+  case SEXP_TYPE_VECTOR:
+    return sexpCreateVectorOf(sexpVectorRetain(program->value.vector));
+
+  case SEXP_TYPE_MATRIX:
+    return sexpCreateMatrixOf(sexpMatrixRetain(program->value.matrix));
+
+  case SEXP_TYPE_BIGNUM:
+    return sexpCreateBignumOf(sexpBignumRetain(program->value.bignum));
+
+  case SEXP_TYPE_ARRAY:
+    return sexpCreateArrayOf(sexpArrayRetain(program->value.array));
 
   case SEXP_TYPE_CONS:
     ret = NULL;
-    Sexp s1 = program->value.cons[0];
-    Sexp s2 = program->value.cons[1];
+    Sexp s1 = SEXP_CAR(program);
+    Sexp s2 = SEXP_CDR(program);
 
-    if(s1->type == SEXP_TYPE_SYMBOL) {
+    if(SEXP_TYPE_OF(s1) == SEXP_TYPE_SYMBOL) {
       switch(keywordMatch(s1->value.symbol))
       {
       case KEYWORD_QUOTE:
-        if(s2->type == SEXP_TYPE_CONS) {
-          Sexp s3 = s2->value.cons[0];
-          Sexp s4 = s2->value.cons[1];
-          if(s4->type == SEXP_TYPE_NIL) {
-            return s3;
+        if(SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS) {
+          Sexp s3 = SEXP_CAR(s2);
+          Sexp s4 = SEXP_CDR(s2);
+          // copied, since function definitions are shared by their callers
+          if(SEXP_TYPE_OF(s4) == SEXP_TYPE_NIL) {
+            return sexpCopy(s3);
           }
         }
         return evalSexpConsNoMatch(program, environment);
 
       case KEYWORD_LAMBDA:
-        return program;
+        return functionCreate(program, environment, evalClosure);
 
       // Cons (Symbol "define", Cons (Symbol x, Cons (e, Nil)))
       // program   s1            s2    s3        s4   s5  s6
       case KEYWORD_DEFINE:
-        if(s2->type == SEXP_TYPE_CONS) {
-          Sexp s3 = s2->value.cons[0];
-          Sexp s4 = s2->value.cons[1];
-          if(s3->type == SEXP_TYPE_SYMBOL && s4->type == SEXP_TYPE_CONS) {
-            Sexp s5 = s4->value.cons[0];
-            Sexp s6 = s4->value.cons[1];
-            if(s6->type == SEXP_TYPE_NIL) {
+        if(SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS) {
+          Sexp s3 = SEXP_CAR(s2);
+          Sexp s4 = SEXP_CDR(s2);
+          if(SEXP_TYPE_OF(s3) == SEXP_TYPE_SYMBOL && SEXP_TYPE_OF(s4) == SEXP_TYPE_CONS) {
+            Sexp s5 = SEXP_CAR(s4);
+            Sexp s6 = SEXP_CDR(s4);
+            if(SEXP_TYPE_OF(s6) == SEXP_TYPE_NIL) {
               if((int)keywordMatch(s3->value.symbol) != -1) {
                 printf("! keyword %s can not be redefined\n", s3->value.symbol);
                 throwException();
                 printf("Control should not reach this point!\n");
                 return NULL;
               } else {
-                Sexp newValue = evalSexp(s5, environment);
+                // lambda bodies are simplified once, when they are defined
+                Sexp simplified = (simplifyFormKeyword(s5) == KEYWORD_LAMBDA) ?
+                  simplifySexp(s5) : NULL;
+                Sexp newValue = evalSexp((simplified) ? simplified : s5,
+                                         environment);
+                if(immortalLoading) {
+                  newValue = immortalFreeze(newValue);
+                }
                 symtableUpdate(globalEnvironment, s3->value.symbol, newValue);
-                //sexpFree(newValue);
+                callCacheInvalidate();
+                sexpFree(newValue);
+                if(simplified) sexpFree(simplified);
                 return sexpCreateNil();
               }
             }
@@ -496,13 +910,13 @@ Sexp evalSexp(Sexp program, Symtable environment)
       // Cons(Symbol "cons", Cons(e1, Cons(e2, Nil)))
       // program   s1         s2  s3   s4  s5   s6
       case KEYWORD_CONS:
-        if(s2->type == SEXP_TYPE_CONS) {
-          Sexp s3 = s2->value.cons[0];
-          Sexp s4 = s2->value.cons[1];
-          if(s4->type == SEXP_TYPE_CONS) {
-            Sexp s5 = s4->value.cons[0];
-            Sexp s6 = s4->value.cons[1];
-            if(s6->type == SEXP_TYPE_NIL) {
+        if(SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS) {
+          Sexp s3 = SEXP_CAR(s2);
+          Sexp s4 = SEXP_CDR(s2);
+          if(SEXP_TYPE_OF(s4) == SEXP_TYPE_CONS) {
+            Sexp s5 = SEXP_CAR(s4);
+            Sexp s6 = SEXP_CDR(s4);
+            if(SEXP_TYPE_OF(s6) == SEXP_TYPE_NIL) {
               return sexpCreateCons(evalSexp(s3, environment),
                                     evalSexp(s5, environment));
             }
@@ -516,17 +930,18 @@ Sexp evalSexp(Sexp program, Symtable environment)
 
       case KEYWORD_LOAD:
         // | Cons (Symbol "save", Cons (Symbol f, Nil))
-        if(s2->type != SEXP_TYPE_CONS ||
-           s2->value.cons[0]->type != SEXP_TYPE_SYMBOL)
+        if(SEXP_TYPE_OF(s2) != SEXP_TYPE_CONS ||
+           SEXP_TYPE_OF(SEXP_CAR(s2)) != SEXP_TYPE_SYMBOL)
         {
           return evalSexpConsNoMatch(program, environment);
         }
-        const char* symbol = s2->value.cons[0]->value.symbol;
+        const char* symbol = SEXP_CAR(s2)->value.symbol;
         unsigned long len = strlen(symbol) + 4; // add space for ".le\0"
         char* filename = malloc(sizeof(char) * len);
         snprintf(filename, len, "%s.le", symbol);
         FileContents lib = librarySmartLoad(filename);
         FileContentsLine line = lib->head;
+        immortalLoading++;
         while(line)
         {
           LexTokenList tokenlist = transformBufferToTokenList(line->line);
@@ -540,6 +955,9 @@ Sexp evalSexp(Sexp program, Symtable environment)
           }
           line = line->next;
         }
+        if(!--immortalLoading) {
+          immortalSeal();
+        }
         return sexpCreateNil();
 
       case KEYWORD_EQUALS:
@@ -547,13 +965,16 @@ Sexp evalSexp(Sexp program, Symtable environment)
         // | Cons (Symbol "equals", Cons(e1, Cons(e2, Nil))
         //   program    s1           s2
         ret = NULL;
-        if(s2->type == SEXP_TYPE_CONS &&
-           s2->value.cons[1]->type == SEXP_TYPE_CONS &&
-           s2->value.cons[1]->value.cons[1]->type == SEXP_TYPE_NIL)
+        if(SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS &&
+           SEXP_TYPE_OF(SEXP_CDR(s2)) == SEXP_TYPE_CONS &&
+           SEXP_TYPE_OF(SEXP_CDR(SEXP_CDR(s2))) == SEXP_TYPE_NIL)
         {
-          Sexp e1 = evalSexp(s2->value.cons[0], environment);
-          Sexp e2 = evalSexp(s2->value.cons[1]->value.cons[0], environment);
-          return evalSexpEquals(e1, environment, e2, environment);
+          Sexp e1 = evalSexp(SEXP_CAR(s2), environment);
+          Sexp e2 = evalSexp(SEXP_CAR(SEXP_CDR(s2)), environment);
+          ret = sexpCreateBoolean(evalEquals(e1, e2));
+          sexpFree(e1);
+          sexpFree(e2);
+          return ret;
         }
         return evalSexpConsNoMatch(program, environment);
 
@@ -561,15 +982,15 @@ Sexp evalSexp(Sexp program, Symtable environment)
         // would be in F# :
         // | Cons (Symbol "if", Cons(cond, Cons(e1, Cons(e2, Nil))))
         //  program   s1         s2
-        if(s2->type == SEXP_TYPE_CONS &&
-           s2->value.cons[1]->type == SEXP_TYPE_CONS &&
-           s2->value.cons[1]->value.cons[1]->type == SEXP_TYPE_CONS &&
-           s2->value.cons[1]->value.cons[1]->value.cons[1]->type == SEXP_TYPE_NIL)
+        if(SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS &&
+           SEXP_TYPE_OF(SEXP_CDR(s2)) == SEXP_TYPE_CONS &&
+           SEXP_TYPE_OF(SEXP_CDR(SEXP_CDR(s2))) == SEXP_TYPE_CONS &&
+           SEXP_TYPE_OF(SEXP_CDR(SEXP_CDR(SEXP_CDR(s2)))) == SEXP_TYPE_NIL)
         {
-          Sexp cond = evalSexp(s2->value.cons[0], environment);
-          if(cond->type == SEXP_TYPE_BOOLEAN) {
-            Sexp e1 = s2->value.cons[1]->value.cons[0];
-            Sexp e2 = s2->value.cons[1]->value.cons[1]->value.cons[0];
+          Sexp cond = evalSexp(SEXP_CAR(s2), environment);
+          if(SEXP_TYPE_OF(cond) == SEXP_TYPE_BOOLEAN) {
+            Sexp e1 = SEXP_CAR(SEXP_CDR(s2));
+            Sexp e2 = SEXP_CAR(SEXP_CDR(SEXP_CDR(s2)));
             if(cond->value.boolean) {
               return evalSexp(e1, environment);
             }
@@ -589,11 +1010,11 @@ Sexp evalSexp(Sexp program, Symtable environment)
       case KEYWORD_NOT:
         // would be in F# :
         // | Cons(Symbol "not", Cons(e, Nil))
-        if(s2->type == SEXP_TYPE_CONS &&
-           s2->value.cons[1]->type == SEXP_TYPE_NIL)
+        if(SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS &&
+           SEXP_TYPE_OF(SEXP_CDR(s2)) == SEXP_TYPE_NIL)
         {
-          Sexp e = evalSexp(s2->value.cons[0], environment);
-          if(e->type == SEXP_TYPE_BOOLEAN) {
+          Sexp e = evalSexp(SEXP_CAR(s2), environment);
+          if(SEXP_TYPE_OF(e) == SEXP_TYPE_BOOLEAN) {
             return sexpCreateBoolean(!e->value.boolean);
           }
           else {
@@ -608,10 +1029,10 @@ Sexp evalSexp(Sexp program, Symtable environment)
       case KEYWORD_MESSAGE:
         // would be in F# :
         // | Cons(Symbol "message", Cons(String format, args..)
-        if(s2->type == SEXP_TYPE_CONS &&
-           s2->value.cons[0]->type == SEXP_TYPE_STRING) {
-          const char* string = s2->value.cons[0]->value.string;
-          Sexp args = evalList(s2->value.cons[1], environment);
+        if(SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS &&
+           SEXP_TYPE_OF(SEXP_CAR(s2)) == SEXP_TYPE_STRING) {
+          SexpString string = SEXP_CAR(s2)->value.string;
+          Sexp args = evalList(SEXP_CDR(s2), environment);
           stringPrintMessage(string, args);
           return sexpCreateNil();
         }
@@ -627,27 +1048,27 @@ Sexp evalSexp(Sexp program, Symtable environment)
         // | Cons(Symbol "let", Cons(Symbol k, Cons(e1, Cons(Symbol "in", Cons(e2, Nil)))))
         //          s1            s2   k        s3  e1   s4     s5         s6  e2
         // (let k e1 in e2)
-        if(s2->type == SEXP_TYPE_CONS &&
-           s2->value.cons[0]->type == SEXP_TYPE_SYMBOL &&
-           s2->value.cons[1]->type == SEXP_TYPE_CONS)
+        if(SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS &&
+           SEXP_TYPE_OF(SEXP_CAR(s2)) == SEXP_TYPE_SYMBOL &&
+           SEXP_TYPE_OF(SEXP_CDR(s2)) == SEXP_TYPE_CONS)
         {
-          Sexp s3 = s2->value.cons[1];
-          Sexp e1 = s3->value.cons[0];
-          Sexp s4 = s3->value.cons[1];
-          if(s4->type == SEXP_TYPE_CONS &&
-             s4->value.cons[0]->type == SEXP_TYPE_SYMBOL &&
-             keywordMatch(s4->value.cons[0]->value.symbol) == KEYWORD_IN &&
-             s4->value.cons[1]->type == SEXP_TYPE_CONS &&
-             s4->value.cons[1]->value.cons[1]->type == SEXP_TYPE_NIL)
+          Sexp s3 = SEXP_CDR(s2);
+          Sexp e1 = SEXP_CAR(s3);
+          Sexp s4 = SEXP_CDR(s3);
+          if(SEXP_TYPE_OF(s4) == SEXP_TYPE_CONS &&
+             SEXP_TYPE_OF(SEXP_CAR(s4)) == SEXP_TYPE_SYMBOL &&
+             keywordMatch(SEXP_CAR(s4)->value.symbol) == KEYWORD_IN &&
+             SEXP_TYPE_OF(SEXP_CDR(s4)) == SEXP_TYPE_CONS &&
+             SEXP_TYPE_OF(SEXP_CDR(SEXP_CDR(s4))) == SEXP_TYPE_NIL)
           {
-            Sexp s5 = s4->value.cons[0];
-            Sexp s6 = s4->value.cons[1];
-            Sexp e2 = s6->value.cons[0];
-            Sexp k = s2->value.cons[0];
+            Sexp s5 = SEXP_CAR(s4);
+            Sexp s6 = SEXP_CDR(s4);
+            Sexp e2 = SEXP_CAR(s6);
+            Sexp k = SEXP_CAR(s2);
 
             // 1) bind evaluation of e1 to k (new symtable)
             Sexp e1_eval = evalSexp(e1, environment);
-            symtableUpdate(environment, s2->value.cons[0]->value.symbol, e1_eval);
+            symtableUpdate(environment, SEXP_CAR(s2)->value.symbol, e1_eval);
 
             // 2) return evaluation of e2 (with new symtable)
             return evalSexp(e2, environment);
@@ -663,18 +1084,22 @@ Sexp evalSexp(Sexp program, Symtable environment)
         return evalSexpConsNoMatch(program, environment);
       } // switch(keywordMatch(s1->value.symbol))
 
-    } // if(s1->type == SEXP_TYPE_SYMBOL)
+    } // if(SEXP_TYPE_OF(s1) == SEXP_TYPE_SYMBOL)
+
+    if(SEXP_TYPE_OF(s1) == SEXP_TYPE_SLOT) {
+      return evalSexpConsNoMatch(program, environment);
+    }
 
 
     // would be in F# :
     // | Cons(Operator op, Cons(arg1, Cons(arg2, Nil)))
-    if(s1->type == SEXP_TYPE_OPERATOR &&
-       s2->type == SEXP_TYPE_CONS &&
-       s2->value.cons[1]->type == SEXP_TYPE_CONS &&
-       s2->value.cons[1]->value.cons[1]->type == SEXP_TYPE_NIL)
+    if(SEXP_TYPE_OF(s1) == SEXP_TYPE_OPERATOR &&
+       SEXP_TYPE_OF(s2) == SEXP_TYPE_CONS &&
+       SEXP_TYPE_OF(SEXP_CDR(s2)) == SEXP_TYPE_CONS &&
+       SEXP_TYPE_OF(SEXP_CDR(SEXP_CDR(s2))) == SEXP_TYPE_NIL)
     {
-      Sexp arg1 = evalSexp(s2->value.cons[0], environment);
-      Sexp arg2 = evalSexp(s2->value.cons[1]->value.cons[0], environment);
+      Sexp arg1 = evalSexp(SEXP_CAR(s2), environment);
+      Sexp arg2 = evalSexp(SEXP_CAR(SEXP_CDR(s2)), environment);
       return applyOperator(arg1, arg2, s1->value.operator);
     }
     else {
@@ -698,4 +1123,6 @@ Sexp evalSexp(Sexp program, Symtable environment)
 
 
 
+#undef EVAL_FRAME_SIZE
+#undef EVAL_REORDER_INTERVAL
 #endif // PLD_LISP_EVAL_H
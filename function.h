@@ -0,0 +1,495 @@
+#ifndef PLD_LISP_FUNCTION_H
+#define PLD_LISP_FUNCTION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sexp.h"
+#include "symtable.h"
+#include "keyword.h"
+#include "exception.h"
+
+/*
+ * Lambdas evaluated inside a local scope become flat closures: every local
+ * variable referred to by the body is copied into the capture vector of the
+ * function object once, and its references in the body are replaced by slots,
+ * which the evaluator loads by index from the running closure.
+ * Variables that are not bound when the lambda is evaluated, e.g. globals or
+ * the name of a function being defined, are still looked up when called.
+ */
+
+
+
+/* variables bound at a point in the body, kept as a stack of names */
+struct _function_scope_t {
+  const char** names;
+  int count;
+  int capacity;
+};
+
+typedef struct _function_scope_t* FunctionScope;
+
+
+
+/* scope functions */
+void functionScopePush(FunctionScope scope, const char* name)
+{
+  if(scope->count == scope->capacity) {
+    scope->capacity = (scope->capacity) ? scope->capacity * 2 : 16;
+    scope->names = realloc(scope->names, sizeof(const char*) * scope->capacity);
+  }
+  scope->names[scope->count++] = name;
+}
+
+void functionScopePushPattern(FunctionScope scope, Sexp pattern)
+{
+  while(SEXP_TYPE_OF(pattern) == SEXP_TYPE_CONS) {
+    functionScopePushPattern(scope, SEXP_CAR(pattern));
+    pattern = SEXP_CDR(pattern);
+  }
+  if(SEXP_TYPE_OF(pattern) == SEXP_TYPE_SYMBOL) {
+    functionScopePush(scope, pattern->value.symbol);
+  }
+}
+
+int functionScopeBinds(FunctionScope scope, const char* name)
+{
+  for(int i = scope->count - 1; i >= 0; i--) {
+    if(!strcmp(scope->names[i], name)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+
+/* function utility functions */
+
+// is symbol bound by one of the first count list elements of pattern?
+int functionPatternBinds(Sexp pattern, int count, const char* symbol)
+{
+  for(int i = 0; i < count; i++) {
+    if(!strcmp(SEXP_CAR(pattern)->value.symbol, symbol)) {
+      return 1;
+    }
+    pattern = SEXP_CDR(pattern);
+  }
+  return 0;
+}
+
+void functionAnalyseClause(SexpClause clause, Sexp pattern, Sexp body)
+{
+  clause->pattern = pattern;
+  clause->body = body;
+  clause->arity = 0;
+  clause->flat = 1;
+  clause->hits = 0;
+
+  Sexp element = pattern;
+  for(; SEXP_TYPE_OF(element) == SEXP_TYPE_CONS; element = SEXP_CDR(element)) {
+    Sexp variable = SEXP_CAR(element);
+    if(SEXP_TYPE_OF(variable) != SEXP_TYPE_SYMBOL ||
+       (int)keywordMatch(variable->value.symbol) != -1 ||
+       (clause->flat &&
+        functionPatternBinds(pattern, clause->arity, variable->value.symbol))) {
+      clause->flat = 0;
+    }
+    clause->arity++;
+  }
+  clause->rest = SEXP_TYPE_OF(element) == SEXP_TYPE_SYMBOL;
+  if(SEXP_TYPE_OF(element) != SEXP_TYPE_NIL) {
+    clause->flat = 0;
+  }
+}
+
+/*
+ * Can no value match both patterns? A variable matches anything, while nil
+ * and cons cells only match values of their own shape.
+ */
+int functionPatternsExclusive(Sexp pattern1, Sexp pattern2)
+{
+  if(SEXP_TYPE_OF(pattern1) == SEXP_TYPE_SYMBOL || SEXP_TYPE_OF(pattern2) == SEXP_TYPE_SYMBOL) {
+    return 0;
+  }
+  if(SEXP_TYPE_OF(pattern1) == SEXP_TYPE_CONS && SEXP_TYPE_OF(pattern2) == SEXP_TYPE_CONS) {
+    return functionPatternsExclusive(SEXP_CAR(pattern1),
+                                     SEXP_CAR(pattern2)) ||
+           functionPatternsExclusive(SEXP_CDR(pattern1),
+                                     SEXP_CDR(pattern2));
+  }
+  return SEXP_TYPE_OF(pattern1) != SEXP_TYPE_NIL || SEXP_TYPE_OF(pattern2) != SEXP_TYPE_NIL;
+}
+
+// does the pattern bind every variable once, i.e. can it match without error?
+int functionPatternValid(Sexp pattern, FunctionScope scope)
+{
+  if(SEXP_TYPE_OF(pattern) == SEXP_TYPE_SYMBOL) {
+    if((int)keywordMatch(pattern->value.symbol) != -1 ||
+       functionScopeBinds(scope, pattern->value.symbol)) {
+      return 0;
+    }
+    functionScopePush(scope, pattern->value.symbol);
+    return 1;
+  }
+  if(SEXP_TYPE_OF(pattern) == SEXP_TYPE_CONS) {
+    return functionPatternValid(SEXP_CAR(pattern), scope) &&
+           functionPatternValid(SEXP_CDR(pattern), scope);
+  }
+  return 1;
+}
+
+void functionAnalyseClauses(SexpFunction function, Sexp rules)
+{
+  function->order = malloc(sizeof(int) * function->clauseCount);
+  function->adaptive = function->clauseCount > 1;
+  function->calls = 0;
+
+  struct _function_scope_t scope = { NULL, 0, 0 };
+  for(int i = 0; i < function->clauseCount; i++) {
+    SexpClause clause = &function->clauses[i];
+    functionAnalyseClause(clause, SEXP_CAR(rules),
+                          SEXP_CAR(SEXP_CDR(rules)));
+    rules = SEXP_CDR(SEXP_CDR(rules));
+    function->order[i] = i;
+
+    scope.count = 0;
+    if(!functionPatternValid(clause->pattern, &scope)) {
+      function->adaptive = 0;
+    }
+    for(int j = 0; j < i && function->adaptive; j++) {
+      if(!functionPatternsExclusive(function->clauses[j].pattern,
+                                    clause->pattern)) {
+        function->adaptive = 0;
+      }
+    }
+  }
+  free(scope.names);
+}
+
+// try the clauses with the most hits first, keeping ties in source order
+void functionReorderClauses(SexpFunction function)
+{
+  for(int i = 1; i < function->clauseCount; i++) {
+    int index = function->order[i];
+    unsigned long hits = function->clauses[index].hits;
+    int j = i - 1;
+    for(; j >= 0 && function->clauses[function->order[j]].hits < hits; j--) {
+      function->order[j + 1] = function->order[j];
+    }
+    function->order[j + 1] = index;
+  }
+}
+
+
+
+// is sexp a well-formed (let k e1 in e2)?
+int functionIsLet(Sexp sexp)
+{
+  Sexp args = SEXP_CDR(sexp);
+  for(int i = 0; i < 4; i++) {
+    if(SEXP_TYPE_OF(args) != SEXP_TYPE_CONS) {
+      return 0;
+    }
+    args = SEXP_CDR(args);
+  }
+  return SEXP_TYPE_OF(args) == SEXP_TYPE_NIL &&
+         SEXP_TYPE_OF(SEXP_CAR(SEXP_CDR(sexp))) == SEXP_TYPE_SYMBOL;
+}
+
+int functionCaptureIndex(SexpFunction function, const char* name)
+{
+  for(int i = 0; i < function->captureCount; i++) {
+    if(!strcmp(function->captureNames[i], name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void functionCaptureAdd(SexpFunction function, const char* name, Sexp value)
+{
+  int count = function->captureCount;
+  function->captureNames = realloc(function->captureNames,
+                                   sizeof(char*) * (count + 1));
+  function->captures = realloc(function->captures, sizeof(Sexp) * (count + 1));
+  function->captureNames[count] = malloc((strlen(name) + 1) * sizeof(char));
+  strcpy(function->captureNames[count], name);
+  function->captures[count] = sexpCopy(value);
+  function->captureCount++;
+}
+
+
+
+/*
+ * Capture the free variables of sexp that are bound locally, either in
+ * environment or by the enclosing closure. Nested lambdas are searched as
+ * well, since they capture their variables from this function later on.
+ */
+void functionCollect(SexpFunction function, Sexp sexp, FunctionScope scope,
+                     Symtable environment, SexpFunction enclosing)
+{
+  if(SEXP_TYPE_OF(sexp) == SEXP_TYPE_SYMBOL) {
+    const char* name = sexp->value.symbol;
+    if((int)keywordMatch(name) != -1 || functionScopeBinds(scope, name) ||
+       functionCaptureIndex(function, name) >= 0) {
+      return;
+    }
+    int index = (enclosing) ? functionCaptureIndex(enclosing, name) : -1;
+    if(index >= 0) {
+      functionCaptureAdd(function, name, enclosing->captures[index]);
+      return;
+    }
+    SymtableBinding binding = symtableLookupBinding(environment, name);
+    if(binding) {
+      functionCaptureAdd(function, name, binding->value);
+    }
+    return;
+  }
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS) {
+    return;
+  }
+
+  int count = scope->count;
+  Sexp head = SEXP_CAR(sexp);
+  int keyword = (SEXP_TYPE_OF(head) == SEXP_TYPE_SYMBOL) ?
+    (int)keywordMatch(head->value.symbol) : -1;
+  switch(keyword)
+  {
+  case KEYWORD_QUOTE:
+    return;
+
+  case KEYWORD_LAMBDA:
+    for(Sexp rules = SEXP_CDR(sexp);
+        SEXP_TYPE_OF(rules) == SEXP_TYPE_CONS &&
+        SEXP_TYPE_OF(SEXP_CDR(rules)) == SEXP_TYPE_CONS;
+        rules = SEXP_CDR(SEXP_CDR(rules))) {
+      functionScopePushPattern(scope, SEXP_CAR(rules));
+      functionCollect(function, SEXP_CAR(SEXP_CDR(rules)), scope,
+                      environment, enclosing);
+      scope->count = count;
+    }
+    return;
+
+  case KEYWORD_LET:
+    if(functionIsLet(sexp)) {
+      Sexp args = SEXP_CDR(sexp);
+      functionCollect(function, SEXP_CAR(SEXP_CDR(args)), scope,
+                      environment, enclosing);
+      functionScopePush(scope, SEXP_CAR(args)->value.symbol);
+      functionCollect(function,
+                      SEXP_CAR(SEXP_CDR(SEXP_CDR(SEXP_CDR(args)))),
+                      scope, environment, enclosing);
+      scope->count = count;
+      return;
+    }
+    break;
+
+  case KEYWORD_DEFINE:
+    // the defined symbol is global, only its value is searched
+    if(SEXP_TYPE_OF(SEXP_CDR(sexp)) == SEXP_TYPE_CONS) {
+      sexp = SEXP_CDR(SEXP_CDR(sexp));
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  for(; SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS; sexp = SEXP_CDR(sexp)) {
+    functionCollect(function, SEXP_CAR(sexp), scope, environment,
+                    enclosing);
+  }
+}
+
+// copy sexp, replacing free references to captured variables with slots
+Sexp functionRewrite(SexpFunction function, Sexp sexp, FunctionScope scope)
+{
+  if(SEXP_TYPE_OF(sexp) == SEXP_TYPE_SYMBOL) {
+    int index = functionScopeBinds(scope, sexp->value.symbol) ? -1 :
+      functionCaptureIndex(function, sexp->value.symbol);
+    return (index >= 0) ? sexpCreateSlot(index) : sexpCopy(sexp);
+  }
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS) {
+    return sexpCopy(sexp);
+  }
+
+  Sexp head = SEXP_CAR(sexp);
+  int keyword = (SEXP_TYPE_OF(head) == SEXP_TYPE_SYMBOL) ?
+    (int)keywordMatch(head->value.symbol) : -1;
+  switch(keyword)
+  {
+  case KEYWORD_QUOTE:
+  case KEYWORD_LAMBDA: // nested lambdas capture by name when evaluated
+    return sexpCopy(sexp);
+
+  case KEYWORD_LET:
+    if(functionIsLet(sexp)) {
+      Sexp args = SEXP_CDR(sexp);
+      Sexp e1 = functionRewrite(function, SEXP_CAR(SEXP_CDR(args)),
+                                scope);
+      int count = scope->count;
+      functionScopePush(scope, SEXP_CAR(args)->value.symbol);
+      Sexp e2 = functionRewrite(function,
+        SEXP_CAR(SEXP_CDR(SEXP_CDR(SEXP_CDR(args)))), scope);
+      scope->count = count;
+      Sexp ret = sexpCreateCons(head,
+                 sexpCreateCons(SEXP_CAR(args),
+                 sexpCreateCons(e1,
+                 sexpCreateCons(SEXP_CAR(SEXP_CDR(SEXP_CDR(args))),
+                 sexpCreateCons(e2, sexpCreateNil())))));
+      sexpFree(e1);
+      sexpFree(e2);
+      return ret;
+    }
+    break;
+
+  case KEYWORD_DEFINE:
+    if(SEXP_TYPE_OF(SEXP_CDR(sexp)) == SEXP_TYPE_CONS) {
+      Sexp rest = functionRewrite(function, SEXP_CDR(SEXP_CDR(sexp)),
+                                  scope);
+      Sexp ret = sexpCreateCons(head,
+                 sexpCreateCons(SEXP_CAR(SEXP_CDR(sexp)), rest));
+      sexpFree(rest);
+      return ret;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  Sexp car = functionRewrite(function, head, scope);
+  Sexp cdr = functionRewrite(function, SEXP_CDR(sexp), scope);
+  Sexp ret = sexpCreateCons(car, cdr);
+  sexpFree(car);
+  sexpFree(cdr);
+  return ret;
+}
+
+
+
+// rewrite the bodies of the rules p1 e1 p2 e2 ..., patterns are kept as-is
+Sexp functionRewriteRules(SexpFunction function, Sexp rules,
+                          FunctionScope scope)
+{
+  if(SEXP_TYPE_OF(rules) != SEXP_TYPE_CONS) {
+    return sexpCopy(rules);
+  }
+  int count = scope->count;
+  Sexp pattern = SEXP_CAR(rules);
+  functionScopePushPattern(scope, pattern);
+  Sexp body = functionRewrite(function, SEXP_CAR(SEXP_CDR(rules)),
+                              scope);
+  scope->count = count;
+  Sexp rest = functionRewriteRules(function,
+                                   SEXP_CDR(SEXP_CDR(rules)), scope);
+  Sexp ret = sexpCreateCons(pattern, sexpCreateCons(body, rest));
+  sexpFree(body);
+  sexpFree(rest);
+  return ret;
+}
+
+
+
+/*
+ * Create the function object of a lambda expression (lambda p1 e1 ...),
+ * evaluated in the local environment, inside the enclosing closure (or NULL).
+ * The source is copied, and clauses are analysed up front, so that calls can
+ * skip clauses whose arity does not fit and bind flat patterns directly.
+ */
+Sexp functionCreate(Sexp lambda, Symtable environment, SexpFunction enclosing)
+{
+  Sexp rules = SEXP_CDR(lambda);
+  int clauseCount = 0;
+  for(; SEXP_TYPE_OF(rules) == SEXP_TYPE_CONS; rules = SEXP_CDR(rules)) {
+    if(SEXP_TYPE_OF(SEXP_CDR(rules)) != SEXP_TYPE_CONS) {
+      break;
+    }
+    rules = SEXP_CDR(rules);
+    clauseCount++;
+  }
+  if(SEXP_TYPE_OF(rules) != SEXP_TYPE_NIL) {
+    printf("! malformed rules ");
+    sexpPrint(rules);
+    printf("\n");
+    throwException();
+    printf("Control should not reach this point!\n");
+    return NULL;
+  }
+
+  SexpFunction function = malloc(sizeof(struct _sexp_function_t));
+  function->references = 0;
+  function->source = sexpCopy(lambda);
+  function->code = NULL;
+  function->clauseCount = clauseCount;
+  function->clauses = malloc(sizeof(struct _sexp_clause_t) * clauseCount);
+  function->memo = NULL;
+  function->captureCount = 0;
+  function->captureNames = NULL;
+  function->captures = NULL;
+
+  // capture local variables, unless evaluated at top-level
+  if(environment->head || enclosing) {
+    struct _function_scope_t scope = { NULL, 0, 0 };
+    functionCollect(function, lambda, &scope, environment, enclosing);
+    if(function->captureCount) {
+      function->code = functionRewriteRules(function, SEXP_CDR(lambda),
+                                            &scope);
+    }
+    free(scope.names);
+  }
+
+  functionAnalyseClauses(function, (function->code) ?
+                         function->code : SEXP_CDR(function->source));
+  return sexpCreateFunction(function);
+}
+
+
+
+// a new function object with the same rules and captures, but no statistics
+SexpFunction functionClone(SexpFunction function)
+{
+  SexpFunction clone = malloc(sizeof(struct _sexp_function_t));
+  clone->references = 0;
+  clone->source = sexpCopy(function->source);
+  clone->code = (function->code) ? sexpCopy(function->code) : NULL;
+  clone->clauseCount = function->clauseCount;
+  clone->clauses = malloc(sizeof(struct _sexp_clause_t) * clone->clauseCount);
+  clone->memo = NULL;
+  clone->captureCount = 0;
+  clone->captureNames = NULL;
+  clone->captures = NULL;
+  for(int i = 0; i < function->captureCount; i++) {
+    functionCaptureAdd(clone, function->captureNames[i], function->captures[i]);
+  }
+  functionAnalyseClauses(clone, (clone->code) ?
+                         clone->code : SEXP_CDR(clone->source));
+  return clone;
+}
+
+/* show how often each clause of the global functions has matched */
+void functionPrintProfiles(Symtable environment)
+{
+  for(SymtableElement element = environment->head; element;
+      element = element->next) {
+    Sexp value = element->binding->value;
+    if(SEXP_TYPE_OF(value) != SEXP_TYPE_FUNCTION || !value->value.function->calls) {
+      continue;
+    }
+    SexpFunction function = value->value.function;
+    printf("%s: %lu calls%s\n", element->binding->symbol, function->calls,
+           (function->adaptive) ? ", adaptive" : "");
+    for(int i = 0; i < function->clauseCount; i++) {
+      SexpClause clause = &function->clauses[function->order[i]];
+      printf("  %6.2f%% %8lu  ", 100.0 * clause->hits / function->calls,
+             clause->hits);
+      sexpPrint(clause->pattern);
+      printf("\n");
+    }
+  }
+}
+
+
+
+#endif // PLD_LISP_FUNCTION_H
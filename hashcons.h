@@ -0,0 +1,265 @@
+#ifndef PLD_LISP_HASHCONS_H
+#define PLD_LISP_HASHCONS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sexp.h"
+
+#define HASHCONS_INITIAL_CAPACITY 1024
+#define HASHCONS_STRING_LIMIT 256 // longer strings are not hash-consed
+
+/*
+ * Hash-consing of S-expressions, enabled with --hash-cons.
+ *
+ * Every S-expression created while hash-consing is enabled is looked up in a
+ * table of the unique nodes and replaced by the existing node when there is
+ * one. The children of a cons are unique already, so conses are keyed by the
+ * pointers of their car and cdr, and equal structures share a single node.
+ * Copying a unique node only counts a reference, and freeing it only drops
+ * one, see sexpCopy and sexpFree. Structurally equal S-expressions are then
+ * pointer-equal, which makes equals a pointer comparison in most cases.
+ *
+ * Builtins, functions, vectors and matrices are never hash-consed, so a cons
+ * with one of them as a child is not unique either, and is stored and copied
+ * as usual.
+ * Neither are long strings, which would be hashed whole every time one is
+ * appended to.
+ * Unique nodes are shared, so they must never be modified in place.
+ */
+int hashconsEnabled = 0;
+
+#ifdef SEXP_COMPACT
+
+// compact cells have no reference count, see sexp.h
+Sexp hashconsIntern(Sexp fresh)
+{
+  return fresh;
+}
+
+void hashconsRemove(Sexp sexp)
+{
+}
+
+void hashconsPrintStatistics()
+{
+  printf("hash-consing is not available with compact cells\n");
+}
+
+#else
+
+struct _hashcons_table_t {
+  Sexp* slots;          // open addressing with linear probing
+  unsigned long capacity; // a power of two
+  unsigned long size;     // unique nodes in the table
+  unsigned long used;     // unique nodes and removed slots
+  unsigned long hits;     // number of created nodes that already existed
+};
+
+struct _hashcons_table_t hashconsTable = { NULL, 0, 0, 0, 0 };
+
+// marks slots of removed nodes, so probing continues past them
+struct _sexp_t hashconsRemoved;
+
+
+
+/* utility functions for hash-consing */
+int hashconsIsUnique(Sexp sexp)
+{
+  return sexp->references > 0;
+}
+
+// can the node be hash-consed, are its children unique?
+int hashconsIsInternable(Sexp sexp)
+{
+  switch(SEXP_TYPE_OF(sexp))
+  {
+  case SEXP_TYPE_BUILTIN:
+  case SEXP_TYPE_FUNCTION:
+  case SEXP_TYPE_VECTOR:
+  case SEXP_TYPE_MATRIX:
+  case SEXP_TYPE_BIGNUM:
+  case SEXP_TYPE_ARRAY:
+    return 0;
+  case SEXP_TYPE_STRING:
+    return sexp->value.string->length <= HASHCONS_STRING_LIMIT;
+  case SEXP_TYPE_CONS:
+    return hashconsIsUnique(SEXP_CAR(sexp)) &&
+      hashconsIsUnique(SEXP_CDR(sexp));
+  default:
+    return 1;
+  }
+}
+
+unsigned long hashconsHash(Sexp sexp)
+{
+  unsigned long hash = 14695981039346656037ul;
+  enum _sexp_type_t type = SEXP_TYPE_OF(sexp);
+  hash = sexpHashBytes(hash, &type, sizeof(type));
+  switch(SEXP_TYPE_OF(sexp))
+  {
+  case SEXP_TYPE_CONS:
+  {
+    Sexp cons[2] = { SEXP_CAR(sexp), SEXP_CDR(sexp) };
+    return sexpHashBytes(hash, cons, sizeof(cons));
+  }
+  case SEXP_TYPE_SYMBOL:
+    return sexpHashBytes(hash, sexp->value.symbol, strlen(sexp->value.symbol));
+  case SEXP_TYPE_STRING:
+    return sexpHashBytes(hash, sexp->value.string->chars,
+                         sexp->value.string->length);
+  case SEXP_TYPE_BOOLEAN:
+    return sexpHashBytes(hash, &sexp->value.boolean, sizeof(int));
+  case SEXP_TYPE_INTEGER:
+    return sexpHashBytes(hash, &sexp->value.integer, sizeof(long));
+  case SEXP_TYPE_DOUBLE:
+    return sexpHashBytes(hash, &sexp->value.doubleFP, sizeof(double));
+  case SEXP_TYPE_OPERATOR:
+    return sexpHashBytes(hash, &sexp->value.operator, sizeof(Operator));
+  case SEXP_TYPE_SLOT:
+    return sexpHashBytes(hash, &sexp->value.slot, sizeof(int));
+  default:
+    return hash;
+  }
+}
+
+// are the nodes equal, given that their children are unique?
+int hashconsEquals(Sexp a, Sexp b)
+{
+  if(SEXP_TYPE_OF(a) != SEXP_TYPE_OF(b)) {
+    return 0;
+  }
+  switch(SEXP_TYPE_OF(a))
+  {
+  case SEXP_TYPE_CONS:
+    return SEXP_CAR(a) == SEXP_CAR(b) &&
+      SEXP_CDR(a) == SEXP_CDR(b);
+  case SEXP_TYPE_SYMBOL:
+    return !strcmp(a->value.symbol, b->value.symbol);
+  case SEXP_TYPE_STRING:
+    return sexpStringEquals(a->value.string, b->value.string);
+  case SEXP_TYPE_BOOLEAN:
+    return a->value.boolean == b->value.boolean;
+  case SEXP_TYPE_INTEGER:
+    return a->value.integer == b->value.integer;
+  case SEXP_TYPE_DOUBLE:
+    // bitwise, so 0.0 and -0.0 stay distinct
+    return !memcmp(&a->value.doubleFP, &b->value.doubleFP, sizeof(double));
+  case SEXP_TYPE_OPERATOR:
+    return a->value.operator == b->value.operator;
+  case SEXP_TYPE_SLOT:
+    return a->value.slot == b->value.slot;
+  case SEXP_TYPE_NIL:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+void hashconsInsertSlot(Sexp sexp)
+{
+  unsigned long mask = hashconsTable.capacity - 1;
+  unsigned long i = hashconsHash(sexp) & mask;
+  while(hashconsTable.slots[i]) {
+    i = (i + 1) & mask;
+  }
+  hashconsTable.slots[i] = sexp;
+}
+
+// rehash into a table with room for twice the unique nodes
+void hashconsGrow()
+{
+  Sexp* slots = hashconsTable.slots;
+  unsigned long capacity = hashconsTable.capacity;
+
+  unsigned long grown = HASHCONS_INITIAL_CAPACITY;
+  while(grown < 4 * (hashconsTable.size + 1)) {
+    grown *= 2;
+  }
+  hashconsTable.slots = calloc(grown, sizeof(Sexp));
+  hashconsTable.capacity = grown;
+  hashconsTable.used = hashconsTable.size;
+
+  for(unsigned long i = 0; i < capacity; i++) {
+    if(slots[i] && slots[i] != &hashconsRemoved) {
+      hashconsInsertSlot(slots[i]);
+    }
+  }
+  free(slots);
+}
+
+
+
+/* hash-consing functions */
+
+/*
+ * Returns the unique node equal to the freshly created node,
+ * which is consumed: either it becomes the unique node, or it is freed.
+ */
+Sexp hashconsIntern(Sexp fresh)
+{
+  if(!hashconsIsInternable(fresh)) {
+    return fresh;
+  }
+  if(2 * (hashconsTable.used + 1) > hashconsTable.capacity) {
+    hashconsGrow();
+  }
+
+  unsigned long mask = hashconsTable.capacity - 1;
+  unsigned long i = hashconsHash(fresh) & mask;
+  Sexp* vacant = NULL;
+  for(; hashconsTable.slots[i]; i = (i + 1) & mask) {
+    Sexp sexp = hashconsTable.slots[i];
+    if(sexp == &hashconsRemoved) {
+      if(!vacant) {
+        vacant = &hashconsTable.slots[i];
+      }
+    }
+    else if(hashconsEquals(sexp, fresh)) {
+      sexp->references++;
+      hashconsTable.hits++;
+      sexpFree(fresh);
+      return sexp;
+    }
+  }
+
+  if(!vacant) {
+    vacant = &hashconsTable.slots[i];
+    hashconsTable.used++;
+  }
+  *vacant = fresh;
+  fresh->references = 1;
+  hashconsTable.size++;
+  return fresh;
+}
+
+// removes a unique node whose last reference is dropped
+void hashconsRemove(Sexp sexp)
+{
+  unsigned long mask = hashconsTable.capacity - 1;
+  unsigned long i = hashconsHash(sexp) & mask;
+  while(hashconsTable.slots[i] != sexp) {
+    i = (i + 1) & mask;
+  }
+  hashconsTable.slots[i] = &hashconsRemoved;
+  hashconsTable.size--;
+}
+
+void hashconsPrintStatistics()
+{
+  if(!hashconsEnabled) {
+    printf("hash-consing is disabled, see --hash-cons\n");
+    return;
+  }
+  printf("unique nodes:          %lu\n", hashconsTable.size);
+  printf("shared nodes created:  %lu\n", hashconsTable.hits);
+  printf("table capacity:        %lu\n", hashconsTable.capacity);
+}
+
+#endif // SEXP_COMPACT
+
+
+
+#undef HASHCONS_INITIAL_CAPACITY
+#undef HASHCONS_STRING_LIMIT
+#endif // PLD_LISP_HASHCONS_H
@@ -0,0 +1,241 @@
+#ifndef PLD_LISP_IMMORTAL_H
+#define PLD_LISP_IMMORTAL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "sexp.h"
+#include "function.h"
+
+#define IMMORTAL_REGION_SIZE ((size_t)1 << 28) // reserved, not committed
+
+#ifdef SEXP_COMPACT
+#define IMMORTAL_ALIGNMENT 16 // the type is kept in the low bits of pointers
+#else
+#define IMMORTAL_ALIGNMENT 8
+#endif
+
+/*
+ * The immortal region holds the definitions loaded from library files.
+ *
+ * While a library is loaded, every defined value is frozen: it is copied into
+ * the region, cells and strings alike, and the copy is bound instead. When
+ * the library has been loaded, the region is made read-only. Immortal
+ * S-expressions are neither copied nor freed, see sexpCopy and sexpFree, so
+ * looking up a library function returns its definition itself, and a value
+ * built from library constants only refers to them.
+ *
+ * Function objects stay on the heap, since their statistics change on every
+ * call, but their source and code are frozen along with the cell referring to
+ * them. Nothing in the region is freed until exit.
+ */
+int immortalLoading = 0; // the number of libraries being loaded
+uintptr_t immortalNext = 0;
+uintptr_t immortalSealed = 0; // everything before is read-only
+
+
+
+/* region functions */
+
+// the bytes taken by size bytes in the region
+size_t immortalAligned(size_t size)
+{
+  return (size + IMMORTAL_ALIGNMENT - 1) & ~(size_t)(IMMORTAL_ALIGNMENT - 1);
+}
+
+// can size more bytes be allocated in the region? reserves it on first use
+int immortalReserve(size_t size)
+{
+  if(!sexpImmortalBegin) {
+    void* region = mmap(NULL, IMMORTAL_REGION_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(region == MAP_FAILED) {
+      return 0;
+    }
+    sexpImmortalBegin = immortalNext = immortalSealed = (uintptr_t)region;
+    sexpImmortalSize = IMMORTAL_REGION_SIZE;
+  }
+  return size <= sexpImmortalBegin + sexpImmortalSize - immortalNext;
+}
+
+void* immortalAlloc(size_t size)
+{
+  void* memory = (void*)immortalNext;
+  immortalNext += immortalAligned(size);
+  return memory;
+}
+
+// makes everything frozen so far read-only, the next value starts a new page
+void immortalSeal()
+{
+  if(immortalNext == immortalSealed) {
+    return;
+  }
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t end = (immortalNext + page - 1) & ~(page - 1);
+  mprotect((void*)immortalSealed, end - immortalSealed, PROT_READ);
+  immortalNext = immortalSealed = end;
+}
+
+
+
+/* freezing */
+
+// the bytes needed to freeze the S-expression
+size_t immortalSize(Sexp sexp)
+{
+  size_t size = 0;
+  for(; !SEXP_IMMORTAL(sexp); sexp = SEXP_CDR(sexp)) {
+    size += immortalAligned(sizeof(struct _sexp_t));
+    switch(SEXP_TYPE_OF(sexp))
+    {
+    case SEXP_TYPE_SYMBOL:
+      return size + immortalAligned(strlen(sexp->value.symbol) + 1);
+    case SEXP_TYPE_STRING:
+      return size + immortalAligned(sizeof(struct _sexp_string_t) +
+                                    sexp->value.string->length);
+    case SEXP_TYPE_CONS:
+      size += immortalSize(SEXP_CAR(sexp));
+      continue;
+    default:
+      return size;
+    }
+  }
+  return size;
+}
+
+char* immortalSymbol(const char* symbol)
+{
+  char* copy = immortalAlloc(strlen(symbol) + 1);
+  strcpy(copy, symbol);
+  return copy;
+}
+
+// a view is frozen as a string of its own
+SexpString immortalString(SexpString string)
+{
+  SexpString copy = immortalAlloc(sizeof(struct _sexp_string_t) +
+                                  string->length);
+  copy->references = 1;
+  copy->length = string->length;
+  copy->chars = copy->buffer;
+  copy->owner = NULL;
+  copy->used = copy->capacity = string->length;
+  memcpy(copy->buffer, string->chars, string->length);
+  return copy;
+}
+
+// copies the S-expression into the region, which has room for it
+Sexp immortalCopy(Sexp sexp)
+{
+  Sexp copy = NULL;
+  Sexp last = NULL;
+  for(; !SEXP_IMMORTAL(sexp); sexp = SEXP_CDR(sexp)) {
+    Sexp cell = immortalAlloc(sizeof(struct _sexp_t));
+    *cell = *sexp;
+#ifndef SEXP_COMPACT
+    cell->references = 0;
+#endif
+    if(last) {
+      SEXP_SET_CDR(last, cell);
+    } else {
+      copy = cell;
+    }
+
+    switch(SEXP_TYPE_OF(sexp))
+    {
+    case SEXP_TYPE_SYMBOL:
+      cell->value.symbol = immortalSymbol(sexp->value.symbol);
+      return copy;
+    case SEXP_TYPE_STRING:
+      cell->value.string = immortalString(sexp->value.string);
+      return copy;
+    case SEXP_TYPE_FUNCTION:
+      cell->value.function->references++; // held until exit
+      return copy;
+    case SEXP_TYPE_VECTOR:
+      sexpVectorRetain(cell->value.vector); // held until exit
+      return copy;
+    case SEXP_TYPE_MATRIX:
+      sexpMatrixRetain(cell->value.matrix); // held until exit
+      return copy;
+    case SEXP_TYPE_BIGNUM:
+      sexpBignumRetain(cell->value.bignum); // held until exit
+      return copy;
+    case SEXP_TYPE_ARRAY:
+      sexpArrayRetain(cell->value.array); // held until exit
+      return copy;
+    case SEXP_TYPE_CONS:
+      SEXP_SET_CAR(cell, immortalCopy(SEXP_CAR(sexp)));
+      last = cell;
+      continue;
+    default:
+      return copy;
+    }
+  }
+
+  // the tail is immortal already
+  if(last) {
+    SEXP_SET_CDR(last, sexp);
+    return copy;
+  }
+  return sexp;
+}
+
+/*
+ * Freezes a value defined by a library, taking it over. A function has its
+ * source and code frozen as well, and its clauses analysed again. The value
+ * stays as it is when the region is full.
+ */
+Sexp immortalFreeze(Sexp sexp)
+{
+  SexpFunction function = (SEXP_TYPE_OF(sexp) == SEXP_TYPE_FUNCTION &&
+                           !SEXP_IMMORTAL(sexp->value.function->source)) ?
+    sexp->value.function : NULL;
+  size_t size = immortalSize(sexp);
+  if(function) {
+    size += immortalSize(function->source);
+    if(function->code) size += immortalSize(function->code);
+  }
+  if(!immortalReserve(size)) {
+    return sexp;
+  }
+
+  if(function) {
+    Sexp source = function->source;
+    function->source = immortalCopy(source);
+    sexpFree(source);
+    if(function->code) {
+      Sexp code = function->code;
+      function->code = immortalCopy(code);
+      sexpFree(code);
+    }
+    free(function->order);
+    functionAnalyseClauses(function, (function->code) ?
+                           function->code : SEXP_CDR(function->source));
+  }
+  Sexp frozen = immortalCopy(sexp);
+  sexpFree(sexp);
+  return frozen;
+}
+
+/* show how much of the region is in use */
+void immortalPrintStatistics()
+{
+  if(!sexpImmortalBegin) {
+    printf("no library has been loaded\n");
+    return;
+  }
+  printf("immortal bytes:        %lu\n",
+         (unsigned long)(immortalNext - sexpImmortalBegin));
+  printf("read-only bytes:       %lu\n",
+         (unsigned long)(immortalSealed - sexpImmortalBegin));
+}
+
+
+
+#undef IMMORTAL_REGION_SIZE
+#undef IMMORTAL_ALIGNMENT
+#endif // PLD_LISP_IMMORTAL_H
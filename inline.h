@@ -0,0 +1,316 @@
+#ifndef PLD_LISP_INLINE_H
+#define PLD_LISP_INLINE_H
+
+#include <stdio.h>
+#include <string.h>
+#include "sexp.h"
+#include "symtable.h"
+#include "keyword.h"
+#include "simplify.h"
+
+#define INLINE_MAX_NODES 32
+#define INLINE_MAX_PARAMETERS 8
+#define INLINE_MAX_CALLEES 16
+
+/*
+ * Inlining of small global functions into their call sites.
+ *
+ * A call (f a1 ... an) is replaced by the body of f with the arguments
+ * substituted for the parameters, when f is a single-clause function whose
+ * pattern is a list of n distinct variables, e.g.
+ *   (define fst (lambda (l) (head l)))
+ *   (fst (iota 3)) -> (head (iota 3)).
+ * Since lambdas see the environment they are called from, the remaining free
+ * variables of the body mean the same at the call site. The parameters are
+ * gone there though, so the body may only apply operators, builtins and
+ * global functions that never refer to them, e.g.
+ *   (define snd (lambda (l) (head (tail l))))
+ * is inlined, since head and tail only refer to their own pattern variables.
+ * The functions these call are checked as well, and none of them may apply a
+ * function passed to it, which could be a lambda reading the parameters.
+ * To keep the evaluation of the arguments unchanged, the body must be small,
+ * may not refer to f itself and must use every parameter exactly once
+ * (literal arguments may be used any number of times), in the order of the
+ * arguments and before anything is applied to them, e.g.
+ * (lambda (a b) (cons b a)) is not inlined, since it would evaluate b before
+ * a. Control flow and binding forms (if, let, lambda, define, ...) are never
+ * inlined into.
+ *
+ * Expansions are built on the first call of a site and kept in its inline
+ * cache entry, so they are invalidated along with it when f is redefined.
+ */
+
+
+
+/* statistics about the inlined call sites */
+struct _inline_statistics_t {
+  unsigned long expandedSites;
+  unsigned long rejectedSites;
+};
+
+struct _inline_statistics_t inlineStatistics = { 0, 0 };
+
+
+
+/* utility functions for inlining */
+int inlineParameterIndex(Sexp symbol, Sexp* parameters, int count)
+{
+  for(int i = 0; i < count; i++) {
+    if(!strcmp(symbol->value.symbol, parameters[i]->value.symbol)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// whether the parameters before limit whose arguments are evaluated are used
+int inlineArgumentsUsed(Sexp* arguments, int limit, int* uses)
+{
+  for(int i = 0; i < limit; i++) {
+    if(!uses[i] && !simplifyIsLiteral(arguments[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// whether a pattern binds a symbol
+int inlinePatternBinds(Sexp pattern, Sexp symbol)
+{
+  if(SEXP_TYPE_OF(pattern) == SEXP_TYPE_SYMBOL) {
+    return !strcmp(pattern->value.symbol, symbol->value.symbol);
+  }
+  return SEXP_TYPE_OF(pattern) == SEXP_TYPE_CONS &&
+    (inlinePatternBinds(SEXP_CAR(pattern), symbol) ||
+     inlinePatternBinds(SEXP_CDR(pattern), symbol));
+}
+
+int inlineCalleeSafe(Sexp symbol, Sexp* parameters, int count,
+                     SexpFunction* callees, int* calleeCount);
+
+/*
+ * Whether a clause body of a function called from an inlined body does not
+ * refer to the parameters, unless its pattern binds them, and only applies
+ * operators, builtins and global functions that are safe in turn.
+ */
+int inlineCheckCallee(Sexp sexp, Sexp pattern, Sexp* parameters, int count,
+                      SexpFunction* callees, int* calleeCount)
+{
+  if(SEXP_TYPE_OF(sexp) == SEXP_TYPE_SYMBOL) {
+    return inlinePatternBinds(pattern, sexp) ||
+      inlineParameterIndex(sexp, parameters, count) < 0;
+  }
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS) {
+    return 1;
+  }
+  int keyword = simplifyFormKeyword(sexp);
+  if(keyword == KEYWORD_QUOTE) {
+    return 1;
+  }
+  Sexp head = SEXP_CAR(sexp);
+  if(keyword == -1 && SEXP_TYPE_OF(head) != SEXP_TYPE_OPERATOR &&
+     (SEXP_TYPE_OF(head) != SEXP_TYPE_SYMBOL || inlinePatternBinds(pattern, head) ||
+      !inlineCalleeSafe(head, parameters, count, callees, calleeCount))) {
+    return 0;
+  }
+  for(; SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS; sexp = SEXP_CDR(sexp)) {
+    if(!inlineCheckCallee(SEXP_CAR(sexp), pattern, parameters, count,
+                          callees, calleeCount)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Whether a symbol in function position is bound to a builtin, or to a global
+ * function whose clauses are safe, see inlineCheckCallee. callees holds the
+ * functions already checked, so recursive functions are checked once.
+ */
+int inlineCalleeSafe(Sexp symbol, Sexp* parameters, int count,
+                     SexpFunction* callees, int* calleeCount)
+{
+  if(inlineParameterIndex(symbol, parameters, count) >= 0) {
+    return 0;
+  }
+  SymtableBinding binding = symtableLookupBinding(globalEnvironment, symbol->value.symbol);
+  if(!binding || SEXP_TYPE_OF(binding->value) == SEXP_TYPE_BUILTIN) {
+    return binding != NULL;
+  }
+  if(SEXP_TYPE_OF(binding->value) != SEXP_TYPE_FUNCTION) {
+    return 0;
+  }
+  SexpFunction function = binding->value->value.function;
+  for(int i = 0; i < *calleeCount; i++) {
+    if(callees[i] == function) {
+      return 1;
+    }
+  }
+  // the slots of closures refer to their own captures
+  if(function->captureCount || *calleeCount == INLINE_MAX_CALLEES) {
+    return 0;
+  }
+  callees[(*calleeCount)++] = function;
+  for(int i = 0; i < function->clauseCount; i++) {
+    SexpClause clause = &function->clauses[i];
+    if(!inlineCheckCallee(clause->body, clause->pattern, parameters, count,
+                          callees, calleeCount)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Counts the parameter occurrences of a body in uses,
+ * returns 0 if the body contains a form that can not be inlined, or would
+ * evaluate the arguments in another order than the call.
+ */
+int inlineCheckBody(Sexp sexp, const char* name, Sexp* parameters,
+                    Sexp* arguments, int count, int* uses,
+                    SexpFunction* callees, int* calleeCount)
+{
+  if(SEXP_TYPE_OF(sexp) == SEXP_TYPE_SYMBOL) {
+    if(!strcmp(sexp->value.symbol, name)) {
+      return 0; // recursive
+    }
+    int index = inlineParameterIndex(sexp, parameters, count);
+    if(index >= 0) {
+      if(!simplifyIsLiteral(arguments[index]) &&
+         !inlineArgumentsUsed(arguments, index, uses)) {
+        return 0;
+      }
+      uses[index]++;
+    }
+    return 1;
+  }
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS) {
+    return 1;
+  }
+
+  Sexp head = SEXP_CAR(sexp);
+  switch(simplifyFormKeyword(sexp))
+  {
+  case KEYWORD_QUOTE:
+    return 1;
+  case KEYWORD_CONS:
+  case KEYWORD_EQUALS:
+  case KEYWORD_NOT:
+  case KEYWORD_MESSAGE:
+    break;
+  case -1:
+    // a lambda applied in the body would not see the parameters
+    if(SEXP_TYPE_OF(head) != SEXP_TYPE_OPERATOR &&
+       (SEXP_TYPE_OF(head) != SEXP_TYPE_SYMBOL ||
+        !inlineCalleeSafe(head, parameters, count, callees, calleeCount))) {
+      return 0;
+    }
+    break;
+  default:
+    return 0;
+  }
+
+  for(; SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS; sexp = SEXP_CDR(sexp)) {
+    if(!inlineCheckBody(SEXP_CAR(sexp), name, parameters, arguments, count, uses,
+                        callees, calleeCount)) {
+      return 0;
+    }
+  }
+  // an application may fail or print, so all arguments are evaluated before
+  return SEXP_TYPE_OF(sexp) == SEXP_TYPE_NIL &&
+    inlineArgumentsUsed(arguments, count, uses);
+}
+
+// replace all parameters at once, so arguments are never substituted into
+Sexp inlineSubstitute(Sexp sexp, Sexp* parameters, Sexp* arguments, int count)
+{
+  if(SEXP_TYPE_OF(sexp) == SEXP_TYPE_SYMBOL) {
+    int index = inlineParameterIndex(sexp, parameters, count);
+    return sexpCopy((index >= 0) ? arguments[index] : sexp);
+  }
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS ||
+     simplifyFormKeyword(sexp) == KEYWORD_QUOTE) {
+    return sexpCopy(sexp);
+  }
+  Sexp car = inlineSubstitute(SEXP_CAR(sexp), parameters, arguments, count);
+  Sexp cdr = inlineSubstitute(SEXP_CDR(sexp), parameters, arguments, count);
+  Sexp ret = sexpCreateCons(car, cdr);
+  sexpFree(car);
+  sexpFree(cdr);
+  return ret;
+}
+
+
+
+/*
+ * Returns the expansion of the call site (name args...) to function,
+ * or NULL if the function can not be inlined there.
+ */
+Sexp inlineCall(const char* name, Sexp function, Sexp site)
+{
+  Sexp parameters[INLINE_MAX_PARAMETERS];
+  Sexp arguments[INLINE_MAX_PARAMETERS];
+  int uses[INLINE_MAX_PARAMETERS];
+  int count = 0;
+  SexpFunction callees[INLINE_MAX_CALLEES];
+  int calleeCount = 0;
+
+  // a single clause with a pattern of distinct variables matching the call,
+  // closures are not inlined since their slots refer to their own captures,
+  // memoized functions since their calls must go through the memo table
+  if(SEXP_TYPE_OF(function) != SEXP_TYPE_FUNCTION ||
+     function->value.function->clauseCount != 1 ||
+     function->value.function->captureCount ||
+     function->value.function->memo) {
+    return NULL;
+  }
+  SexpClause clause = &function->value.function->clauses[0];
+  Sexp body = clause->body;
+  if(!clause->flat || clause->arity > INLINE_MAX_PARAMETERS ||
+     simplifyCountNodes(body) > INLINE_MAX_NODES) {
+    inlineStatistics.rejectedSites++;
+    return NULL;
+  }
+
+  Sexp pattern = clause->pattern;
+  Sexp args = SEXP_CDR(site);
+  for(; count < clause->arity && SEXP_TYPE_OF(args) == SEXP_TYPE_CONS; count++) {
+    parameters[count] = SEXP_CAR(pattern);
+    arguments[count] = SEXP_CAR(args);
+    uses[count] = 0;
+    pattern = SEXP_CDR(pattern);
+    args = SEXP_CDR(args);
+  }
+  if(count != clause->arity || SEXP_TYPE_OF(args) != SEXP_TYPE_NIL) {
+    inlineStatistics.rejectedSites++;
+    return NULL;
+  }
+
+  if(!inlineCheckBody(body, name, parameters, arguments, count, uses,
+                      callees, &calleeCount)) {
+    inlineStatistics.rejectedSites++;
+    return NULL;
+  }
+  for(int i = 0; i < count; i++) {
+    if(uses[i] != 1 && !simplifyIsLiteral(arguments[i])) {
+      inlineStatistics.rejectedSites++;
+      return NULL;
+    }
+  }
+
+  inlineStatistics.expandedSites++;
+  return inlineSubstitute(body, parameters, arguments, count);
+}
+
+void inlinePrintStatistics()
+{
+  printf("inlined call sites:    %lu\n", inlineStatistics.expandedSites);
+  printf("rejected call sites:   %lu\n", inlineStatistics.rejectedSites);
+}
+
+
+
+#undef INLINE_MAX_NODES
+#undef INLINE_MAX_PARAMETERS
+#undef INLINE_MAX_CALLEES
+#endif // PLD_LISP_INLINE_H
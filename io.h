@@ -90,7 +90,7 @@ void fileContentsAddLine(FileContents contents, const char* text)
   FileContentsLine line = fileContentsLineCreate();
   unsigned long len = strlen(text);
   line->linelength = len;
-  line->line = malloc(sizeof(char) * len);
+  line->line = malloc(sizeof(char) * (len + 1));
   strcpy(line->line, text);
 
   if(!contents->head) {
@@ -167,6 +167,7 @@ FileContents librarySmartLoad(const char* filename)
   FileContents contents = fileContentsCreate();
   unsigned int bufsize = 256;
   char* input = malloc(sizeof(char) * bufsize);
+  memset(input, '\0', bufsize);
 
   char c = EOF;
   unsigned int i = 0;
@@ -177,9 +178,9 @@ FileContents librarySmartLoad(const char* filename)
     // no more space in buffer
     if(i >= bufsize - 1) {
       bufsize *= 2;
-      fileContentsAddLine(contents, input);
       char* newBuffer = malloc(sizeof(char) * bufsize);
-      strcpy(newBuffer, input);
+      memset(newBuffer, '\0', bufsize);
+      memcpy(newBuffer, input, i);
       free(input);
       input = newBuffer;
     }
@@ -243,7 +244,7 @@ FileContents librarySmartLoad(const char* filename)
 
     // finished reading S-expression
     if(scopeBalance == 0 && i > 1) {
-      input[i+1] = '\0';
+      input[i] = '\0';
       fileContentsAddLine(contents, input);
       /* printf("NEW LINE: \"%s\"\n", input); */
       memset(input, '\0', bufsize);
@@ -272,7 +273,7 @@ char* inputBufferRead()
     if(index >= bufsize - 1) { // space for terminating '\0'
       bufsize *= 2;
       char* newbuffer = malloc(bufsize * sizeof(char));
-      strcpy(newbuffer, buffer);
+      memcpy(newbuffer, buffer, index);
       free(buffer);
       buffer = newbuffer;
     }
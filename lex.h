@@ -4,9 +4,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #include "keyword.h"
 #include "operator.h"
 #include "exception.h"
+#include "memory/manager.h"
 
 /* token types */
 enum _lex_token_special_char_t {
@@ -23,7 +25,8 @@ enum _lex_token_type_t {
   LEX_TOKEN_TYPE_INTEGER,
   LEX_TOKEN_TYPE_DOUBLE,
   LEX_TOKEN_TYPE_OPERATOR,
-  LEX_TOKEN_TYPE_STRING
+  LEX_TOKEN_TYPE_STRING,
+  LEX_TOKEN_TYPE_BIGNUM
 };
 
 union _lex_token_value_t {
@@ -31,9 +34,10 @@ union _lex_token_value_t {
   Operator operator;
   enum _lex_token_special_char_t special_char;
   char* symbol;
-  int integer;
+  long integer;
   double doubleFP;
   char* string;
+  char* bignum; // the digits of an integer too large for a long
 };
 
 struct _lex_token_t {
@@ -92,12 +96,11 @@ LexToken lexTokenCreateSymbol(char* symbol)
 {
   LexToken token = lexTokenAlloc();
   token->type = LEX_TOKEN_TYPE_SYMBOL;
-  token->value.symbol = malloc(strlen(symbol) * sizeof(char));
-  strcpy(token->value.symbol, symbol);
+  token->value.symbol = memoryManagerCreateString(symbol);
   return token;
 }
 
-LexToken lexTokenCreateInteger(int integer)
+LexToken lexTokenCreateInteger(long integer)
 {
   LexToken token = lexTokenAlloc();
   token->type = LEX_TOKEN_TYPE_INTEGER;
@@ -125,8 +128,15 @@ LexToken lexTokenCreateString(char* string)
 {
   LexToken token = lexTokenAlloc();
   token->type = LEX_TOKEN_TYPE_STRING;
-  token->value.string = malloc(strlen(string) * sizeof(char));
-  strcpy(token->value.string, string);
+  token->value.string = memoryManagerCreateString(string);
+  return token;
+}
+
+LexToken lexTokenCreateBignum(char* digits)
+{
+  LexToken token = lexTokenAlloc();
+  token->type = LEX_TOKEN_TYPE_BIGNUM;
+  token->value.bignum = memoryManagerCreateString(digits);
   return token;
 }
 
@@ -137,13 +147,16 @@ void lexTokenFree(LexToken token)
   case LEX_TOKEN_TYPE_KEYWORD:     break;
   case LEX_TOKEN_TYPE_SPECIALCHAR: break;
   case LEX_TOKEN_TYPE_SYMBOL:
-    free(token->value.symbol);
+    memoryManagerFreeString(token->value.symbol);
     break;
   case LEX_TOKEN_TYPE_INTEGER:     break;
   case LEX_TOKEN_TYPE_DOUBLE:      break;
   case LEX_TOKEN_TYPE_OPERATOR:    break;
   case LEX_TOKEN_TYPE_STRING:
-    free(token->value.string);
+    memoryManagerFreeString(token->value.string);
+    break;
+  case LEX_TOKEN_TYPE_BIGNUM:
+    memoryManagerFreeString(token->value.bignum);
     break;
   default:
     printf("lex token free: Invalid token type!\n"); // exit(-1);
@@ -191,7 +204,7 @@ void lexTokenPrint(LexToken token)
     printf("SYMBOL(%s)", token->value.symbol);
     break;
   case LEX_TOKEN_TYPE_INTEGER:
-    printf("INT(%i)", token->value.integer);
+    printf("INT(%ld)", token->value.integer);
     break;
   case LEX_TOKEN_TYPE_DOUBLE:
     printf("DOUBLE(%lg)", token->value.doubleFP);
@@ -202,6 +215,9 @@ void lexTokenPrint(LexToken token)
   case LEX_TOKEN_TYPE_STRING:
     printf("STRING(\"%s\")", token->value.string);
     break;
+  case LEX_TOKEN_TYPE_BIGNUM:
+    printf("BIGNUM(%s)", token->value.bignum);
+    break;
   default:
     printf("lex token print: Invalid token type!\n"); // exit(-1);
   }
@@ -267,6 +283,9 @@ void lexTokenListPrint(LexTokenList list)
 
 /* token utility functions */
 
+// the longest number constant, integers of up to a thousand digits
+#define LEX_NUMBER_LENGTH 1024
+
 /*
  * int lexReadIntFromBuffer() :
  *
@@ -286,11 +305,30 @@ void lexBadDouble()
   printf("! malformed floating-point constant\n");
   throwException();
 }
-int lexReadNumberFromBuffer(char dest[32], const char* src,
+/*
+ * Reads the exponent of a floating-point constant, e.g. e300 or e-7, at most
+ * space characters of it, and returns the number of characters read, or 0 if
+ * src does not start with one.
+ */
+int lexReadExponent(char* dest, const char* src, int space)
+{
+  int sign = src[1] == '-' || src[1] == '+';
+  if(src[0] != 'e' || !('0' <= src[1 + sign] && src[1 + sign] <= '9')) {
+    return 0;
+  }
+  int k = 0;
+  for(; k < space && (k <= sign || ('0' <= src[k] && src[k] <= '9')); k++) {
+    dest[k] = src[k];
+  }
+  return k;
+}
+
+int lexReadNumberFromBuffer(char dest[LEX_NUMBER_LENGTH], const char* src,
                          unsigned int len, unsigned int i,
                          int* isFloatingPoint)
 {
   int ret = 0;
+  int exponent;
   if(i < 0 || i >= len) {
     printf("lex read int from buffer: invalid index i\n");
     throwException();
@@ -299,10 +337,10 @@ int lexReadNumberFromBuffer(char dest[32], const char* src,
   *isFloatingPoint = 0;
 
   // reading negative number
-  if(src[i] == '-' && i < len - 1 && src[i + 1] != '0') {
+  if(src[i] == '-' && i < len - 1 && (src[i + 1] != '0' || src[i + 2] == '.')) {
     dest[0] = '-';
     ret++;
-    for(int k = 1; k < 32; k++)
+    for(int k = 1; k < LEX_NUMBER_LENGTH - 1; k++)
     {
       if(src[i + k] == '.') {
         (*isFloatingPoint)++;
@@ -311,6 +349,17 @@ int lexReadNumberFromBuffer(char dest[32], const char* src,
         if(*isFloatingPoint > 1) { lexBadDouble(); }
       }
 
+      else if(src[i + k] == 'e' &&
+              (exponent = lexReadExponent(dest + k, src + i + k, LEX_NUMBER_LENGTH - 1 - k))) {
+        ret += exponent;
+        *isFloatingPoint += !*isFloatingPoint;
+        if('a' <= src[i + k + exponent] && src[i + k + exponent] <= 'z') {
+          lexBadDouble();
+          return 0;
+        }
+        break;
+      }
+
       else if('a' <= src[i + k] && src[i + k] <= 'z') {
         if(*isFloatingPoint) { lexBadDouble(); }
         else { lexBadInteger(); }
@@ -328,7 +377,7 @@ int lexReadNumberFromBuffer(char dest[32], const char* src,
 
   // reading floating-point number between 0 and 1
   else if(src[i] == '0' && i < len - 1 && src[i + 1] == '.') {
-    for(int k = 0; k < 32; k++)
+    for(int k = 0; k < LEX_NUMBER_LENGTH - 1; k++)
     {
       if(src[i + k] == '.') {
         (*isFloatingPoint)++;
@@ -342,6 +391,17 @@ int lexReadNumberFromBuffer(char dest[32], const char* src,
         ret++;
       }
 
+      else if(src[i + k] == 'e' &&
+              (exponent = lexReadExponent(dest + k, src + i + k, LEX_NUMBER_LENGTH - 1 - k))) {
+        ret += exponent;
+        *isFloatingPoint += !*isFloatingPoint;
+        if('a' <= src[i + k + exponent] && src[i + k + exponent] <= 'z') {
+          lexBadDouble();
+          return 0;
+        }
+        break;
+      }
+
       else if('a' <= src[i + k] && src[i + k] <= 'z') {
         lexBadDouble();
         return 0;
@@ -382,7 +442,7 @@ int lexReadNumberFromBuffer(char dest[32], const char* src,
   else if('1' <= src[i] && src[i] <= '9') {
     dest[0] = src[i];
     ret++;
-    for(int k = 1; k < 32; k++)
+    for(int k = 1; k < LEX_NUMBER_LENGTH - 1; k++)
     {
       if(src[i + k] == '.') {
         (*isFloatingPoint)++;
@@ -396,6 +456,17 @@ int lexReadNumberFromBuffer(char dest[32], const char* src,
         ret++;
       }
 
+      else if(src[i + k] == 'e' &&
+              (exponent = lexReadExponent(dest + k, src + i + k, LEX_NUMBER_LENGTH - 1 - k))) {
+        ret += exponent;
+        *isFloatingPoint += !*isFloatingPoint;
+        if('a' <= src[i + k + exponent] && src[i + k + exponent] <= 'z') {
+          lexBadDouble();
+          return 0;
+        }
+        break;
+      }
+
       else if('a' <= src[i + k] && src[i + k] <= 'z') {
         lexBadInteger();
         return 0;
@@ -620,7 +691,7 @@ LexTokenList transformBufferToTokenList(char* buffer)
 
     // not a symbol, and not a character -> match an integer
     else if(buffer[i] == '-' || ('0' <= buffer[i] && buffer[i] <= '9')) {
-      char number[32];
+      char number[LEX_NUMBER_LENGTH];
       int isFloatingPoint;
       int readNumber = lexReadNumberFromBuffer(number, buffer, len, i,
                                             &isFloatingPoint);
@@ -632,14 +703,18 @@ LexTokenList transformBufferToTokenList(char* buffer)
       i += readNumber - 1; // do not advance 1 character too much
       /* printf("readNumber: %s\n", number); */
 
-      int intValue;
       double doubleValue;
       if(isFloatingPoint && sscanf(number, "%lg", &doubleValue) == 1) {
         lexTokenListAdd(list, lexTokenCreateDouble(doubleValue));
         continue;
       }
-      else if(sscanf(number, "%i", &intValue) == 1) {
-        lexTokenListAdd(list, lexTokenCreateInteger(intValue));
+      char* end = number;
+      errno = 0;
+      long intValue = isFloatingPoint ? 0 : strtol(number, &end, 10);
+      if(end != number && !*end) {
+        // the digits of an integer out of range are kept for a bignum
+        lexTokenListAdd(list, (errno == ERANGE) ? lexTokenCreateBignum(number)
+                                                : lexTokenCreateInteger(intValue));
         continue;
       }
       else {
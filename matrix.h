@@ -0,0 +1,839 @@
+#ifndef PLD_LISP_MATRIX_H
+#define PLD_LISP_MATRIX_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "sexp.h"
+#include "operator.h"
+#include "exception.h"
+#include "builtin.h"
+#include "vector.h"
+
+/*
+ * Builtins on matrices of doubles, see struct _sexp_matrix_t:
+ *   (matrix l)       the matrix whose rows are the lists of numbers in l
+ *   (midentity n)    the n x n identity matrix
+ *   (mlist m)        the list of the rows of m, each a list
+ *   (mrows m) (mcols m)  the number of rows and of columns of m
+ *   (mref m i j)     the element of m in row i and column j
+ *   (mtranspose m)   the transpose of m
+ *   (mlu a)          the list (l u p) of matrices, with p a = l u
+ *   (msolve a b)     the x with a x = b, b a matrix or a vector
+ *   (mdet a)         the determinant of a
+ * The arithmetic operators apply to matrices too, see matrixApplyOperator:
+ * + and - elementwise, * is the matrix product, and a number is applied to
+ * every element.
+ *
+ * A product is computed in tiles of 4 rows of the result, which are kept in
+ * vector registers while the rows of the left matrix and the columns of the
+ * right one are read. The tiles are taken in blocks, so the part of the right
+ * matrix they read stays in the cache while each row of the left matrix is
+ * multiplied with it. Like the string search kernels, the tile kernel is
+ * chosen when first used: tiles of 4 x 8 with AVX2 and FMA, otherwise tiles of
+ * 4 x 4, which fit the 16 registers of SSE2.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_X86
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__SANITIZE_ADDRESS__)
+#define MATRIX_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define MATRIX_KERNEL
+#endif
+
+#define MATRIX_TILE_ROWS 4
+#define MATRIX_BLOCK_DEPTH 256   // rows of the right matrix in a block
+#define MATRIX_BLOCK_COLUMNS 256 // columns of the right matrix in a block
+#define MATRIX_BLOCK 256         // elements applied a number at a time
+#define MATRIX_BLOCK_TRANSPOSE 8 // rows of a matrix transposed at a time
+#define MATRIX_BLOCK_PIVOTS 64   // columns of a matrix factored at a time
+
+typedef double MatrixPair __attribute__((vector_size(16)));
+
+typedef void (*MatrixTileKernel)(const double* a, size_t lda, const double* b,
+                                 size_t ldb, double* c, size_t ldc, size_t depth);
+
+void matrixTileSelect();
+
+MatrixTileKernel matrixTile = NULL;
+size_t matrixTileColumns = 0;
+
+
+
+/* kernels, on row-major matrices, the stride of each is its number of columns */
+
+/*
+ * c += a b for a tile of 4 x 4, a has depth columns. The tile is written out,
+ * so that the compiler keeps it in registers.
+ */
+void matrixMultiplyTile4(const double* a, size_t lda, const double* b, size_t ldb,
+                         double* c, size_t ldc, size_t depth)
+{
+  MatrixPair c00, c01, c10, c11, c20, c21, c30, c31;
+  memcpy(&c00, c, sizeof(c00));
+  memcpy(&c01, c + 2, sizeof(c01));
+  memcpy(&c10, c + ldc, sizeof(c10));
+  memcpy(&c11, c + ldc + 2, sizeof(c11));
+  memcpy(&c20, c + 2 * ldc, sizeof(c20));
+  memcpy(&c21, c + 2 * ldc + 2, sizeof(c21));
+  memcpy(&c30, c + 3 * ldc, sizeof(c30));
+  memcpy(&c31, c + 3 * ldc + 2, sizeof(c31));
+  for(size_t k = 0; k < depth; k++) {
+    MatrixPair b0, b1;
+    memcpy(&b0, b + k * ldb, sizeof(b0));
+    memcpy(&b1, b + k * ldb + 2, sizeof(b1));
+    double a0 = a[k], a1 = a[lda + k], a2 = a[2 * lda + k], a3 = a[3 * lda + k];
+    c00 += a0 * b0;
+    c01 += a0 * b1;
+    c10 += a1 * b0;
+    c11 += a1 * b1;
+    c20 += a2 * b0;
+    c21 += a2 * b1;
+    c30 += a3 * b0;
+    c31 += a3 * b1;
+  }
+  memcpy(c, &c00, sizeof(c00));
+  memcpy(c + 2, &c01, sizeof(c01));
+  memcpy(c + ldc, &c10, sizeof(c10));
+  memcpy(c + ldc + 2, &c11, sizeof(c11));
+  memcpy(c + 2 * ldc, &c20, sizeof(c20));
+  memcpy(c + 2 * ldc + 2, &c21, sizeof(c21));
+  memcpy(c + 3 * ldc, &c30, sizeof(c30));
+  memcpy(c + 3 * ldc + 2, &c31, sizeof(c31));
+}
+
+#ifdef MATRIX_X86
+
+// c += a b for a tile of 4 x 8
+__attribute__((target("avx2,fma")))
+void matrixMultiplyTile8(const double* a, size_t lda, const double* b, size_t ldb,
+                         double* c, size_t ldc, size_t depth)
+{
+  VectorDoubles c00, c01, c10, c11, c20, c21, c30, c31;
+  memcpy(&c00, c, sizeof(c00));
+  memcpy(&c01, c + 4, sizeof(c01));
+  memcpy(&c10, c + ldc, sizeof(c10));
+  memcpy(&c11, c + ldc + 4, sizeof(c11));
+  memcpy(&c20, c + 2 * ldc, sizeof(c20));
+  memcpy(&c21, c + 2 * ldc + 4, sizeof(c21));
+  memcpy(&c30, c + 3 * ldc, sizeof(c30));
+  memcpy(&c31, c + 3 * ldc + 4, sizeof(c31));
+  for(size_t k = 0; k < depth; k++) {
+    VectorDoubles b0, b1;
+    memcpy(&b0, b + k * ldb, sizeof(b0));
+    memcpy(&b1, b + k * ldb + 4, sizeof(b1));
+    double a0 = a[k], a1 = a[lda + k], a2 = a[2 * lda + k], a3 = a[3 * lda + k];
+    c00 += a0 * b0;
+    c01 += a0 * b1;
+    c10 += a1 * b0;
+    c11 += a1 * b1;
+    c20 += a2 * b0;
+    c21 += a2 * b1;
+    c30 += a3 * b0;
+    c31 += a3 * b1;
+  }
+  memcpy(c, &c00, sizeof(c00));
+  memcpy(c + 4, &c01, sizeof(c01));
+  memcpy(c + ldc, &c10, sizeof(c10));
+  memcpy(c + ldc + 4, &c11, sizeof(c11));
+  memcpy(c + 2 * ldc, &c20, sizeof(c20));
+  memcpy(c + 2 * ldc + 4, &c21, sizeof(c21));
+  memcpy(c + 3 * ldc, &c30, sizeof(c30));
+  memcpy(c + 3 * ldc + 4, &c31, sizeof(c31));
+}
+
+#endif // MATRIX_X86
+
+void matrixTileSelect()
+{
+  matrixTile = matrixMultiplyTile4;
+  matrixTileColumns = 4;
+#ifdef MATRIX_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    matrixTile = matrixMultiplyTile8;
+    matrixTileColumns = 8;
+  }
+#endif
+}
+
+// c += a b for the rows x columns left over at the edges of a block
+void matrixMultiplyEdge(const double* a, size_t lda, const double* b, size_t ldb,
+                        double* c, size_t ldc, size_t rows, size_t columns,
+                        size_t depth)
+{
+  for(size_t i = 0; i < rows; i++) {
+    for(size_t k = 0; k < depth; k++) {
+      double element = a[i * lda + k];
+      for(size_t j = 0; j < columns; j++) {
+        c[i * ldc + j] += element * b[k * ldb + j];
+      }
+    }
+  }
+}
+
+/*
+ * c += a b, a is m x p, b is p x n, and the rows of each are stride elements
+ * apart. Each block of b is first copied into panels of the width of a tile,
+ * so the rows of b a tile reads are next to each other rather than a row of b
+ * apart, which would map them to the same few sets of the cache when that is
+ * a power of two.
+ */
+void matrixMultiplyAdd(const double* a, size_t lda, const double* b, size_t ldb,
+                       double* c, size_t ldc, size_t m, size_t p, size_t n)
+{
+  if(!matrixTile) {
+    matrixTileSelect();
+  }
+  size_t width = matrixTileColumns;
+  size_t depthLimit = (p < MATRIX_BLOCK_DEPTH) ? p : MATRIX_BLOCK_DEPTH;
+  size_t columnLimit = (n < MATRIX_BLOCK_COLUMNS) ? n : MATRIX_BLOCK_COLUMNS;
+  double* panels = malloc(sizeof(double) * depthLimit * columnLimit + 1);
+  if(!panels) {
+    // without room for the panels, the product is computed untiled
+    matrixMultiplyEdge(a, lda, b, ldb, c, ldc, m, n, p);
+    return;
+  }
+  for(size_t j0 = 0; j0 < n; j0 += MATRIX_BLOCK_COLUMNS) {
+    size_t j1 = (n - j0 < MATRIX_BLOCK_COLUMNS) ? n : j0 + MATRIX_BLOCK_COLUMNS;
+    size_t tiled = j0 + (j1 - j0) / width * width; // columns in whole tiles
+    for(size_t k0 = 0; k0 < p; k0 += MATRIX_BLOCK_DEPTH) {
+      size_t depth = (p - k0 < MATRIX_BLOCK_DEPTH) ? p - k0 : MATRIX_BLOCK_DEPTH;
+      for(size_t j = j0; j < tiled; j += width) {
+        double* panel = panels + (j - j0) * depth;
+        for(size_t k = 0; k < depth; k++) {
+          memcpy(panel + k * width, b + (k0 + k) * ldb + j, sizeof(double) * width);
+        }
+      }
+      for(size_t i = 0; i < m; i += MATRIX_TILE_ROWS) {
+        size_t rows = (m - i < MATRIX_TILE_ROWS) ? m - i : MATRIX_TILE_ROWS;
+        size_t j = j0;
+        for(; rows == MATRIX_TILE_ROWS && j < tiled; j += width) {
+          matrixTile(a + i * lda + k0, lda, panels + (j - j0) * depth, width,
+                     c + i * ldc + j, ldc, depth);
+        }
+        matrixMultiplyEdge(a + i * lda + k0, lda, b + k0 * ldb + j, ldb,
+                           c + i * ldc + j, ldc, rows, j1 - j, depth);
+      }
+    }
+  }
+  free(panels);
+}
+
+// c = a b, a is m x p, b is p x n
+void matrixMultiply(const double* a, const double* b, double* c,
+                    size_t m, size_t p, size_t n)
+{
+  memset(c, 0, sizeof(double) * m * n);
+  matrixMultiplyAdd(a, p, b, n, c, n, m, p, n);
+}
+
+// y -= factor x
+MATRIX_KERNEL
+void matrixSubtractMultiple(double* restrict y, const double* restrict x,
+                            double factor, size_t n)
+{
+  VectorDoubles f = { factor, factor, factor, factor };
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4) {
+    VectorDoubles a, b;
+    memcpy(&a, x + i, sizeof(a));
+    memcpy(&b, y + i, sizeof(b));
+    b -= f * a;
+    memcpy(y + i, &b, sizeof(b));
+  }
+  for(; i < n; i++) {
+    y[i] -= factor * x[i];
+  }
+}
+
+void matrixSwapRows(double* a, size_t n, size_t i, size_t j)
+{
+  for(size_t k = 0; k < n; k++) {
+    double swap = a[i * n + k];
+    a[i * n + k] = a[j * n + k];
+    a[j * n + k] = swap;
+  }
+}
+
+/*
+ * Factors the n x n matrix a in place, by Gaussian elimination with partial
+ * pivoting: afterwards its upper triangle is U, and its lower triangle is L
+ * without the diagonal of ones, so that row i of L U is row rows[i] of a.
+ * Returns the sign of the permutation, or 0 if a is singular, that is if a
+ * pivot is lost in the rounding errors of the elements of a.
+ *
+ * The columns are eliminated MATRIX_BLOCK_PIVOTS at a time: these are factored
+ * alone, then the rows of U to their right are solved for, and the rest of
+ * the matrix is updated by a single product, which does most of the work.
+ */
+int matrixDecompose(double* a, size_t n, size_t* rows)
+{
+  int sign = 1;
+  double largest = 0;
+  for(size_t i = 0; i < n; i++) {
+    rows[i] = i;
+  }
+  for(size_t i = 0; i < n * n; i++) {
+    largest = fmax(largest, fabs(a[i]));
+  }
+  // without room for the blocks of L, the columns are factored in one block
+  double* l = malloc(sizeof(double) * n * MATRIX_BLOCK_PIVOTS + 1);
+  size_t block = (l) ? MATRIX_BLOCK_PIVOTS : n;
+  for(size_t k0 = 0; k0 < n; k0 += block) {
+    size_t k1 = (n - k0 < block) ? n : k0 + block;
+    for(size_t k = k0; k < k1; k++) {
+      size_t pivot = k;
+      for(size_t i = k + 1; i < n; i++) {
+        if(fabs(a[i * n + k]) > fabs(a[pivot * n + k])) {
+          pivot = i;
+        }
+      }
+      if(fabs(a[pivot * n + k]) <= largest * n * DBL_EPSILON) {
+        free(l);
+        return 0;
+      }
+      if(pivot != k) {
+        matrixSwapRows(a, n, pivot, k);
+        size_t swap = rows[pivot];
+        rows[pivot] = rows[k];
+        rows[k] = swap;
+        sign = -sign;
+      }
+      for(size_t i = k + 1; i < n; i++) {
+        double factor = a[i * n + k] /= a[k * n + k];
+        matrixSubtractMultiple(a + i * n + k + 1, a + k * n + k + 1, factor, k1 - k - 1);
+      }
+    }
+    if(k1 == n) {
+      break;
+    }
+    for(size_t i = k0 + 1; i < k1; i++) {
+      for(size_t k = k0; k < i; k++) {
+        matrixSubtractMultiple(a + i * n + k1, a + k * n + k1, a[i * n + k], n - k1);
+      }
+    }
+    // a -= l u below and to the right of the block, with l negated
+    for(size_t i = k1; i < n; i++) {
+      for(size_t k = k0; k < k1; k++) {
+        l[(i - k1) * (k1 - k0) + k - k0] = -a[i * n + k];
+      }
+    }
+    matrixMultiplyAdd(l, k1 - k0, a + k0 * n + k1, n, a + k1 * n + k1, n,
+                      n - k1, k1 - k0, n - k1);
+  }
+  free(l);
+  return sign;
+}
+
+/*
+ * Solves L U x = b in place of x, which holds the rows of b permuted as given
+ * by matrixDecompose, each of m columns. Whole rows are eliminated at a time,
+ * so the columns of b are solved together, and as in matrixDecompose, the rows
+ * solved in a block are eliminated from the others by a single product.
+ */
+void matrixSubstitute(const double* lu, size_t n, double* x, size_t m)
+{
+  // without room for the blocks of L and U, the rows are solved in one block
+  double* l = malloc(sizeof(double) * n * MATRIX_BLOCK_PIVOTS + 1);
+  size_t block = (l) ? MATRIX_BLOCK_PIVOTS : n;
+  for(size_t k0 = 0; k0 < n; k0 += block) {
+    size_t k1 = (n - k0 < block) ? n : k0 + block;
+    for(size_t i = k0 + 1; i < k1; i++) {
+      for(size_t k = k0; k < i; k++) {
+        matrixSubtractMultiple(x + i * m, x + k * m, lu[i * n + k], m);
+      }
+    }
+    // x -= l x below the block
+    for(size_t i = k1; i < n; i++) {
+      for(size_t k = k0; k < k1; k++) {
+        l[(i - k1) * (k1 - k0) + k - k0] = -lu[i * n + k];
+      }
+    }
+    matrixMultiplyAdd(l, k1 - k0, x + k0 * m, m, x + k1 * m, m, n - k1, k1 - k0, m);
+  }
+  for(size_t k1 = n; k1 > 0; k1 = (k1 > block) ? k1 - block : 0) {
+    size_t k0 = (k1 > block) ? k1 - block : 0;
+    for(size_t i = k1; i-- > k0;) {
+      for(size_t k = i + 1; k < k1; k++) {
+        matrixSubtractMultiple(x + i * m, x + k * m, lu[i * n + k], m);
+      }
+      for(size_t j = 0; j < m; j++) {
+        x[i * m + j] /= lu[i * n + i];
+      }
+    }
+    // x -= u x above the block
+    for(size_t i = 0; i < k0; i++) {
+      for(size_t k = k0; k < k1; k++) {
+        l[i * (k1 - k0) + k - k0] = -lu[i * n + k];
+      }
+    }
+    matrixMultiplyAdd(l, k1 - k0, x + k0 * m, m, x, m, k0, k1 - k0, m);
+  }
+  free(l);
+}
+
+
+
+/* allocation, reported as an error of the builtin or operator name */
+void matrixOutOfMemory(const char* name, size_t rows, size_t columns)
+{
+  printf("! %s: out of memory for a %zu x %zu matrix\n", name, rows, columns);
+  throwException();
+  printf("Control should not reach this point!\n");
+}
+
+// sexpMatrixCreate, which reports a matrix too large to allocate
+SexpMatrix matrixCreate(const char* name, size_t rows, size_t columns)
+{
+  SexpMatrix matrix = sexpMatrixCreate(rows, columns);
+  if(!matrix) {
+    matrixOutOfMemory(name, rows, columns);
+  }
+  return matrix;
+}
+
+
+
+/* operators */
+void matrixBadOperands(Operator operator, const char* operands)
+{
+  printf("! operator ");
+  operatorPrint(operator);
+  printf(" cannot be applied to %s\n", operands);
+  throwException();
+  printf("Control should not reach this point!\n");
+}
+
+// the matrix times a vector of as many elements as it has columns
+Sexp matrixMultiplyVector(SexpMatrix matrix, Sexp operand)
+{
+  if(operand->value.vector->length != matrix->columns) {
+    matrixBadOperands(OPERATOR_MULTIPLY, "a matrix and a vector of another size");
+    return NULL;
+  }
+  SexpVector y = vectorCreate("*", SEXP_VECTOR_DOUBLE, matrix->rows);
+  double* buffer = malloc(sizeof(double) * (matrix->columns + 1));
+  if(!buffer) {
+    sexpVectorRelease(y);
+    matrixOutOfMemory("*", matrix->rows, matrix->columns);
+  }
+  const double* x = vectorDoublesAt(operand, 0, matrix->columns, buffer);
+  for(size_t i = 0; i < matrix->rows; i++) {
+    y->elements.doubles[i] = vectorDotDoubles(matrix->elements + i * matrix->columns,
+                                              x, matrix->columns);
+  }
+  free(buffer);
+  return sexpCreateVectorOf(y);
+}
+
+/*
+ * Applies an arithmetic operator where an operand is a matrix: + and - on two
+ * matrices of the same size, * as the matrix product, or on a matrix and a
+ * vector, and + - * / on a matrix and a number, to each of its elements.
+ */
+Sexp matrixApplyOperator(Sexp num1, Sexp num2, Operator operator)
+{
+  if(SEXP_TYPE_OF(num1) == SEXP_TYPE_MATRIX && SEXP_TYPE_OF(num2) == SEXP_TYPE_MATRIX) {
+    SexpMatrix a = num1->value.matrix;
+    SexpMatrix b = num2->value.matrix;
+    if(operator == OPERATOR_MULTIPLY) {
+      if(a->columns != b->rows) {
+        matrixBadOperands(operator, "matrices of incompatible sizes");
+        return NULL;
+      }
+      SexpMatrix c = matrixCreate("*", a->rows, b->columns);
+      matrixMultiply(a->elements, b->elements, c->elements,
+                     a->rows, a->columns, b->columns);
+      return sexpCreateMatrixOf(c);
+    }
+    if(operator != OPERATOR_PLUS && operator != OPERATOR_MINUS) {
+      matrixBadOperands(operator, "two matrices");
+      return NULL;
+    }
+    if(a->rows != b->rows || a->columns != b->columns) {
+      matrixBadOperands(operator, "matrices of different sizes");
+      return NULL;
+    }
+    SexpMatrix c = matrixCreate(operatorName(operator), a->rows, a->columns);
+    vectorApplyDoubles(operator, a->elements, b->elements, c->elements,
+                       a->rows * a->columns);
+    return sexpCreateMatrixOf(c);
+  }
+
+  if(SEXP_TYPE_OF(num1) == SEXP_TYPE_MATRIX && SEXP_TYPE_OF(num2) == SEXP_TYPE_VECTOR &&
+     operator == OPERATOR_MULTIPLY) {
+    return matrixMultiplyVector(num1->value.matrix, num2);
+  }
+
+  Sexp number = (SEXP_TYPE_OF(num1) == SEXP_TYPE_MATRIX) ? num2 : num1;
+  if(!vectorIsNumber(number) ||
+     (operator != OPERATOR_PLUS && operator != OPERATOR_MINUS &&
+      operator != OPERATOR_MULTIPLY && operator != OPERATOR_DIVIDE)) {
+    matrixBadOperands(operator, "a matrix and this value");
+    return NULL;
+  }
+  SexpMatrix a = (SEXP_TYPE_OF(num1) == SEXP_TYPE_MATRIX) ?
+    num1->value.matrix : num2->value.matrix;
+  size_t length = a->rows * a->columns;
+  double block[MATRIX_BLOCK];
+  SexpMatrix c = matrixCreate(operatorName(operator), a->rows, a->columns);
+  for(size_t start = 0; start < length; start += MATRIX_BLOCK) {
+    size_t count = (length - start < MATRIX_BLOCK) ? length - start : MATRIX_BLOCK;
+    const double* scalar = vectorDoublesAt(number, start, count, block);
+    if(number == num2) {
+      vectorApplyDoubles(operator, a->elements + start, scalar, c->elements + start, count);
+    } else {
+      vectorApplyDoubles(operator, scalar, a->elements + start, c->elements + start, count);
+    }
+  }
+  return sexpCreateMatrixOf(c);
+}
+
+
+
+/* builtins */
+
+// the only argument, a matrix, otherwise NULL
+SexpMatrix matrixArgument(Sexp arguments)
+{
+  if(SEXP_TYPE_OF(arguments) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_MATRIX ||
+     SEXP_TYPE_OF(SEXP_CDR(arguments)) != SEXP_TYPE_NIL) {
+    return NULL;
+  }
+  return SEXP_CAR(arguments)->value.matrix;
+}
+
+// the only argument, a square matrix, otherwise NULL
+SexpMatrix matrixSquareArgument(Sexp arguments)
+{
+  SexpMatrix matrix = matrixArgument(arguments);
+  return (matrix && matrix->rows == matrix->columns) ? matrix : NULL;
+}
+
+// the number of elements of a list of numbers, or -1
+long matrixRowLength(Sexp row)
+{
+  long length = 0;
+  for(; SEXP_TYPE_OF(row) == SEXP_TYPE_CONS && vectorIsNumber(SEXP_CAR(row));
+      row = SEXP_CDR(row)) {
+    length++;
+  }
+  return (SEXP_TYPE_OF(row) == SEXP_TYPE_NIL) ? length : -1;
+}
+
+Sexp matrixFromListBuiltin(Sexp arguments)
+{
+  Sexp list = (SEXP_TYPE_OF(arguments) == SEXP_TYPE_CONS &&
+               SEXP_TYPE_OF(SEXP_CDR(arguments)) == SEXP_TYPE_NIL) ?
+    SEXP_CAR(arguments) : NULL;
+  size_t rows = 0;
+  long columns = -1;
+  Sexp row = list;
+  for(; row && SEXP_TYPE_OF(row) == SEXP_TYPE_CONS; row = SEXP_CDR(row)) {
+    long length = matrixRowLength(SEXP_CAR(row));
+    if(length < 0 || (rows && length != columns)) {
+      break;
+    }
+    columns = length;
+    rows++;
+  }
+  if(!row || SEXP_TYPE_OF(row) != SEXP_TYPE_NIL) {
+    vectorBadArguments("matrix", "a list of lists of numbers, all of the same length");
+    return NULL;
+  }
+
+  SexpMatrix matrix = matrixCreate("matrix", rows, (rows) ? columns : 0);
+  double* element = matrix->elements;
+  for(row = list; SEXP_TYPE_OF(row) == SEXP_TYPE_CONS; row = SEXP_CDR(row)) {
+    for(Sexp column = SEXP_CAR(row); SEXP_TYPE_OF(column) == SEXP_TYPE_CONS;
+        column = SEXP_CDR(column)) {
+      Sexp number = SEXP_CAR(column);
+      *element++ = (SEXP_TYPE_OF(number) == SEXP_TYPE_INTEGER) ?
+        (double)number->value.integer : number->value.doubleFP;
+    }
+  }
+  return sexpCreateMatrixOf(matrix);
+}
+
+Sexp matrixIdentityBuiltin(Sexp arguments)
+{
+  if(SEXP_TYPE_OF(arguments) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_INTEGER ||
+     SEXP_TYPE_OF(SEXP_CDR(arguments)) != SEXP_TYPE_NIL ||
+     SEXP_CAR(arguments)->value.integer < 0) {
+    vectorBadArguments("midentity", "a non-negative integer");
+    return NULL;
+  }
+  size_t n = SEXP_CAR(arguments)->value.integer;
+  SexpMatrix matrix = matrixCreate("midentity", n, n);
+  memset(matrix->elements, 0, sizeof(double) * n * n);
+  for(size_t i = 0; i < n; i++) {
+    matrix->elements[i * n + i] = 1;
+  }
+  return sexpCreateMatrixOf(matrix);
+}
+
+Sexp matrixToListBuiltin(Sexp arguments)
+{
+  SexpMatrix matrix = matrixArgument(arguments);
+  if(!matrix) {
+    vectorBadArguments("mlist", "a matrix");
+    return NULL;
+  }
+  Sexp* rows = malloc(sizeof(Sexp) * (matrix->rows + 1));
+  Sexp* elements = malloc(sizeof(Sexp) * (matrix->columns + 1));
+  if(!rows || !elements) {
+    free(rows);
+    free(elements);
+    matrixOutOfMemory("mlist", matrix->rows, matrix->columns);
+  }
+  for(size_t i = 0; i < matrix->rows; i++) {
+    for(size_t j = 0; j < matrix->columns; j++) {
+      elements[j] = sexpCreateDouble(matrix->elements[i * matrix->columns + j]);
+    }
+    rows[i] = sexpCreateListOf(elements, matrix->columns, sexpCreateNil());
+  }
+  Sexp list = sexpCreateListOf(rows, matrix->rows, sexpCreateNil());
+  free(elements);
+  free(rows);
+  return list;
+}
+
+Sexp matrixRowsBuiltin(Sexp arguments)
+{
+  SexpMatrix matrix = matrixArgument(arguments);
+  if(!matrix) {
+    vectorBadArguments("mrows", "a matrix");
+    return NULL;
+  }
+  return sexpCreateInteger((long)matrix->rows);
+}
+
+Sexp matrixColumnsBuiltin(Sexp arguments)
+{
+  SexpMatrix matrix = matrixArgument(arguments);
+  if(!matrix) {
+    vectorBadArguments("mcols", "a matrix");
+    return NULL;
+  }
+  return sexpCreateInteger((long)matrix->columns);
+}
+
+Sexp matrixRefBuiltin(Sexp arguments)
+{
+  if(SEXP_TYPE_OF(arguments) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_MATRIX ||
+     !vectorTwoArguments(SEXP_CDR(arguments)) ||
+     SEXP_TYPE_OF(SEXP_CAR(SEXP_CDR(arguments))) != SEXP_TYPE_INTEGER ||
+     SEXP_TYPE_OF(SEXP_CAR(SEXP_CDR(SEXP_CDR(arguments)))) != SEXP_TYPE_INTEGER) {
+    vectorBadArguments("mref", "a matrix, a row and a column");
+    return NULL;
+  }
+  SexpMatrix matrix = SEXP_CAR(arguments)->value.matrix;
+  long i = SEXP_CAR(SEXP_CDR(arguments))->value.integer;
+  long j = SEXP_CAR(SEXP_CDR(SEXP_CDR(arguments)))->value.integer;
+  if(i < 0 || (size_t)i >= matrix->rows || j < 0 || (size_t)j >= matrix->columns) {
+    vectorBadArguments("mref", "a row and a column within the matrix");
+    return NULL;
+  }
+  return sexpCreateDouble(matrix->elements[i * matrix->columns + j]);
+}
+
+Sexp matrixTransposeBuiltin(Sexp arguments)
+{
+  SexpMatrix matrix = matrixArgument(arguments);
+  if(!matrix) {
+    vectorBadArguments("mtranspose", "a matrix");
+    return NULL;
+  }
+  size_t rows = matrix->rows;
+  size_t columns = matrix->columns;
+  SexpMatrix transpose = matrixCreate("mtranspose", columns, rows);
+  // in blocks, so the rows written stay in the cache
+  for(size_t i0 = 0; i0 < rows; i0 += MATRIX_BLOCK_TRANSPOSE) {
+    size_t i1 = (rows - i0 < MATRIX_BLOCK_TRANSPOSE) ? rows : i0 + MATRIX_BLOCK_TRANSPOSE;
+    for(size_t j = 0; j < columns; j++) {
+      for(size_t i = i0; i < i1; i++) {
+        transpose->elements[j * rows + i] = matrix->elements[i * columns + j];
+      }
+    }
+  }
+  return sexpCreateMatrixOf(transpose);
+}
+
+// a copy of the square matrix factored, see matrixDecompose,
+// and in *rows the order of its rows, which is freed by the caller
+SexpMatrix matrixFactor(const char* name, SexpMatrix matrix, size_t** rows, int* sign)
+{
+  SexpMatrix lu = matrixCreate(name, matrix->rows, matrix->columns);
+  *rows = malloc(sizeof(size_t) * (matrix->rows + 1));
+  if(!*rows) {
+    sexpMatrixRelease(lu);
+    matrixOutOfMemory(name, matrix->rows, matrix->columns);
+  }
+  memcpy(lu->elements, matrix->elements, sizeof(double) * matrix->rows * matrix->columns);
+  *sign = matrixDecompose(lu->elements, lu->rows, *rows);
+  return lu;
+}
+
+Sexp matrixDecomposeBuiltin(Sexp arguments)
+{
+  SexpMatrix matrix = matrixSquareArgument(arguments);
+  if(!matrix) {
+    vectorBadArguments("mlu", "a square matrix");
+    return NULL;
+  }
+  size_t n = matrix->rows;
+  size_t* rows = NULL;
+  int sign = 0;
+  SexpMatrix lu = matrixFactor("mlu", matrix, &rows, &sign);
+  if(!sign) {
+    free(rows);
+    sexpMatrixRelease(lu);
+    printf("! mlu: the matrix is singular\n");
+    throwException();
+    return NULL;
+  }
+
+  SexpMatrix l = sexpMatrixCreate(n, n);
+  SexpMatrix u = sexpMatrixCreate(n, n);
+  SexpMatrix p = sexpMatrixCreate(n, n);
+  if(!l || !u || !p) {
+    if(l) {
+      sexpMatrixRelease(l);
+    }
+    if(u) {
+      sexpMatrixRelease(u);
+    }
+    if(p) {
+      sexpMatrixRelease(p);
+    }
+    free(rows);
+    sexpMatrixRelease(lu);
+    matrixOutOfMemory("mlu", n, n);
+  }
+  memset(p->elements, 0, sizeof(double) * n * n);
+  for(size_t i = 0; i < n; i++) {
+    for(size_t j = 0; j < n; j++) {
+      double element = lu->elements[i * n + j];
+      l->elements[i * n + j] = (j < i) ? element : (j == i);
+      u->elements[i * n + j] = (j >= i) ? element : 0;
+    }
+    p->elements[i * n + rows[i]] = 1;
+  }
+  free(rows);
+  sexpMatrixRelease(lu);
+  Sexp factors[] = { sexpCreateMatrixOf(l), sexpCreateMatrixOf(u),
+                     sexpCreateMatrixOf(p) };
+  return sexpCreateListOf(factors, 3, sexpCreateNil());
+}
+
+Sexp matrixSolveBuiltin(Sexp arguments)
+{
+  if(!vectorTwoArguments(arguments) ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_MATRIX ||
+     (SEXP_TYPE_OF(SEXP_CAR(SEXP_CDR(arguments))) != SEXP_TYPE_MATRIX &&
+      SEXP_TYPE_OF(SEXP_CAR(SEXP_CDR(arguments))) != SEXP_TYPE_VECTOR)) {
+    vectorBadArguments("msolve", "a square matrix, and a matrix or a vector");
+    return NULL;
+  }
+  SexpMatrix a = SEXP_CAR(arguments)->value.matrix;
+  Sexp b = SEXP_CAR(SEXP_CDR(arguments));
+  size_t n = a->rows;
+  size_t m = (SEXP_TYPE_OF(b) == SEXP_TYPE_MATRIX) ? b->value.matrix->columns : 1;
+  size_t length = (SEXP_TYPE_OF(b) == SEXP_TYPE_MATRIX) ?
+    b->value.matrix->rows : b->value.vector->length;
+  if(a->columns != n || length != n) {
+    vectorBadArguments("msolve", "a square matrix, and as many rows on the right");
+    return NULL;
+  }
+
+  size_t* rows = NULL;
+  int sign = 0;
+  SexpMatrix lu = matrixFactor("msolve", a, &rows, &sign);
+  if(!sign) {
+    free(rows);
+    sexpMatrixRelease(lu);
+    printf("! msolve: the matrix is singular\n");
+    throwException();
+    return NULL;
+  }
+  SexpMatrix x = sexpMatrixCreate(n, m);
+  if(!x) {
+    free(rows);
+    sexpMatrixRelease(lu);
+    matrixOutOfMemory("msolve", n, m);
+  }
+  for(size_t i = 0; i < n; i++) {
+    if(SEXP_TYPE_OF(b) == SEXP_TYPE_MATRIX) {
+      memcpy(x->elements + i * m, b->value.matrix->elements + rows[i] * m,
+             sizeof(double) * m);
+    } else {
+      x->elements[i] = *vectorDoublesAt(b, rows[i], 1, x->elements + i);
+    }
+  }
+  matrixSubstitute(lu->elements, n, x->elements, m);
+  free(rows);
+  sexpMatrixRelease(lu);
+  if(SEXP_TYPE_OF(b) == SEXP_TYPE_MATRIX) {
+    return sexpCreateMatrixOf(x);
+  }
+  SexpVector solution = sexpVectorCreate(SEXP_VECTOR_DOUBLE, n);
+  if(!solution) {
+    sexpMatrixRelease(x);
+    matrixOutOfMemory("msolve", n, 1);
+  }
+  memcpy(solution->elements.doubles, x->elements, sizeof(double) * n);
+  sexpMatrixRelease(x);
+  return sexpCreateVectorOf(solution);
+}
+
+Sexp matrixDeterminantBuiltin(Sexp arguments)
+{
+  SexpMatrix matrix = matrixSquareArgument(arguments);
+  if(!matrix) {
+    vectorBadArguments("mdet", "a square matrix");
+    return NULL;
+  }
+  size_t n = matrix->rows;
+  size_t* rows = NULL;
+  int sign = 0;
+  SexpMatrix lu = matrixFactor("mdet", matrix, &rows, &sign);
+  double determinant = sign;
+  for(size_t i = 0; i < n && sign; i++) {
+    determinant *= lu->elements[i * n + i];
+  }
+  free(rows);
+  sexpMatrixRelease(lu);
+  return sexpCreateDouble(determinant);
+}
+
+void matrixRegisterBuiltins()
+{
+  builtinRegister("matrix", matrixFromListBuiltin);
+  builtinRegister("midentity", matrixIdentityBuiltin);
+  builtinRegister("mlist", matrixToListBuiltin);
+  builtinRegister("mrows", matrixRowsBuiltin);
+  builtinRegister("mcols", matrixColumnsBuiltin);
+  builtinRegister("mref", matrixRefBuiltin);
+  builtinRegister("mtranspose", matrixTransposeBuiltin);
+  builtinRegister("mlu", matrixDecomposeBuiltin);
+  builtinRegister("msolve", matrixSolveBuiltin);
+  builtinRegister("mdet", matrixDeterminantBuiltin);
+}
+
+
+
+#undef MATRIX_KERNEL
+#undef MATRIX_TILE_ROWS
+#undef MATRIX_BLOCK_TRANSPOSE
+#undef MATRIX_BLOCK_PIVOTS
+#undef MATRIX_BLOCK_DEPTH
+#undef MATRIX_BLOCK_COLUMNS
+#undef MATRIX_BLOCK
+#endif // PLD_LISP_MATRIX_H
@@ -0,0 +1,230 @@
+#ifndef PLD_LISP_MEMO_H
+#define PLD_LISP_MEMO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "sexp.h"
+#include "builtin.h"
+#include "function.h"
+#include "exception.h"
+
+#define MEMO_DEFAULT_LIMIT 65536
+#define MEMO_INITIAL_CAPACITY 16
+
+/*
+ * Memoization of functions: (memo f) returns a copy of the function f, which
+ * remembers the result of every call keyed by its arguments, e.g.
+ *   (define fib (memo (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))))
+ * Arguments are compared structurally, so f must not depend on anything but
+ * its arguments. At most limit results are kept, (memo f limit) sets the limit,
+ * and the oldest result is evicted first. The results are kept in a ring
+ * buffer which grows up to the limit, so a large limit costs nothing until
+ * it is reached; without memory to grow, the oldest result is evicted early.
+ */
+struct _memo_entry_t {
+  unsigned long hash;
+  int count;
+  Sexp* arguments;
+  Sexp result;
+  struct _memo_entry_t* next; // next entry in the same bucket
+};
+
+struct _memo_table_t {
+  unsigned int limit;
+  unsigned int capacity; // of the ring buffer, at most limit
+  unsigned int size;
+  unsigned int bucketMask;
+  struct _memo_entry_t** buckets;
+  struct _memo_entry_t** entries; // ring buffer in insertion order
+  unsigned int oldest;
+};
+
+typedef struct _memo_entry_t* MemoEntry;
+typedef struct _memo_table_t* MemoTable;
+
+
+
+/* memo table functions */
+
+// returns NULL if there is no memory for the table
+MemoTable memoTableCreate(unsigned int limit)
+{
+  MemoTable table = malloc(sizeof(struct _memo_table_t));
+  if(!table) {
+    return NULL;
+  }
+  unsigned int buckets = 16;
+  while(buckets < limit && buckets < (1u << 20)) {
+    buckets *= 2;
+  }
+  table->limit = limit;
+  table->capacity = (limit < MEMO_INITIAL_CAPACITY) ? limit : MEMO_INITIAL_CAPACITY;
+  table->size = 0;
+  table->bucketMask = buckets - 1;
+  table->buckets = calloc(buckets, sizeof(MemoEntry));
+  table->entries = malloc(sizeof(MemoEntry) * table->capacity);
+  table->oldest = 0;
+  if(!table->buckets || !table->entries) {
+    free(table->buckets);
+    free(table->entries);
+    free(table);
+    return NULL;
+  }
+  return table;
+}
+
+// doubles the ring buffer up to the limit, returns 0 if there is no memory
+int memoTableGrow(MemoTable table)
+{
+  unsigned int capacity = (table->capacity > table->limit / 2) ?
+    table->limit : table->capacity * 2;
+  MemoEntry* entries = malloc(sizeof(MemoEntry) * capacity);
+  if(!entries) {
+    return 0;
+  }
+  for(unsigned int i = 0; i < table->size; i++) {
+    entries[i] = table->entries[(table->oldest + i) % table->capacity];
+  }
+  free(table->entries);
+  table->entries = entries;
+  table->capacity = capacity;
+  table->oldest = 0;
+  return 1;
+}
+
+void memoEntryFree(MemoEntry entry)
+{
+  for(int i = 0; i < entry->count; i++) {
+    sexpFree(entry->arguments[i]);
+  }
+  free(entry->arguments);
+  sexpFree(entry->result);
+  free(entry);
+}
+
+void memoTableFree(MemoTable table)
+{
+  for(unsigned int i = 0; i < table->size; i++) {
+    memoEntryFree(table->entries[(table->oldest + i) % table->capacity]);
+  }
+  free(table->buckets);
+  free(table->entries);
+  free(table);
+}
+
+unsigned long memoHash(Sexp* frame, int count)
+{
+  unsigned long hash = (unsigned long)count;
+  for(int i = 0; i < count; i++) {
+    hash = hash * 31 + sexpHash(frame[i]);
+  }
+  return hash;
+}
+
+// returns the remembered result of the call, or NULL
+Sexp memoLookup(MemoTable table, unsigned long hash, Sexp* frame, int count)
+{
+  MemoEntry entry = table->buckets[hash & table->bucketMask];
+  for(; entry; entry = entry->next) {
+    if(entry->hash != hash || entry->count != count) {
+      continue;
+    }
+    int i = 0;
+    while(i < count && sexpIdentical(entry->arguments[i], frame[i])) {
+      i++;
+    }
+    if(i == count) {
+      return entry->result;
+    }
+  }
+  return NULL;
+}
+
+void memoEvictOldest(MemoTable table)
+{
+  MemoEntry oldest = table->entries[table->oldest];
+  MemoEntry* link = &table->buckets[oldest->hash & table->bucketMask];
+  while(*link != oldest) {
+    link = &(*link)->next;
+  }
+  *link = oldest->next;
+  memoEntryFree(oldest);
+  table->oldest = (table->oldest + 1) % table->capacity;
+  table->size--;
+}
+
+void memoStore(MemoTable table, unsigned long hash, Sexp* frame, int count,
+               Sexp result)
+{
+  if(table->size == table->capacity &&
+     (table->capacity == table->limit || !memoTableGrow(table))) {
+    memoEvictOldest(table);
+  }
+  MemoEntry entry = malloc(sizeof(struct _memo_entry_t));
+  entry->hash = hash;
+  entry->count = count;
+  entry->arguments = malloc(sizeof(Sexp) * (count ? count : 1));
+  for(int i = 0; i < count; i++) {
+    entry->arguments[i] = sexpCopy(frame[i]);
+  }
+  entry->result = sexpCopy(result);
+
+  MemoEntry* bucket = &table->buckets[hash & table->bucketMask];
+  entry->next = *bucket;
+  *bucket = entry;
+  table->entries[(table->oldest + table->size) % table->capacity] = entry;
+  table->size++;
+}
+
+
+
+/* builtins */
+
+// (memo f) or (memo f limit)
+Sexp memoBuiltin(Sexp arguments)
+{
+  Sexp function = (SEXP_TYPE_OF(arguments) == SEXP_TYPE_CONS) ?
+    SEXP_CAR(arguments) : NULL;
+  Sexp rest = (function) ? SEXP_CDR(arguments) : NULL;
+  long limit = MEMO_DEFAULT_LIMIT;
+  if(rest && SEXP_TYPE_OF(rest) == SEXP_TYPE_CONS &&
+     SEXP_TYPE_OF(SEXP_CAR(rest)) == SEXP_TYPE_INTEGER &&
+     SEXP_TYPE_OF(SEXP_CDR(rest)) == SEXP_TYPE_NIL) {
+    limit = SEXP_CAR(rest)->value.integer;
+  }
+  else if(rest && SEXP_TYPE_OF(rest) != SEXP_TYPE_NIL) {
+    function = NULL;
+  }
+
+  if(!function || SEXP_TYPE_OF(function) != SEXP_TYPE_FUNCTION ||
+     limit <= 0 || (unsigned long)limit > UINT_MAX) {
+    printf("! memo expects a lambda and an optional positive limit of at most %u\n",
+           UINT_MAX);
+    throwException();
+    printf("Control should not reach this point!\n");
+    return NULL;
+  }
+
+  MemoTable table = memoTableCreate((unsigned int)limit);
+  if(!table) {
+    printf("! memo could not allocate a table of %ld results\n", limit);
+    throwException();
+    printf("Control should not reach this point!\n");
+    return NULL;
+  }
+  SexpFunction memoized = functionClone(function->value.function);
+  memoized->memo = table;
+  return sexpCreateFunction(memoized);
+}
+
+void memoRegisterBuiltins()
+{
+  builtinRegister("memo", memoBuiltin);
+}
+
+
+
+#undef MEMO_DEFAULT_LIMIT
+#undef MEMO_INITIAL_CAPACITY
+#endif // PLD_LISP_MEMO_H
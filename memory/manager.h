@@ -3,107 +3,149 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 
-#define MEM_SIZE_DEFAULT 512
-#define MEM_SIZE_STRING_DEFAULT 32
-
-/* Implementation of dynamic array */
-struct _dynamic_array_t {
-  size_t size;
-  size_t capacity;
-  void* data;
+#define MEM_SIZE_CHUNK 65536 // must be a power of two
+
+/*
+ * Arena for the strings of the interpreter: symbols, strings, tokens and the
+ * names of bindings. Memory for other small objects tied to strings, such as
+ * the headers of string values, can be taken with memoryManagerAllocate.
+ *
+ * Strings are cut from chunks of MEM_SIZE_CHUNK bytes with a bump pointer.
+ * Chunks are aligned to their size, so the chunk of a string is found by
+ * masking its address, and each chunk counts the strings it holds. A chunk is
+ * released when its last string is freed, and the current chunk is rewound
+ * instead, so the strings of a REPL iteration reuse the same memory. Chunks
+ * are never moved or grown, so a string keeps its address until it is freed.
+ * A string longer than a chunk gets a chunk of its own.
+ */
+struct _memory_chunk_t {
+  size_t used;  // bytes handed out, including this header
+  size_t live;  // number of strings not yet freed
 };
 
+typedef struct _memory_chunk_t* MemoryChunk;
 
 
-/* typedefs for easy usage */
-typedef struct _dynamic_array_t* DynamicArray;
 
-DynamicArray memoryManagerCreateDynamicArray(size_t size)
-{
-  DynamicArray da = malloc(sizeof(struct _dynamic_array_t));
-  da->data = malloc(size);
-  da->capacity = size;
-  da->size = 0;
-  return da;
-}
+/* global data structures for easy usage */
+MemoryChunk __string_manager__ = NULL; // the chunk strings are cut from
+size_t memoryManagerChunks = 0;        // number of chunks allocated
+size_t memoryManagerLiveChunks = 0;    // number of chunks not released
+size_t memoryManagerLiveStrings = 0;
 
 
 
-/* global data structures for easy usage */
-DynamicArray __string_manager__;
+MemoryChunk memoryManagerChunkOf(const void* ptr)
+{
+  return (MemoryChunk)((uintptr_t)ptr & ~(uintptr_t)(MEM_SIZE_CHUNK - 1));
+}
 
+MemoryChunk memoryManagerCreateChunk(size_t size)
+{
+  MemoryChunk chunk = aligned_alloc(MEM_SIZE_CHUNK, size);
+  chunk->used = sizeof(struct _memory_chunk_t);
+  chunk->live = 0;
+  memoryManagerChunks++;
+  memoryManagerLiveChunks++;
+  return chunk;
+}
 
+// allocates size bytes, at a multiple of alignment (a power of two)
+void* memoryManagerAllocate(size_t size, size_t alignment)
+{
+#ifdef __SANITIZE_ADDRESS__
+  return malloc(size); // keep use-after-free detection
+#else
+  memoryManagerLiveStrings++;
+  if(size > MEM_SIZE_CHUNK - sizeof(struct _memory_chunk_t) - alignment) {
+    size_t total = (sizeof(struct _memory_chunk_t) + size +
+                    MEM_SIZE_CHUNK - 1) & ~(size_t)(MEM_SIZE_CHUNK - 1);
+    MemoryChunk chunk = memoryManagerCreateChunk(total);
+    chunk->used = total;
+    chunk->live = 1;
+    return chunk + 1;
+  }
 
+  MemoryChunk chunk = __string_manager__;
+  size_t used = (chunk) ? (chunk->used + alignment - 1) & ~(alignment - 1) : 0;
+  if(!chunk || used + size > MEM_SIZE_CHUNK) {
+    // the previous chunk is released along with its last string
+    chunk = __string_manager__ = memoryManagerCreateChunk(MEM_SIZE_CHUNK);
+    used = chunk->used;
+  }
+  chunk->used = used + size;
+  chunk->live++;
+  return (char*)chunk + used;
+#endif
+}
+
+// allocates room for a string of length characters and the null character
 char* memoryManagerCreateStringFromLength(size_t length)
 {
-  const size_t totalLength = length + 1; // saving space for null character
-  if(__string_manager__->size + totalLength > __string_manager__->capacity) {
-    // saving old values
-    void* data = __string_manager__->data;
-    size_t size = __string_manager__->size;
-
-    // update the string manager
-    __string_manager__->capacity *= 2;
-    __string_manager__->size += totalLength;
-    __string_manager__->data = malloc(__string_manager__->capacity * 2);
-    memcpy(__string_manager__->data, data, size);
-    void* ptr = &((char*)__string_manager__->data)[size];
-    return ptr;
-  } else {
-    void* ptr = &((char*)__string_manager__->data)[__string_manager__->size];
-    __string_manager__->size += totalLength;
-    return ptr;
-  }
+  return memoryManagerAllocate(length + 1, 1); // saving space for null character
 }
 
 char* memoryManagerCreateString(const char* str)
 {
-  const size_t length = strlen(str) + 1; // saving space for null character
-  if(__string_manager__->size + length > __string_manager__->capacity) {
-    // saving old values
-    void* data = __string_manager__->data;
-    size_t size = __string_manager__->size;
-
-    // update the string manager
-    __string_manager__->capacity *= 2;
-    __string_manager__->size += length;
-    __string_manager__->data = malloc(__string_manager__->capacity * 2);
-    memcpy(__string_manager__->data, data, size);
-    char* ptr = &((char*)__string_manager__->data)[size];
-    strncpy(ptr, str, length);
-    return ptr;
-  } else {
-    void* ptr = &((char*)__string_manager__->data)[__string_manager__->size];
-    strncpy(ptr, str, length);
-    __string_manager__->size += length;
-    return ptr;
+  const size_t length = strlen(str);
+  char* ptr = memoryManagerCreateStringFromLength(length);
+  memcpy(ptr, str, length + 1);
+  return ptr;
+}
+
+// frees memory from memoryManagerAllocate or a string
+void memoryManagerFree(void* ptr)
+{
+#ifdef __SANITIZE_ADDRESS__
+  free(ptr);
+#else
+  memoryManagerLiveStrings--;
+  MemoryChunk chunk = memoryManagerChunkOf(ptr);
+  if(--chunk->live) {
+    return;
   }
+  if(chunk == __string_manager__) {
+    chunk->used = sizeof(struct _memory_chunk_t);
+    return;
+  }
+  memoryManagerLiveChunks--;
+  free(chunk);
+#endif
 }
 
+void memoryManagerFreeString(char* str)
+{
+  memoryManagerFree(str);
+}
 
 
-void memoryManagerInit()
+
+void memoryManagerPrintStatistics()
 {
-  __string_manager__ = memoryManagerCreateDynamicArray(MEM_SIZE_STRING_DEFAULT);
+  printf("live strings:          %lu\n", (unsigned long)memoryManagerLiveStrings);
+  printf("live chunks:           %lu\n", (unsigned long)memoryManagerLiveChunks);
+  printf("chunks allocated:      %lu\n", (unsigned long)memoryManagerChunks);
 }
 
+// print the bytes of the current chunk, freed strings included
 void memoryManagerPrintStrings()
 {
-  char* ptr = __string_manager__->data;
-  size_t sz = __string_manager__->size;
+  if(!__string_manager__) {
+    return;
+  }
+  char* ptr = (char*)(__string_manager__ + 1);
+  char* end = (char*)__string_manager__ + __string_manager__->used;
 
-  for(size_t i = 0; i < sz; i++)
+  for(; ptr < end; ptr++)
   {
     printf("%i %c\n", *ptr, *ptr);
-    //putchar(*ptr);
-    //if(*ptr == '\0') { putchar('\n'); }
-    ptr++;
   }
 }
 
 
-#undef MEM_SIZE_DEFAULT
+#undef MEM_SIZE_CHUNK
 
 #endif // PLD_LISP_MEMORY_MANAGER_H
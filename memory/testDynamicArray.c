@@ -3,7 +3,6 @@
 
 int main()
 {
-  memoryManagerInit();
   memoryManagerCreateString("hej");
   memoryManagerCreateString("goddag");
   char* test = memoryManagerCreateString("farvel");
@@ -0,0 +1,80 @@
+#include "manager.h"
+#include <assert.h>
+#include "../timer.h"
+
+/*
+ * Tests of the string arena, and a benchmark against malloc, e.g.
+ *   gcc test_strings.c -o test_strings -O2 && ./test_strings
+ */
+#define MANY 1000000
+
+void testStablePointers()
+{
+  char* first = memoryManagerCreateString("first");
+  char* strings[MANY / 10];
+  for(size_t i = 0; i < MANY / 10; i++) {
+    strings[i] = memoryManagerCreateString("a string of some length");
+  }
+  assert(!strcmp(first, "first"));
+  for(size_t i = 0; i < MANY / 10; i++) {
+    memoryManagerFreeString(strings[i]);
+  }
+  memoryManagerFreeString(first);
+  assert(memoryManagerLiveStrings == 0);
+  assert(memoryManagerLiveChunks == 1); // the current chunk is kept
+}
+
+void testLongString()
+{
+  const size_t LENGTH = 200000;
+  char* str = memoryManagerCreateStringFromLength(LENGTH);
+  memset(str, 'x', LENGTH);
+  str[LENGTH] = '\0';
+  char* after = memoryManagerCreateString("after");
+  assert(strlen(str) == LENGTH && !strcmp(after, "after"));
+  memoryManagerFreeString(str);
+  memoryManagerFreeString(after);
+  assert(memoryManagerLiveChunks == 1);
+}
+
+// allocate short strings as the interpreter does, then free them in order
+void benchmark(const char* what, char* (*create)(const char*),
+               void (*destroy)(char*))
+{
+  static char* strings[MANY];
+  char symbols[1000][16];
+  for(size_t i = 0; i < 1000; i++) {
+    snprintf(symbols[i], sizeof(symbols[i]), "x%lu", (unsigned long)i);
+  }
+  timerStart();
+  for(size_t i = 0; i < MANY; i++) {
+    strings[i] = create(symbols[i % 1000]);
+  }
+  for(size_t i = 0; i < MANY; i++) {
+    destroy(strings[i]);
+  }
+  fprintf(stderr, "%-8s %d strings: %g ms.\n", what, MANY, timerStop());
+}
+
+char* mallocCreateString(const char* str)
+{
+  char* ptr = malloc(strlen(str) + 1);
+  strcpy(ptr, str);
+  return ptr;
+}
+
+void mallocFreeString(char* str)
+{
+  free(str);
+}
+
+int main()
+{
+  testStablePointers();
+  testLongString();
+
+  benchmark("malloc", mallocCreateString, mallocFreeString);
+  benchmark("arena", memoryManagerCreateString, memoryManagerFreeString);
+
+  return 0;
+}
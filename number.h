@@ -3,29 +3,322 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
 
-#define MAX_NUMBER_LENGTH_IN_CHAR_BUFFER 32
+/*
+ * A double is printed with the fewest digits that read back as the same
+ * double, e.g. 0.1 and not 0.1000000000000000055511151231257827, in decimal
+ * notation between 1e-6 and 1e21, and otherwise as in 1.5e300, which the
+ * lexer reads back too. A double always has a decimal point, so it is not
+ * read back as an integer.
+ *
+ * The digits are found by Grisu3, see F. Loitsch, "Printing floating-point
+ * numbers quickly and accurately with integers", PLDI 2010: the double and
+ * the two halfway points to its neighbours are scaled by a cached power of
+ * ten into 64-bit integers, and digits are taken from the upper halfway point
+ * until the rest is within the interval between them. For about one double
+ * in two hundred the rounding errors of the scaling leave it unsure whether
+ * the digits are the shortest, and they are then found with snprintf.
+ */
+#define NUMBER_LENGTH 32     // the longest double printed, with its sign
+#define NUMBER_DIGITS 17     // enough to tell any two doubles apart
+#define NUMBER_FIXED_MIN -5  // positions of the decimal point relative to
+#define NUMBER_FIXED_MAX 21  // the first digit, printed without an exponent
 
+// f 2^e
+struct _number_fp_t {
+  uint64_t f;
+  int e;
+};
 
+typedef struct _number_fp_t NumberFp;
 
-void numberPrintDouble(double number)
+// 10^k = f 2^e, rounded, for every 8th k from -348 to 340
+struct _number_power_t {
+  uint64_t f;
+  int e;
+  int k;
+};
+
+const struct _number_power_t numberPowers[] = {
+  { 0xfa8fd5a0081c0288ul, -1220, -348 }, { 0xbaaee17fa23ebf76ul, -1193, -340 },
+  { 0x8b16fb203055ac76ul, -1166, -332 }, { 0xcf42894a5dce35eaul, -1140, -324 },
+  { 0x9a6bb0aa55653b2dul, -1113, -316 }, { 0xe61acf033d1a45dful, -1087, -308 },
+  { 0xab70fe17c79ac6caul, -1060, -300 }, { 0xff77b1fcbebcdc4ful, -1034, -292 },
+  { 0xbe5691ef416bd60cul, -1007, -284 }, { 0x8dd01fad907ffc3cul, -980, -276 },
+  { 0xd3515c2831559a83ul, -954, -268 }, { 0x9d71ac8fada6c9b5ul, -927, -260 },
+  { 0xea9c227723ee8bcbul, -901, -252 }, { 0xaecc49914078536dul, -874, -244 },
+  { 0x823c12795db6ce57ul, -847, -236 }, { 0xc21094364dfb5637ul, -821, -228 },
+  { 0x9096ea6f3848984ful, -794, -220 }, { 0xd77485cb25823ac7ul, -768, -212 },
+  { 0xa086cfcd97bf97f4ul, -741, -204 }, { 0xef340a98172aace5ul, -715, -196 },
+  { 0xb23867fb2a35b28eul, -688, -188 }, { 0x84c8d4dfd2c63f3bul, -661, -180 },
+  { 0xc5dd44271ad3cdbaul, -635, -172 }, { 0x936b9fcebb25c996ul, -608, -164 },
+  { 0xdbac6c247d62a584ul, -582, -156 }, { 0xa3ab66580d5fdaf6ul, -555, -148 },
+  { 0xf3e2f893dec3f126ul, -529, -140 }, { 0xb5b5ada8aaff80b8ul, -502, -132 },
+  { 0x87625f056c7c4a8bul, -475, -124 }, { 0xc9bcff6034c13053ul, -449, -116 },
+  { 0x964e858c91ba2655ul, -422, -108 }, { 0xdff9772470297ebdul, -396, -100 },
+  { 0xa6dfbd9fb8e5b88ful, -369, -92 }, { 0xf8a95fcf88747d94ul, -343, -84 },
+  { 0xb94470938fa89bcful, -316, -76 }, { 0x8a08f0f8bf0f156bul, -289, -68 },
+  { 0xcdb02555653131b6ul, -263, -60 }, { 0x993fe2c6d07b7facul, -236, -52 },
+  { 0xe45c10c42a2b3b06ul, -210, -44 }, { 0xaa242499697392d3ul, -183, -36 },
+  { 0xfd87b5f28300ca0eul, -157, -28 }, { 0xbce5086492111aebul, -130, -20 },
+  { 0x8cbccc096f5088ccul, -103, -12 }, { 0xd1b71758e219652cul, -77, -4 },
+  { 0x9c40000000000000ul, -50, 4 }, { 0xe8d4a51000000000ul, -24, 12 },
+  { 0xad78ebc5ac620000ul, 3, 20 }, { 0x813f3978f8940984ul, 30, 28 },
+  { 0xc097ce7bc90715b3ul, 56, 36 }, { 0x8f7e32ce7bea5c70ul, 83, 44 },
+  { 0xd5d238a4abe98068ul, 109, 52 }, { 0x9f4f2726179a2245ul, 136, 60 },
+  { 0xed63a231d4c4fb27ul, 162, 68 }, { 0xb0de65388cc8ada8ul, 189, 76 },
+  { 0x83c7088e1aab65dbul, 216, 84 }, { 0xc45d1df942711d9aul, 242, 92 },
+  { 0x924d692ca61be758ul, 269, 100 }, { 0xda01ee641a708deaul, 295, 108 },
+  { 0xa26da3999aef774aul, 322, 116 }, { 0xf209787bb47d6b85ul, 348, 124 },
+  { 0xb454e4a179dd1877ul, 375, 132 }, { 0x865b86925b9bc5c2ul, 402, 140 },
+  { 0xc83553c5c8965d3dul, 428, 148 }, { 0x952ab45cfa97a0b3ul, 455, 156 },
+  { 0xde469fbd99a05fe3ul, 481, 164 }, { 0xa59bc234db398c25ul, 508, 172 },
+  { 0xf6c69a72a3989f5cul, 534, 180 }, { 0xb7dcbf5354e9beceul, 561, 188 },
+  { 0x88fcf317f22241e2ul, 588, 196 }, { 0xcc20ce9bd35c78a5ul, 614, 204 },
+  { 0x98165af37b2153dful, 641, 212 }, { 0xe2a0b5dc971f303aul, 667, 220 },
+  { 0xa8d9d1535ce3b396ul, 694, 228 }, { 0xfb9b7cd9a4a7443cul, 720, 236 },
+  { 0xbb764c4ca7a44410ul, 747, 244 }, { 0x8bab8eefb6409c1aul, 774, 252 },
+  { 0xd01fef10a657842cul, 800, 260 }, { 0x9b10a4e5e9913129ul, 827, 268 },
+  { 0xe7109bfba19c0c9dul, 853, 276 }, { 0xac2820d9623bf429ul, 880, 284 },
+  { 0x80444b5e7aa7cf85ul, 907, 292 }, { 0xbf21e44003acdd2dul, 933, 300 },
+  { 0x8e679c2f5e44ff8ful, 960, 308 }, { 0xd433179d9c8cb841ul, 986, 316 },
+  { 0x9e19db92b4e31ba9ul, 1013, 324 }, { 0xeb96bf6ebadf77d9ul, 1039, 332 },
+  { 0xaf87023b9bf0ee6bul, 1066, 340 },
+};
+
+
+
+/* Grisu3 */
+
+// the upper 64 bits of the product, rounded
+NumberFp numberMultiply(NumberFp x, NumberFp y)
+{
+  uint64_t a = x.f >> 32, b = x.f & 0xFFFFFFFF, c = y.f >> 32, d = y.f & 0xFFFFFFFF;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t middle = (bd >> 32) + (ad & 0xFFFFFFFF) + (bc & 0xFFFFFFFF) + (1u << 31);
+  NumberFp product = { ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64 };
+  return product;
+}
+
+NumberFp numberNormalize(NumberFp x)
+{
+  int shift = __builtin_clzll(x.f);
+  x.f <<= shift;
+  x.e -= shift;
+  return x;
+}
+
+/*
+ * Moves the last digit down while that brings the digits closer to w, with
+ * distance the distance from the upper bound to w. Returns whether the digits
+ * are certainly the closest, given that each scaled value may be off by unit.
+ */
+int numberRoundWeed(char* digits, int length, uint64_t distance, uint64_t interval,
+                    uint64_t rest, uint64_t tenKappa, uint64_t unit)
+{
+  uint64_t smallDistance = distance - unit;
+  uint64_t bigDistance = distance + unit;
+  while(rest < smallDistance && interval - rest >= tenKappa &&
+        (rest + tenKappa < smallDistance ||
+         smallDistance - rest >= rest + tenKappa - smallDistance)) {
+    digits[length - 1]--;
+    rest += tenKappa;
+  }
+  if(rest < bigDistance && interval - rest >= tenKappa &&
+     (rest + tenKappa < bigDistance ||
+      bigDistance - rest > rest + tenKappa - bigDistance)) {
+    return 0;
+  }
+  return 2 * unit <= rest && rest <= interval - 4 * unit;
+}
+
+// the digits of the shortest number between low and high, closest to w
+int numberDigitGen(NumberFp low, NumberFp w, NumberFp high, char* digits,
+                   int* length, int* kappa)
 {
-  char buffer[32];
-  memset(buffer, '0', 32);
-  int written = snprintf(buffer, 32, "%f", number);
-  int dot;
-  for(dot = 0; dot < 32; dot++) {
-    if(buffer[dot] == '.') break;
-  }
-  int trailing = dot + 1;
-  for(int i = written - 1; i > dot; i--) {
-    if(buffer[i] != '0') {
-      trailing = i;
+  uint64_t unit = 1;
+  uint64_t tooLow = low.f - unit, tooHigh = high.f + unit;
+  uint64_t interval = tooHigh - tooLow;
+  int shift = -w.e;
+  uint64_t one = (uint64_t)1 << shift;
+  uint32_t integrals = tooHigh >> shift;
+  uint64_t fractionals = tooHigh & (one - 1);
+
+  uint32_t divisor = 1;
+  *kappa = 1;
+  while(*kappa < 10 && divisor * 10ull <= integrals) {
+    divisor *= 10;
+    (*kappa)++;
+  }
+  *length = 0;
+  while(*kappa > 0) {
+    digits[(*length)++] = '0' + integrals / divisor;
+    integrals %= divisor;
+    (*kappa)--;
+    uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+    if(rest < interval) {
+      return numberRoundWeed(digits, *length, tooHigh - w.f, interval, rest,
+                             (uint64_t)divisor << shift, unit);
+    }
+    divisor /= 10;
+  }
+  for(;;) {
+    fractionals *= 10;
+    unit *= 10;
+    interval *= 10;
+    digits[(*length)++] = '0' + (fractionals >> shift);
+    fractionals &= one - 1;
+    (*kappa)--;
+    if(fractionals < interval) {
+      return numberRoundWeed(digits, *length, (tooHigh - w.f) * unit, interval,
+                             fractionals, one, unit);
+    }
+  }
+}
+
+// the digits of a positive double, which is digits 10^exponent, if certain
+int numberGrisu(double number, char* digits, int* length, int* exponent)
+{
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(double));
+  uint64_t significand = bits & (((uint64_t)1 << 52) - 1);
+  int biased = (bits >> 52) & 0x7FF;
+  NumberFp w = { significand, -1074 };
+  if(biased) {
+    w.f |= (uint64_t)1 << 52;
+    w.e = biased - 1075;
+  }
+  // halfway to the neighbours, the lower one closer at a power of two
+  NumberFp plus = { (w.f << 1) + 1, w.e - 1 };
+  NumberFp minus = { (w.f << 1) - 1, w.e - 1 };
+  if(!significand && biased > 1) {
+    minus.f = (w.f << 2) - 1;
+    minus.e = w.e - 2;
+  }
+  plus = numberNormalize(plus);
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+  w = numberNormalize(w);
+
+  // a power of ten that scales the exponents into [-60, -32]
+  int k = (int)ceil((-60 - (w.e + 64) + 63) * 0.30102999566398114);
+  const struct _number_power_t* power = &numberPowers[(348 + k - 1) / 8 + 1];
+  NumberFp scale = { power->f, power->e };
+  int kappa;
+  int certain = numberDigitGen(numberMultiply(minus, scale), numberMultiply(w, scale),
+                               numberMultiply(plus, scale), digits, length, &kappa);
+  *exponent = kappa - power->k;
+  return certain;
+}
+
+// the same, by trying more and more digits with snprintf
+void numberShortest(double number, char* digits, int* length, int* exponent)
+{
+  char text[NUMBER_LENGTH];
+  for(int precision = 1; precision <= NUMBER_DIGITS; precision++) {
+    snprintf(text, NUMBER_LENGTH, "%.*e", precision - 1, number);
+    if(strtod(text, NULL) == number || precision == NUMBER_DIGITS) {
       break;
     }
   }
-  buffer[trailing + 1] = '\0';
-  printf("%s", buffer);
+  char* e = strchr(text, 'e');
+  *length = 0;
+  for(char* c = text; c < e; c++) {
+    if(*c != '.') {
+      digits[(*length)++] = *c;
+    }
+  }
+  *exponent = atoi(e + 1) - (*length - 1);
+}
+
+
+
+/* formatting */
+
+// writes the double into buffer, of NUMBER_LENGTH characters, returns the length
+int numberFormatDouble(double number, char* buffer)
+{
+  char* c = buffer;
+  if(signbit(number)) {
+    *c++ = '-';
+    number = -number;
+  }
+  if(!isfinite(number) || number == 0) {
+    const char* text = isnan(number) ? "nan" : isinf(number) ? "inf" : "0.0";
+    strcpy(c, text);
+    return c - buffer + strlen(text);
+  }
+
+  char digits[NUMBER_DIGITS + 2];
+  int length, exponent;
+  if(!numberGrisu(number, digits, &length, &exponent)) {
+    numberShortest(number, digits, &length, &exponent);
+  }
+
+  int point = length + exponent;
+  if(NUMBER_FIXED_MIN <= point && point <= NUMBER_FIXED_MAX) {
+    if(point <= 0) {
+      // 0.000ddd
+      *c++ = '0';
+      *c++ = '.';
+      memset(c, '0', -point);
+      c += -point;
+      memcpy(c, digits, length);
+      c += length;
+    }
+    else if(point >= length) {
+      // ddd000.0
+      memcpy(c, digits, length);
+      memset(c + length, '0', point - length);
+      c += point;
+      *c++ = '.';
+      *c++ = '0';
+    }
+    else {
+      // ddd.ddd
+      memcpy(c, digits, point);
+      c += point;
+      *c++ = '.';
+      memcpy(c, digits + point, length - point);
+      c += length - point;
+    }
+  }
+  else {
+    // d.ddde-ddd
+    *c++ = digits[0];
+    *c++ = '.';
+    if(length > 1) {
+      memcpy(c, digits + 1, length - 1);
+      c += length - 1;
+    }
+    else {
+      *c++ = '0';
+    }
+    *c++ = 'e';
+    int scientific = point - 1;
+    if(scientific < 0) {
+      *c++ = '-';
+      scientific = -scientific;
+    }
+    if(scientific >= 100) {
+      *c++ = '0' + scientific / 100;
+    }
+    if(scientific >= 10) {
+      *c++ = '0' + scientific / 10 % 10;
+    }
+    *c++ = '0' + scientific % 10;
+  }
+  *c = '\0';
+  return c - buffer;
+}
+
+void numberPrintDouble(double number)
+{
+  char buffer[NUMBER_LENGTH];
+  fwrite(buffer, 1, numberFormatDouble(number, buffer), stdout);
 }
 
 
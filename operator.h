@@ -26,25 +26,36 @@ typedef enum _operator_t Operator;
 
 
 /* utility functions for operator type */
-void operatorPrint(Operator operator)
+
+// the symbol of an operator, or NULL if it is invalid
+const char* operatorName(Operator operator)
 {
   switch(operator)
   {
-  case OPERATOR_EQUAL:         printf("=");  break;
-  case OPERATOR_LESS:          printf("<");  break;
-  case OPERATOR_LESS_EQUAL:    printf("<="); break;
-  case OPERATOR_GREATER:       printf(">");  break;
-  case OPERATOR_GREATER_EQUAL: printf(">="); break;
-  case OPERATOR_PLUS:          printf("+");  break;
-  case OPERATOR_MINUS:         printf("-");  break;
-  case OPERATOR_MULTIPLY:      printf("*");  break;
-  case OPERATOR_DIVIDE:        printf("/");  break;
-  case OPERATOR_MODULUS:       printf("%%"); break;
-  case OPERATOR_POWER:         printf("**"); break;
+  case OPERATOR_EQUAL:         return "=";
+  case OPERATOR_LESS:          return "<";
+  case OPERATOR_LESS_EQUAL:    return "<=";
+  case OPERATOR_GREATER:       return ">";
+  case OPERATOR_GREATER_EQUAL: return ">=";
+  case OPERATOR_PLUS:          return "+";
+  case OPERATOR_MINUS:         return "-";
+  case OPERATOR_MULTIPLY:      return "*";
+  case OPERATOR_DIVIDE:        return "/";
+  case OPERATOR_MODULUS:       return "%";
+  case OPERATOR_POWER:         return "**";
   default:
+    return NULL;
+  }
+}
+
+void operatorPrint(Operator operator)
+{
+  const char* name = operatorName(operator);
+  if(!name) {
     printf("operator print: invalid operator type\n");
-    break;
+    return;
   }
+  printf("%s", name);
 }
 
 
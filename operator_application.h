@@ -7,15 +7,51 @@
 #include "sexp.h"
 #include "operator.h"
 #include "exception.h"
+#include "matrix.h"
+#include "bignum.h"
 
 /*
  * Since PLD C-LISP is a weakly-typed, interpreted language,
  * it is a design choice to implicitly convert operands from int to double
  * when performing calculations.
+ * Integers are longs, and a result which overflows one is a bignum, see
+ * bignum.h. A bignum with a double is converted to a double as well.
  */
+
+// is either operand a bignum, and the other an integer or a double?
+int applyIsBignumOperation(Sexp num1, Sexp num2)
+{
+  if(SEXP_TYPE_OF(num1) != SEXP_TYPE_BIGNUM && SEXP_TYPE_OF(num2) != SEXP_TYPE_BIGNUM) {
+    return 0;
+  }
+  return (bignumIsInteger(num1) || SEXP_TYPE_OF(num1) == SEXP_TYPE_DOUBLE) &&
+    (bignumIsInteger(num2) || SEXP_TYPE_OF(num2) == SEXP_TYPE_DOUBLE);
+}
+
+Sexp applyOperator(Sexp num1, Sexp num2, Operator operator);
+
+Sexp applyBignumOperator(Sexp num1, Sexp num2, Operator operator)
+{
+  if(SEXP_TYPE_OF(num1) != SEXP_TYPE_DOUBLE && SEXP_TYPE_OF(num2) != SEXP_TYPE_DOUBLE) {
+    return bignumApplyOperator(num1, num2, operator);
+  }
+  Sexp arg1 = (SEXP_TYPE_OF(num1) == SEXP_TYPE_DOUBLE) ?
+    sexpCopy(num1) : sexpCreateDouble(bignumIntegerToDouble(num1));
+  Sexp arg2 = (SEXP_TYPE_OF(num2) == SEXP_TYPE_DOUBLE) ?
+    sexpCopy(num2) : sexpCreateDouble(bignumIntegerToDouble(num2));
+  Sexp result = applyOperator(arg1, arg2, operator);
+  sexpFree(arg1);
+  sexpFree(arg2);
+  return result;
+}
+
 Sexp applyEqualityOperator(Sexp num1, Sexp num2, Operator operator)
 {
-  if(num1->type == SEXP_TYPE_INTEGER && num2->type == SEXP_TYPE_INTEGER) {
+  if(applyIsBignumOperation(num1, num2)) {
+    return applyBignumOperator(num1, num2, operator);
+  }
+
+  if(SEXP_TYPE_OF(num1) == SEXP_TYPE_INTEGER && SEXP_TYPE_OF(num2) == SEXP_TYPE_INTEGER) {
     switch(operator)
     {
     case OPERATOR_EQUAL:
@@ -35,7 +71,7 @@ Sexp applyEqualityOperator(Sexp num1, Sexp num2, Operator operator)
     }
   }
 
-  else if(num1->type == SEXP_TYPE_INTEGER && num2->type == SEXP_TYPE_DOUBLE) {
+  else if(SEXP_TYPE_OF(num1) == SEXP_TYPE_INTEGER && SEXP_TYPE_OF(num2) == SEXP_TYPE_DOUBLE) {
     double arg1 = (double)num1->value.integer;
     switch(operator)
     {
@@ -56,7 +92,7 @@ Sexp applyEqualityOperator(Sexp num1, Sexp num2, Operator operator)
     }
   }
 
-  else if(num1->type == SEXP_TYPE_DOUBLE && num2->type == SEXP_TYPE_INTEGER) {
+  else if(SEXP_TYPE_OF(num1) == SEXP_TYPE_DOUBLE && SEXP_TYPE_OF(num2) == SEXP_TYPE_INTEGER) {
     double arg2 = (double)num2->value.integer;
     switch(operator)
     {
@@ -77,7 +113,7 @@ Sexp applyEqualityOperator(Sexp num1, Sexp num2, Operator operator)
     }
   }
 
-  else if(num1->type == SEXP_TYPE_DOUBLE && num2->type == SEXP_TYPE_DOUBLE) {
+  else if(SEXP_TYPE_OF(num1) == SEXP_TYPE_DOUBLE && SEXP_TYPE_OF(num2) == SEXP_TYPE_DOUBLE) {
     switch(operator)
     {
     case OPERATOR_EQUAL:
@@ -106,18 +142,20 @@ Sexp applyEqualityOperator(Sexp num1, Sexp num2, Operator operator)
 
 Sexp applyArithmeticOperator(Sexp num1, Sexp num2, Operator operator)
 {
-  if(num1->type == SEXP_TYPE_STRING && num2->type == SEXP_TYPE_STRING) {
-    int len = 0;
-    // space for terminating '\0' character
-    len = strlen(num1->value.string) + strlen(num2->value.string) + 1;
-    char buffer[len];
-    int written;
+  if(SEXP_TYPE_OF(num1) == SEXP_TYPE_MATRIX || SEXP_TYPE_OF(num2) == SEXP_TYPE_MATRIX) {
+    return matrixApplyOperator(num1, num2, operator);
+  }
+
+  if(applyIsBignumOperation(num1, num2)) {
+    return applyBignumOperator(num1, num2, operator);
+  }
+
+  if(SEXP_TYPE_OF(num1) == SEXP_TYPE_STRING && SEXP_TYPE_OF(num2) == SEXP_TYPE_STRING) {
     switch(operator)
     {
     case OPERATOR_PLUS:
-      written = sprintf(buffer, "%s", num1->value.string);
-      written += sprintf(&buffer[written], "%s", num2->value.string);
-      return sexpCreateString(buffer);
+      return sexpCreateStringOf(sexpStringAppend(num1->value.string,
+                                                 num2->value.string));
     case OPERATOR_MINUS:
     case OPERATOR_MULTIPLY:
     case OPERATOR_DIVIDE:
@@ -134,21 +172,35 @@ Sexp applyArithmeticOperator(Sexp num1, Sexp num2, Operator operator)
     }
   }
 
-  else if(num1->type == SEXP_TYPE_INTEGER && num2->type == SEXP_TYPE_INTEGER) {
+  else if(SEXP_TYPE_OF(num1) == SEXP_TYPE_INTEGER && SEXP_TYPE_OF(num2) == SEXP_TYPE_INTEGER) {
+    long result;
     switch(operator)
     {
     case OPERATOR_PLUS:
-      return sexpCreateInteger(num1->value.integer + num2->value.integer);
+      if(__builtin_add_overflow(num1->value.integer, num2->value.integer, &result)) {
+        return bignumApplyOperator(num1, num2, operator);
+      }
+      return sexpCreateInteger(result);
     case OPERATOR_MINUS:
-      return sexpCreateInteger(num1->value.integer - num2->value.integer);
+      if(__builtin_sub_overflow(num1->value.integer, num2->value.integer, &result)) {
+        return bignumApplyOperator(num1, num2, operator);
+      }
+      return sexpCreateInteger(result);
     case OPERATOR_MULTIPLY:
-      return sexpCreateInteger(num1->value.integer * num2->value.integer);
+      if(__builtin_mul_overflow(num1->value.integer, num2->value.integer, &result)) {
+        return bignumApplyOperator(num1, num2, operator);
+      }
+      return sexpCreateInteger(result);
     case OPERATOR_DIVIDE:
       if(num2->value.integer == 0) {
         printf("! divion by zero\n");
         throwException();
         return NULL;
       }
+      if(num2->value.integer == -1) {
+        // LONG_MIN / -1 overflows
+        return applyArithmeticOperator(num1, num2, OPERATOR_MULTIPLY);
+      }
       return sexpCreateInteger(num1->value.integer / num2->value.integer);
     case OPERATOR_MODULUS:
       if(num2->value.integer == 0) {
@@ -156,6 +208,9 @@ Sexp applyArithmeticOperator(Sexp num1, Sexp num2, Operator operator)
         throwException();
         return NULL;
       }
+      if(num2->value.integer == -1) {
+        return sexpCreateInteger(0);
+      }
       return sexpCreateInteger(num1->value.integer % num2->value.integer);
     case OPERATOR_POWER:
       if(num1->value.integer == 0 && num2->value.integer == 0) {
@@ -168,8 +223,7 @@ Sexp applyArithmeticOperator(Sexp num1, Sexp num2, Operator operator)
         throwException();
         return NULL;
       }
-      return sexpCreateInteger((int)pow((double)num1->value.integer,
-                                        (double)num2->value.integer));
+      return bignumPower(num1, num2->value.integer);
     default:
       printf("apply arithmetic operator: invalid operator type\n");
       throwException();
@@ -177,7 +231,7 @@ Sexp applyArithmeticOperator(Sexp num1, Sexp num2, Operator operator)
     }
   }
 
-  else if(num1->type == SEXP_TYPE_DOUBLE && num2->type == SEXP_TYPE_DOUBLE) {
+  else if(SEXP_TYPE_OF(num1) == SEXP_TYPE_DOUBLE && SEXP_TYPE_OF(num2) == SEXP_TYPE_DOUBLE) {
     switch(operator)
     {
     case OPERATOR_PLUS:
@@ -209,7 +263,7 @@ Sexp applyArithmeticOperator(Sexp num1, Sexp num2, Operator operator)
     }
   }
 
-  else if(num1->type == SEXP_TYPE_INTEGER && num2->type == SEXP_TYPE_DOUBLE) {
+  else if(SEXP_TYPE_OF(num1) == SEXP_TYPE_INTEGER && SEXP_TYPE_OF(num2) == SEXP_TYPE_DOUBLE) {
     double arg1 = (double)num1->value.integer;
     switch(operator)
     {
@@ -243,7 +297,7 @@ Sexp applyArithmeticOperator(Sexp num1, Sexp num2, Operator operator)
     }
   }
 
-  else if(num1->type == SEXP_TYPE_DOUBLE && num2->type == SEXP_TYPE_INTEGER) {
+  else if(SEXP_TYPE_OF(num1) == SEXP_TYPE_DOUBLE && SEXP_TYPE_OF(num2) == SEXP_TYPE_INTEGER) {
     double arg2 = (double)num2->value.integer;
     switch(operator)
     {
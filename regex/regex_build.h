@@ -5,26 +5,317 @@
 #include <string.h>
 #include "regex_types.h"
 
-Regex regexBuild(const char* string)
+/*
+ * Patterns are made of characters, which match themselves, and
+ *   .          any character
+ *   [abc] [a-z] [^...]  a character of a set, or not of it
+ *   \d \w \s   a digit, a word character or a space
+ *   \c         the character c, e.g. \. or \*
+ *   r* r+ r?   repetitions
+ *   r|s (r)    alternation and grouping
+ * On a malformed pattern, regexBuild returns NULL and sets regexError.
+ */
+const char* regexError = NULL;
+
+struct _regex_parser_t {
+  const char* pattern;
+  size_t length;
+  size_t position;
+};
+
+Regex regexParseAlternation(struct _regex_parser_t* parser);
+
+int regexParserAtEnd(struct _regex_parser_t* parser)
+{
+  return parser->position == parser->length;
+}
+
+char regexParserPeek(struct _regex_parser_t* parser)
+{
+  return parser->pattern[parser->position];
+}
+
+Regex regexParseFailed(const char* error, Regex regex)
 {
-  int len = strlen(string);
-  Regex regex = regexAlloc();
+  regexError = error;
+  regexFree(regex);
+  return NULL;
+}
 
-  for(int i = 0; i < len; i++)
+// adds the class of an escaped character to the set, e.g. \d
+void regexParseEscape(unsigned char* set, char c)
+{
+  switch(c)
   {
-    char ch = string[i];
-    if('A' <= ch && ch <= 'z') {
-      regex->type = REGEX_TYPE_SYMBOL;
-      regex->value.symbol = ch;
+  case 'd':
+    regexSetAdd(set, '0', '9');
+    break;
+  case 'w':
+    regexSetAdd(set, 'a', 'z');
+    regexSetAdd(set, 'A', 'Z');
+    regexSetAdd(set, '0', '9');
+    regexSetAdd(set, '_', '_');
+    break;
+  case 's':
+    regexSetAdd(set, ' ', ' ');
+    regexSetAdd(set, '\t', '\r'); // \t \n \v \f \r
+    break;
+  case 'n':
+    regexSetAdd(set, '\n', '\n');
+    break;
+  case 't':
+    regexSetAdd(set, '\t', '\t');
+    break;
+  default:
+    regexSetAdd(set, (unsigned char)c, (unsigned char)c);
+  }
+}
+
+// parses a set, after its '['
+Regex regexParseSet(struct _regex_parser_t* parser)
+{
+  Regex regex = regexCreateCharacters();
+  int negated = !regexParserAtEnd(parser) && regexParserPeek(parser) == '^';
+  parser->position += negated;
+
+  // a ']' first in the set is a character of it
+  int first = 1;
+  while(!regexParserAtEnd(parser) && (first || regexParserPeek(parser) != ']')) {
+    first = 0;
+    unsigned char c = regexParserPeek(parser);
+    parser->position++;
+    if(c == '\\') {
+      if(regexParserAtEnd(parser)) {
+        break;
+      }
+      regexParseEscape(regex->value.set, regexParserPeek(parser));
+      parser->position++;
+      continue;
     }
-    else if('0' <= ch && ch <= '9') {
-      regex->type = REGEX_TYPE_DIGIT;
-      regex->value.digit = ch;
+    unsigned char last = c;
+    if(parser->position + 1 < parser->length && regexParserPeek(parser) == '-' &&
+       parser->pattern[parser->position + 1] != ']') {
+      last = parser->pattern[parser->position + 1];
+      parser->position += 2;
+      if(last < c) {
+        return regexParseFailed("a range ending before its start", regex);
+      }
     }
+    regexSetAdd(regex->value.set, c, last);
   }
+  if(regexParserAtEnd(parser)) {
+    return regexParseFailed("a set without ']'", regex);
+  }
+  parser->position++;
 
+  if(negated) {
+    for(int i = 0; i < 32; i++) {
+      regex->value.set[i] = ~regex->value.set[i];
+    }
+  }
   return regex;
 }
 
+Regex regexParseAtom(struct _regex_parser_t* parser)
+{
+  char c = regexParserPeek(parser);
+  parser->position++;
+  Regex regex = NULL;
+  switch(c)
+  {
+  case '(':
+    regex = regexParseAlternation(parser);
+    if(!regex) {
+      return NULL;
+    }
+    if(regexParserAtEnd(parser) || regexParserPeek(parser) != ')') {
+      return regexParseFailed("a '(' without ')'", regex);
+    }
+    parser->position++;
+    return regex;
+  case '[':
+    return regexParseSet(parser);
+  case '.':
+    regex = regexCreateCharacters();
+    regexSetAdd(regex->value.set, 0, 255);
+    return regex;
+  case '\\':
+    if(regexParserAtEnd(parser)) {
+      return regexParseFailed("a '\\' at the end", NULL);
+    }
+    regex = regexCreateCharacters();
+    regexParseEscape(regex->value.set, regexParserPeek(parser));
+    parser->position++;
+    return regex;
+  case '*':
+  case '+':
+  case '?':
+    return regexParseFailed("a repetition of nothing", NULL);
+  default:
+    return regexCreateSymbol(c);
+  }
+}
+
+Regex regexParseRepetition(struct _regex_parser_t* parser)
+{
+  Regex regex = regexParseAtom(parser);
+  while(regex && !regexParserAtEnd(parser)) {
+    switch(regexParserPeek(parser))
+    {
+    case '*':
+      regex = regexCreateNode(REGEX_TYPE_STAR, regex, NULL);
+      break;
+    case '+':
+      regex = regexCreateNode(REGEX_TYPE_PLUS, regex, NULL);
+      break;
+    case '?':
+      regex = regexCreateNode(REGEX_TYPE_OPTIONAL, regex, NULL);
+      break;
+    default:
+      return regex;
+    }
+    parser->position++;
+  }
+  return regex;
+}
+
+Regex regexParseConcatenation(struct _regex_parser_t* parser)
+{
+  Regex regex = NULL;
+  while(!regexParserAtEnd(parser) && regexParserPeek(parser) != '|' &&
+        regexParserPeek(parser) != ')') {
+    Regex next = regexParseRepetition(parser);
+    if(!next) {
+      return regexParseFailed(regexError, regex);
+    }
+    regex = (regex) ? regexCreateNode(REGEX_TYPE_CONCAT, regex, next) : next;
+  }
+  return (regex) ? regex : regexCreateEpsilon();
+}
+
+Regex regexParseAlternation(struct _regex_parser_t* parser)
+{
+  Regex regex = regexParseConcatenation(parser);
+  while(regex && !regexParserAtEnd(parser) && regexParserPeek(parser) == '|') {
+    parser->position++;
+    Regex next = regexParseConcatenation(parser);
+    if(!next) {
+      return regexParseFailed(regexError, regex);
+    }
+    regex = regexCreateNode(REGEX_TYPE_OR, regex, next);
+  }
+  return regex;
+}
+
+Regex regexBuild(const char* pattern, size_t length)
+{
+  struct _regex_parser_t parser = { pattern, length, 0 };
+  Regex regex = regexParseAlternation(&parser);
+  if(regex && !regexParserAtEnd(&parser)) {
+    return regexParseFailed("a ')' without '('", regex);
+  }
+  return regex;
+}
+
+
+
+/* compiling to automata */
+int regexAutomatonAdd(RegexAutomaton automaton, enum _regex_state_type_t type,
+                      int out0, int out1)
+{
+  if(automaton->count == automaton->capacity) {
+    automaton->capacity *= 2;
+    automaton->states = realloc(automaton->states,
+                                sizeof(struct _regex_state_t) * automaton->capacity);
+  }
+  struct _regex_state_t* state = &automaton->states[automaton->count];
+  state->type = type;
+  state->out[0] = out0;
+  state->out[1] = out1;
+  return automaton->count++;
+}
+
+/*
+ * Adds the states matching the regex followed by the state next, and returns
+ * the first of them. The backward automaton takes concatenations in reverse.
+ */
+int regexCompileTo(RegexAutomaton automaton, Regex regex, int next, int backward)
+{
+  int state = 0;
+  int first = 0;
+  switch(regex->type)
+  {
+  case REGEX_TYPE_EPSILON:
+    return next;
+  case REGEX_TYPE_CHARACTERS:
+    state = regexAutomatonAdd(automaton, REGEX_STATE_CHARACTERS, next, -1);
+    memcpy(automaton->states[state].set, regex->value.set, 32);
+    return state;
+  case REGEX_TYPE_CONCAT:
+    first = regexCompileTo(automaton, regex->value.children[!backward], next, backward);
+    return regexCompileTo(automaton, regex->value.children[backward], first, backward);
+  case REGEX_TYPE_OR:
+    first = regexCompileTo(automaton, regex->value.children[0], next, backward);
+    state = regexCompileTo(automaton, regex->value.children[1], next, backward);
+    return regexAutomatonAdd(automaton, REGEX_STATE_SPLIT, first, state);
+  case REGEX_TYPE_STAR:
+    state = regexAutomatonAdd(automaton, REGEX_STATE_SPLIT, -1, next);
+    first = regexCompileTo(automaton, regex->value.children[0], state, backward);
+    automaton->states[state].out[0] = first;
+    return state;
+  case REGEX_TYPE_PLUS:
+    state = regexAutomatonAdd(automaton, REGEX_STATE_SPLIT, -1, next);
+    first = regexCompileTo(automaton, regex->value.children[0], state, backward);
+    automaton->states[state].out[0] = first;
+    return first;
+  case REGEX_TYPE_OPTIONAL:
+    first = regexCompileTo(automaton, regex->value.children[0], next, backward);
+    return regexAutomatonAdd(automaton, REGEX_STATE_SPLIT, first, next);
+  default:
+    printf("regex compile: invalid regex type\n");
+    return next;
+  }
+}
+
+void regexAutomatonInit(RegexAutomaton automaton, Regex regex, int backward)
+{
+  automaton->count = 0;
+  automaton->capacity = 16;
+  automaton->states = malloc(sizeof(struct _regex_state_t) * automaton->capacity);
+  int match = regexAutomatonAdd(automaton, REGEX_STATE_MATCH, -1, -1);
+  automaton->start = regexCompileTo(automaton, regex, match, backward);
+  if(backward) {
+    // .* in front, so the match may begin anywhere
+    int loop = regexAutomatonAdd(automaton, REGEX_STATE_SPLIT, automaton->start, -1);
+    int any = regexAutomatonAdd(automaton, REGEX_STATE_CHARACTERS, loop, -1);
+    memset(automaton->states[any].set, 0xff, 32);
+    automaton->states[loop].out[1] = any;
+    automaton->start = loop;
+  }
+
+  automaton->dfaCount = 0;
+  automaton->dfaCapacity = 64;
+  automaton->dfa = calloc(automaton->dfaCapacity, sizeof(RegexDfaState));
+  automaton->dfaStart = NULL;
+  automaton->work = malloc(sizeof(int) * automaton->count);
+  automaton->stack = malloc(sizeof(int) * automaton->count);
+  automaton->marks = calloc(automaton->count, sizeof(unsigned int));
+  automaton->generation = 0;
+  automaton->flushes = 0;
+}
+
+RegexProgram regexCompile(const char* pattern, size_t length)
+{
+  Regex regex = regexBuild(pattern, length);
+  if(!regex) {
+    return NULL;
+  }
+  RegexProgram program = malloc(sizeof(struct _regex_program_t));
+  regexAutomatonInit(&program->forward, regex, 0);
+  regexAutomatonInit(&program->backward, regex, 1);
+  regexFree(regex);
+  return program;
+}
+
 
 #endif // PLD_LISP_REGEX_BUILD_H
@@ -1,12 +1,230 @@
 #ifndef PLD_LISP_REGEX_EVAL_H
 #define PLD_LISP_REGEX_EVAL_H
 
+#include <stdlib.h>
+#include <string.h>
 #include "regex_types.h"
+#include "regex_build.h"
 
-int regexEvalIsMatch(Regex regex, const char* string)
+#define REGEX_DFA_LIMIT 1024 // states of a DFA kept at once, 2 kB each
+
+/*
+ * The automata are run as DFAs built while matching: a state of the DFA is
+ * computed the first time a character leads to it, and the transition is then
+ * stored in the state it was taken from. Matching a text thus costs a table
+ * lookup per character once the states it needs exist, and the number of
+ * states is bounded by the texts matched rather than by the pattern. When a
+ * DFA reaches REGEX_DFA_LIMIT states, it is thrown away and built again.
+ */
+
+/* building the DFA */
+void regexDfaClear(RegexAutomaton automaton)
+{
+  for(int i = 0; i < automaton->dfaCapacity; i++) {
+    free(automaton->dfa[i]);
+    automaton->dfa[i] = NULL;
+  }
+  automaton->dfaCount = 0;
+  automaton->dfaStart = NULL;
+}
+
+void regexClosureBegin(RegexAutomaton automaton)
+{
+  if(!++automaton->generation) {
+    memset(automaton->marks, 0, sizeof(unsigned int) * automaton->count);
+    automaton->generation = 1;
+  }
+}
+
+// adds the state, and those it reaches without a character, to the work list
+int regexClosureAdd(RegexAutomaton automaton, int state, int count)
+{
+  int top = 0;
+  automaton->stack[top++] = state;
+  automaton->marks[state] = automaton->generation;
+  while(top) {
+    struct _regex_state_t* next = &automaton->states[automaton->stack[--top]];
+    if(next->type != REGEX_STATE_SPLIT) {
+      automaton->work[count++] = next - automaton->states;
+      continue;
+    }
+    // out[1] is pushed first, so states are visited in order
+    for(int i = 1; i >= 0; i--) {
+      if(automaton->marks[next->out[i]] != automaton->generation) {
+        automaton->marks[next->out[i]] = automaton->generation;
+        automaton->stack[top++] = next->out[i];
+      }
+    }
+  }
+  return count;
+}
+
+int regexCompareStates(const void* a, const void* b)
+{
+  return *(const int*)a - *(const int*)b;
+}
+
+// the state of the DFA for the count states in the work list, added if new
+RegexDfaState regexDfaLookup(RegexAutomaton automaton, int count)
+{
+  qsort(automaton->work, count, sizeof(int), regexCompareStates);
+  unsigned long hash = 14695981039346656037ul;
+  for(int i = 0; i < count; i++) {
+    hash = (hash ^ (unsigned long)automaton->work[i]) * 1099511628211ul;
+  }
+
+  unsigned long mask = automaton->dfaCapacity - 1;
+  unsigned long slot = hash & mask;
+  for(RegexDfaState state; (state = automaton->dfa[slot]); slot = (slot + 1) & mask) {
+    if(state->hash == hash && state->count == count &&
+       !memcmp(state->states, automaton->work, sizeof(int) * count)) {
+      return state;
+    }
+  }
+
+  if(automaton->dfaCount == REGEX_DFA_LIMIT) {
+    regexDfaClear(automaton);
+    automaton->flushes++;
+    slot = hash & mask;
+  }
+  else if(2 * (automaton->dfaCount + 1) > automaton->dfaCapacity) {
+    // grow, rehashing the states
+    RegexDfaState* old = automaton->dfa;
+    int capacity = automaton->dfaCapacity;
+    automaton->dfaCapacity *= 2;
+    automaton->dfa = calloc(automaton->dfaCapacity, sizeof(RegexDfaState));
+    mask = automaton->dfaCapacity - 1;
+    for(int i = 0; i < capacity; i++) {
+      if(old[i]) {
+        unsigned long j = old[i]->hash & mask;
+        while(automaton->dfa[j]) j = (j + 1) & mask;
+        automaton->dfa[j] = old[i];
+      }
+    }
+    free(old);
+    for(slot = hash & mask; automaton->dfa[slot]; slot = (slot + 1) & mask);
+  }
+
+  RegexDfaState state = calloc(1, sizeof(struct _regex_dfa_state_t) +
+                               sizeof(int) * count);
+  state->hash = hash;
+  state->count = count;
+  memcpy(state->states, automaton->work, sizeof(int) * count);
+  for(int i = 0; i < count; i++) {
+    if(automaton->states[state->states[i]].type == REGEX_STATE_MATCH) {
+      state->accepting = 1;
+    }
+  }
+  automaton->dfa[slot] = state;
+  automaton->dfaCount++;
+  return state;
+}
+
+RegexDfaState regexDfaStart(RegexAutomaton automaton)
+{
+  if(!automaton->dfaStart) {
+    regexClosureBegin(automaton);
+    int count = regexClosureAdd(automaton, automaton->start, 0);
+    RegexDfaState start = regexDfaLookup(automaton, count);
+    automaton->dfaStart = start;
+  }
+  return automaton->dfaStart;
+}
+
+// the state reached on c, which is stored as a transition of from
+RegexDfaState regexDfaStep(RegexAutomaton automaton, RegexDfaState from, unsigned char c)
+{
+  RegexDfaState next = from->next[c];
+  if(next) {
+    return next;
+  }
+
+  regexClosureBegin(automaton);
+  int count = 0;
+  for(int i = 0; i < from->count; i++) {
+    struct _regex_state_t* state = &automaton->states[from->states[i]];
+    if(state->type == REGEX_STATE_CHARACTERS && regexSetContains(state->set, c) &&
+       automaton->marks[state->out[0]] != automaton->generation) {
+      count = regexClosureAdd(automaton, state->out[0], count);
+    }
+  }
+  unsigned int flushes = automaton->flushes;
+  next = regexDfaLookup(automaton, count);
+  if(flushes == automaton->flushes) {
+    from->next[c] = next; // from is gone if the DFA was thrown away
+  }
+  return next;
+}
+
+
+
+/* matching */
+
+// does the whole string match?
+int regexEvalIsMatch(RegexProgram program, const char* string, size_t length)
+{
+  RegexAutomaton automaton = &program->forward;
+  RegexDfaState state = regexDfaStart(automaton);
+  for(size_t i = 0; i < length && state->count; i++) {
+    state = regexDfaStep(automaton, state, string[i]);
+  }
+  return state->accepting;
+}
+
+/*
+ * Finds the leftmost match in the string, and the longest one starting there.
+ * Reading the string backwards, the backward automaton accepts at each index
+ * where a match starts, so the last index it accepts at is the leftmost. The
+ * forward automaton then reads on from there until it cannot match any more.
+ * Both take linear time. Is there a match?
+ */
+int regexEvalFind(RegexProgram program, const char* string, size_t length,
+                  size_t* start, size_t* end)
+{
+  RegexAutomaton automaton = &program->backward;
+  RegexDfaState state = regexDfaStart(automaton);
+  size_t first = (state->accepting) ? length : length + 1;
+  for(size_t i = length; i-- > 0;) {
+    state = regexDfaStep(automaton, state, string[i]);
+    if(state->accepting) {
+      first = i;
+    }
+  }
+  if(first > length) {
+    return 0;
+  }
+
+  automaton = &program->forward;
+  state = regexDfaStart(automaton);
+  size_t last = first;
+  for(size_t i = first; i < length && state->count;) {
+    state = regexDfaStep(automaton, state, string[i++]);
+    if(state->accepting) {
+      last = i;
+    }
+  }
+  *start = first;
+  *end = last;
+  return 1;
+}
+
+void regexAutomatonFree(RegexAutomaton automaton)
+{
+  regexDfaClear(automaton);
+  free(automaton->dfa);
+  free(automaton->states);
+  free(automaton->work);
+  free(automaton->stack);
+  free(automaton->marks);
+}
+
+void regexProgramFree(RegexProgram program)
 {
-  return 0;
+  regexAutomatonFree(&program->forward);
+  regexAutomatonFree(&program->backward);
+  free(program);
 }
 
 
+#undef REGEX_DFA_LIMIT
 #endif // PLD_LISP_REGEX_EVAL_H
@@ -1,17 +1,142 @@
+#include <assert.h>
+#include <regex.h> // POSIX, for comparison
 #include "regex_types.h"
 #include "regex_build.h"
+#include "regex_eval.h"
+#include "../timer.h"
 
-void test(const char* str)
+/*
+ * Tests of the regex compiler and matcher, and a benchmark against the
+ * POSIX regexec of the C library, e.g.
+ *   gcc regex_test.c -o regex_test -O2 && ./regex_test
+ */
+#define LINES 100000
+
+void testMatch(const char* pattern, const char* string, int expected)
 {
-  Regex reg = regexBuild(str);
-  regexPrintDebug(reg);
-  printf("\n");
+  RegexProgram program = regexCompile(pattern, strlen(pattern));
+  assert(program);
+  if(regexEvalIsMatch(program, string, strlen(string)) != expected) {
+    printf("\"%s\" %s \"%s\"\n", pattern,
+           (expected) ? "does not match" : "matches", string);
+    assert(0);
+  }
+  regexProgramFree(program);
+}
+
+void testFind(const char* pattern, const char* string, const char* expected)
+{
+  RegexProgram program = regexCompile(pattern, strlen(pattern));
+  assert(program);
+  size_t start = 0;
+  size_t end = 0;
+  int found = regexEvalFind(program, string, strlen(string), &start, &end);
+  if(found != (expected != NULL) ||
+     (found && (end - start != strlen(expected) ||
+                memcmp(string + start, expected, end - start)))) {
+    printf("\"%s\" finds \"%.*s\" in \"%s\"\n", pattern,
+           (int)(end - start), string + start, string);
+    assert(0);
+  }
+  regexProgramFree(program);
+}
+
+void testMalformed(const char* pattern)
+{
+  assert(!regexCompile(pattern, strlen(pattern)));
+  assert(regexError);
+}
+
+void testDfaLimit()
+{
+  // (a|b)*a(a|b){12} needs more states than a DFA may keep
+  const char* pattern = "(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)";
+  RegexProgram program = regexCompile(pattern, strlen(pattern));
+  char string[LINES];
+  unsigned int random = 1;
+  for(size_t i = 0; i < LINES; i++) {
+    random = random * 1103515245 + 12345;
+    string[i] = (random >> 16) & 1 ? 'a' : 'b';
+  }
+  for(size_t i = 13; i < LINES; i += 997) {
+    assert(regexEvalIsMatch(program, string, i) == (string[i - 13] == 'a'));
+  }
+  assert(program->forward.flushes > 0);
+  regexProgramFree(program);
+}
+
+void benchmark()
+{
+  const char* pattern = "[a-z]+[0-9]*@[a-z]+\\.(com|org|net)";
+  static char lines[LINES][32];
+  for(int i = 0; i < LINES; i++) {
+    sprintf(lines[i], (i % 3) ? "user%d@example.%s" : "user%d.example.%s",
+            i, (i % 2) ? "org" : "dk");
+  }
+
+  RegexProgram program = regexCompile(pattern, strlen(pattern));
+  int matches = 0;
+  timerStart();
+  for(int i = 0; i < LINES; i++) {
+    matches += regexEvalIsMatch(program, lines[i], strlen(lines[i]));
+  }
+  fprintf(stderr, "dfa      %d lines: %g ms.\n", LINES, timerStop());
+  regexProgramFree(program);
+
+  regex_t posix;
+  regcomp(&posix, "^[a-z]+[0-9]*@[a-z]+\\.(com|org|net)$", REG_EXTENDED | REG_NOSUB);
+  int posixMatches = 0;
+  timerStart();
+  for(int i = 0; i < LINES; i++) {
+    posixMatches += !regexec(&posix, lines[i], 0, NULL, 0);
+  }
+  fprintf(stderr, "regexec  %d lines: %g ms.\n", LINES, timerStop());
+  regfree(&posix);
+  assert(matches == posixMatches);
 }
 
 int main()
 {
-  test("a"); test("A"); test("z"); test("Z");
-  test("0"); test("9"); test("");
+  testMatch("", "", 1);
+  testMatch("", "a", 0);
+  testMatch("abc", "abc", 1);
+  testMatch("abc", "abcd", 0);
+  testMatch("a.c", "a-c", 1);
+  testMatch("a*", "", 1);
+  testMatch("a*", "aaaa", 1);
+  testMatch("a+", "", 0);
+  testMatch("ab?c", "ac", 1);
+  testMatch("ab?c", "abbc", 0);
+  testMatch("(ab|cd)*", "abcdab", 1);
+  testMatch("(ab|cd)*", "abc", 0);
+  testMatch("[a-c]+x", "abcabx", 1);
+  testMatch("[^0-9]+", "abc", 1);
+  testMatch("[^0-9]+", "ab1", 0);
+  testMatch("[]a]*", "]a]", 1);
+  testMatch("[a-]+", "a-a", 1);
+  testMatch("\\d+\\.\\d+", "3.14", 1);
+  testMatch("\\d+\\.\\d+", "3x14", 0);
+  testMatch("\\w+\\s\\w+", "hello world", 1);
+  testMatch("(a*)*b", "aaab", 1);
+  testMatch("(|a)+", "aa", 1);
+
+  testFind("b+", "abbbc", "bbb");
+  testFind("b*", "abbbc", "");
+  testFind("abcd|c", "xabcd", "abcd");
+  testFind("[0-9]+", "room 101, floor 3", "101");
+  testFind("x", "abc", NULL);
+  testFind("c$", "abc", NULL);
+  testFind("", "", "");
+
+  testMalformed("(a");
+  testMalformed("a)");
+  testMalformed("*a");
+  testMalformed("[abc");
+  testMalformed("[z-a]");
+  testMalformed("a\\");
 
+  testDfaLimit();
+  benchmark();
+  printf("all regex tests passed\n");
   return 0;
 }
@@ -3,22 +3,29 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
-/* regex types */
-union _regex_value_t {
-  void* epsilon;
-  char symbol;
-  char digit;
-  union _regex_value_t* or[2];
-  char range[2];
-};
+/*
+ * A regular expression is built in three steps: regexBuild parses the pattern
+ * into a tree of the types below, regexCompile turns the tree into Thompson
+ * automata, one for each direction, and regex_eval.h runs them as DFAs whose
+ * states are built the first time they are reached.
+ */
 
+/* regex types */
 enum _regex_type_t {
-  REGEX_TYPE_EPSILON,
-  REGEX_TYPE_SYMBOL,
-  REGEX_TYPE_DIGIT,
+  REGEX_TYPE_EPSILON,    // the empty string
+  REGEX_TYPE_CHARACTERS, // any one character of a set
+  REGEX_TYPE_CONCAT,
   REGEX_TYPE_OR,
-  REGEX_TYPE_RANGE
+  REGEX_TYPE_STAR,
+  REGEX_TYPE_PLUS,
+  REGEX_TYPE_OPTIONAL
+};
+
+union _regex_value_t {
+  unsigned char set[32]; // a bit for each character
+  struct _regex_t* children[2]; // only the first for the repetitions
 };
 
 struct _regex_t {
@@ -26,10 +33,69 @@ struct _regex_t {
   union _regex_value_t value;
 };
 
+/* nondeterministic automata */
+enum _regex_state_type_t {
+  REGEX_STATE_CHARACTERS, // goes to out[0] on a character of the set
+  REGEX_STATE_SPLIT,      // goes to out[0] and out[1] without a character
+  REGEX_STATE_MATCH
+};
+
+struct _regex_state_t {
+  enum _regex_state_type_t type;
+  int out[2];
+  unsigned char set[32];
+};
+
+/*
+ * A state of the DFA is a set of states of the automaton, of which only those
+ * reading a character or matching are kept, in increasing order. Transitions
+ * are NULL until they are taken for the first time.
+ */
+struct _regex_dfa_state_t {
+  struct _regex_dfa_state_t* next[256];
+  unsigned long hash;
+  int accepting;
+  int count;
+  int states[];
+};
+
+struct _regex_automaton_t {
+  struct _regex_state_t* states;
+  int count;
+  int capacity;
+  int start;
+
+  // the DFA built so far, its states in a hash table with linear probing
+  struct _regex_dfa_state_t** dfa;
+  int dfaCount;
+  int dfaCapacity;
+  struct _regex_dfa_state_t* dfaStart;
+
+  // scratch space for computing a state of the DFA
+  int* work;
+  int* stack;
+  unsigned int* marks;
+  unsigned int generation;
+  unsigned int flushes; // the number of times the DFA was thrown away
+};
+
+/*
+ * A compiled pattern. The forward automaton is anchored at the start of the
+ * text, the backward automaton reads the text from the end, and may start
+ * matching anywhere, see regexEvalFind.
+ */
+struct _regex_program_t {
+  struct _regex_automaton_t forward;
+  struct _regex_automaton_t backward;
+};
+
 
 
 /* typedefs for easy usage */
 typedef struct _regex_t* Regex;
+typedef struct _regex_automaton_t* RegexAutomaton;
+typedef struct _regex_dfa_state_t* RegexDfaState;
+typedef struct _regex_program_t* RegexProgram;
 
 
 
@@ -43,34 +109,70 @@ Regex regexCreateEpsilon()
 {
   Regex regex = regexAlloc();
   regex->type = REGEX_TYPE_EPSILON;
-  regex->value.epsilon = (void*)NULL;
   return regex;
 }
 
-Regex regexCreateSymbol(char symbol)
+// a set without characters, see regexSetAdd
+Regex regexCreateCharacters()
 {
-  if(!('A' <= symbol && symbol <= 'z')) {
-    printf("regex create symbol: symbol is not within [a-zA-Z] valid range\n");
-    return NULL;
-  }
   Regex regex = regexAlloc();
-  regex->type = REGEX_TYPE_SYMBOL;
-  regex->value.symbol = symbol;
+  regex->type = REGEX_TYPE_CHARACTERS;
+  memset(regex->value.set, 0, sizeof(regex->value.set));
   return regex;
 }
 
-Regex regexCreateDigit(char digit)
+Regex regexCreateSymbol(char symbol)
+{
+  Regex regex = regexCreateCharacters();
+  unsigned char c = (unsigned char)symbol;
+  regex->value.set[c >> 3] |= 1 << (c & 7);
+  return regex;
+}
+
+Regex regexCreateNode(enum _regex_type_t type, Regex first, Regex second)
 {
-  if(!('0' <= digit && digit <= '9')) {
-    printf("regex create digit: digit is not within [0-9] valid range\n");
-    return NULL;
-  }
   Regex regex = regexAlloc();
-  regex->type = REGEX_TYPE_DIGIT;
-  regex->value.digit = digit;
+  regex->type = type;
+  regex->value.children[0] = first;
+  regex->value.children[1] = second;
   return regex;
 }
 
+void regexFree(Regex regex)
+{
+  if(!regex) {
+    return;
+  }
+  switch(regex->type)
+  {
+  case REGEX_TYPE_CONCAT:
+  case REGEX_TYPE_OR:
+    regexFree(regex->value.children[1]);
+    // fall through
+  case REGEX_TYPE_STAR:
+  case REGEX_TYPE_PLUS:
+  case REGEX_TYPE_OPTIONAL:
+    regexFree(regex->value.children[0]);
+    break;
+  default:
+    break;
+  }
+  free(regex);
+}
+
+/* character sets */
+void regexSetAdd(unsigned char* set, unsigned char first, unsigned char last)
+{
+  for(unsigned int c = first; c <= last; c++) {
+    set[c >> 3] |= 1 << (c & 7);
+  }
+}
+
+int regexSetContains(const unsigned char* set, unsigned char c)
+{
+  return (set[c >> 3] >> (c & 7)) & 1;
+}
+
 void regexPrintDebug(Regex regex)
 {
   switch(regex->type)
@@ -78,14 +180,30 @@ void regexPrintDebug(Regex regex)
   case REGEX_TYPE_EPSILON:
     printf("Epsilon");
     break;
-  case REGEX_TYPE_SYMBOL:
-    printf("Symbol \"%c\"", regex->value.symbol);
+  case REGEX_TYPE_CHARACTERS:
+    printf("Characters \"");
+    for(unsigned int c = 0; c < 256; c++) {
+      if(regexSetContains(regex->value.set, c)) {
+        printf((c >= ' ' && c <= '~') ? "%c" : "\\x%02x", c);
+      }
+    }
+    printf("\"");
     break;
+  case REGEX_TYPE_CONCAT:
   case REGEX_TYPE_OR:
-    printf("regex print debug: or not implemented\n");
+    printf((regex->type == REGEX_TYPE_CONCAT) ? "Concat(" : "Or(");
+    regexPrintDebug(regex->value.children[0]);
+    printf(", ");
+    regexPrintDebug(regex->value.children[1]);
+    printf(")");
     break;
-  case REGEX_TYPE_RANGE:
-    printf("regex print debug: range not implemented\n");
+  case REGEX_TYPE_STAR:
+  case REGEX_TYPE_PLUS:
+  case REGEX_TYPE_OPTIONAL:
+    printf((regex->type == REGEX_TYPE_STAR) ? "Star(" :
+           (regex->type == REGEX_TYPE_PLUS) ? "Plus(" : "Optional(");
+    regexPrintDebug(regex->value.children[0]);
+    printf(")");
     break;
   default:
     printf("regex print debug: invalid regex type\n");
@@ -95,11 +213,3 @@ void regexPrintDebug(Regex regex)
 
 
 #endif // PLD_LISP_REGEX_TYPES_H
-
-
-/*
-
-"a"  ->  Symbol a
-
-
- */
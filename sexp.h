@@ -4,21 +4,44 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include "operator.h"
 #include "number.h"
+#include "memory/manager.h"
+
+#define SEXP_LIST_BUFFER 64
+#define SEXP_CELLS_PER_BLOCK 4096
 
 /* s-expression types */
 struct _sexp_t;
+struct _sexp_builtin_t;
+struct _sexp_function_t;
+struct _sexp_string_t;
+struct _sexp_vector_t;
+struct _sexp_matrix_t;
+struct _sexp_bignum_t;
+struct _memo_table_t;
 
 union _sexp_value_t {
   char* symbol;
   int boolean;
   void* nil; // must be a null pointer
+#ifdef SEXP_COMPACT
+  struct _sexp_t* cdr; // the car is kept in the tag, see below
+#else
   struct _sexp_t* cons[2];
-  int integer;
+#endif
+  long integer;
   double doubleFP;
   Operator operator;
-  char* string;
+  struct _sexp_string_t* string;
+  struct _sexp_builtin_t* builtin;
+  struct _sexp_function_t* function;
+  int slot;
+  struct _sexp_vector_t* vector;
+  struct _sexp_matrix_t* matrix;
+  struct _sexp_bignum_t* bignum;
+  struct _sexp_array_t* array;
 };
 
 enum _sexp_type_t {
@@ -29,18 +52,210 @@ enum _sexp_type_t {
   SEXP_TYPE_INTEGER,
   SEXP_TYPE_DOUBLE,
   SEXP_TYPE_OPERATOR,
-  SEXP_TYPE_STRING
+  SEXP_TYPE_STRING,
+  SEXP_TYPE_BUILTIN,
+  SEXP_TYPE_FUNCTION,
+  SEXP_TYPE_SLOT, // index into the captured variables of the running closure
+  SEXP_TYPE_VECTOR,
+  SEXP_TYPE_MATRIX,
+  SEXP_TYPE_BIGNUM,
+  SEXP_TYPE_ARRAY
+};
+
+/*
+ * Cells are allocated in blocks, see sexpAlloc, and their layout is hidden
+ * behind the macros below: the type of an S-expression is SEXP_TYPE_OF(s),
+ * and a cons is taken apart with SEXP_CAR(s) and SEXP_CDR(s).
+ *
+ * By default a cell holds the type, a reference count for hash-consing and the
+ * value, 24 bytes. Built with -DSEXP_COMPACT, a cell is 16 bytes: blocks are
+ * 16-byte aligned, so the type fits in the low bits of the car pointer of a
+ * cons, and the cdr or the value of an atom takes the second word. Compact
+ * cells have no room for a reference count, so they are never hash-consed.
+ */
+#ifdef SEXP_COMPACT
+
+#ifdef SEXP_CACHE_HASH
+#error "SEXP_CACHE_HASH needs the default cell layout"
+#endif
+
+#define SEXP_TAG_MASK ((uintptr_t)15)
+
+struct _sexp_t {
+  uintptr_t tag; // the type, or'ed with the car of a cons
+  union _sexp_value_t value;
 };
 
+#define SEXP_TYPE_OF(s) ((enum _sexp_type_t)((s)->tag & SEXP_TAG_MASK))
+#define SEXP_CAR(s) ((struct _sexp_t*)((s)->tag & ~SEXP_TAG_MASK))
+#define SEXP_CDR(s) ((s)->value.cdr)
+#define SEXP_SET_TYPE(s, t) ((s)->tag = (uintptr_t)(t))
+#define SEXP_SET_CAR(s, a) ((s)->tag = (uintptr_t)(a) | SEXP_TYPE_CONS)
+#define SEXP_SET_CDR(s, d) ((s)->value.cdr = (d))
+#define SEXP_SHARED(s) 0
+
+#else
+
 struct _sexp_t {
   enum _sexp_type_t type;
+  unsigned int references; // only hash-consed nodes are shared, see hashcons.h
   union _sexp_value_t value;
+#ifdef SEXP_CACHE_HASH
+  unsigned long hash; // see sexpEqualsHash, 0 if unknown
+#endif
+};
+
+#define SEXP_TYPE_OF(s) ((s)->type)
+#define SEXP_CAR(s) ((s)->value.cons[0])
+#define SEXP_CDR(s) ((s)->value.cons[1])
+#define SEXP_SET_TYPE(s, t) ((s)->type = (t))
+#define SEXP_SET_CAR(s, a) ((s)->value.cons[0] = (a))
+#define SEXP_SET_CDR(s, d) ((s)->value.cons[1] = (d))
+#define SEXP_SHARED(s) ((s)->references)
+
+#endif
+
+/*
+ * A builtin is a function implemented natively in C, which receives the
+ * list of evaluated arguments. Builtins are registered once and live until
+ * exit, so copies of a builtin S-expression share the same descriptor.
+ */
+struct _sexp_builtin_t {
+  const char* name;
+  struct _sexp_t* (*function)(struct _sexp_t* arguments);
+};
+
+/*
+ * Strings are immutable and know their length. Copies of a string share it,
+ * and a substring is a view into the characters of the string it was taken
+ * from, which it keeps alive. Characters are not null terminated, so chars is
+ * always printed and compared by its length.
+ *
+ * A string owning its characters may have room for more, which appending
+ * fills in place, see sexpStringAppend.
+ */
+struct _sexp_string_t {
+  unsigned int references;
+  size_t length;
+  const char* chars;
+  struct _sexp_string_t* owner; // the string viewed, NULL if chars are its own
+  size_t used;     // characters written to the buffer of an owner
+  size_t capacity; // size of the buffer of an owner
+  char buffer[];
+};
+
+/*
+ * Numeric vectors hold integers or doubles unboxed, all of the same type, so
+ * their elements are processed in tight loops, see vector.h. Like strings,
+ * vectors are immutable and shared by their copies. The elements follow the
+ * header, aligned for vector instructions.
+ */
+enum _sexp_vector_type_t {
+  SEXP_VECTOR_INTEGER,
+  SEXP_VECTOR_DOUBLE
+};
+
+struct _sexp_vector_t {
+  unsigned int references;
+  enum _sexp_vector_type_t type;
+  size_t length;
+  union {
+    long* integers;
+    double* doubles;
+  } elements;
+};
+
+/*
+ * Matrices hold doubles in row-major order, see matrix.h. Like vectors, they
+ * are immutable and shared by their copies, and their elements follow the
+ * header, aligned for vector instructions.
+ */
+struct _sexp_matrix_t {
+  unsigned int references;
+  size_t rows;
+  size_t columns;
+  double* elements;
+};
+
+/*
+ * An integer that does not fit a long is a bignum, see bignum.h: a sign and
+ * the digits of its magnitude in base SEXP_BIGNUM_BASE, least significant
+ * first, so that it is printed without dividing it. Arithmetic returns a
+ * long again whenever the result fits one, so a bignum never does. Like
+ * strings, bignums are immutable and shared by their copies.
+ */
+#define SEXP_BIGNUM_BASE 1000000000u
+#define SEXP_BIGNUM_BASE_DIGITS 9
+
+struct _sexp_bignum_t {
+  unsigned int references;
+  int negative;
+  size_t length; // the most significant digit is not zero
+  uint32_t digits[];
+};
+
+/*
+ * Arrays are the vectors of Scheme, see array.h: they hold any S-expressions,
+ * which are read and replaced by index in constant time. Unlike all other
+ * values they are mutable, so the copies of an array share it, and see the
+ * elements it is given after they were made. An array that holds itself is
+ * never freed, and prints as #(...) where it appears inside itself.
+ */
+struct _sexp_array_t {
+  unsigned int references;
+  size_t length;
+  struct _sexp_t* elements[];
+};
+
+/*
+ * A function is the value of a lambda expression (lambda p1 e1 p2 e2 ...).
+ * Its clauses are analysed once, when the lambda is evaluated, and hold
+ * references into the source, which is kept for printing and comparison.
+ * Functions are immutable, so copies share them by reference counting.
+ *
+ * A closure additionally holds the values of the local variables its body
+ * refers to, captured when the lambda is evaluated. Its clauses then refer to
+ * code, a copy of the source where these variables are replaced by slots.
+ *
+ * When no arguments can match more than one clause, the clauses are tried in
+ * order of their hit counts rather than in source order, see adaptive.
+ */
+struct _sexp_clause_t {
+  struct _sexp_t* pattern;
+  struct _sexp_t* body;
+  int arity; // number of arguments matched by the list elements of pattern
+  int rest;  // does the pattern end in a variable binding the remaining ones?
+  int flat;  // is the pattern a list of distinct variables?
+  unsigned long hits; // number of calls matched by this clause
+};
+
+struct _sexp_function_t {
+  unsigned int references;
+  struct _sexp_t* source;
+  struct _sexp_t* code;
+  int clauseCount;
+  struct _sexp_clause_t* clauses;
+  int* order;   // indices of the clauses, in the order they are tried
+  int adaptive; // are the clause patterns mutually exclusive?
+  unsigned long calls;
+  struct _memo_table_t* memo; // results of earlier calls, see memo.h
+  int captureCount;
+  char** captureNames;
+  struct _sexp_t** captures;
 };
 
 
 
 /* typedefs for easy usage */
 typedef struct _sexp_t* Sexp;
+typedef struct _sexp_builtin_t* SexpBuiltin;
+typedef struct _sexp_clause_t* SexpClause;
+typedef struct _sexp_function_t* SexpFunction;
+typedef struct _sexp_string_t* SexpString;
+typedef struct _sexp_vector_t* SexpVector;
+typedef struct _sexp_matrix_t* SexpMatrix;
+typedef struct _sexp_bignum_t* SexpBignum;
+typedef struct _sexp_array_t* SexpArray;
 
 
 
@@ -49,85 +264,662 @@ Sexp sexpCreateSymbol(const char* symbol);
 Sexp sexpCreateBoolean(int bool);
 Sexp sexpCreateNil();
 Sexp sexpCreateCons(Sexp sexp1, Sexp sexp2);
-Sexp sexpCreateInteger(int integer);
+Sexp sexpCreateListOf(Sexp* elements, size_t count, Sexp tail);
+Sexp sexpCreateInteger(long integer);
 Sexp sexpCreateDouble(double doubleFP);
 Sexp sexpCreateOperator(Operator operator);
 Sexp sexpCreateString(const char* string);
+Sexp sexpCreateStringOf(SexpString string);
+Sexp sexpCreateBuiltin(SexpBuiltin builtin);
+Sexp sexpCreateFunction(SexpFunction function);
+Sexp sexpCreateSlot(int slot);
+Sexp sexpCreateVectorOf(SexpVector vector);
+Sexp sexpCreateMatrixOf(SexpMatrix matrix);
+Sexp sexpCreateBignumOf(SexpBignum bignum);
+Sexp sexpCreateArrayOf(SexpArray array);
 Sexp sexpCopy(Sexp sexp);
+Sexp sexpCopyList(Sexp list);
+void sexpFree(struct _sexp_t* sexp);
+void sexpPrint(Sexp sexp);
+void memoTableFree(struct _memo_table_t* table);
+extern int hashconsEnabled;
+Sexp hashconsIntern(Sexp sexp);
+void hashconsRemove(Sexp sexp);
+unsigned long sexpHashBytes(unsigned long hash, const void* data, size_t size);
+unsigned long sexpEqualsHash(Sexp sexp);
+
+
+
+/*
+ * Definitions loaded from library files are frozen into the immortal region,
+ * see immortal.h. Its S-expressions are never copied nor freed: sexpCopy
+ * returns them as they are, and sexpFree leaves them alone.
+ */
+uintptr_t sexpImmortalBegin = 0;
+size_t sexpImmortalSize = 0;
+
+#define SEXP_IMMORTAL(s) ((uintptr_t)(s) - sexpImmortalBegin < sexpImmortalSize)
+
+
+
+/* string functions */
+
+// an empty string with room for capacity characters
+SexpString sexpStringAllocate(size_t capacity)
+{
+  SexpString string = memoryManagerAllocate(
+    sizeof(struct _sexp_string_t) + capacity, sizeof(void*));
+  string->references = 1;
+  string->length = 0;
+  string->chars = string->buffer;
+  string->owner = NULL;
+  string->used = 0;
+  string->capacity = capacity;
+  return string;
+}
+
+SexpString sexpStringCreate(const char* chars, size_t length)
+{
+  SexpString string = sexpStringAllocate(length);
+  memcpy(string->buffer, chars, length);
+  string->length = string->used = length;
+  return string;
+}
+
+// immortal strings are shared without counting, see immortal.h
+SexpString sexpStringRetain(SexpString string)
+{
+  if(!SEXP_IMMORTAL(string)) {
+    string->references++;
+  }
+  return string;
+}
+
+void sexpStringRelease(SexpString string)
+{
+  if(SEXP_IMMORTAL(string) || --string->references) {
+    return;
+  }
+  if(string->owner) {
+    sexpStringRelease(string->owner);
+  }
+  memoryManagerFree(string);
+}
+
+// the characters from start, without copying them
+SexpString sexpStringView(SexpString string, size_t start, size_t length)
+{
+  if(start == 0 && length == string->length) {
+    return sexpStringRetain(string);
+  }
+  SexpString view = memoryManagerAllocate(sizeof(struct _sexp_string_t),
+                                          sizeof(void*));
+  view->references = 1;
+  view->length = length;
+  view->chars = string->chars + start;
+  view->owner = sexpStringRetain((string->owner) ? string->owner : string);
+  return view;
+}
+
+/*
+ * The first string followed by the second. When the first ends where the
+ * characters written to its owner end, the second is written after them if
+ * there is room, and the result is a view of the owner. Other strings of the
+ * owner only see their own length, so they are not changed. Otherwise both are
+ * copied to a new owner with room for as many characters again, so building a
+ * string by appending to it copies each character a constant number of times.
+ */
+SexpString sexpStringAppend(SexpString string1, SexpString string2)
+{
+  SexpString owner = (string1->owner) ? string1->owner : string1;
+  size_t start = string1->chars - owner->buffer;
+  size_t length = string1->length + string2->length;
+  if(!SEXP_IMMORTAL(owner) && start + string1->length == owner->used &&
+     owner->capacity - owner->used >= string2->length) {
+    memcpy(owner->buffer + owner->used, string2->chars, string2->length);
+    owner->used += string2->length;
+    return sexpStringView(owner, start, length);
+  }
+
+  SexpString string = sexpStringAllocate(2 * length);
+  memcpy(string->buffer, string1->chars, string1->length);
+  memcpy(string->buffer + string1->length, string2->chars, string2->length);
+  string->length = string->used = length;
+  return string;
+}
+
+// copies share their characters, so they are equal without comparing them
+int sexpStringEquals(SexpString string1, SexpString string2)
+{
+  return string1->length == string2->length &&
+    (string1->chars == string2->chars ||
+     !memcmp(string1->chars, string2->chars, string1->length));
+}
+
+
+
+/* vector functions */
+#define SEXP_VECTOR_ALIGNMENT 32
+
+// a vector of length elements, which are not initialized,
+// or NULL if its size overflows or there is no memory for it
+SexpVector sexpVectorCreate(enum _sexp_vector_type_t type, size_t length)
+{
+  size_t header = (sizeof(struct _sexp_vector_t) + SEXP_VECTOR_ALIGNMENT - 1) &
+    ~(size_t)(SEXP_VECTOR_ALIGNMENT - 1);
+  if(length > (SIZE_MAX - header - SEXP_VECTOR_ALIGNMENT) / sizeof(double)) {
+    return NULL;
+  }
+  size_t size = (header + sizeof(double) * length + SEXP_VECTOR_ALIGNMENT - 1) &
+    ~(size_t)(SEXP_VECTOR_ALIGNMENT - 1);
+  SexpVector vector = aligned_alloc(SEXP_VECTOR_ALIGNMENT, size);
+  if(!vector) {
+    return NULL;
+  }
+  vector->references = 1;
+  vector->type = type;
+  vector->length = length;
+  vector->elements.doubles = (double*)((char*)vector + header);
+  return vector;
+}
+
+SexpVector sexpVectorRetain(SexpVector vector)
+{
+  vector->references++;
+  return vector;
+}
+
+void sexpVectorRelease(SexpVector vector)
+{
+  if(!--vector->references) {
+    free(vector);
+  }
+}
+
+// vectors of integers and of doubles are never identical, see evalEquals
+int sexpVectorEquals(SexpVector vector1, SexpVector vector2)
+{
+  if(vector1 == vector2) {
+    return 1;
+  }
+  if(vector1->type != vector2->type || vector1->length != vector2->length) {
+    return 0;
+  }
+  for(size_t i = 0; i < vector1->length; i++) {
+    if((vector1->type == SEXP_VECTOR_INTEGER) ?
+       vector1->elements.integers[i] != vector2->elements.integers[i] :
+       vector1->elements.doubles[i] != vector2->elements.doubles[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// printed as in SRFI 4, e.g. #s64(1 2 3) or #f64(0.5 1.5)
+void sexpVectorPrint(SexpVector vector)
+{
+  printf((vector->type == SEXP_VECTOR_INTEGER) ? "#s64(" : "#f64(");
+  for(size_t i = 0; i < vector->length; i++) {
+    if(i) printf(" ");
+    if(vector->type == SEXP_VECTOR_INTEGER) {
+      printf("%ld", vector->elements.integers[i]);
+    } else {
+      numberPrintDouble(vector->elements.doubles[i]);
+    }
+  }
+  printf(")");
+}
+
+
+
+/* matrix functions */
+
+// a rows x columns matrix, whose elements are not initialized,
+// or NULL if its size overflows or there is no memory for it
+SexpMatrix sexpMatrixCreate(size_t rows, size_t columns)
+{
+  size_t header = (sizeof(struct _sexp_matrix_t) + SEXP_VECTOR_ALIGNMENT - 1) &
+    ~(size_t)(SEXP_VECTOR_ALIGNMENT - 1);
+  if(columns &&
+     rows > (SIZE_MAX - header - SEXP_VECTOR_ALIGNMENT) / sizeof(double) / columns) {
+    return NULL;
+  }
+  size_t size = (header + sizeof(double) * rows * columns + SEXP_VECTOR_ALIGNMENT - 1) &
+    ~(size_t)(SEXP_VECTOR_ALIGNMENT - 1);
+  SexpMatrix matrix = aligned_alloc(SEXP_VECTOR_ALIGNMENT, size);
+  if(!matrix) {
+    return NULL;
+  }
+  matrix->references = 1;
+  matrix->rows = rows;
+  matrix->columns = columns;
+  matrix->elements = (double*)((char*)matrix + header);
+  return matrix;
+}
+
+SexpMatrix sexpMatrixRetain(SexpMatrix matrix)
+{
+  matrix->references++;
+  return matrix;
+}
+
+void sexpMatrixRelease(SexpMatrix matrix)
+{
+  if(!--matrix->references) {
+    free(matrix);
+  }
+}
+
+int sexpMatrixEquals(SexpMatrix matrix1, SexpMatrix matrix2)
+{
+  if(matrix1 == matrix2) {
+    return 1;
+  }
+  if(matrix1->rows != matrix2->rows || matrix1->columns != matrix2->columns) {
+    return 0;
+  }
+  for(size_t i = 0; i < matrix1->rows * matrix1->columns; i++) {
+    if(matrix1->elements[i] != matrix2->elements[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// printed as its rows, e.g. #m((1 0) (0 1))
+void sexpMatrixPrint(SexpMatrix matrix)
+{
+  printf("#m(");
+  for(size_t i = 0; i < matrix->rows; i++) {
+    printf((i) ? " (" : "(");
+    for(size_t j = 0; j < matrix->columns; j++) {
+      if(j) printf(" ");
+      numberPrintDouble(matrix->elements[i * matrix->columns + j]);
+    }
+    printf(")");
+  }
+  printf(")");
+}
+
+#undef SEXP_VECTOR_ALIGNMENT
+
+
+
+/* bignum functions */
+
+// a bignum of length digits, which are not initialized
+SexpBignum sexpBignumCreate(size_t length)
+{
+  SexpBignum bignum = malloc(sizeof(struct _sexp_bignum_t) + sizeof(uint32_t) * length);
+  bignum->references = 1;
+  bignum->negative = 0;
+  bignum->length = length;
+  return bignum;
+}
+
+SexpBignum sexpBignumRetain(SexpBignum bignum)
+{
+  bignum->references++;
+  return bignum;
+}
+
+void sexpBignumRelease(SexpBignum bignum)
+{
+  if(!--bignum->references) {
+    free(bignum);
+  }
+}
+
+int sexpBignumEquals(SexpBignum bignum1, SexpBignum bignum2)
+{
+  return bignum1 == bignum2 ||
+    (bignum1->negative == bignum2->negative && bignum1->length == bignum2->length &&
+     !memcmp(bignum1->digits, bignum2->digits, sizeof(uint32_t) * bignum1->length));
+}
+
+// the decimal digits of a bignum, to be freed: the digits in base 10^9 are
+// written out as they are, 9 decimal digits each
+char* sexpBignumText(SexpBignum bignum)
+{
+  char* text = malloc(SEXP_BIGNUM_BASE_DIGITS * bignum->length + 2);
+  char* c = text;
+  if(bignum->negative) {
+    *c++ = '-';
+  }
+  c += sprintf(c, "%u", bignum->digits[bignum->length - 1]);
+  for(size_t i = bignum->length - 1; i-- > 0;) {
+    uint32_t digit = bignum->digits[i];
+    for(int k = SEXP_BIGNUM_BASE_DIGITS - 1; k >= 0; k--) {
+      c[k] = '0' + digit % 10;
+      digit /= 10;
+    }
+    c += SEXP_BIGNUM_BASE_DIGITS;
+  }
+  *c = '\0';
+  return text;
+}
+
+void sexpBignumPrint(SexpBignum bignum)
+{
+  char* text = sexpBignumText(bignum);
+  fputs(text, stdout);
+  free(text);
+}
+
+
+
+/* array functions */
+
+// an array of length elements, which are not initialized,
+// or NULL if its size overflows or there is no memory for it
+SexpArray sexpArrayCreate(size_t length)
+{
+  if(length > (SIZE_MAX - sizeof(struct _sexp_array_t)) / sizeof(Sexp)) {
+    return NULL;
+  }
+  SexpArray array = malloc(sizeof(struct _sexp_array_t) + sizeof(Sexp) * length);
+  if(!array) {
+    return NULL;
+  }
+  array->references = 1;
+  array->length = length;
+  return array;
+}
+
+SexpArray sexpArrayRetain(SexpArray array)
+{
+  array->references++;
+  return array;
+}
+
+void sexpArrayRelease(SexpArray array)
+{
+  if(--array->references) {
+    return;
+  }
+  for(size_t i = 0; i < array->length; i++) {
+    sexpFree(array->elements[i]);
+  }
+  free(array);
+}
+
+// the arrays being printed, innermost first, which mark a cycle when met again
+struct _sexp_array_visit_t {
+  SexpArray array;
+  struct _sexp_array_visit_t* outer;
+};
+
+struct _sexp_array_visit_t* sexpArraysPrinted = NULL;
+
+int sexpArrayIsPrinted(SexpArray array)
+{
+  for(struct _sexp_array_visit_t* visit = sexpArraysPrinted; visit; visit = visit->outer) {
+    if(visit->array == array) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// printed as in Scheme, e.g. #(1 "a" (2 3))
+void sexpArrayPrint(SexpArray array)
+{
+  if(sexpArrayIsPrinted(array)) {
+    printf("#(...)");
+    return;
+  }
+  struct _sexp_array_visit_t visit = { array, sexpArraysPrinted };
+  sexpArraysPrinted = &visit;
+  printf("#(");
+  for(size_t i = 0; i < array->length; i++) {
+    if(i) printf(" ");
+    sexpPrint(array->elements[i]);
+  }
+  printf(")");
+  sexpArraysPrinted = visit.outer;
+}
+
+
+
+/* cell allocation */
+
+/*
+ * Cells are cut from blocks of SEXP_CELLS_PER_BLOCK cells. A single cell is
+ * taken from the free list when possible, while a run of cells, see
+ * sexpAllocRun, is always cut from the unused end of the current block, so
+ * the spine of a list built at once is contiguous in memory.
+ */
+
+// free cells are linked through their first word
+Sexp sexpFreeCells = NULL;
+Sexp sexpBlockNext = NULL;
+Sexp sexpBlockEnd = NULL;
+
+void sexpFreeCell(Sexp cell)
+{
+#ifdef __SANITIZE_ADDRESS__
+  free(cell);
+#else
+  *(Sexp*)cell = sexpFreeCells;
+  sexpFreeCells = cell;
+#endif
+}
+
+// starts a new block, when fewer than count cells are left in the current one
+void sexpReserveCells(size_t count)
+{
+  if((size_t)(sexpBlockEnd - sexpBlockNext) >= count) {
+    return;
+  }
+  // blocks are never returned, their cells are reused instead
+  while(sexpBlockNext != sexpBlockEnd) {
+    sexpFreeCell(sexpBlockNext++);
+  }
+  sexpBlockNext = malloc(sizeof(struct _sexp_t) * SEXP_CELLS_PER_BLOCK);
+  sexpBlockEnd = sexpBlockNext + SEXP_CELLS_PER_BLOCK;
+}
+
+Sexp sexpAllocCell()
+{
+#ifdef __SANITIZE_ADDRESS__
+  return malloc(sizeof(struct _sexp_t)); // keep use-after-free detection
+#else
+  if(!sexpFreeCells) {
+    sexpReserveCells(1);
+    return sexpBlockNext++;
+  }
+  Sexp cell = sexpFreeCells;
+  sexpFreeCells = *(Sexp*)cell;
+  return cell;
+#endif
+}
+
+// allocates up to *count contiguous cells, and sets *count to how many
+Sexp sexpAllocRun(size_t* count)
+{
+#ifdef __SANITIZE_ADDRESS__
+  *count = 1;
+  return sexpAllocCell();
+#else
+  if(*count > SEXP_CELLS_PER_BLOCK) {
+    *count = SEXP_CELLS_PER_BLOCK;
+  }
+  sexpReserveCells(*count);
+  Sexp run = sexpBlockNext;
+  sexpBlockNext += *count;
+  return run;
+#endif
+}
 
 
 
 /* S-expression type functions */
-Sexp sexpAlloc()
+Sexp sexpInit(Sexp sexp, enum _sexp_type_t type)
 {
-  return malloc(sizeof(struct _sexp_t));
+  SEXP_SET_TYPE(sexp, type);
+#ifndef SEXP_COMPACT
+  sexp->references = 0;
+#endif
+#ifdef SEXP_CACHE_HASH
+  sexp->hash = 0;
+#endif
+  return sexp;
+}
+
+Sexp sexpAlloc(enum _sexp_type_t type)
+{
+  return sexpInit(sexpAllocCell(), type);
+}
+
+// finishes an S-expression created from its value
+Sexp sexpCreated(Sexp sexp)
+{
+#ifdef SEXP_CACHE_HASH
+  sexp->hash = sexpEqualsHash(sexp);
+#endif
+  return (hashconsEnabled) ? hashconsIntern(sexp) : sexp;
 }
 
 Sexp sexpCreateSymbol(const char* symbol)
 {
-  Sexp sexp = sexpAlloc();
-  sexp->type = SEXP_TYPE_SYMBOL;
-  sexp->value.symbol = malloc(strlen(symbol) * sizeof(char));
-  strcpy(sexp->value.symbol, symbol);
-  return sexp;
+  Sexp sexp = sexpAlloc(SEXP_TYPE_SYMBOL);
+  sexp->value.symbol = memoryManagerCreateString(symbol);
+  return sexpCreated(sexp);
 }
 
 Sexp sexpCreateBoolean(int bool)
 {
-  Sexp sexp = sexpAlloc();
-  sexp->type = SEXP_TYPE_BOOLEAN;
+  Sexp sexp = sexpAlloc(SEXP_TYPE_BOOLEAN);
   sexp->value.boolean = bool;
-  return sexp;
+  return sexpCreated(sexp);
 }
 
 Sexp sexpCreateNil()
 {
-  Sexp sexp = sexpAlloc();
-  sexp->type = SEXP_TYPE_NIL;
+  Sexp sexp = sexpAlloc(SEXP_TYPE_NIL);
   sexp->value.nil = NULL;
-  return sexp;
+  return sexpCreated(sexp);
+}
+
+// same as sexpCreateCons, but takes over car and cdr instead of copying them
+Sexp sexpCreateConsOf(Sexp car, Sexp cdr)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_CONS);
+  SEXP_SET_CAR(sexp, car);
+  SEXP_SET_CDR(sexp, cdr);
+  return sexpCreated(sexp);
 }
 
 Sexp sexpCreateCons(Sexp sexp1, Sexp sexp2)
 {
-  Sexp sexp = sexpAlloc();
-  sexp->type = SEXP_TYPE_CONS;
-  sexp->value.cons[0] = sexpCopy(sexp1);
-  sexp->value.cons[1] = sexpCopy(sexp2);
-  return sexp;
+  return sexpCreateConsOf(sexpCopy(sexp1), sexpCopy(sexp2));
+}
+
+/*
+ * Creates the list of count elements ending in tail, taking over both. The
+ * spine is allocated in runs of contiguous cells, see sexpAllocRun, which
+ * are still ordinary cons cells to everything else. It is built from the end,
+ * since a cons can only be hash-consed after its cdr, see hashcons.h.
+ */
+Sexp sexpCreateListOf(Sexp* elements, size_t count, Sexp tail)
+{
+  Sexp list = tail;
+  while(count) {
+    size_t length = count;
+    Sexp run = sexpAllocRun(&length);
+    while(length--) {
+      Sexp sexp = sexpInit(&run[length], SEXP_TYPE_CONS);
+      SEXP_SET_CAR(sexp, elements[--count]);
+      SEXP_SET_CDR(sexp, list);
+      list = sexpCreated(sexp);
+    }
+  }
+  return list;
 }
 
-Sexp sexpCreateInteger(int integer)
+Sexp sexpCreateInteger(long integer)
 {
-  Sexp sexp = sexpAlloc();
-  sexp->type = SEXP_TYPE_INTEGER;
+  Sexp sexp = sexpAlloc(SEXP_TYPE_INTEGER);
   sexp->value.integer = integer;
-  return sexp;
+  return sexpCreated(sexp);
 }
 
 Sexp sexpCreateDouble(double doubleFP)
 {
-  Sexp sexp = sexpAlloc();
-  sexp->type = SEXP_TYPE_DOUBLE;
+  Sexp sexp = sexpAlloc(SEXP_TYPE_DOUBLE);
   sexp->value.doubleFP = doubleFP;
-  return sexp;
+  return sexpCreated(sexp);
 }
 
 Sexp sexpCreateOperator(Operator operator)
 {
-  Sexp sexp = sexpAlloc();
-  sexp->type = SEXP_TYPE_OPERATOR;
+  Sexp sexp = sexpAlloc(SEXP_TYPE_OPERATOR);
   sexp->value.operator = operator;
-  return sexp;
+  return sexpCreated(sexp);
+}
+
+// takes over the reference to the string
+Sexp sexpCreateStringOf(SexpString string)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_STRING);
+  sexp->value.string = string;
+  return sexpCreated(sexp);
 }
 
 Sexp sexpCreateString(const char* string)
 {
-  Sexp sexp = sexpAlloc();
-  sexp->type = SEXP_TYPE_STRING;
-  sexp->value.string = malloc(strlen(string) * sizeof(char));
-  strcpy(sexp->value.string, string);
-  return sexp;
+  return sexpCreateStringOf(sexpStringCreate(string, strlen(string)));
+}
+
+Sexp sexpCreateBuiltin(SexpBuiltin builtin)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_BUILTIN);
+  sexp->value.builtin = builtin;
+  return sexpCreated(sexp);
+}
+
+Sexp sexpCreateFunction(SexpFunction function)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_FUNCTION);
+  sexp->value.function = function;
+  function->references++;
+  return sexpCreated(sexp);
+}
+
+Sexp sexpCreateVectorOf(SexpVector vector)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_VECTOR);
+  sexp->value.vector = vector;
+  return sexpCreated(sexp);
+}
+
+Sexp sexpCreateMatrixOf(SexpMatrix matrix)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_MATRIX);
+  sexp->value.matrix = matrix;
+  return sexpCreated(sexp);
+}
+
+Sexp sexpCreateBignumOf(SexpBignum bignum)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_BIGNUM);
+  sexp->value.bignum = bignum;
+  return sexpCreated(sexp);
+}
+
+// takes over the reference to the array
+Sexp sexpCreateArrayOf(SexpArray array)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_ARRAY);
+  sexp->value.array = array;
+  return sexpCreated(sexp);
+}
+
+Sexp sexpCreateSlot(int slot)
+{
+  Sexp sexp = sexpAlloc(SEXP_TYPE_SLOT);
+  sexp->value.slot = slot;
+  return sexpCreated(sexp);
 }
 
 Sexp sexpCopy(Sexp sexp)
@@ -136,7 +928,16 @@ Sexp sexpCopy(Sexp sexp)
     printf("sexp copy: sexp is null\n"); // exit(-1);
     return NULL;
   }
-  switch(sexp->type)
+  if(SEXP_IMMORTAL(sexp)) {
+    return sexp;
+  }
+#ifndef SEXP_COMPACT
+  if(sexp->references) {
+    sexp->references++;
+    return sexp;
+  }
+#endif
+  switch(SEXP_TYPE_OF(sexp))
   {
   case SEXP_TYPE_SYMBOL:
     return sexpCreateSymbol(sexp->value.symbol);
@@ -145,7 +946,7 @@ Sexp sexpCopy(Sexp sexp)
   case SEXP_TYPE_NIL:
     return sexpCreateNil();
   case SEXP_TYPE_CONS:
-    return sexpCreateCons(sexp->value.cons[0], sexp->value.cons[1]);
+    return sexpCopyList(sexp);
   case SEXP_TYPE_INTEGER:
     return sexpCreateInteger(sexp->value.integer);
   case SEXP_TYPE_DOUBLE:
@@ -153,20 +954,240 @@ Sexp sexpCopy(Sexp sexp)
   case SEXP_TYPE_OPERATOR:
     return sexpCreateOperator(sexp->value.operator);
   case SEXP_TYPE_STRING:
-    return sexpCreateString(sexp->value.string);
+    return sexpCreateStringOf(sexpStringRetain(sexp->value.string));
+  case SEXP_TYPE_BUILTIN:
+    return sexpCreateBuiltin(sexp->value.builtin);
+  case SEXP_TYPE_FUNCTION:
+    return sexpCreateFunction(sexp->value.function);
+  case SEXP_TYPE_SLOT:
+    return sexpCreateSlot(sexp->value.slot);
+  case SEXP_TYPE_VECTOR:
+    return sexpCreateVectorOf(sexpVectorRetain(sexp->value.vector));
+  case SEXP_TYPE_MATRIX:
+    return sexpCreateMatrixOf(sexpMatrixRetain(sexp->value.matrix));
+  case SEXP_TYPE_BIGNUM:
+    return sexpCreateBignumOf(sexpBignumRetain(sexp->value.bignum));
+  case SEXP_TYPE_ARRAY:
+    return sexpCreateArrayOf(sexpArrayRetain(sexp->value.array));
   default:
     printf("Sexp copy: Invalid recorded sexp type!\n"); // exit(-1);
     return NULL;
   }
 }
 
+/*
+ * Copies a list along its tail without recursion, so long lists can not
+ * exhaust the stack. The copy has a contiguous spine, see sexpCreateListOf.
+ */
+Sexp sexpCopyList(Sexp list)
+{
+  Sexp buffer[SEXP_LIST_BUFFER];
+  Sexp* spine = buffer;
+  size_t capacity = SEXP_LIST_BUFFER;
+  size_t count = 0;
+
+  // shared and immortal tails are not copied, see sexpCopy
+  Sexp sexp = list;
+  for(; SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS && !SEXP_SHARED(sexp) &&
+        !SEXP_IMMORTAL(sexp);
+      sexp = SEXP_CDR(sexp)) {
+    if(count == capacity) {
+      Sexp* grown = malloc(sizeof(Sexp) * capacity * 2);
+      memcpy(grown, spine, sizeof(Sexp) * count);
+      if(spine != buffer) free(spine);
+      spine = grown;
+      capacity *= 2;
+    }
+    spine[count++] = sexp;
+  }
+
+  for(size_t i = 0; i < count; i++) {
+    spine[i] = sexpCopy(SEXP_CAR(spine[i]));
+  }
+  Sexp copy = sexpCreateListOf(spine, count, sexpCopy(sexp));
+  if(spine != buffer) free(spine);
+  return copy;
+}
+
+
+
+/*
+ * Structural hash and identity of S-expressions, which do not allocate.
+ * Unlike the equals form, numbers of different types are never identical,
+ * and functions and arrays, which may still change, are only identical to
+ * themselves.
+ */
+unsigned long sexpHashBytes(unsigned long hash, const void* data, size_t size)
+{
+  const unsigned char* bytes = data;
+  for(size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ul; // FNV-1a
+  }
+  return hash;
+}
+
+unsigned long sexpHash(Sexp sexp)
+{
+  unsigned long hash = 14695981039346656037ul;
+  while(1) {
+    enum _sexp_type_t type = SEXP_TYPE_OF(sexp);
+    hash = sexpHashBytes(hash, &type, sizeof(type));
+    switch(SEXP_TYPE_OF(sexp))
+    {
+    case SEXP_TYPE_CONS: {
+      unsigned long car = sexpHash(SEXP_CAR(sexp));
+      hash = sexpHashBytes(hash, &car, sizeof(car));
+      sexp = SEXP_CDR(sexp);
+      continue;
+    }
+    case SEXP_TYPE_SYMBOL:
+      return sexpHashBytes(hash, sexp->value.symbol, strlen(sexp->value.symbol));
+    case SEXP_TYPE_STRING:
+      return sexpHashBytes(hash, sexp->value.string->chars,
+                           sexp->value.string->length);
+    case SEXP_TYPE_BOOLEAN:
+      return sexpHashBytes(hash, &sexp->value.boolean, sizeof(int));
+    case SEXP_TYPE_INTEGER:
+      return sexpHashBytes(hash, &sexp->value.integer, sizeof(long));
+    case SEXP_TYPE_DOUBLE:
+      return sexpHashBytes(hash, &sexp->value.doubleFP, sizeof(double));
+    case SEXP_TYPE_OPERATOR:
+      return sexpHashBytes(hash, &sexp->value.operator, sizeof(Operator));
+    case SEXP_TYPE_BUILTIN:
+      return sexpHashBytes(hash, &sexp->value.builtin, sizeof(SexpBuiltin));
+    case SEXP_TYPE_FUNCTION:
+      return sexpHashBytes(hash, &sexp->value.function, sizeof(SexpFunction));
+    case SEXP_TYPE_VECTOR:
+      hash = sexpHashBytes(hash, &sexp->value.vector->type,
+                           sizeof(enum _sexp_vector_type_t));
+      return sexpHashBytes(hash, sexp->value.vector->elements.doubles,
+                           sizeof(double) * sexp->value.vector->length);
+    case SEXP_TYPE_MATRIX:
+      hash = sexpHashBytes(hash, &sexp->value.matrix->rows, sizeof(size_t));
+      hash = sexpHashBytes(hash, &sexp->value.matrix->columns, sizeof(size_t));
+      return sexpHashBytes(hash, sexp->value.matrix->elements, sizeof(double) *
+                           sexp->value.matrix->rows * sexp->value.matrix->columns);
+    case SEXP_TYPE_BIGNUM:
+      hash = sexpHashBytes(hash, &sexp->value.bignum->negative, sizeof(int));
+      return sexpHashBytes(hash, sexp->value.bignum->digits,
+                           sizeof(uint32_t) * sexp->value.bignum->length);
+    case SEXP_TYPE_ARRAY:
+      return sexpHashBytes(hash, &sexp->value.array, sizeof(SexpArray));
+    default:
+      return hash;
+    }
+  }
+}
+
+/*
+ * With SEXP_CACHE_HASH defined, every S-expression keeps a hash that is equal
+ * for S-expressions that the equals form considers equal, so most unequal
+ * lists are told apart without walking them. Numbers of both types and
+ * functions are hashed by their type alone, since they may be equal otherwise,
+ * and so are arrays, whose elements may change after the hash is taken.
+ */
+unsigned long sexpEqualsHash(Sexp sexp)
+{
+  enum _sexp_type_t type = (SEXP_TYPE_OF(sexp) == SEXP_TYPE_DOUBLE ||
+                            SEXP_TYPE_OF(sexp) == SEXP_TYPE_BIGNUM) ?
+    SEXP_TYPE_INTEGER : SEXP_TYPE_OF(sexp);
+  unsigned long hash = 14695981039346656037ul;
+  hash = sexpHashBytes(hash, &type, sizeof(type));
+  switch(SEXP_TYPE_OF(sexp))
+  {
+  case SEXP_TYPE_CONS: {
+#ifdef SEXP_CACHE_HASH
+    unsigned long car = SEXP_CAR(sexp)->hash;
+    unsigned long cdr = SEXP_CDR(sexp)->hash;
+    if(!car || !cdr) {
+      return 0;
+    }
+    hash = sexpHashBytes(hash, &car, sizeof(car));
+    hash = sexpHashBytes(hash, &cdr, sizeof(cdr));
+    break;
+#else
+    return 0;
+#endif
+  }
+  case SEXP_TYPE_SYMBOL:
+    hash = sexpHashBytes(hash, sexp->value.symbol, strlen(sexp->value.symbol));
+    break;
+  case SEXP_TYPE_STRING:
+    hash = sexpHashBytes(hash, sexp->value.string->chars,
+                         sexp->value.string->length);
+    break;
+  case SEXP_TYPE_BOOLEAN:
+    hash = sexpHashBytes(hash, &sexp->value.boolean, sizeof(int));
+    break;
+  case SEXP_TYPE_OPERATOR:
+    hash = sexpHashBytes(hash, &sexp->value.operator, sizeof(Operator));
+    break;
+  case SEXP_TYPE_BUILTIN:
+    hash = sexpHashBytes(hash, &sexp->value.builtin, sizeof(SexpBuiltin));
+    break;
+  default:
+    break;
+  }
+  return (hash) ? hash : 1;
+}
+
+int sexpIdentical(Sexp sexp1, Sexp sexp2)
+{
+  while(1) {
+    if(sexp1 == sexp2) {
+      return 1;
+    }
+    if(SEXP_TYPE_OF(sexp1) != SEXP_TYPE_OF(sexp2)) {
+      return 0;
+    }
+    switch(SEXP_TYPE_OF(sexp1))
+    {
+    case SEXP_TYPE_CONS:
+      if(!sexpIdentical(SEXP_CAR(sexp1), SEXP_CAR(sexp2))) {
+        return 0;
+      }
+      sexp1 = SEXP_CDR(sexp1);
+      sexp2 = SEXP_CDR(sexp2);
+      continue;
+    case SEXP_TYPE_NIL:
+      return 1;
+    case SEXP_TYPE_SYMBOL:
+      return !strcmp(sexp1->value.symbol, sexp2->value.symbol);
+    case SEXP_TYPE_STRING:
+      return sexpStringEquals(sexp1->value.string, sexp2->value.string);
+    case SEXP_TYPE_BOOLEAN:
+      return sexp1->value.boolean == sexp2->value.boolean;
+    case SEXP_TYPE_INTEGER:
+      return sexp1->value.integer == sexp2->value.integer;
+    case SEXP_TYPE_DOUBLE:
+      return sexp1->value.doubleFP == sexp2->value.doubleFP;
+    case SEXP_TYPE_OPERATOR:
+      return sexp1->value.operator == sexp2->value.operator;
+    case SEXP_TYPE_BUILTIN:
+      return sexp1->value.builtin == sexp2->value.builtin;
+    case SEXP_TYPE_FUNCTION:
+      return sexp1->value.function == sexp2->value.function;
+    case SEXP_TYPE_VECTOR:
+      return sexpVectorEquals(sexp1->value.vector, sexp2->value.vector);
+    case SEXP_TYPE_MATRIX:
+      return sexpMatrixEquals(sexp1->value.matrix, sexp2->value.matrix);
+    case SEXP_TYPE_BIGNUM:
+      return sexpBignumEquals(sexp1->value.bignum, sexp2->value.bignum);
+    case SEXP_TYPE_ARRAY:
+      return sexp1->value.array == sexp2->value.array;
+    default:
+      return 0;
+    }
+  }
+}
+
 void sexpPrintDebug(Sexp sexp)
 {
   if(!sexp) {
     printf("sexp print: sexp is null\n");
     return;
   }
-  switch(sexp->type)
+  switch(SEXP_TYPE_OF(sexp))
   {
   case SEXP_TYPE_SYMBOL:
     printf("Symbol \"%s\"", sexp->value.symbol);
@@ -177,15 +1198,22 @@ void sexpPrintDebug(Sexp sexp)
   case SEXP_TYPE_NIL:
     printf("Nil");
     break;
-  case SEXP_TYPE_CONS:
-    printf("Cons(");
-    sexpPrintDebug(sexp->value.cons[0]);
-    printf(", ");
-    sexpPrintDebug(sexp->value.cons[1]);
-    printf(")");
+  case SEXP_TYPE_CONS: {
+    // the tail is printed by the loop, only the elements by recursion
+    size_t depth = 0;
+    for(; SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS; sexp = SEXP_CDR(sexp), depth++) {
+      printf("Cons(");
+      sexpPrintDebug(SEXP_CAR(sexp));
+      printf(", ");
+    }
+    sexpPrintDebug(sexp);
+    while(depth--) {
+      printf(")");
+    }
     break;
+  }
   case SEXP_TYPE_INTEGER:
-    printf("Int %i", sexp->value.integer);
+    printf("Int %ld", sexp->value.integer);
     break;
   case SEXP_TYPE_DOUBLE:
     printf("Double "); numberPrintDouble(sexp->value.doubleFP);
@@ -196,8 +1224,48 @@ void sexpPrintDebug(Sexp sexp)
     printf("'");
     break;
   case SEXP_TYPE_STRING:
-    printf("String \"%s\"", sexp->value.string);
+    printf("String \"%.*s\"", (int)sexp->value.string->length,
+           sexp->value.string->chars);
+    break;
+  case SEXP_TYPE_BUILTIN:
+    printf("Builtin %s", sexp->value.builtin->name);
+    break;
+  case SEXP_TYPE_FUNCTION:
+    printf("Function(");
+    sexpPrintDebug(sexp->value.function->source);
+    printf(")");
     break;
+  case SEXP_TYPE_SLOT:
+    printf("Slot %i", sexp->value.slot);
+    break;
+  case SEXP_TYPE_VECTOR:
+    printf("Vector ");
+    sexpVectorPrint(sexp->value.vector);
+    break;
+  case SEXP_TYPE_MATRIX:
+    printf("Matrix ");
+    sexpMatrixPrint(sexp->value.matrix);
+    break;
+  case SEXP_TYPE_BIGNUM:
+    printf("Bignum ");
+    sexpBignumPrint(sexp->value.bignum);
+    break;
+  case SEXP_TYPE_ARRAY: {
+    if(sexpArrayIsPrinted(sexp->value.array)) {
+      printf("Array(...)");
+      break;
+    }
+    struct _sexp_array_visit_t visit = { sexp->value.array, sexpArraysPrinted };
+    sexpArraysPrinted = &visit;
+    printf("Array(");
+    for(size_t i = 0; i < sexp->value.array->length; i++) {
+      if(i) printf(", ");
+      sexpPrintDebug(sexp->value.array->elements[i]);
+    }
+    printf(")");
+    sexpArraysPrinted = visit.outer;
+    break;
+  }
   default:
     printf("Sexp print: Invalid recorded sexp type!\n"); // exit(-1);
   }
@@ -209,11 +1277,15 @@ void sexpPrint(Sexp sexp);
 
 void sexpPrintTail(Sexp sexp)
 {
+  for(; sexp && SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS; sexp = SEXP_CDR(sexp)) {
+    printf(" ");
+    sexpPrint(SEXP_CAR(sexp));
+  }
   if(!sexp) {
     printf("sexp print tail: sexp is null\n");
     return;
   }
-  switch(sexp->type)
+  switch(SEXP_TYPE_OF(sexp))
   {
   case SEXP_TYPE_SYMBOL:
     printf(". %s)", sexp->value.symbol);
@@ -224,13 +1296,8 @@ void sexpPrintTail(Sexp sexp)
   case SEXP_TYPE_NIL:
     printf(")");
     break;
-  case SEXP_TYPE_CONS:
-    printf(" ");
-    sexpPrint(sexp->value.cons[0]);
-    sexpPrintTail(sexp->value.cons[1]);
-    break;
   case SEXP_TYPE_INTEGER:
-    printf(" %i", sexp->value.integer);
+    printf(" %ld", sexp->value.integer);
     break;
   case SEXP_TYPE_DOUBLE:
     printf(" "); numberPrintDouble(sexp->value.doubleFP);
@@ -240,7 +1307,39 @@ void sexpPrintTail(Sexp sexp)
     operatorPrint(sexp->value.operator);
     break;
   case SEXP_TYPE_STRING:
-    printf(". \"%s\")", sexp->value.string);
+    printf(". \"%.*s\")", (int)sexp->value.string->length,
+           sexp->value.string->chars);
+    break;
+  case SEXP_TYPE_BUILTIN:
+    printf(". #<builtin %s>)", sexp->value.builtin->name);
+    break;
+  case SEXP_TYPE_FUNCTION:
+    printf(". ");
+    sexpPrint(sexp->value.function->source);
+    printf(")");
+    break;
+  case SEXP_TYPE_SLOT:
+    printf(". #<slot %i>)", sexp->value.slot);
+    break;
+  case SEXP_TYPE_VECTOR:
+    printf(". ");
+    sexpVectorPrint(sexp->value.vector);
+    printf(")");
+    break;
+  case SEXP_TYPE_MATRIX:
+    printf(". ");
+    sexpMatrixPrint(sexp->value.matrix);
+    printf(")");
+    break;
+  case SEXP_TYPE_BIGNUM:
+    printf(". ");
+    sexpBignumPrint(sexp->value.bignum);
+    printf(")");
+    break;
+  case SEXP_TYPE_ARRAY:
+    printf(". ");
+    sexpArrayPrint(sexp->value.array);
+    printf(")");
     break;
   default:
     printf("Sexp print tail: Invalid recorded sexp type!\n"); // exit(-1);
@@ -253,7 +1352,7 @@ void sexpPrint(Sexp sexp)
     printf("sexp print: sexp is null\n");
     return;
   }
-  switch(sexp->type)
+  switch(SEXP_TYPE_OF(sexp))
   {
   case SEXP_TYPE_SYMBOL:
     printf("%s", sexp->value.symbol);
@@ -265,21 +1364,21 @@ void sexpPrint(Sexp sexp)
     printf("()");
     break;
   case SEXP_TYPE_CONS:
-    if(sexp->value.cons[0]->type == SEXP_TYPE_SYMBOL &&
-       !strcmp(sexp->value.cons[0]->value.symbol, "quote") &&
-       sexp->value.cons[1]->type == SEXP_TYPE_CONS &&
-       sexp->value.cons[1]->value.cons[1]->type == SEXP_TYPE_NIL)
+    if(SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_SYMBOL &&
+       !strcmp(SEXP_CAR(sexp)->value.symbol, "quote") &&
+       SEXP_TYPE_OF(SEXP_CDR(sexp)) == SEXP_TYPE_CONS &&
+       SEXP_TYPE_OF(SEXP_CDR(SEXP_CDR(sexp))) == SEXP_TYPE_NIL)
     {
       printf("'");
-      sexpPrint(sexp->value.cons[1]->value.cons[0]);
+      sexpPrint(SEXP_CAR(SEXP_CDR(sexp)));
     } else {
       printf("(");
-      sexpPrint(sexp->value.cons[0]);
-      sexpPrintTail(sexp->value.cons[1]);
+      sexpPrint(SEXP_CAR(sexp));
+      sexpPrintTail(SEXP_CDR(sexp));
     }
     break;
   case SEXP_TYPE_INTEGER:
-    printf("%i", sexp->value.integer);
+    printf("%ld", sexp->value.integer);
     break;
   case SEXP_TYPE_DOUBLE:
     numberPrintDouble(sexp->value.doubleFP);
@@ -288,50 +1387,119 @@ void sexpPrint(Sexp sexp)
     operatorPrint(sexp->value.operator);
     break;
   case SEXP_TYPE_STRING:
-    printf("\"%s\"", sexp->value.string);
-    break;
-  default:
-    printf("Sexp print: Invalid recorded sexp type\n"); // exit(-1);
-  }
-}
-
-void sexpFree(struct _sexp_t* sexp)
-{
-  if(!sexp) {
-    //printf("Cannot free sexp that is already null!\n"); // exit(-1);
-    return;
-  }
-  switch(sexp->type)
-  {
-  case SEXP_TYPE_SYMBOL:
-    free(sexp->value.symbol);
+    printf("\"%.*s\"", (int)sexp->value.string->length,
+           sexp->value.string->chars);
     break;
-  case SEXP_TYPE_BOOLEAN:
+  case SEXP_TYPE_BUILTIN:
+    printf("#<builtin %s>", sexp->value.builtin->name);
     break;
-  case SEXP_TYPE_NIL:
+  case SEXP_TYPE_FUNCTION:
+    sexpPrint(sexp->value.function->source);
     break;
-  case SEXP_TYPE_CONS:
-    sexpFree(sexp->value.cons[0]);
-    sexpFree(sexp->value.cons[1]);
+  case SEXP_TYPE_SLOT:
+    printf("#<slot %i>", sexp->value.slot);
     break;
-  case SEXP_TYPE_INTEGER:
+  case SEXP_TYPE_VECTOR:
+    sexpVectorPrint(sexp->value.vector);
     break;
-  case SEXP_TYPE_DOUBLE:
+  case SEXP_TYPE_MATRIX:
+    sexpMatrixPrint(sexp->value.matrix);
     break;
-  case SEXP_TYPE_OPERATOR:
+  case SEXP_TYPE_BIGNUM:
+    sexpBignumPrint(sexp->value.bignum);
     break;
-  case SEXP_TYPE_STRING:
-    free(sexp->value.string);
+  case SEXP_TYPE_ARRAY:
+    sexpArrayPrint(sexp->value.array);
     break;
   default:
-    printf("sexp free: Invalid recorded sexp type\n"); // exit(-1);
-    return;
+    printf("Sexp print: Invalid recorded sexp type\n"); // exit(-1);
+  }
+}
+
+// frees a list along its tail without recursion, see sexpCopyList
+void sexpFree(struct _sexp_t* sexp)
+{
+  while(sexp) {
+    if(SEXP_IMMORTAL(sexp)) {
+      return;
+    }
+#ifndef SEXP_COMPACT
+    if(sexp->references) {
+      if(--sexp->references) {
+        return;
+      }
+      hashconsRemove(sexp);
+    }
+#endif
+    Sexp next = NULL;
+    switch(SEXP_TYPE_OF(sexp))
+    {
+    case SEXP_TYPE_SYMBOL:
+      memoryManagerFreeString(sexp->value.symbol);
+      break;
+    case SEXP_TYPE_BOOLEAN:
+      break;
+    case SEXP_TYPE_NIL:
+      break;
+    case SEXP_TYPE_CONS:
+      sexpFree(SEXP_CAR(sexp));
+      next = SEXP_CDR(sexp);
+      break;
+    case SEXP_TYPE_INTEGER:
+      break;
+    case SEXP_TYPE_DOUBLE:
+      break;
+    case SEXP_TYPE_OPERATOR:
+      break;
+    case SEXP_TYPE_STRING:
+      sexpStringRelease(sexp->value.string);
+      break;
+    case SEXP_TYPE_BUILTIN:
+      break;
+    case SEXP_TYPE_FUNCTION:
+      if(--sexp->value.function->references == 0) {
+        SexpFunction function = sexp->value.function;
+        for(int i = 0; i < function->captureCount; i++) {
+          free(function->captureNames[i]);
+          sexpFree(function->captures[i]);
+        }
+        free(function->captureNames);
+        free(function->captures);
+        sexpFree(function->source);
+        sexpFree(function->code);
+        free(function->clauses);
+        free(function->order);
+        if(function->memo) memoTableFree(function->memo);
+        free(function);
+      }
+      break;
+    case SEXP_TYPE_SLOT:
+      break;
+    case SEXP_TYPE_VECTOR:
+      sexpVectorRelease(sexp->value.vector);
+      break;
+    case SEXP_TYPE_MATRIX:
+      sexpMatrixRelease(sexp->value.matrix);
+      break;
+    case SEXP_TYPE_BIGNUM:
+      sexpBignumRelease(sexp->value.bignum);
+      break;
+    case SEXP_TYPE_ARRAY:
+      sexpArrayRelease(sexp->value.array);
+      break;
+    default:
+      printf("sexp free: Invalid recorded sexp type\n"); // exit(-1);
+      return;
+    }
+    sexpFreeCell(sexp);
+    sexp = next;
   }
-  free(sexp);
 }
 
 
 
 
 
+#undef SEXP_LIST_BUFFER
+#undef SEXP_CELLS_PER_BLOCK
 #endif // PLD_LISP_SEXP_H
@@ -0,0 +1,402 @@
+#ifndef PLD_LISP_SIMPLIFY_H
+#define PLD_LISP_SIMPLIFY_H
+
+#include <stdio.h>
+#include <string.h>
+#include "sexp.h"
+#include "keyword.h"
+#include "operator.h"
+#include "operator_application.h"
+
+/*
+ * Simplification of programs before they are evaluated:
+ * - operator applications on literals are folded,
+ *   e.g. (+ 1 (* 2 3)) -> 7,
+ * - if/not on constant booleans are pruned,
+ *   e.g. (if true e1 e2) -> e1,
+ * - let-bindings of constants are substituted into a body which calls no
+ *   functions, e.g. (let a 1 in (+ a 2)) -> 3.
+ * Operator applications that would raise an error (division by zero, ...)
+ * are left for the evaluator, so errors are still reported at runtime.
+ */
+#define SIMPLIFY_POWER_LIMIT 4096 // integer powers folded, at most
+
+
+
+/* statistics about the simplifications made so far */
+struct _simplify_statistics_t {
+  unsigned long passes;
+  unsigned long nodesBefore;
+  unsigned long nodesEliminated;
+  unsigned long foldedOperators;
+  unsigned long prunedConditionals;
+  unsigned long collapsedLets;
+};
+
+struct _simplify_statistics_t simplifyStatistics = { 0, 0, 0, 0, 0, 0 };
+
+
+
+/* utility functions for simplification */
+unsigned long simplifyCountNodes(Sexp sexp)
+{
+  unsigned long count = 0;
+  while(sexp && SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS) {
+    count += 1 + simplifyCountNodes(SEXP_CAR(sexp));
+    sexp = SEXP_CDR(sexp);
+  }
+  return count + 1;
+}
+
+int simplifyIsLiteral(Sexp sexp)
+{
+  switch(SEXP_TYPE_OF(sexp))
+  {
+  case SEXP_TYPE_NIL:
+  case SEXP_TYPE_BOOLEAN:
+  case SEXP_TYPE_INTEGER:
+  case SEXP_TYPE_DOUBLE:
+  case SEXP_TYPE_STRING:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+int simplifyIsNumber(Sexp sexp)
+{
+  return SEXP_TYPE_OF(sexp) == SEXP_TYPE_INTEGER || SEXP_TYPE_OF(sexp) == SEXP_TYPE_DOUBLE;
+}
+
+double simplifyNumberValue(Sexp sexp)
+{
+  return (SEXP_TYPE_OF(sexp) == SEXP_TYPE_INTEGER) ?
+    (double)sexp->value.integer : sexp->value.doubleFP;
+}
+
+// is it safe to apply the operator at this point, i.e. it will not throw?
+int simplifyCanFold(Operator operator, Sexp arg1, Sexp arg2)
+{
+  if(SEXP_TYPE_OF(arg1) == SEXP_TYPE_STRING && SEXP_TYPE_OF(arg2) == SEXP_TYPE_STRING) {
+    return operator == OPERATOR_PLUS;
+  }
+  if(!simplifyIsNumber(arg1) || !simplifyIsNumber(arg2)) {
+    return 0;
+  }
+
+  switch(operator)
+  {
+  case OPERATOR_DIVIDE:
+  case OPERATOR_MODULUS:
+    return !(SEXP_TYPE_OF(arg1) == SEXP_TYPE_INTEGER &&
+             SEXP_TYPE_OF(arg2) == SEXP_TYPE_INTEGER && arg2->value.integer == 0);
+  case OPERATOR_POWER:
+    if(SEXP_TYPE_OF(arg1) == SEXP_TYPE_INTEGER && SEXP_TYPE_OF(arg2) == SEXP_TYPE_INTEGER &&
+       arg2->value.integer > SIMPLIFY_POWER_LIMIT) {
+      return 0; // the power may be too large for a bignum
+    }
+    return !(simplifyNumberValue(arg1) == 0.0 &&
+             simplifyNumberValue(arg2) <= 0.0);
+  default:
+    return 1;
+  }
+}
+
+// returns the keyword of a form (keyword ...), otherwise -1
+int simplifyFormKeyword(Sexp sexp)
+{
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(sexp)) != SEXP_TYPE_SYMBOL) {
+    return -1;
+  }
+  return (int)keywordMatch(SEXP_CAR(sexp)->value.symbol);
+}
+
+// returns the argument count of a form, or -1 if not a proper list
+int simplifyFormArguments(Sexp sexp)
+{
+  int count = 0;
+  Sexp args = SEXP_CDR(sexp);
+  while(SEXP_TYPE_OF(args) == SEXP_TYPE_CONS) {
+    args = SEXP_CDR(args);
+    count++;
+  }
+  return (SEXP_TYPE_OF(args) == SEXP_TYPE_NIL) ? count : -1;
+}
+
+Sexp simplifyFormArgument(Sexp sexp, int index)
+{
+  Sexp args = SEXP_CDR(sexp);
+  for(int i = 0; i < index; i++) {
+    args = SEXP_CDR(args);
+  }
+  return SEXP_CAR(args);
+}
+
+// does (let k e1 in e2) have the expected structure?
+int simplifyIsLet(Sexp sexp)
+{
+  return simplifyFormKeyword(sexp) == KEYWORD_LET &&
+         simplifyFormArguments(sexp) == 4 &&
+         SEXP_TYPE_OF(simplifyFormArgument(sexp, 0)) == SEXP_TYPE_SYMBOL &&
+         SEXP_TYPE_OF(simplifyFormArgument(sexp, 2)) == SEXP_TYPE_SYMBOL &&
+         keywordMatch(simplifyFormArgument(sexp, 2)->value.symbol) == KEYWORD_IN;
+}
+
+/*
+ * Functions see the variables of the environment they are called from, so a
+ * let-binding can only be collapsed when its body calls nothing that could
+ * read it: only operators and the quote, if, not, cons, equals and let forms.
+ */
+int simplifyCallsOnlyPrimitives(Sexp sexp)
+{
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS) {
+    return 1;
+  }
+  switch(simplifyFormKeyword(sexp))
+  {
+  case KEYWORD_QUOTE:
+    return 1;
+  case KEYWORD_IF:
+  case KEYWORD_NOT:
+  case KEYWORD_CONS:
+  case KEYWORD_EQUALS:
+  case KEYWORD_LET:
+    break;
+  default:
+    if(SEXP_TYPE_OF(SEXP_CAR(sexp)) != SEXP_TYPE_OPERATOR) {
+      return 0;
+    }
+  }
+  for(sexp = SEXP_CDR(sexp); SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS; sexp = SEXP_CDR(sexp)) {
+    if(!simplifyCallsOnlyPrimitives(SEXP_CAR(sexp))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* function definitions for mutual recursion */
+Sexp simplifySubstitute(Sexp sexp, const char* symbol, Sexp value);
+Sexp simplifyExpression(Sexp sexp);
+
+
+
+Sexp simplifySubstituteList(Sexp sexp, const char* symbol, Sexp value)
+{
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS) {
+    return simplifySubstitute(sexp, symbol, value);
+  }
+  Sexp car = simplifySubstitute(SEXP_CAR(sexp), symbol, value);
+  Sexp cdr = simplifySubstituteList(SEXP_CDR(sexp), symbol, value);
+  Sexp ret = sexpCreateCons(car, cdr);
+  sexpFree(car);
+  sexpFree(cdr);
+  return ret;
+}
+
+// replace variable references to symbol with value, respecting shadowing
+Sexp simplifySubstitute(Sexp sexp, const char* symbol, Sexp value)
+{
+  if(SEXP_TYPE_OF(sexp) == SEXP_TYPE_SYMBOL) {
+    return sexpCopy(!strcmp(sexp->value.symbol, symbol) ? value : sexp);
+  }
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS) {
+    return sexpCopy(sexp);
+  }
+
+  switch(simplifyFormKeyword(sexp))
+  {
+  case KEYWORD_QUOTE:
+  case KEYWORD_LAMBDA:
+  case KEYWORD_LOAD:
+  case KEYWORD_SAVE:
+    return sexpCopy(sexp);
+
+  case KEYWORD_DEFINE:
+    // the defined symbol is not a variable reference
+    if(simplifyFormArguments(sexp) == 2) {
+      Sexp e = simplifySubstitute(simplifyFormArgument(sexp, 1), symbol, value);
+      Sexp ret = sexpCreateCons(SEXP_CAR(sexp),
+                 sexpCreateCons(simplifyFormArgument(sexp, 0),
+                 sexpCreateCons(e, sexpCreateNil())));
+      sexpFree(e);
+      return ret;
+    }
+    return sexpCopy(sexp);
+
+  case KEYWORD_LET:
+    if(simplifyIsLet(sexp)) {
+      Sexp k = simplifyFormArgument(sexp, 0);
+      Sexp e1 = simplifySubstitute(simplifyFormArgument(sexp, 1), symbol, value);
+      Sexp e2 = (!strcmp(k->value.symbol, symbol)) ?
+        sexpCopy(simplifyFormArgument(sexp, 3)) :
+        simplifySubstitute(simplifyFormArgument(sexp, 3), symbol, value);
+      Sexp ret = sexpCreateCons(SEXP_CAR(sexp),
+                 sexpCreateCons(k,
+                 sexpCreateCons(e1,
+                 sexpCreateCons(simplifyFormArgument(sexp, 2),
+                 sexpCreateCons(e2, sexpCreateNil())))));
+      sexpFree(e1);
+      sexpFree(e2);
+      return ret;
+    }
+    return sexpCopy(sexp);
+
+  default:
+    return simplifySubstituteList(sexp, symbol, value);
+  }
+}
+
+
+
+Sexp simplifyLambda(Sexp sexp)
+{
+  // (lambda p1 e1 p2 e2 ...) -> only the expressions are simplified
+  Sexp rules = SEXP_CDR(sexp);
+  if(SEXP_TYPE_OF(rules) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CDR(rules)) != SEXP_TYPE_CONS) {
+    return sexpCopy(sexp);
+  }
+  Sexp pattern = SEXP_CAR(rules);
+  Sexp body = simplifyExpression(SEXP_CAR(SEXP_CDR(rules)));
+  Sexp rest = sexpCreateCons(SEXP_CAR(sexp),
+                             SEXP_CDR(SEXP_CDR(rules)));
+  Sexp simplifiedRest = simplifyLambda(rest);
+
+  Sexp ret = sexpCreateCons(SEXP_CAR(sexp),
+             sexpCreateCons(pattern,
+             sexpCreateCons(body, SEXP_CDR(simplifiedRest))));
+  sexpFree(body);
+  sexpFree(rest);
+  sexpFree(simplifiedRest);
+  return ret;
+}
+
+Sexp simplifyList(Sexp sexp)
+{
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS) {
+    return simplifyExpression(sexp);
+  }
+  Sexp car = simplifyExpression(SEXP_CAR(sexp));
+  Sexp cdr = simplifyList(SEXP_CDR(sexp));
+  Sexp ret = sexpCreateCons(car, cdr);
+  sexpFree(car);
+  sexpFree(cdr);
+  return ret;
+}
+
+Sexp simplifyExpression(Sexp sexp)
+{
+  if(SEXP_TYPE_OF(sexp) != SEXP_TYPE_CONS) {
+    return sexpCopy(sexp);
+  }
+
+  switch(simplifyFormKeyword(sexp))
+  {
+  case KEYWORD_QUOTE:
+    return sexpCopy(sexp);
+
+  case KEYWORD_LAMBDA:
+    return simplifyLambda(sexp);
+
+  case KEYWORD_IF:
+    if(simplifyFormArguments(sexp) == 3) {
+      Sexp cond = simplifyExpression(simplifyFormArgument(sexp, 0));
+      if(SEXP_TYPE_OF(cond) == SEXP_TYPE_BOOLEAN) {
+        simplifyStatistics.prunedConditionals++;
+        Sexp ret = simplifyExpression(simplifyFormArgument(sexp,
+                                      (cond->value.boolean) ? 1 : 2));
+        sexpFree(cond);
+        return ret;
+      }
+      sexpFree(cond);
+    }
+    break;
+
+  case KEYWORD_NOT:
+    if(simplifyFormArguments(sexp) == 1) {
+      Sexp e = simplifyExpression(simplifyFormArgument(sexp, 0));
+      if(SEXP_TYPE_OF(e) == SEXP_TYPE_BOOLEAN) {
+        simplifyStatistics.prunedConditionals++;
+        Sexp ret = sexpCreateBoolean(!e->value.boolean);
+        sexpFree(e);
+        return ret;
+      }
+      sexpFree(e);
+    }
+    break;
+
+  case KEYWORD_LET:
+    if(simplifyIsLet(sexp)) {
+      const char* k = simplifyFormArgument(sexp, 0)->value.symbol;
+      Sexp e1 = simplifyExpression(simplifyFormArgument(sexp, 1));
+      Sexp e2 = simplifyFormArgument(sexp, 3);
+      if((int)keywordMatch(k) == -1 && simplifyIsLiteral(e1) &&
+         simplifyCallsOnlyPrimitives(e2))
+      {
+        simplifyStatistics.collapsedLets++;
+        Sexp substituted = simplifySubstitute(e2, k, e1);
+        Sexp ret = simplifyExpression(substituted);
+        sexpFree(substituted);
+        sexpFree(e1);
+        return ret;
+      }
+      sexpFree(e1);
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  Sexp ret = simplifyList(sexp);
+
+  // | Cons(Operator op, Cons(arg1, Cons(arg2, Nil)))
+  if(SEXP_TYPE_OF(SEXP_CAR(ret)) == SEXP_TYPE_OPERATOR &&
+     simplifyFormArguments(ret) == 2)
+  {
+    Operator operator = SEXP_CAR(ret)->value.operator;
+    Sexp arg1 = simplifyFormArgument(ret, 0);
+    Sexp arg2 = simplifyFormArgument(ret, 1);
+    if(simplifyCanFold(operator, arg1, arg2)) {
+      simplifyStatistics.foldedOperators++;
+      Sexp folded = applyOperator(arg1, arg2, operator);
+      sexpFree(ret);
+      return folded;
+    }
+  }
+  return ret;
+}
+
+/* simplify a program, returning a new S-expression */
+Sexp simplifySexp(Sexp program)
+{
+  if(!program) {
+    printf("simplify sexp: program is null\n");
+    return NULL;
+  }
+
+  unsigned long before = simplifyCountNodes(program);
+  Sexp ret = simplifyExpression(program);
+  unsigned long after = simplifyCountNodes(ret);
+
+  simplifyStatistics.passes++;
+  simplifyStatistics.nodesBefore += before;
+  simplifyStatistics.nodesEliminated += (before > after) ? before - after : 0;
+  return ret;
+}
+
+void simplifyPrintStatistics()
+{
+  printf("simplification passes: %lu\n", simplifyStatistics.passes);
+  printf("nodes eliminated:      %lu of %lu\n",
+         simplifyStatistics.nodesEliminated, simplifyStatistics.nodesBefore);
+  printf("folded operators:      %lu\n", simplifyStatistics.foldedOperators);
+  printf("pruned conditionals:   %lu\n", simplifyStatistics.prunedConditionals);
+  printf("collapsed lets:        %lu\n", simplifyStatistics.collapsedLets);
+}
+
+
+
+#endif // PLD_LISP_SIMPLIFY_H
@@ -3,34 +3,47 @@
 
 #include "sexp.h"
 #include "exception.h"
+#include "builtin.h"
+#include "string_search.h"
+#include "regex/regex_eval.h"
+
+#define STRING_REGEX_CACHE_SIZE 64 // compiled patterns kept, a power of two
 
 int stringArgumentIsConsInteger(const Sexp sexp)
 {
   // verify that current pointer into args is indeed an integer type
-  return sexp && sexp->type == SEXP_TYPE_CONS &&
-         sexp->value.cons[0]->type == SEXP_TYPE_INTEGER;
+  return sexp && SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS &&
+         (SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_INTEGER ||
+          SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_BIGNUM);
+}
+
+int stringArgumentIsConsDouble(const Sexp sexp)
+{
+  // verify that current pointer into args is indeed a double type
+  return sexp && SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS &&
+         SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_DOUBLE;
 }
 
 int stringArgumentIsConsBoolean(const Sexp sexp)
 {
   // verify that current pointer into args is indeed a boolean type
-  return sexp && sexp->type == SEXP_TYPE_CONS &&
-         sexp->value.cons[0]->type == SEXP_TYPE_BOOLEAN;
+  return sexp && SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS &&
+         SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_BOOLEAN;
 }
 
 int stringArgumentIsConsString(const Sexp sexp)
 {
   // verify that current pointer into args is indeed a string type
-  return sexp && sexp->type == SEXP_TYPE_CONS &&
-         sexp->value.cons[0]->type == SEXP_TYPE_STRING;
+  return sexp && SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS &&
+         SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_STRING;
 }
 
 int stringArgumentIsList(const Sexp sexp)
 {
   // verify that current pointer into args is indeed a list type
-  return sexp && sexp->type == SEXP_TYPE_CONS &&
-         (sexp->value.cons[0]->type == SEXP_TYPE_CONS ||
-          sexp->value.cons[0]->type == SEXP_TYPE_NIL);
+  return sexp && SEXP_TYPE_OF(sexp) == SEXP_TYPE_CONS &&
+         (SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_CONS ||
+          SEXP_TYPE_OF(SEXP_CAR(sexp)) == SEXP_TYPE_NIL);
 }
 
 Sexp stringAdvanceArgsPointer(const Sexp argsPointer)
@@ -40,19 +53,23 @@ Sexp stringAdvanceArgsPointer(const Sexp argsPointer)
     return NULL;
   }
 
-  switch(argsPointer->type)
+  switch(SEXP_TYPE_OF(argsPointer))
   {
   case SEXP_TYPE_NIL:
     return NULL;
 
   case SEXP_TYPE_CONS:
-    return argsPointer->value.cons[1];
+    return SEXP_CDR(argsPointer);
 
   case SEXP_TYPE_BOOLEAN:
   case SEXP_TYPE_INTEGER:
+  case SEXP_TYPE_BIGNUM:
+  case SEXP_TYPE_DOUBLE:
   case SEXP_TYPE_OPERATOR:
   case SEXP_TYPE_SYMBOL:
   case SEXP_TYPE_STRING:
+  case SEXP_TYPE_BUILTIN:
+  case SEXP_TYPE_FUNCTION:
     printf("! malformed message argument list\n");
     throwException();
     return NULL;
@@ -64,10 +81,11 @@ Sexp stringAdvanceArgsPointer(const Sexp argsPointer)
   }
 }
 
-void stringPrintMessage(const char* format, Sexp args)
+void stringPrintMessage(SexpString string, Sexp args)
 {
   Sexp sexp = args;
-  unsigned int len = strlen(format);
+  const char* format = string->chars;
+  unsigned int len = string->length;
   unsigned int i = 0;
 
   while(i < len)
@@ -81,7 +99,18 @@ void stringPrintMessage(const char* format, Sexp args)
           return;
         }
         else {
-          printf("%i", sexp->value.cons[0]->value.integer);
+          sexpPrint(SEXP_CAR(sexp));
+          sexp = stringAdvanceArgsPointer(sexp);
+        }
+        break;
+
+      case 'f':
+        if(!stringArgumentIsConsDouble(sexp)) {
+          printf("! message argument did not match floating-point type\n");
+          return;
+        }
+        else {
+          numberPrintDouble(SEXP_CAR(sexp)->value.doubleFP);
           sexp = stringAdvanceArgsPointer(sexp);
         }
         break;
@@ -92,7 +121,7 @@ void stringPrintMessage(const char* format, Sexp args)
           return;
         }
         else {
-          printf("%s", (sexp->value.cons[0]->value.boolean) ? "true" : "false");
+          printf("%s", (SEXP_CAR(sexp)->value.boolean) ? "true" : "false");
           sexp = stringAdvanceArgsPointer(sexp);
         }
         break;
@@ -103,7 +132,8 @@ void stringPrintMessage(const char* format, Sexp args)
           return;
         }
         else {
-          printf("%s", sexp->value.cons[0]->value.string);
+          printf("%.*s", (int)SEXP_CAR(sexp)->value.string->length,
+                 SEXP_CAR(sexp)->value.string->chars);
           sexp = stringAdvanceArgsPointer(sexp);
         }
         break;
@@ -114,7 +144,7 @@ void stringPrintMessage(const char* format, Sexp args)
           return;
         }
         else {
-          sexpPrint(sexp->value.cons[0]);
+          sexpPrint(SEXP_CAR(sexp));
           sexp = stringAdvanceArgsPointer(sexp);
         }
         break;
@@ -139,4 +169,320 @@ void stringPrintMessage(const char* format, Sexp args)
 }
 
 
+
+/*
+ * String builtins. Strings know their length, and substrings are views into
+ * the string they are taken from, so only stringjoin copies any characters,
+ * and each of them once:
+ *   (stringlength s)        the number of characters in s
+ *   (substring s start end) the characters of s from start up to end
+ *   (stringindex s t)       the index of the first t in s, or -1
+ *   (stringcontains s t)    is t in s?
+ *   (stringcount s t)       the number of non-overlapping t in s
+ *   (stringequals s t)      are the strings equal?
+ *   (stringsplit s sep)     the list of substrings of s between each sep
+ *   (stringjoin l)          the strings of the list l one after another
+ *   (stringjoin l sep)      the same, with sep between each of them
+ *   (regexmatch r s)        does all of s match the pattern r?
+ *   (regexfind r s)         the leftmost longest substring of s matching r,
+ *                           or () if there is none
+ *   (readfile name)         the contents of the file
+ * See regex/regex_build.h for the syntax of patterns, and string_search.h for
+ * how strings are searched.
+ */
+
+// the next argument, if it has the type, otherwise NULL
+Sexp stringNextArgument(Sexp* arguments, enum _sexp_type_t type)
+{
+  if(SEXP_TYPE_OF(*arguments) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(*arguments)) != type) {
+    return NULL;
+  }
+  Sexp argument = SEXP_CAR(*arguments);
+  *arguments = SEXP_CDR(*arguments);
+  return argument;
+}
+
+void stringBadArguments(const char* name, const char* expected)
+{
+  printf("! %s expects %s\n", name, expected);
+  throwException();
+  printf("Control should not reach this point!\n");
+}
+
+// the index of the first occurrence of pattern in string from start, or -1
+long stringIndexOf(SexpString string, SexpString pattern, size_t start)
+{
+  if(pattern->length > string->length) {
+    return -1;
+  }
+  if(!pattern->length) {
+    return (long)start;
+  }
+  return stringSearch(string->chars, string->length,
+                      pattern->chars, pattern->length, start);
+}
+
+Sexp stringLengthBuiltin(Sexp arguments)
+{
+  Sexp string = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  if(!string || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL) {
+    stringBadArguments("stringlength", "a string");
+    return NULL;
+  }
+  return sexpCreateInteger((long)string->value.string->length);
+}
+
+Sexp stringSubstringBuiltin(Sexp arguments)
+{
+  Sexp string = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  Sexp start = (string) ? stringNextArgument(&arguments, SEXP_TYPE_INTEGER) : NULL;
+  Sexp end = (start) ? stringNextArgument(&arguments, SEXP_TYPE_INTEGER) : NULL;
+  if(!end || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL ||
+     start->value.integer < 0 || end->value.integer < start->value.integer ||
+     (size_t)end->value.integer > string->value.string->length) {
+    stringBadArguments("substring", "a string, and a start and end within it");
+    return NULL;
+  }
+  return sexpCreateStringOf(sexpStringView(string->value.string,
+                                           start->value.integer,
+                                           end->value.integer - start->value.integer));
+}
+
+Sexp stringIndexBuiltin(Sexp arguments)
+{
+  Sexp string = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  Sexp pattern = (string) ? stringNextArgument(&arguments, SEXP_TYPE_STRING) : NULL;
+  if(!pattern || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL) {
+    stringBadArguments("stringindex", "two strings");
+    return NULL;
+  }
+  return sexpCreateInteger((int)stringIndexOf(string->value.string,
+                                              pattern->value.string, 0));
+}
+
+Sexp stringContainsBuiltin(Sexp arguments)
+{
+  Sexp string = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  Sexp pattern = (string) ? stringNextArgument(&arguments, SEXP_TYPE_STRING) : NULL;
+  if(!pattern || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL) {
+    stringBadArguments("stringcontains", "two strings");
+    return NULL;
+  }
+  return sexpCreateBoolean(stringIndexOf(string->value.string,
+                                         pattern->value.string, 0) >= 0);
+}
+
+Sexp stringCountBuiltin(Sexp arguments)
+{
+  Sexp string = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  Sexp pattern = (string) ? stringNextArgument(&arguments, SEXP_TYPE_STRING) : NULL;
+  if(!pattern || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL ||
+     !pattern->value.string->length) {
+    stringBadArguments("stringcount", "a string and a non-empty string");
+    return NULL;
+  }
+  int count = 0;
+  long index = 0;
+  while((index = stringIndexOf(string->value.string, pattern->value.string,
+                               index)) >= 0) {
+    count++;
+    index += pattern->value.string->length;
+  }
+  return sexpCreateInteger(count);
+}
+
+Sexp stringEqualsBuiltin(Sexp arguments)
+{
+  Sexp string1 = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  Sexp string2 = (string1) ? stringNextArgument(&arguments, SEXP_TYPE_STRING) : NULL;
+  if(!string2 || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL) {
+    stringBadArguments("stringequals", "two strings");
+    return NULL;
+  }
+  return sexpCreateBoolean(sexpStringEquals(string1->value.string,
+                                            string2->value.string));
+}
+
+Sexp stringReadFileBuiltin(Sexp arguments)
+{
+  Sexp name = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  if(!name || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL) {
+    stringBadArguments("readfile", "the name of a file");
+    return NULL;
+  }
+  char* filename = strndup(name->value.string->chars, name->value.string->length);
+  FILE* file = fopen(filename, "rb");
+  free(filename);
+  if(!file || fseek(file, 0, SEEK_END)) {
+    if(file) fclose(file);
+    printf("! readfile: cannot open %.*s\n", (int)name->value.string->length,
+           name->value.string->chars);
+    throwException();
+    return NULL;
+  }
+  long size = ftell(file);
+  rewind(file);
+  SexpString contents = sexpStringAllocate((size > 0) ? size : 0);
+  contents->length = contents->used = fread(contents->buffer, 1, contents->capacity, file);
+  fclose(file);
+  return sexpCreateStringOf(contents);
+}
+
+Sexp stringSplitBuiltin(Sexp arguments)
+{
+  Sexp string = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  Sexp separator = (string) ? stringNextArgument(&arguments, SEXP_TYPE_STRING) : NULL;
+  if(!separator || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL ||
+     !separator->value.string->length) {
+    stringBadArguments("stringsplit", "a string and a non-empty separator");
+    return NULL;
+  }
+
+  SexpString whole = string->value.string;
+  size_t length = separator->value.string->length;
+  size_t count = 0;
+  size_t capacity = 16;
+  Sexp* parts = malloc(sizeof(Sexp) * capacity);
+  size_t start = 0;
+  while(1) {
+    long index = stringIndexOf(whole, separator->value.string, start);
+    size_t end = (index < 0) ? whole->length : (size_t)index;
+    if(count == capacity) {
+      capacity *= 2;
+      parts = realloc(parts, sizeof(Sexp) * capacity);
+    }
+    parts[count++] = sexpCreateStringOf(sexpStringView(whole, start, end - start));
+    if(index < 0) {
+      break;
+    }
+    start = end + length;
+  }
+  Sexp list = sexpCreateListOf(parts, count, sexpCreateNil());
+  free(parts);
+  return list;
+}
+
+Sexp stringJoinBuiltin(Sexp arguments)
+{
+  Sexp list = (SEXP_TYPE_OF(arguments) == SEXP_TYPE_CONS) ? SEXP_CAR(arguments) : NULL;
+  arguments = (list) ? SEXP_CDR(arguments) : arguments;
+  Sexp separator = (SEXP_TYPE_OF(arguments) == SEXP_TYPE_CONS) ?
+    stringNextArgument(&arguments, SEXP_TYPE_STRING) : NULL;
+  size_t between = (separator) ? separator->value.string->length : 0;
+
+  // the length is known before anything is copied
+  size_t length = 0;
+  Sexp part = list;
+  for(; part && SEXP_TYPE_OF(part) == SEXP_TYPE_CONS; part = SEXP_CDR(part)) {
+    if(SEXP_TYPE_OF(SEXP_CAR(part)) != SEXP_TYPE_STRING) {
+      break;
+    }
+    length += SEXP_CAR(part)->value.string->length + ((part != list) ? between : 0);
+  }
+  if(!part || SEXP_TYPE_OF(part) != SEXP_TYPE_NIL ||
+     SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL) {
+    stringBadArguments("stringjoin", "a list of strings, and optionally a separator");
+    return NULL;
+  }
+
+  SexpString joined = sexpStringAllocate(length);
+  char* c = joined->buffer;
+  for(part = list; SEXP_TYPE_OF(part) == SEXP_TYPE_CONS; part = SEXP_CDR(part)) {
+    if(separator && part != list) {
+      memcpy(c, separator->value.string->chars, between);
+      c += between;
+    }
+    SexpString string = SEXP_CAR(part)->value.string;
+    memcpy(c, string->chars, string->length);
+    c += string->length;
+  }
+  joined->length = joined->used = length;
+  return sexpCreateStringOf(joined);
+}
+
+/*
+ * Compiled patterns, by their hash. A pattern is usually a literal in the
+ * code of a function, so it is compiled on the first call only, and the DFA
+ * built while matching is kept for the following calls.
+ */
+struct _string_regex_entry_t {
+  SexpString pattern;
+  RegexProgram program;
+} stringRegexCache[STRING_REGEX_CACHE_SIZE];
+
+RegexProgram stringRegexCompile(const char* name, SexpString pattern)
+{
+  unsigned long hash = sexpHashBytes(14695981039346656037ul, pattern->chars,
+                                     pattern->length);
+  struct _string_regex_entry_t* entry =
+    &stringRegexCache[hash & (STRING_REGEX_CACHE_SIZE - 1)];
+  if(entry->pattern && sexpStringEquals(entry->pattern, pattern)) {
+    return entry->program;
+  }
+
+  RegexProgram program = regexCompile(pattern->chars, pattern->length);
+  if(!program) {
+    printf("! %s: malformed pattern, %s\n", name, regexError);
+    throwException();
+    return NULL;
+  }
+  if(entry->pattern) {
+    sexpStringRelease(entry->pattern);
+    regexProgramFree(entry->program);
+  }
+  // a copy, since a view would keep the whole of its string alive
+  entry->pattern = sexpStringCreate(pattern->chars, pattern->length);
+  entry->program = program;
+  return program;
+}
+
+Sexp stringRegexMatchBuiltin(Sexp arguments)
+{
+  Sexp pattern = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  Sexp string = (pattern) ? stringNextArgument(&arguments, SEXP_TYPE_STRING) : NULL;
+  if(!string || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL) {
+    stringBadArguments("regexmatch", "a pattern and a string");
+    return NULL;
+  }
+  RegexProgram program = stringRegexCompile("regexmatch", pattern->value.string);
+  return sexpCreateBoolean(regexEvalIsMatch(program, string->value.string->chars,
+                                            string->value.string->length));
+}
+
+Sexp stringRegexFindBuiltin(Sexp arguments)
+{
+  Sexp pattern = stringNextArgument(&arguments, SEXP_TYPE_STRING);
+  Sexp string = (pattern) ? stringNextArgument(&arguments, SEXP_TYPE_STRING) : NULL;
+  if(!string || SEXP_TYPE_OF(arguments) != SEXP_TYPE_NIL) {
+    stringBadArguments("regexfind", "a pattern and a string");
+    return NULL;
+  }
+  RegexProgram program = stringRegexCompile("regexfind", pattern->value.string);
+  size_t start = 0;
+  size_t end = 0;
+  if(!regexEvalFind(program, string->value.string->chars,
+                    string->value.string->length, &start, &end)) {
+    return sexpCreateNil();
+  }
+  return sexpCreateStringOf(sexpStringView(string->value.string, start, end - start));
+}
+
+void stringRegisterBuiltins()
+{
+  builtinRegister("stringlength", stringLengthBuiltin);
+  builtinRegister("substring", stringSubstringBuiltin);
+  builtinRegister("stringindex", stringIndexBuiltin);
+  builtinRegister("stringcontains", stringContainsBuiltin);
+  builtinRegister("stringcount", stringCountBuiltin);
+  builtinRegister("stringequals", stringEqualsBuiltin);
+  builtinRegister("readfile", stringReadFileBuiltin);
+  builtinRegister("stringsplit", stringSplitBuiltin);
+  builtinRegister("stringjoin", stringJoinBuiltin);
+  builtinRegister("regexmatch", stringRegexMatchBuiltin);
+  builtinRegister("regexfind", stringRegexFindBuiltin);
+}
+
+
+#undef STRING_REGEX_CACHE_SIZE
 #endif // PLD_LISP_STRING_H
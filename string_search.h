@@ -0,0 +1,140 @@
+#ifndef PLD_LISP_STRING_SEARCH_H
+#define PLD_LISP_STRING_SEARCH_H
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STRING_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Search for a pattern of at least one character in a text, from an index.
+ * The vector kernels compare the first and the last character of the pattern
+ * with 16 or 32 positions of the text at a time, and only compare the rest of
+ * the pattern where both are equal, so most of the text is skipped in blocks.
+ * A single character is found with memchr, which the C library vectorizes.
+ * The kernel is chosen when first used, by what the processor supports, and
+ * may be set directly, see test_search.c.
+ */
+typedef long (*StringSearchKernel)(const char* text, size_t length,
+                                   const char* pattern, size_t size, size_t start);
+
+long stringSearchSelect(const char* text, size_t length,
+                        const char* pattern, size_t size, size_t start);
+
+StringSearchKernel stringSearch = stringSearchSelect;
+const char* stringSearchName = "none";
+
+
+
+/* kernels, each returns the index of the first occurrence, or -1 */
+long stringSearchScalar(const char* text, size_t length,
+                        const char* pattern, size_t size, size_t start)
+{
+  if(size > length) {
+    return -1;
+  }
+  const char* last = text + length - size;
+  const char* c = text + start;
+  while(c <= last) {
+    c = memchr(c, pattern[0], last - c + 1);
+    if(!c) {
+      return -1;
+    }
+    if(!memcmp(c + 1, pattern + 1, size - 1)) {
+      return c - text;
+    }
+    c++;
+  }
+  return -1;
+}
+
+#ifdef STRING_SEARCH_X86
+
+// the first candidate in mask, block positions from i, which matches in full
+long stringSearchCandidates(unsigned int mask, const char* text, size_t i,
+                            const char* pattern, size_t size)
+{
+  for(; mask; mask &= mask - 1) {
+    size_t index = i + __builtin_ctz(mask);
+    if(size == 2 || !memcmp(text + index + 1, pattern + 1, size - 2)) {
+      return (long)index;
+    }
+  }
+  return -1;
+}
+
+__attribute__((target("sse2")))
+long stringSearchSse2(const char* text, size_t length,
+                      const char* pattern, size_t size, size_t start)
+{
+  if(size < 2 || size > length) {
+    // memchr is vectorized already
+    return stringSearchScalar(text, length, pattern, size, start);
+  }
+  const __m128i first = _mm_set1_epi8(pattern[0]);
+  const __m128i last = _mm_set1_epi8(pattern[size - 1]);
+  size_t i = start;
+  for(; i + size - 1 + 16 <= length; i += 16) {
+    __m128i head = _mm_loadu_si128((const __m128i*)(text + i));
+    __m128i tail = _mm_loadu_si128((const __m128i*)(text + i + size - 1));
+    unsigned int mask = _mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+    long index = stringSearchCandidates(mask, text, i, pattern, size);
+    if(index >= 0) {
+      return index;
+    }
+  }
+  return stringSearchScalar(text, length, pattern, size, i);
+}
+
+__attribute__((target("avx2")))
+long stringSearchAvx2(const char* text, size_t length,
+                      const char* pattern, size_t size, size_t start)
+{
+  if(size < 2 || size > length) {
+    // memchr is vectorized already
+    return stringSearchScalar(text, length, pattern, size, start);
+  }
+  const __m256i first = _mm256_set1_epi8(pattern[0]);
+  const __m256i last = _mm256_set1_epi8(pattern[size - 1]);
+  size_t i = start;
+  for(; i + size - 1 + 32 <= length; i += 32) {
+    __m256i head = _mm256_loadu_si256((const __m256i*)(text + i));
+    __m256i tail = _mm256_loadu_si256((const __m256i*)(text + i + size - 1));
+    unsigned int mask = _mm256_movemask_epi8(
+      _mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+    long index = stringSearchCandidates(mask, text, i, pattern, size);
+    if(index >= 0) {
+      return index;
+    }
+  }
+  return stringSearchScalar(text, length, pattern, size, i);
+}
+
+#endif // STRING_SEARCH_X86
+
+long stringSearchSelect(const char* text, size_t length,
+                        const char* pattern, size_t size, size_t start)
+{
+  stringSearch = stringSearchScalar;
+  stringSearchName = "scalar";
+#ifdef STRING_SEARCH_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    stringSearch = stringSearchAvx2;
+    stringSearchName = "avx2";
+  }
+  else if(__builtin_cpu_supports("sse2")) {
+    stringSearch = stringSearchSse2;
+    stringSearchName = "sse2";
+  }
+#endif
+  return stringSearch(text, length, pattern, size, start);
+}
+
+
+
+#endif // PLD_LISP_STRING_SEARCH_H
@@ -3,6 +3,7 @@
 
 #include "sexp.h"
 #include "exception.h"
+#include "memory/manager.h"
 
 
 /* jump buffer for exception handling */
@@ -42,14 +43,15 @@ SymtableBinding symtableBindingAlloc()
 
 SymtableElement symtableElementAlloc()
 {
-  return malloc(sizeof(struct _symtable_element_t));
+  SymtableElement element = malloc(sizeof(struct _symtable_element_t));
+  element->next = NULL;
+  return element;
 }
 
 SymtableBinding symtableBindingCreate(const char* symbol, Sexp sexp)
 {
   SymtableBinding binding = symtableBindingAlloc();
-  binding->symbol = malloc(strlen(symbol) * sizeof(char));
-  strcpy(binding->symbol, symbol);
+  binding->symbol = memoryManagerCreateString(symbol);
   binding->value = sexpCopy(sexp);
   return binding;
 }
@@ -60,7 +62,7 @@ void symtableBindingFree(SymtableBinding binding)
     printf("symtable binding free: binding is null\n");
     return;
   }
-  if(binding->symbol) free(binding->symbol);
+  if(binding->symbol) memoryManagerFreeString(binding->symbol);
   if(binding->value) sexpFree(binding->value);
   free(binding);
 }
@@ -136,6 +138,20 @@ Sexp symtableLookupSymbol(Symtable symtable, const char* symbol)
   return NULL;
 }
 
+// same as symtableLookupSymbol, but returns the binding itself without copying
+SymtableBinding symtableLookupBinding(Symtable symtable, const char* symbol)
+{
+  SymtableElement element = symtable->head;
+  while(element)
+  {
+    if(!strcmp(element->binding->symbol, symbol)) {
+      return element->binding;
+    }
+    element = element->next;
+  }
+  return NULL;
+}
+
 int symtableDisjoint(Symtable symtable1, Symtable symtable2)
 {
   SymtableElement element1 = symtable1->head;
@@ -4,6 +4,7 @@
 #include "sexp.h"
 #include "lex.h"
 #include "operator.h"
+#include "bignum.h"
 
 /* syntree lexing position */
 struct _syntree_lexing_position_t {
@@ -22,7 +23,7 @@ typedef struct _syntree_lexing_position_t* LexingPosition;
 /* functions for lexing positions type */
 LexingPosition syntreeLexingPositionCreate()
 {
-  LexingPosition pos = malloc(sizeof(LexingPosition));
+  LexingPosition pos = malloc(sizeof(struct _syntree_lexing_position_t));
   pos->position = NULL;
   pos->errors = 0;
   pos->scope = 0;
@@ -102,6 +103,19 @@ Sexp readInteger(LexingPosition pos)
   return sexp;
 }
 
+Sexp readBignum(LexingPosition pos)
+{
+  Sexp sexp = NULL;
+  if(pos->position->token->type != LEX_TOKEN_TYPE_BIGNUM) {
+    printf("Parse error: Expected an integer\n"); // exit(-1);
+  }
+  else {
+    sexp = bignumFromString(pos->position->token->value.bignum);
+  }
+  syntreeLexingPositionAdvance(pos);
+  return sexp;
+}
+
 Sexp readDouble(LexingPosition pos)
 {
   Sexp sexp = NULL;
@@ -178,7 +192,7 @@ Sexp readTail(LexingPosition pos)
       syntreeLexingPositionAdvance(pos);
       head = readSexp(pos);
       Sexp close = readTail(pos);
-      if(close->type != SEXP_TYPE_NIL) {
+      if(SEXP_TYPE_OF(close) != SEXP_TYPE_NIL) {
         printf("Syntax error: missing close paranthesis\n");
         pos->errors++;
         return NULL;
@@ -206,6 +220,10 @@ Sexp readTail(LexingPosition pos)
     head = readInteger(pos);
     return sexpCreateCons(head, readTail(pos));
 
+  case LEX_TOKEN_TYPE_BIGNUM:
+    head = readBignum(pos);
+    return sexpCreateCons(head, readTail(pos));
+
   case LEX_TOKEN_TYPE_DOUBLE:
     head = readDouble(pos);
     return sexpCreateCons(head, readTail(pos));
@@ -274,6 +292,9 @@ Sexp readSexp(LexingPosition pos)
   case LEX_TOKEN_TYPE_INTEGER:
     return readInteger(pos);
 
+  case LEX_TOKEN_TYPE_BIGNUM:
+    return readBignum(pos);
+
   case LEX_TOKEN_TYPE_DOUBLE:
     return readDouble(pos);
 
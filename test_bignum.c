@@ -0,0 +1,227 @@
+#include <assert.h>
+#include "eval.h"
+#include "timer.h"
+
+/*
+ * Tests of the bignum kernels against digit by digit multiplication and
+ * against each other, and a benchmark of factorials, powers and printing.
+ * Timings are written to stderr.
+ */
+#define DIGITS_LIMIT 4096
+
+BignumDigit* randomDigits(size_t n)
+{
+  BignumDigit* a = malloc(sizeof(BignumDigit) * (n + 1));
+  for(size_t i = 0; i < n; i++) {
+    a[i] = ((uint64_t)rand() << 16 ^ rand()) % SEXP_BIGNUM_BASE;
+  }
+  if(n > 0 && !a[n - 1]) {
+    a[n - 1] = 1;
+  }
+  return a;
+}
+
+// Karatsuba agrees with digit by digit multiplication, at and around the
+// threshold and on unbalanced operands
+void testMultiply()
+{
+  size_t sizes[] = { 1, 2, 39, 40, 41, 80, 81, 100, 333, 1000 };
+  const int count = sizeof(sizes) / sizeof(sizes[0]);
+  for(int x = 0; x < count; x++) {
+    for(int y = 0; y < count; y++) {
+      size_t n = sizes[x], m = sizes[y];
+      BignumDigit* a = randomDigits(n);
+      BignumDigit* b = randomDigits(m);
+      BignumDigit* expected = malloc(sizeof(BignumDigit) * (n + m));
+      BignumDigit* product = malloc(sizeof(BignumDigit) * (n + m));
+      bignumMultiplySchoolbook(a, n, b, m, expected);
+      bignumMultiplyDigits(a, n, b, m, product);
+      assert(!memcmp(product, expected, sizeof(BignumDigit) * (n + m)));
+      // all digits at their largest carry the most
+      for(size_t i = 0; i < n; i++) a[i] = SEXP_BIGNUM_BASE - 1;
+      for(size_t i = 0; i < m; i++) b[i] = SEXP_BIGNUM_BASE - 1;
+      bignumMultiplySchoolbook(a, n, b, m, expected);
+      bignumMultiplyDigits(a, n, b, m, product);
+      assert(!memcmp(product, expected, sizeof(BignumDigit) * (n + m)));
+      free(a);
+      free(b);
+      free(expected);
+      free(product);
+    }
+  }
+}
+
+// a = q b + r with r < b
+void testDivide()
+{
+  size_t sizes[] = { 1, 2, 3, 10, 50, 200 };
+  const int count = sizeof(sizes) / sizeof(sizes[0]);
+  for(int x = 0; x < count; x++) {
+    for(int y = 0; y <= x; y++) {
+      for(int trial = 0; trial < 20; trial++) {
+        size_t n = sizes[x], m = sizes[y];
+        BignumDigit* a = randomDigits(n);
+        BignumDigit* b = randomDigits(m);
+        if(trial % 4 == 1) {
+          b[m - 1] = 1; // the most scaling
+        }
+        if(trial % 4 == 2) {
+          for(size_t i = 0; i < n; i++) a[i] = SEXP_BIGNUM_BASE - 1;
+        }
+        BignumDigit* q = calloc(n - m + 1, sizeof(BignumDigit));
+        BignumDigit* r = calloc(m, sizeof(BignumDigit));
+        if(m == 1) {
+          r[0] = bignumDivideSmall(a, n, b[0], q);
+        }
+        else {
+          bignumDivideDigits(a, n, b, m, q, r);
+        }
+        assert(bignumCompareDigits(r, bignumTrim(r, m), b, m) < 0);
+        BignumDigit* back = calloc(n + 2, sizeof(BignumDigit));
+        bignumMultiplyDigits(q, n - m + 1, b, m, back);
+        bignumAddInto(back, n + 1, r, m);
+        assert(bignumCompareDigits(back, bignumTrim(back, n + 1), a, n) == 0);
+        free(a);
+        free(b);
+        free(q);
+        free(r);
+        free(back);
+      }
+    }
+  }
+}
+
+Sexp integer(const char* text)
+{
+  char buffer[64];
+  strcpy(buffer, text);
+  LexTokenList tokens = transformBufferToTokenList(buffer);
+  Sexp sexp = transformTokenListToSexp(tokens);
+  lexTokenListFree(tokens);
+  return sexp;
+}
+
+void assertDigits(Sexp sexp, const char* expected)
+{
+  if(SEXP_TYPE_OF(sexp) == SEXP_TYPE_INTEGER) {
+    char text[32];
+    sprintf(text, "%ld", sexp->value.integer);
+    assert(!strcmp(text, expected));
+    return;
+  }
+  assert(SEXP_TYPE_OF(sexp) == SEXP_TYPE_BIGNUM);
+  char* text = sexpBignumText(sexp->value.bignum);
+  assert(!strcmp(text, expected));
+  free(text);
+}
+
+// promotion on overflow, and back to a long when the result fits
+void testOperators()
+{
+  Sexp max = sexpCreateInteger(LONG_MAX);
+  Sexp min = sexpCreateInteger(LONG_MIN);
+  Sexp one = sexpCreateInteger(1);
+  Sexp minusOne = sexpCreateInteger(-1);
+  Sexp sum = applyOperator(max, one, OPERATOR_PLUS);
+  assertDigits(sum, "9223372036854775808");
+  assertDigits(applyOperator(sum, one, OPERATOR_MINUS), "9223372036854775807");
+  assert(SEXP_TYPE_OF(applyOperator(sum, one, OPERATOR_MINUS)) == SEXP_TYPE_INTEGER);
+  assertDigits(applyOperator(min, minusOne, OPERATOR_DIVIDE), "9223372036854775808");
+  assertDigits(applyOperator(min, minusOne, OPERATOR_MODULUS), "0");
+  assertDigits(applyOperator(min, min, OPERATOR_MULTIPLY),
+               "85070591730234615865843651857942052864");
+  assertDigits(applyOperator(sexpCreateInteger(-7), integer("10000000000000000000000"),
+                             OPERATOR_MODULUS), "-7");
+  assertDigits(integer("-9223372036854775808"), "-9223372036854775808");
+  assert(SEXP_TYPE_OF(integer("-9223372036854775808")) == SEXP_TYPE_INTEGER);
+  assertDigits(integer("-9223372036854775809"), "-9223372036854775809");
+
+  Sexp power = applyOperator(sexpCreateInteger(3), sexpCreateInteger(200), OPERATOR_POWER);
+  assertDigits(power, "265613988875874769338781322035779626829233452653394495974574961739092490901302182994384699044001");
+  Sexp cube = applyOperator(power, sexpCreateInteger(3), OPERATOR_POWER);
+  Sexp expected = applyOperator(sexpCreateInteger(3), sexpCreateInteger(600), OPERATOR_POWER);
+  assert(sexpIdentical(cube, expected));
+  assertDigits(applyOperator(cube, power, OPERATOR_DIVIDE),
+               "70550791086553325712464271575934796216507949612787315762871223209262085551582934156579298529447134158154952334825355911866929793071824566694145084454535257027960285323760313192443283334088001");
+  assertDigits(applyOperator(cube, sexpCreateInteger(-5), OPERATOR_POWER), "0");
+}
+
+// the product of the integers from low to high, halving the range, so that
+// the factors of the last products have the same size
+Sexp productTree(long low, long high)
+{
+  if(low == high) {
+    return sexpCreateInteger(low);
+  }
+  long middle = (low + high) / 2;
+  Sexp left = productTree(low, middle);
+  Sexp right = productTree(middle + 1, high);
+  Sexp product = applyOperator(left, right, OPERATOR_MULTIPLY);
+  sexpFree(left);
+  sexpFree(right);
+  return product;
+}
+
+void benchmark()
+{
+  for(long n = 1000; n <= 100000; n *= 10) {
+    timerStart();
+    Sexp tree = productTree(1, n);
+    fprintf(stderr, "%6ld! as a product tree: %g ms.\n", n, timerStop());
+    if(n > 10000) {
+      sexpFree(tree);
+      continue; // a product from left to right takes seconds
+    }
+    timerStart();
+    Sexp product = sexpCreateInteger(1);
+    for(long i = 2; i <= n; i++) {
+      Sexp factor = sexpCreateInteger(i);
+      Sexp next = applyOperator(product, factor, OPERATOR_MULTIPLY);
+      sexpFree(product);
+      sexpFree(factor);
+      product = next;
+    }
+    double time = timerStop();
+    timerStart();
+    char* text = sexpBignumText(product->value.bignum);
+    fprintf(stderr, "%6ld!, %zu digits: %g ms, printed in %g ms.\n", n, strlen(text),
+            time, timerStop());
+    assert(sexpIdentical(product, tree));
+    sexpFree(tree);
+    free(text);
+    sexpFree(product);
+  }
+
+  for(size_t n = 256; n <= DIGITS_LIMIT; n *= 4) {
+    BignumDigit* a = randomDigits(n);
+    BignumDigit* b = randomDigits(n);
+    BignumDigit* product = malloc(sizeof(BignumDigit) * 2 * n);
+    timerStart();
+    bignumMultiplySchoolbook(a, n, b, n, product);
+    double schoolbook = timerStop();
+    timerStart();
+    bignumMultiplyDigits(a, n, b, n, product);
+    fprintf(stderr, "multiply %5zu x %5zu digits: %g ms, schoolbook %g ms.\n",
+            n * SEXP_BIGNUM_BASE_DIGITS, n * SEXP_BIGNUM_BASE_DIGITS, timerStop(),
+            schoolbook);
+    free(a);
+    free(b);
+    free(product);
+  }
+
+  timerStart();
+  Sexp power = applyOperator(sexpCreateInteger(3), sexpCreateInteger(1000000),
+                             OPERATOR_POWER);
+  fprintf(stderr, "3 ** 1000000, %zu digits: %g ms.\n",
+          power->value.bignum->length * SEXP_BIGNUM_BASE_DIGITS, timerStop());
+}
+
+int main()
+{
+  testMultiply();
+  testDivide();
+  testOperators();
+  benchmark();
+  printf("all bignum tests passed\n");
+  return 0;
+}
@@ -0,0 +1,161 @@
+#include <assert.h>
+#include "eval.h"
+#include "timer.h"
+
+/*
+ * Tests of the matrix kernels against plain loops, and a benchmark of the
+ * product, the factorization and solving, on random matrices of up to
+ * SIZE_LIMIT x SIZE_LIMIT. Timings are written to stderr.
+ */
+#define SIZE_LIMIT 1024
+
+double* randomMatrix(size_t rows, size_t columns)
+{
+  double* a = malloc(sizeof(double) * rows * columns + 1);
+  for(size_t i = 0; i < rows * columns; i++) {
+    a[i] = (double)rand() / RAND_MAX - 0.5;
+  }
+  return a;
+}
+
+// c = a b, in the order of the definition
+void naiveMultiply(const double* a, const double* b, double* c,
+                   size_t m, size_t p, size_t n)
+{
+  for(size_t i = 0; i < m; i++) {
+    for(size_t j = 0; j < n; j++) {
+      double sum = 0;
+      for(size_t k = 0; k < p; k++) {
+        sum += a[i * p + k] * b[k * n + j];
+      }
+      c[i * n + j] = sum;
+    }
+  }
+}
+
+double maximumDifference(const double* a, const double* b, size_t n)
+{
+  double difference = 0;
+  for(size_t i = 0; i < n; i++) {
+    difference = fmax(difference, fabs(a[i] - b[i]));
+  }
+  return difference;
+}
+
+struct _kernel_t {
+  MatrixTileKernel kernel;
+  size_t columns;
+} kernels[] = {
+  { matrixMultiplyTile4, 4 },
+#ifdef MATRIX_X86
+  { matrixMultiplyTile8, 8 },
+#endif
+};
+
+const int kernelCount = sizeof(kernels) / sizeof(kernels[0]);
+
+// products of sizes around the tiles and blocks, which leave edges
+void testMultiply()
+{
+  size_t sizes[] = { 1, 3, 4, 7, 8, 9, 31, 255, 257, 300 };
+  const int count = sizeof(sizes) / sizeof(sizes[0]);
+  for(int x = 0; x < count; x += 2) {
+    for(int y = 1; y < count; y += 3) {
+      for(int z = 0; z < count; z += 4) {
+        size_t m = sizes[x], p = sizes[y], n = sizes[z];
+        double* a = randomMatrix(m, p);
+        double* b = randomMatrix(p, n);
+        double* c = randomMatrix(m, n);
+        double* expected = randomMatrix(m, n);
+        naiveMultiply(a, b, expected, m, p, n);
+        for(int k = 0; k < kernelCount; k++) {
+          matrixTile = kernels[k].kernel;
+          matrixTileColumns = kernels[k].columns;
+          matrixMultiply(a, b, c, m, p, n);
+          assert(maximumDifference(c, expected, m * n) < 1e-12 * p);
+        }
+        free(a);
+        free(b);
+        free(c);
+        free(expected);
+      }
+    }
+  }
+}
+
+// a x = b is solved, and a singular matrix is found to be
+void testSolve(size_t n, size_t m)
+{
+  double* a = randomMatrix(n, n);
+  double* b = randomMatrix(n, m);
+  double* lu = malloc(sizeof(double) * n * n);
+  double* x = malloc(sizeof(double) * n * m);
+  double* product = malloc(sizeof(double) * n * m);
+  size_t* rows = malloc(sizeof(size_t) * n);
+  memcpy(lu, a, sizeof(double) * n * n);
+  assert(matrixDecompose(lu, n, rows));
+  for(size_t i = 0; i < n; i++) {
+    memcpy(x + i * m, b + rows[i] * m, sizeof(double) * m);
+  }
+  matrixSubstitute(lu, n, x, m);
+  matrixMultiply(a, x, product, n, n, m);
+  assert(maximumDifference(product, b, n * m) < 1e-9);
+
+  if(n > 1) {
+    memcpy(a + n * (n - 1), a, sizeof(double) * n); // two equal rows
+    assert(!matrixDecompose(a, n, rows));
+  }
+  free(a);
+  free(b);
+  free(lu);
+  free(x);
+  free(product);
+  free(rows);
+}
+
+void benchmark()
+{
+  for(size_t n = 64; n <= SIZE_LIMIT; n *= 2) {
+    double* a = randomMatrix(n, n);
+    double* b = randomMatrix(n, n);
+    double* c = randomMatrix(n, n);
+    size_t* rows = malloc(sizeof(size_t) * n);
+
+    if(n <= SIZE_LIMIT / 2) {
+      timerStart();
+      naiveMultiply(a, b, c, n, n, n);
+      fprintf(stderr, "naive    %4zu x %4zu: %g ms.\n", n, n, timerStop());
+    }
+    timerStart();
+    matrixMultiply(a, b, c, n, n, n);
+    double time = timerStop();
+    fprintf(stderr, "multiply %4zu x %4zu: %g ms, %.1f GFLOP/s.\n", n, n, time,
+            2.0 * n * n * n / time * 1e-6);
+    timerStart();
+    assert(matrixDecompose(a, n, rows));
+    fprintf(stderr, "lu       %4zu x %4zu: %g ms.\n", n, n, timerStop());
+    timerStart();
+    matrixSubstitute(a, n, b, n);
+    fprintf(stderr, "solve    %4zu x %4zu: %g ms, for %zu right-hand sides.\n",
+            n, n, timerStop(), n);
+    free(a);
+    free(b);
+    free(c);
+    free(rows);
+  }
+}
+
+int main()
+{
+  testMultiply();
+  size_t sizes[] = { 1, 2, 63, 64, 65, 100, 300 };
+  for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    testSolve(sizes[i], 1);
+    testSolve(sizes[i], 5);
+  }
+  matrixTileSelect();
+  fprintf(stderr, "selected kernel: 4 x %zu\n", matrixTileColumns);
+  benchmark();
+  printf("all matrix tests passed\n");
+  return 0;
+}
@@ -0,0 +1,157 @@
+#include <assert.h>
+#include <float.h>
+#include "eval.h"
+#include "timer.h"
+
+/*
+ * Tests that doubles are printed with the shortest digits, and read back by
+ * the lexer as the same double, and a benchmark of formatting COUNT doubles.
+ * Timings are written to stderr.
+ */
+#define COUNT 1000000
+
+double randomBits()
+{
+  uint64_t bits = (uint64_t)rand() << 62 ^ (uint64_t)rand() << 31 ^ rand();
+  double number;
+  memcpy(&number, &bits, sizeof(double));
+  return number;
+}
+
+void testFormat(double number, const char* expected)
+{
+  char buffer[NUMBER_LENGTH];
+  int length = numberFormatDouble(number, buffer);
+  assert(length == (int)strlen(buffer));
+  assert(!strcmp(buffer, expected));
+}
+
+// the lexer reads the printed double back, bit for bit
+void testRoundTrip(double number)
+{
+  char buffer[NUMBER_LENGTH];
+  numberFormatDouble(number, buffer);
+  LexTokenList tokens = transformBufferToTokenList(buffer);
+  assert(tokens && tokens->head && !tokens->head->next);
+  assert(tokens->head->token->type == LEX_TOKEN_TYPE_DOUBLE);
+  assert(!memcmp(&tokens->head->token->value.doubleFP, &number, sizeof(double)));
+  lexTokenListFree(tokens);
+}
+
+// Grisu3 finds the same digits as snprintf, or knows that it is unsure
+int testShortest(double number)
+{
+  char digits[NUMBER_DIGITS + 2], expected[NUMBER_DIGITS + 2];
+  int length, exponent, expectedLength, expectedExponent;
+  number = fabs(number);
+  numberShortest(number, expected, &expectedLength, &expectedExponent);
+  if(!numberGrisu(number, digits, &length, &exponent)) {
+    return 0;
+  }
+  assert(length == expectedLength && exponent == expectedExponent);
+  assert(!memcmp(digits, expected, length));
+  return 1;
+}
+
+void testDoubles()
+{
+  testFormat(0.1, "0.1");
+  testFormat(0.1 + 0.2, "0.30000000000000004");
+  testFormat(1.0 / 3, "0.3333333333333333");
+  testFormat(100, "100.0");
+  testFormat(-2.5, "-2.5");
+  testFormat(123456.789, "123456.789");
+  testFormat(0.0, "0.0");
+  testFormat(-0.0, "-0.0");
+  testFormat(1e-6, "0.000001");
+  testFormat(1.5e-7, "1.5e-7");
+  testFormat(1e20, "100000000000000000000.0");
+  testFormat(1e21, "1.0e21");
+  testFormat(1e300, "1.0e300");
+  testFormat(-1e300, "-1.0e300");
+  testFormat(DBL_MAX, "1.7976931348623157e308");
+  testFormat(DBL_MIN, "2.2250738585072014e-308");
+  testFormat(4.9e-324, "5.0e-324");
+  testFormat(HUGE_VAL, "inf");
+  testFormat(-HUGE_VAL, "-inf");
+
+  double special[] = { 0.1, -0.5, 1e-6, 1.5e-7, 1e20, 1e21, 1e300, DBL_MAX, DBL_MIN,
+                       4.9e-324, -0.0, 9007199254740993.0, 0.3 };
+  for(size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++) {
+    testRoundTrip(special[i]);
+  }
+
+  int certain = 0, count = 0;
+  for(int i = 0; i < 100000; i++) {
+    double number = randomBits();
+    if(!isfinite(number)) {
+      continue;
+    }
+    testRoundTrip(number);
+    certain += testShortest(number);
+    count++;
+  }
+  for(int i = 1; i < 100000; i++) {
+    double number = i / 7.0;
+    testRoundTrip(number);
+    certain += testShortest(number);
+    count++;
+  }
+  fprintf(stderr, "Grisu3 was sure of %d of %d doubles.\n", certain, count);
+}
+
+// formatted with %f and trailing zeros cut, as numberPrintDouble used to
+int formatFixed(double number, char* buffer)
+{
+  int written = snprintf(buffer, NUMBER_LENGTH, "%f", number);
+  while(written > 2 && buffer[written - 1] == '0' && buffer[written - 2] != '.') {
+    written--;
+  }
+  buffer[written] = '\0';
+  return written;
+}
+
+int formatExact(double number, char* buffer)
+{
+  return snprintf(buffer, NUMBER_LENGTH, "%.17g", number);
+}
+
+void benchmark()
+{
+  double* numbers = malloc(sizeof(double) * COUNT);
+  char* text = malloc(NUMBER_LENGTH * (size_t)COUNT);
+  const char* kinds[] = { "random bits", "i / 7", "i / 100" };
+  for(int kind = 0; kind < 3; kind++) {
+    for(int i = 0; i < COUNT; i++) {
+      double number;
+      do {
+        number = (kind == 0) ? randomBits() : (kind == 1) ? i / 7.0 : i / 100.0;
+      } while(!isfinite(number));
+      numbers[i] = number;
+    }
+    const char* names[] = { "shortest", "%.17g", "%f" };
+    int (*formats[])(double, char*) = { numberFormatDouble, formatExact, formatFixed };
+    for(int f = 0; f < 3; f++) {
+      if(f == 2 && kind == 0) {
+        continue; // most doubles need more than NUMBER_LENGTH characters
+      }
+      size_t length = 0;
+      timerStart();
+      for(int i = 0; i < COUNT; i++) {
+        length += formats[f](numbers[i], text + length);
+      }
+      fprintf(stderr, "%-12s %-9s %d doubles, %zu characters: %g ms.\n", kinds[kind],
+              names[f], COUNT, length, timerStop());
+    }
+  }
+  free(numbers);
+  free(text);
+}
+
+int main()
+{
+  testDoubles();
+  benchmark();
+  printf("all number tests passed\n");
+  return 0;
+}
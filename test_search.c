@@ -0,0 +1,100 @@
+#include <assert.h>
+#include "eval.h"
+#include "timer.h"
+
+/*
+ * Tests of the string search kernels, and a benchmark of them on the contents
+ * of a file, repeated up to TEXT_SIZE bytes, e.g.
+ *   ./test_search eval.h
+ * Timings are written to stderr.
+ */
+#define TEXT_SIZE (64 << 20)
+
+struct _kernel_t {
+  const char* name;
+  StringSearchKernel kernel;
+} kernels[] = {
+  { "scalar", stringSearchScalar },
+#ifdef STRING_SEARCH_X86
+  { "sse2", stringSearchSse2 },
+  { "avx2", stringSearchAvx2 },
+#endif
+};
+
+const int kernelCount = sizeof(kernels) / sizeof(kernels[0]);
+
+// the number of non-overlapping occurrences, as stringcount finds them
+long countOccurrences(StringSearchKernel kernel, const char* text, size_t length,
+                      const char* pattern)
+{
+  size_t size = strlen(pattern);
+  long count = 0;
+  long index = 0;
+  while((index = kernel(text, length, pattern, size, index)) >= 0) {
+    count++;
+    index += size;
+  }
+  return count;
+}
+
+// every kernel finds every occurrence at every alignment and length
+void testKernels()
+{
+  const char* text = "abracadabra, abracadabra! the cat sat on the mat, abracadabra.";
+  const char* patterns[] = { "a", "abra", "abracadabra", ".", "mat,", "zebra",
+                             "the cat sat on the mat, abracadabra." };
+  for(size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+    size_t size = strlen(patterns[p]);
+    for(size_t length = 0; length <= strlen(text); length++) {
+      for(size_t start = 0; start <= length; start++) {
+        long expected = -1;
+        for(size_t i = start; i + size <= length; i++) {
+          if(!memcmp(text + i, patterns[p], size)) {
+            expected = i;
+            break;
+          }
+        }
+        for(int k = 0; k < kernelCount; k++) {
+          assert(kernels[k].kernel(text, length, patterns[p], size, start) == expected);
+        }
+      }
+    }
+  }
+}
+
+void benchmark(const char* filename)
+{
+  FILE* file = fopen(filename, "rb");
+  assert(file);
+  char* text = malloc(TEXT_SIZE);
+  size_t length = fread(text, 1, TEXT_SIZE, file);
+  fclose(file);
+  assert(length > 0);
+  for(size_t size = length; length < TEXT_SIZE;) {
+    size_t copied = (TEXT_SIZE - length < size) ? TEXT_SIZE - length : size;
+    memcpy(text + length, text, copied);
+    length += copied;
+  }
+
+  const char* patterns[] = { "Sexp", "sexpCreateStringOf", "}", "no such thing" };
+  for(size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+    long expected = countOccurrences(stringSearchScalar, text, length, patterns[p]);
+    for(int k = 0; k < kernelCount; k++) {
+      timerStart();
+      long count = countOccurrences(kernels[k].kernel, text, length, patterns[p]);
+      fprintf(stderr, "%-8s %-20s %zu MB, %ld found: %g ms.\n", kernels[k].name,
+              patterns[p], length >> 20, count, timerStop());
+      assert(count == expected);
+    }
+  }
+  free(text);
+}
+
+int main(int argc, char** argv)
+{
+  testKernels();
+  stringSearch(" ", 1, " ", 1, 0);
+  fprintf(stderr, "selected kernel: %s\n", stringSearchName);
+  benchmark((argc > 1) ? argv[1] : "eval.h");
+  return 0;
+}
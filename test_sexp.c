@@ -0,0 +1,125 @@
+#include <assert.h>
+#include <sys/resource.h>
+#include "eval.h"
+#include "timer.h"
+
+/*
+ * Stress test of the list routines in sexp.h: builds, copies, compares,
+ * prints and frees lists of a million elements, which must not exhaust
+ * the stack. Then builds a string from many fragments, by appending and by
+ * stringjoin. Timings are written to stderr, the printed lists to stdout,
+ * so run as ./test_sexp [--hash-cons] > /dev/null
+ */
+#define LENGTH 1000000
+#define FRAGMENTS 100000
+
+void timerReportOf(const char* what, int count)
+{
+  fprintf(stderr, "%-8s %d elements: %g ms.\n", what, count, timerStop());
+}
+
+void timerReport(const char* what)
+{
+  timerReportOf(what, LENGTH);
+}
+
+long maximumResidentKilobytes()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// the list (0 1 ... n-1) of integers
+Sexp buildList(int n)
+{
+  Sexp list = sexpCreateNil();
+  while(n--) {
+    list = sexpCreateConsOf(sexpCreateInteger(n), list);
+  }
+  return list;
+}
+
+// the sum of a list of integers, along its spine
+long sumList(Sexp list)
+{
+  long sum = 0;
+  for(; SEXP_TYPE_OF(list) == SEXP_TYPE_CONS; list = SEXP_CDR(list)) {
+    sum += SEXP_CAR(list)->value.integer;
+  }
+  return sum;
+}
+
+// the list of n fragments "0,", "1,", ..., "n-1,"
+Sexp buildFragments(int n)
+{
+  char fragment[16];
+  Sexp list = sexpCreateNil();
+  while(n--) {
+    sprintf(fragment, "%d,", n);
+    list = sexpCreateConsOf(sexpCreateString(fragment), list);
+  }
+  return list;
+}
+
+// (fold + "" fragments), freeing each accumulator as the evaluator would
+Sexp appendFragments(Sexp fragments)
+{
+  Sexp string = sexpCreateString("");
+  for(; SEXP_TYPE_OF(fragments) == SEXP_TYPE_CONS; fragments = SEXP_CDR(fragments)) {
+    Sexp next = applyArithmeticOperator(string, SEXP_CAR(fragments), OPERATOR_PLUS);
+    sexpFree(string);
+    string = next;
+  }
+  return string;
+}
+
+int main(int argc, char** argv)
+{
+  if(argc > 1 && !strcmp(argv[1], "--hash-cons")) {
+    hashconsEnabled = 1;
+  }
+
+  long resident = maximumResidentKilobytes();
+  timerStart();
+  Sexp list = buildList(LENGTH);
+  timerReport("build");
+  fprintf(stderr, "memory   %d elements: %ld kB, cells of %zu bytes.\n",
+          LENGTH, maximumResidentKilobytes() - resident, sizeof(struct _sexp_t));
+
+  timerStart();
+  Sexp copy = sexpCopy(list);
+  timerReport("copy");
+
+  timerStart();
+  assert(sumList(copy) == (long)LENGTH * (LENGTH - 1) / 2);
+  timerReport("sum");
+
+  timerStart();
+  assert(evalEquals(list, copy));
+  timerReport("equals");
+
+  timerStart();
+  sexpPrint(copy);
+  printf("\n");
+  timerReport("print");
+
+  timerStart();
+  sexpFree(copy);
+  sexpFree(list);
+  timerReport("free");
+
+  Sexp fragments = buildFragments(FRAGMENTS);
+  timerStart();
+  Sexp appended = appendFragments(fragments);
+  timerReportOf("append", FRAGMENTS);
+
+  timerStart();
+  Sexp joined = stringJoinBuiltin(sexpCreateConsOf(fragments, sexpCreateNil()));
+  timerReportOf("join", FRAGMENTS);
+  assert(sexpStringEquals(appended->value.string, joined->value.string));
+  assert(!memcmp(appended->value.string->chars + appended->value.string->length - 6,
+                 "99999,", 6));
+
+  return 0;
+}
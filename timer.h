@@ -0,0 +1,27 @@
+#ifndef PLD_LISP_TIMER_H
+#define PLD_LISP_TIMER_H
+
+#include <time.h>
+
+/*
+ * Wall-clock timing for the tests and benchmarks: timerStop returns the
+ * milliseconds since the last timerStart.
+ */
+struct timespec timerBegin;
+
+void timerStart()
+{
+  clock_gettime(CLOCK_MONOTONIC, &timerBegin);
+}
+
+double timerStop()
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - timerBegin.tv_sec) * 1000.0
+      + (end.tv_nsec - timerBegin.tv_nsec) * 1E-6;
+}
+
+
+
+#endif // PLD_LISP_TIMER_H
@@ -0,0 +1,710 @@
+#ifndef PLD_LISP_VECTOR_H
+#define PLD_LISP_VECTOR_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "sexp.h"
+#include "exception.h"
+#include "builtin.h"
+#include "bignum.h"
+
+/*
+ * Builtins on numeric vectors, see struct _sexp_vector_t. A vector holds
+ * integers if it is made from integers only, and doubles otherwise:
+ *   (vec l)          the vector of the numbers in the list l
+ *   (viota n)        the vector of the integers 0 to n - 1
+ *   (vlist v)        the list of the elements of v
+ *   (vlength v)      the number of elements of v
+ *   (vref v i)       the element of v at index i
+ *   (vsum v) (vmin v) (vmax v) (vmean v) (vvar v)  reductions of v
+ *   (vdot v w)       the dot product of v and w
+ *   (vadd a b) (vsub a b) (vmul a b) (vdiv a b)
+ *                    elementwise arithmetic on two vectors of the same
+ *                    length, or a vector and a number
+ * Integer results are computed in longs. Sums and dot products that overflow
+ * a long are computed again as bignums, and elementwise results as doubles,
+ * like the scalar operators do. vvar is the population variance. A vector
+ * of integers equals a vector of doubles with the same values, as numbers do.
+ *
+ * The kernels below are plain loops over the elements, written so that the
+ * compiler vectorizes them. Reductions of doubles are not reordered by the
+ * compiler, so they keep several sums in vector registers explicitly. On
+ * x86-64 each kernel is also compiled for AVX2, and the version used is
+ * chosen when the program is loaded.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__SANITIZE_ADDRESS__)
+#define VECTOR_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define VECTOR_KERNEL
+#endif
+
+#define VECTOR_BLOCK 256
+
+typedef double VectorDoubles __attribute__((vector_size(32)));
+typedef long VectorMask __attribute__((vector_size(32)));
+
+
+
+/* kernels */
+
+// the integer kernels return whether a result overflowed a long
+VECTOR_KERNEL
+int vectorSumIntegers(const long* x, size_t n, long* sum)
+{
+  long s = 0;
+  int overflow = 0;
+  for(size_t i = 0; i < n; i++) {
+    overflow |= __builtin_add_overflow(s, x[i], &s);
+  }
+  *sum = s;
+  return overflow;
+}
+
+// passed by pointer, since passing vectors by value depends on the target
+double vectorHorizontalSum(const VectorDoubles* v)
+{
+  return ((*v)[0] + (*v)[1]) + ((*v)[2] + (*v)[3]);
+}
+
+VECTOR_KERNEL
+double vectorSumDoubles(const double* x, size_t n)
+{
+  VectorDoubles sum0 = { 0 }, sum1 = { 0 };
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8) {
+    VectorDoubles a, b;
+    memcpy(&a, x + i, sizeof(a));
+    memcpy(&b, x + i + 4, sizeof(b));
+    sum0 += a;
+    sum1 += b;
+  }
+  sum0 += sum1;
+  double sum = vectorHorizontalSum(&sum0);
+  for(; i < n; i++) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+VECTOR_KERNEL
+int vectorDotIntegers(const long* x, const long* y, size_t n, long* sum)
+{
+  long s = 0;
+  int overflow = 0;
+  for(size_t i = 0; i < n; i++) {
+    long product;
+    overflow |= __builtin_mul_overflow(x[i], y[i], &product);
+    overflow |= __builtin_add_overflow(s, product, &s);
+  }
+  *sum = s;
+  return overflow;
+}
+
+VECTOR_KERNEL
+double vectorDotDoubles(const double* x, const double* y, size_t n)
+{
+  VectorDoubles sum0 = { 0 }, sum1 = { 0 };
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8) {
+    VectorDoubles a0, a1, b0, b1;
+    memcpy(&a0, x + i, sizeof(a0));
+    memcpy(&a1, x + i + 4, sizeof(a1));
+    memcpy(&b0, y + i, sizeof(b0));
+    memcpy(&b1, y + i + 4, sizeof(b1));
+    sum0 += a0 * b0;
+    sum1 += a1 * b1;
+  }
+  sum0 += sum1;
+  double sum = vectorHorizontalSum(&sum0);
+  for(; i < n; i++) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+// the sum of squared differences from the mean
+VECTOR_KERNEL
+double vectorSquaresDoubles(const double* x, size_t n, double mean)
+{
+  VectorDoubles sum0 = { 0 }, sum1 = { 0 };
+  VectorDoubles m = { mean, mean, mean, mean };
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8) {
+    VectorDoubles a, b;
+    memcpy(&a, x + i, sizeof(a));
+    memcpy(&b, x + i + 4, sizeof(b));
+    a -= m;
+    b -= m;
+    sum0 += a * a;
+    sum1 += b * b;
+  }
+  sum0 += sum1;
+  double sum = vectorHorizontalSum(&sum0);
+  for(; i < n; i++) {
+    sum += (x[i] - mean) * (x[i] - mean);
+  }
+  return sum;
+}
+
+VECTOR_KERNEL
+long vectorExtremeIntegers(const long* x, size_t n, int maximum)
+{
+  long extreme = x[0];
+  if(maximum) {
+    for(size_t i = 1; i < n; i++) extreme = (x[i] > extreme) ? x[i] : extreme;
+  } else {
+    for(size_t i = 1; i < n; i++) extreme = (x[i] < extreme) ? x[i] : extreme;
+  }
+  return extreme;
+}
+
+// the least or greatest element, n > 0
+VECTOR_KERNEL
+double vectorExtremeDoubles(const double* x, size_t n, int maximum)
+{
+  VectorDoubles extreme = { x[0], x[0], x[0], x[0] };
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4) {
+    VectorDoubles a;
+    memcpy(&a, x + i, sizeof(a));
+    VectorMask take = (maximum) ? (a > extreme) : (a < extreme);
+    extreme = (VectorDoubles)(((VectorMask)a & take) | ((VectorMask)extreme & ~take));
+  }
+  double result = extreme[0];
+  for(int j = 1; j < 4; j++) {
+    result = ((maximum) ? extreme[j] > result : extreme[j] < result) ? extreme[j] : result;
+  }
+  for(; i < n; i++) {
+    result = ((maximum) ? x[i] > result : x[i] < result) ? x[i] : result;
+  }
+  return result;
+}
+
+// z = x op y elementwise, the divisors are not zero
+VECTOR_KERNEL
+int vectorApplyIntegers(Operator operator, const long* restrict x,
+                        const long* restrict y, long* restrict z, size_t n)
+{
+  int overflow = 0;
+  switch(operator)
+  {
+  case OPERATOR_PLUS:
+    for(size_t i = 0; i < n; i++) overflow |= __builtin_add_overflow(x[i], y[i], z + i);
+    break;
+  case OPERATOR_MINUS:
+    for(size_t i = 0; i < n; i++) overflow |= __builtin_sub_overflow(x[i], y[i], z + i);
+    break;
+  case OPERATOR_MULTIPLY:
+    for(size_t i = 0; i < n; i++) overflow |= __builtin_mul_overflow(x[i], y[i], z + i);
+    break;
+  default:
+    // LONG_MIN / -1 overflows
+    for(size_t i = 0; i < n; i++) {
+      overflow |= x[i] == LONG_MIN && y[i] == -1;
+      z[i] = (y[i] == -1) ? (long)(0ul - (unsigned long)x[i]) : x[i] / y[i];
+    }
+  }
+  return overflow;
+}
+
+// z = x op y elementwise as doubles, where the integer results overflow
+void vectorApplyIntegersAsDoubles(Operator operator, const long* x, const long* y,
+                                  double* z, size_t n)
+{
+  for(size_t i = 0; i < n; i++) {
+    long result;
+    switch(operator)
+    {
+    case OPERATOR_PLUS:
+      z[i] = (__builtin_add_overflow(x[i], y[i], &result)) ?
+        (double)x[i] + (double)y[i] : (double)result;
+      break;
+    case OPERATOR_MINUS:
+      z[i] = (__builtin_sub_overflow(x[i], y[i], &result)) ?
+        (double)x[i] - (double)y[i] : (double)result;
+      break;
+    case OPERATOR_MULTIPLY:
+      z[i] = (__builtin_mul_overflow(x[i], y[i], &result)) ?
+        (double)x[i] * (double)y[i] : (double)result;
+      break;
+    default:
+      z[i] = (x[i] == LONG_MIN && y[i] == -1) ? -(double)x[i] : (double)(x[i] / y[i]);
+    }
+  }
+}
+
+VECTOR_KERNEL
+void vectorApplyDoubles(Operator operator, const double* restrict x,
+                        const double* restrict y, double* restrict z, size_t n)
+{
+  switch(operator)
+  {
+  case OPERATOR_PLUS:
+    for(size_t i = 0; i < n; i++) z[i] = x[i] + y[i];
+    break;
+  case OPERATOR_MINUS:
+    for(size_t i = 0; i < n; i++) z[i] = x[i] - y[i];
+    break;
+  case OPERATOR_MULTIPLY:
+    for(size_t i = 0; i < n; i++) z[i] = x[i] * y[i];
+    break;
+  default:
+    for(size_t i = 0; i < n; i++) z[i] = x[i] / y[i];
+  }
+}
+
+
+
+/* conversions */
+
+// the exact sum of x, or of x * y given y, as a bignum where it needs one
+Sexp vectorSumBignum(const long* x, const long* y, size_t n)
+{
+  Sexp sum = sexpCreateInteger(0);
+  for(size_t i = 0; i < n; i++) {
+    Sexp term = sexpCreateInteger(x[i]);
+    if(y) {
+      Sexp factor = sexpCreateInteger(y[i]);
+      Sexp product = bignumApplyOperator(term, factor, OPERATOR_MULTIPLY);
+      sexpFree(term);
+      sexpFree(factor);
+      term = product;
+    }
+    Sexp next = bignumApplyOperator(sum, term, OPERATOR_PLUS);
+    sexpFree(sum);
+    sexpFree(term);
+    sum = next;
+  }
+  return sum;
+}
+
+Sexp vectorElement(SexpVector vector, size_t i)
+{
+  return (vector->type == SEXP_VECTOR_INTEGER) ?
+    sexpCreateInteger(vector->elements.integers[i]) :
+    sexpCreateDouble(vector->elements.doubles[i]);
+}
+
+/*
+ * Operands are read in blocks of VECTOR_BLOCK elements. Where an operand is
+ * not stored as the kernel needs it, being a number or a vector of integers
+ * taken as doubles, the block is converted into a buffer on the stack, so no
+ * vector is allocated for it.
+ */
+const double* vectorDoublesAt(Sexp operand, size_t start, size_t count, double* block)
+{
+  if(SEXP_TYPE_OF(operand) != SEXP_TYPE_VECTOR) {
+    double number = (SEXP_TYPE_OF(operand) == SEXP_TYPE_INTEGER) ?
+      (double)operand->value.integer : operand->value.doubleFP;
+    for(size_t i = 0; i < count; i++) block[i] = number;
+    return block;
+  }
+  SexpVector vector = operand->value.vector;
+  if(vector->type == SEXP_VECTOR_DOUBLE) {
+    return vector->elements.doubles + start;
+  }
+  for(size_t i = 0; i < count; i++) {
+    block[i] = (double)vector->elements.integers[start + i];
+  }
+  return block;
+}
+
+const long* vectorIntegersAt(Sexp operand, size_t start, size_t count, long* block)
+{
+  if(SEXP_TYPE_OF(operand) != SEXP_TYPE_VECTOR) {
+    for(size_t i = 0; i < count; i++) block[i] = operand->value.integer;
+    return block;
+  }
+  return operand->value.vector->elements.integers + start;
+}
+
+// does the operand hold integers only?
+int vectorHoldsIntegers(Sexp operand)
+{
+  return (SEXP_TYPE_OF(operand) == SEXP_TYPE_VECTOR) ?
+    operand->value.vector->type == SEXP_VECTOR_INTEGER :
+    SEXP_TYPE_OF(operand) == SEXP_TYPE_INTEGER;
+}
+
+
+
+/* builtins */
+void vectorBadArguments(const char* name, const char* expected)
+{
+  printf("! %s expects %s\n", name, expected);
+  throwException();
+  printf("Control should not reach this point!\n");
+}
+
+// sexpVectorCreate, which reports a vector too large to allocate
+SexpVector vectorCreate(const char* name, enum _sexp_vector_type_t type, size_t length)
+{
+  SexpVector vector = sexpVectorCreate(type, length);
+  if(!vector) {
+    printf("! %s: out of memory for a vector of %zu elements\n", name, length);
+    throwException();
+    printf("Control should not reach this point!\n");
+  }
+  return vector;
+}
+
+int vectorIsNumber(Sexp sexp)
+{
+  return SEXP_TYPE_OF(sexp) == SEXP_TYPE_INTEGER ||
+    SEXP_TYPE_OF(sexp) == SEXP_TYPE_DOUBLE;
+}
+
+// the only argument, a vector, otherwise NULL
+SexpVector vectorArgument(Sexp arguments)
+{
+  if(SEXP_TYPE_OF(arguments) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_VECTOR ||
+     SEXP_TYPE_OF(SEXP_CDR(arguments)) != SEXP_TYPE_NIL) {
+    return NULL;
+  }
+  return SEXP_CAR(arguments)->value.vector;
+}
+
+// are there exactly two arguments?
+int vectorTwoArguments(Sexp arguments)
+{
+  return SEXP_TYPE_OF(arguments) == SEXP_TYPE_CONS &&
+    SEXP_TYPE_OF(SEXP_CDR(arguments)) == SEXP_TYPE_CONS &&
+    SEXP_TYPE_OF(SEXP_CDR(SEXP_CDR(arguments))) == SEXP_TYPE_NIL;
+}
+
+Sexp vectorFromListBuiltin(Sexp arguments)
+{
+  Sexp list = (SEXP_TYPE_OF(arguments) == SEXP_TYPE_CONS &&
+               SEXP_TYPE_OF(SEXP_CDR(arguments)) == SEXP_TYPE_NIL) ?
+    SEXP_CAR(arguments) : NULL;
+  size_t length = 0;
+  int doubles = 0;
+  Sexp element = list;
+  for(; element && SEXP_TYPE_OF(element) == SEXP_TYPE_CONS &&
+        vectorIsNumber(SEXP_CAR(element)); element = SEXP_CDR(element)) {
+    doubles |= SEXP_TYPE_OF(SEXP_CAR(element)) == SEXP_TYPE_DOUBLE;
+    length++;
+  }
+  if(!element || SEXP_TYPE_OF(element) != SEXP_TYPE_NIL) {
+    vectorBadArguments("vec", "a list of numbers");
+    return NULL;
+  }
+
+  SexpVector vector = vectorCreate("vec", (doubles) ? SEXP_VECTOR_DOUBLE :
+                                    SEXP_VECTOR_INTEGER, length);
+  size_t i = 0;
+  for(element = list; SEXP_TYPE_OF(element) == SEXP_TYPE_CONS;
+      element = SEXP_CDR(element), i++) {
+    Sexp number = SEXP_CAR(element);
+    if(!doubles) {
+      vector->elements.integers[i] = number->value.integer;
+    } else {
+      vector->elements.doubles[i] = (SEXP_TYPE_OF(number) == SEXP_TYPE_INTEGER) ?
+        (double)number->value.integer : number->value.doubleFP;
+    }
+  }
+  return sexpCreateVectorOf(vector);
+}
+
+Sexp vectorIotaBuiltin(Sexp arguments)
+{
+  if(SEXP_TYPE_OF(arguments) != SEXP_TYPE_CONS ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_INTEGER ||
+     SEXP_TYPE_OF(SEXP_CDR(arguments)) != SEXP_TYPE_NIL ||
+     SEXP_CAR(arguments)->value.integer < 0) {
+    vectorBadArguments("viota", "a non-negative integer");
+    return NULL;
+  }
+  size_t length = SEXP_CAR(arguments)->value.integer;
+  SexpVector vector = vectorCreate("viota", SEXP_VECTOR_INTEGER, length);
+  for(size_t i = 0; i < length; i++) {
+    vector->elements.integers[i] = i;
+  }
+  return sexpCreateVectorOf(vector);
+}
+
+Sexp vectorToListBuiltin(Sexp arguments)
+{
+  SexpVector vector = vectorArgument(arguments);
+  if(!vector) {
+    vectorBadArguments("vlist", "a vector");
+    return NULL;
+  }
+  Sexp* elements = malloc(sizeof(Sexp) * (vector->length + 1));
+  if(!elements) {
+    printf("! vlist: out of memory for a list of %zu elements\n", vector->length);
+    throwException();
+    printf("Control should not reach this point!\n");
+  }
+  for(size_t i = 0; i < vector->length; i++) {
+    elements[i] = vectorElement(vector, i);
+  }
+  Sexp list = sexpCreateListOf(elements, vector->length, sexpCreateNil());
+  free(elements);
+  return list;
+}
+
+Sexp vectorLengthBuiltin(Sexp arguments)
+{
+  SexpVector vector = vectorArgument(arguments);
+  if(!vector) {
+    vectorBadArguments("vlength", "a vector");
+    return NULL;
+  }
+  return sexpCreateInteger((long)vector->length);
+}
+
+Sexp vectorRefBuiltin(Sexp arguments)
+{
+  if(!vectorTwoArguments(arguments) ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_VECTOR ||
+     SEXP_TYPE_OF(SEXP_CAR(SEXP_CDR(arguments))) != SEXP_TYPE_INTEGER ||
+     SEXP_CAR(SEXP_CDR(arguments))->value.integer < 0 ||
+     (size_t)SEXP_CAR(SEXP_CDR(arguments))->value.integer >=
+     SEXP_CAR(arguments)->value.vector->length) {
+    vectorBadArguments("vref", "a vector and an index within it");
+    return NULL;
+  }
+  return vectorElement(SEXP_CAR(arguments)->value.vector,
+                       SEXP_CAR(SEXP_CDR(arguments))->value.integer);
+}
+
+Sexp vectorSumBuiltin(Sexp arguments)
+{
+  SexpVector vector = vectorArgument(arguments);
+  if(!vector) {
+    vectorBadArguments("vsum", "a vector");
+    return NULL;
+  }
+  long sum;
+  if(vector->type == SEXP_VECTOR_INTEGER) {
+    if(vectorSumIntegers(vector->elements.integers, vector->length, &sum)) {
+      return vectorSumBignum(vector->elements.integers, NULL, vector->length);
+    }
+    return sexpCreateInteger(sum);
+  }
+  return sexpCreateDouble(vectorSumDoubles(vector->elements.doubles, vector->length));
+}
+
+Sexp vectorExtreme(Sexp arguments, const char* name, int maximum)
+{
+  SexpVector vector = vectorArgument(arguments);
+  if(!vector || !vector->length) {
+    vectorBadArguments(name, "a non-empty vector");
+    return NULL;
+  }
+  if(vector->type == SEXP_VECTOR_INTEGER) {
+    return sexpCreateInteger(vectorExtremeIntegers(vector->elements.integers,
+                                                     vector->length, maximum));
+  }
+  return sexpCreateDouble(vectorExtremeDoubles(vector->elements.doubles,
+                                               vector->length, maximum));
+}
+
+Sexp vectorMinBuiltin(Sexp arguments)
+{
+  return vectorExtreme(arguments, "vmin", 0);
+}
+
+Sexp vectorMaxBuiltin(Sexp arguments)
+{
+  return vectorExtreme(arguments, "vmax", 1);
+}
+
+// the mean of a vector, and the sum of squared differences from it
+double vectorMoments(Sexp arguments, const char* name, double* squares)
+{
+  SexpVector vector = vectorArgument(arguments);
+  if(!vector || !vector->length) {
+    vectorBadArguments(name, "a non-empty vector");
+    return 0;
+  }
+  double block[VECTOR_BLOCK];
+  double mean = 0;
+  long sum;
+  if(vector->type == SEXP_VECTOR_DOUBLE) {
+    mean = vectorSumDoubles(vector->elements.doubles, vector->length);
+  } else if(!vectorSumIntegers(vector->elements.integers, vector->length, &sum)) {
+    mean = (double)sum;
+  } else {
+    for(size_t start = 0; start < vector->length; start += VECTOR_BLOCK) {
+      size_t count = (vector->length - start < VECTOR_BLOCK) ?
+        vector->length - start : VECTOR_BLOCK;
+      mean += vectorSumDoubles(vectorDoublesAt(SEXP_CAR(arguments), start,
+                                               count, block), count);
+    }
+  }
+  mean /= vector->length;
+  if(squares) {
+    *squares = 0;
+    for(size_t start = 0; start < vector->length; start += VECTOR_BLOCK) {
+      size_t count = (vector->length - start < VECTOR_BLOCK) ?
+        vector->length - start : VECTOR_BLOCK;
+      *squares += vectorSquaresDoubles(vectorDoublesAt(SEXP_CAR(arguments), start,
+                                                       count, block), count, mean);
+    }
+  }
+  return mean;
+}
+
+Sexp vectorMeanBuiltin(Sexp arguments)
+{
+  return sexpCreateDouble(vectorMoments(arguments, "vmean", NULL));
+}
+
+Sexp vectorVarianceBuiltin(Sexp arguments)
+{
+  double squares = 0;
+  vectorMoments(arguments, "vvar", &squares);
+  return sexpCreateDouble(squares / vectorArgument(arguments)->length);
+}
+
+Sexp vectorDotBuiltin(Sexp arguments)
+{
+  if(!vectorTwoArguments(arguments) ||
+     SEXP_TYPE_OF(SEXP_CAR(arguments)) != SEXP_TYPE_VECTOR ||
+     SEXP_TYPE_OF(SEXP_CAR(SEXP_CDR(arguments))) != SEXP_TYPE_VECTOR ||
+     SEXP_CAR(arguments)->value.vector->length !=
+     SEXP_CAR(SEXP_CDR(arguments))->value.vector->length) {
+    vectorBadArguments("vdot", "two vectors of the same length");
+    return NULL;
+  }
+  Sexp x = SEXP_CAR(arguments);
+  Sexp y = SEXP_CAR(SEXP_CDR(arguments));
+  size_t length = x->value.vector->length;
+  if(vectorHoldsIntegers(x) && vectorHoldsIntegers(y)) {
+    const long* xs = x->value.vector->elements.integers;
+    const long* ys = y->value.vector->elements.integers;
+    long sum;
+    if(vectorDotIntegers(xs, ys, length, &sum)) {
+      return vectorSumBignum(xs, ys, length);
+    }
+    return sexpCreateInteger(sum);
+  }
+  double xblock[VECTOR_BLOCK];
+  double yblock[VECTOR_BLOCK];
+  double dot = 0;
+  for(size_t start = 0; start < length; start += VECTOR_BLOCK) {
+    size_t count = (length - start < VECTOR_BLOCK) ? length - start : VECTOR_BLOCK;
+    dot += vectorDotDoubles(vectorDoublesAt(x, start, count, xblock),
+                            vectorDoublesAt(y, start, count, yblock), count);
+  }
+  return sexpCreateDouble(dot);
+}
+
+/*
+ * Elementwise arithmetic. A number is taken as a vector of copies of itself,
+ * and the result holds doubles unless both operands hold integers.
+ */
+Sexp vectorApply(Sexp arguments, const char* name, Operator operator)
+{
+  Sexp a = (vectorTwoArguments(arguments)) ? SEXP_CAR(arguments) : NULL;
+  Sexp b = (a) ? SEXP_CAR(SEXP_CDR(arguments)) : NULL;
+  int valid = a && ((SEXP_TYPE_OF(a) == SEXP_TYPE_VECTOR && vectorIsNumber(b)) ||
+                    (vectorIsNumber(a) && SEXP_TYPE_OF(b) == SEXP_TYPE_VECTOR) ||
+                    (SEXP_TYPE_OF(a) == SEXP_TYPE_VECTOR &&
+                     SEXP_TYPE_OF(b) == SEXP_TYPE_VECTOR &&
+                     a->value.vector->length == b->value.vector->length));
+  if(!valid) {
+    vectorBadArguments(name, "two vectors of the same length, or a vector and a number");
+    return NULL;
+  }
+
+  size_t length = (SEXP_TYPE_OF(a) == SEXP_TYPE_VECTOR) ?
+    a->value.vector->length : b->value.vector->length;
+  if(vectorHoldsIntegers(a) && vectorHoldsIntegers(b)) {
+    long xblock[VECTOR_BLOCK];
+    long yblock[VECTOR_BLOCK];
+    for(size_t start = 0; operator == OPERATOR_DIVIDE && start < length;
+        start += VECTOR_BLOCK) {
+      size_t count = (length - start < VECTOR_BLOCK) ? length - start : VECTOR_BLOCK;
+      const long* y = vectorIntegersAt(b, start, count, yblock);
+      for(size_t i = 0; i < count; i++) {
+        if(!y[i]) {
+          printf("! %s: division by zero\n", name);
+          throwException();
+          return NULL;
+        }
+      }
+    }
+    SexpVector z = vectorCreate(name, SEXP_VECTOR_INTEGER, length);
+    int overflow = 0;
+    for(size_t start = 0; start < length; start += VECTOR_BLOCK) {
+      size_t count = (length - start < VECTOR_BLOCK) ? length - start : VECTOR_BLOCK;
+      overflow |= vectorApplyIntegers(operator, vectorIntegersAt(a, start, count, xblock),
+                                      vectorIntegersAt(b, start, count, yblock),
+                                      z->elements.integers + start, count);
+    }
+    if(!overflow) {
+      return sexpCreateVectorOf(z);
+    }
+    sexpVectorRelease(z);
+    z = vectorCreate(name, SEXP_VECTOR_DOUBLE, length);
+    for(size_t start = 0; start < length; start += VECTOR_BLOCK) {
+      size_t count = (length - start < VECTOR_BLOCK) ? length - start : VECTOR_BLOCK;
+      vectorApplyIntegersAsDoubles(operator, vectorIntegersAt(a, start, count, xblock),
+                                   vectorIntegersAt(b, start, count, yblock),
+                                   z->elements.doubles + start, count);
+    }
+    return sexpCreateVectorOf(z);
+  }
+
+  double xblock[VECTOR_BLOCK];
+  double yblock[VECTOR_BLOCK];
+  SexpVector z = vectorCreate(name, SEXP_VECTOR_DOUBLE, length);
+  for(size_t start = 0; start < length; start += VECTOR_BLOCK) {
+    size_t count = (length - start < VECTOR_BLOCK) ? length - start : VECTOR_BLOCK;
+    vectorApplyDoubles(operator, vectorDoublesAt(a, start, count, xblock),
+                       vectorDoublesAt(b, start, count, yblock),
+                       z->elements.doubles + start, count);
+  }
+  return sexpCreateVectorOf(z);
+}
+
+Sexp vectorAddBuiltin(Sexp arguments)
+{
+  return vectorApply(arguments, "vadd", OPERATOR_PLUS);
+}
+
+Sexp vectorSubtractBuiltin(Sexp arguments)
+{
+  return vectorApply(arguments, "vsub", OPERATOR_MINUS);
+}
+
+Sexp vectorMultiplyBuiltin(Sexp arguments)
+{
+  return vectorApply(arguments, "vmul", OPERATOR_MULTIPLY);
+}
+
+Sexp vectorDivideBuiltin(Sexp arguments)
+{
+  return vectorApply(arguments, "vdiv", OPERATOR_DIVIDE);
+}
+
+void vectorRegisterBuiltins()
+{
+  builtinRegister("vec", vectorFromListBuiltin);
+  builtinRegister("viota", vectorIotaBuiltin);
+  builtinRegister("vlist", vectorToListBuiltin);
+  builtinRegister("vlength", vectorLengthBuiltin);
+  builtinRegister("vref", vectorRefBuiltin);
+  builtinRegister("vsum", vectorSumBuiltin);
+  builtinRegister("vmin", vectorMinBuiltin);
+  builtinRegister("vmax", vectorMaxBuiltin);
+  builtinRegister("vmean", vectorMeanBuiltin);
+  builtinRegister("vvar", vectorVarianceBuiltin);
+  builtinRegister("vdot", vectorDotBuiltin);
+  builtinRegister("vadd", vectorAddBuiltin);
+  builtinRegister("vsub", vectorSubtractBuiltin);
+  builtinRegister("vmul", vectorMultiplyBuiltin);
+  builtinRegister("vdiv", vectorDivideBuiltin);
+}
+
+
+
+#undef VECTOR_KERNEL
+#undef VECTOR_BLOCK
+#endif // PLD_LISP_VECTOR_H